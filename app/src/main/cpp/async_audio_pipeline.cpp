@@ -0,0 +1,237 @@
+#include "async_audio_pipeline.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+// Codec callbacks must never block, so index queues are far larger than any codec's buffer count
+static const size_t CODEC_QUEUE_SIZE = 64;
+// Stretched audio buffered between the stretch and encode stages
+static const size_t PCM_RING_FRAMES = 32 * PcmRingBuffer::AAC_FRAME_SIZE;
+
+AsyncAudioPipeline::AsyncAudioPipeline(MediaExtractor& extractor, MediaCodec& decoder, MediaCodec& encoder,
+                                       TimeStretcher& stretcher, const SegmentTimeline& timeline,
+                                       int32_t sampleRate, int32_t channels, const JobControl* control)
+        : extractor(extractor), decoder(decoder), encoder(encoder), stretcher(stretcher), timeline(timeline),
+          sampleRate(sampleRate), channels(channels), control(control),
+          decoderInputs(CODEC_QUEUE_SIZE), decodedOutputs(CODEC_QUEUE_SIZE),
+          encoderInputs(CODEC_QUEUE_SIZE), encodedOutputs(CODEC_QUEUE_SIZE),
+          pcm(channels, PCM_RING_FRAMES) {
+}
+
+int AsyncAudioPipeline::attach() {
+    CodecCallbacks decoderCallbacks;
+    decoderCallbacks.onInputAvailable = [this](size_t index) {
+        if (!decoderInputs.tryPush(index)) fail("decoder input queue");
+        extractSignal.notify();
+    };
+    decoderCallbacks.onOutputAvailable = [this](size_t index, const SampleInfo& info) {
+        if (!decodedOutputs.tryPush({index, info})) fail("decoder output queue");
+        stretchSignal.notify();
+    };
+    decoderCallbacks.onError = [this](int) { fail("decoder"); };
+
+    CodecCallbacks encoderCallbacks;
+    encoderCallbacks.onInputAvailable = [this](size_t index) {
+        if (!encoderInputs.tryPush(index)) fail("encoder input queue");
+        encodeSignal.notify();
+    };
+    encoderCallbacks.onOutputAvailable = [this](size_t index, const SampleInfo& info) {
+        if (!encodedOutputs.tryPush({index, info})) fail("encoder output queue");
+        muxSignal.notify();
+    };
+    encoderCallbacks.onError = [this](int) { fail("encoder"); };
+
+    if (decoder.setCallbacks(decoderCallbacks) != MEDIA_OK ||
+        encoder.setCallbacks(encoderCallbacks) != MEDIA_OK) {
+        LOGE("Failed to switch audio codecs to async mode");
+        return -1;
+    }
+    return 0;
+}
+
+void AsyncAudioPipeline::fail(const char* stage) {
+    if (!failed.exchange(true)) {
+        LOGE("Async audio pipeline failed in %s", stage);
+    }
+    extractSignal.notify();
+    stretchSignal.notify();
+    encodeSignal.notify();
+    muxSignal.notify();
+}
+
+void AsyncAudioPipeline::extractStage() {
+    while (!failed) {
+        size_t index;
+        extractSleeps += extractSignal.wait([this] { return !decoderInputs.empty() || failed; });
+        if (!decoderInputs.tryPop(&index)) continue;
+        if (isCancelled(control)) {
+            fail("extract, cancelled");
+            return;
+        }
+
+        size_t bufSize;
+        uint8_t* buf = decoder.getInputBuffer(index, &bufSize);
+        if (!buf) {
+            fail("extract");
+            return;
+        }
+
+        ssize_t sampleSize = extractor.readSampleData(buf, bufSize);
+        if (sampleSize < 0) {
+            decoder.queueInputBuffer(index, 0, 0, 0, BUFFER_FLAG_END_OF_STREAM);
+            LOGI("Sent EOS to audio decoder");
+            return;
+        }
+        decoder.queueInputBuffer(index, 0, sampleSize, extractor.getSampleTime(), 0);
+        extractor.advance();
+    }
+}
+
+// Moves everything the stretcher has produced into the PCM ring, waiting
+// for the encode stage whenever it is full. Returns false if the pipeline
+// failed while waiting.
+bool AsyncAudioPipeline::drainStretcher() {
+    while (true) {
+        if (pcm.fillFrom(stretcher) > 0) encodeSignal.notify();
+        if (stretcher.available() == 0) return true;
+
+        ScopedStage wait(profilerOf(control), PipelineStage::Stretch, true);
+        stretchSleeps += stretchSignal.wait([this] { return pcm.writableFrames() > 0 || failed; });
+        if (failed) return false;
+    }
+}
+
+void AsyncAudioPipeline::stretchStage() {
+    SegmentTimeline::Cursor cursor(timeline);
+    ssize_t currentSegment = -1;
+
+    while (!failed) {
+        CodecOutput output;
+        stretchSleeps += stretchSignal.wait([this] { return !decodedOutputs.empty() || failed; });
+        if (!decodedOutputs.tryPop(&output)) continue;
+
+        if (output.info.size > 0) {
+            size_t outSize;
+            uint8_t* outBuf = decoder.getOutputBuffer(output.index, &outSize);
+            const short* samples = outBuf ? reinterpret_cast<const short*>(outBuf + output.info.offset) : nullptr;
+            size_t frames = output.info.size / (channels * sizeof(short));
+            // The tap sees the whole track, gaps included
+            if (samples && peakTap) peakTap->add(output.info.presentationTimeUs, samples, frames);
+            // Audio in a gap between segments is cut, like the video
+            const TimelineSegment* segment = cursor.locate(output.info.presentationTimeUs);
+            if (samples && segment) {
+                if (cursor.index() != currentSegment) {
+                    currentSegment = cursor.index();
+                    stretcher.setSpeed(segment->speed);
+                }
+                ScopedStage stretch(profilerOf(control), PipelineStage::Stretch);
+                if (segment->warp) {
+                    stretcher.write(samples, frames, *segment->warp,
+                                    output.info.presentationTimeUs - segment->sourceStartUs);
+                } else {
+                    stretcher.write(samples, frames);
+                }
+                if (control) control->profiler()->count(PipelineStage::Stretch, 1, output.info.size);
+            }
+        }
+        decoder.releaseOutputBuffer(output.index, false);
+
+        if (!drainStretcher()) return;
+
+        if (output.info.flags & BUFFER_FLAG_END_OF_STREAM) {
+            stretcher.flush();
+            if (!drainStretcher()) return;
+            pcm.finish();
+            encodeSignal.notify();
+            return;
+        }
+    }
+}
+
+void AsyncAudioPipeline::encodeStage() {
+    const size_t frameBytes = channels * sizeof(short);
+
+    while (!failed) {
+        // Whole AAC frames only, until the stretch stage has finished
+        encodeSleeps += encodeSignal.wait([this] {
+            return pcm.readableFrames() >= PcmRingBuffer::AAC_FRAME_SIZE || pcm.isFinished() || failed;
+        });
+        if (failed) return;
+
+        size_t index;
+        encodeSleeps += encodeSignal.wait([this] { return !encoderInputs.empty() || failed; });
+        if (failed || !encoderInputs.tryPop(&index)) return;
+
+        size_t encSize;
+        uint8_t* encBuf = encoder.getInputBuffer(index, &encSize);
+        if (!encBuf || encSize < frameBytes) {
+            fail("encode");
+            return;
+        }
+
+        // PTS comes from the ring's frame counter, not from accumulated per-buffer durations
+        int64_t pts = pcm.readPosition() * 1000000 / sampleRate;
+        size_t frames = pcm.readForEncoder(encBuf, encSize);
+        if (frames == 0) {
+            encoder.queueInputBuffer(index, 0, 0, pts, BUFFER_FLAG_END_OF_STREAM);
+            LOGI("Sent EOS to audio encoder");
+            return;
+        }
+        encoder.queueInputBuffer(index, 0, frames * frameBytes, pts, 0);
+        stretchSignal.notify();
+    }
+}
+
+int AsyncAudioPipeline::run(MediaMuxer& muxer, size_t muxerTrack) {
+    std::thread extractThread(&AsyncAudioPipeline::extractStage, this);
+    std::thread stretchThread(&AsyncAudioPipeline::stretchStage, this);
+    std::thread encodeThread(&AsyncAudioPipeline::encodeStage, this);
+
+    bool done = false;
+    while (!done && !failed) {
+        CodecOutput output;
+        muxSleeps += muxSignal.wait([this] { return !encodedOutputs.empty() || failed; });
+        if (!encodedOutputs.tryPop(&output)) continue;
+
+        if (output.info.size > 0) {
+            size_t encOutSize;
+            uint8_t* encBuf = encoder.getOutputBuffer(output.index, &encOutSize);
+            if (encBuf && muxer.writeSampleData(muxerTrack, encBuf, output.info) == MEDIA_OK) {
+                encodedCount++;
+            } else {
+                fail("mux");
+            }
+        }
+        encoder.releaseOutputBuffer(output.index, false);
+
+        if (output.info.flags & BUFFER_FLAG_END_OF_STREAM) {
+            LOGI("Audio encoder output EOS");
+            done = true;
+        }
+    }
+
+    // Unblocks any stage still waiting once the muxer has seen EOS
+    if (!done) fail("mux");
+    extractSignal.notify();
+    extractThread.join();
+    stretchThread.join();
+    encodeThread.join();
+    return done ? 0 : -1;
+}
+
+void AsyncAudioPipeline::logStats() const {
+    LOGI("Audio stage queues (pushes / max depth / avg depth):");
+    LOGI("  decoder inputs  %zu / %zu / %.2f", decoderInputs.pushCount(), decoderInputs.maxDepthSeen(),
+         decoderInputs.averageDepth());
+    LOGI("  decoded buffers %zu / %zu / %.2f", decodedOutputs.pushCount(), decodedOutputs.maxDepthSeen(),
+         decodedOutputs.averageDepth());
+    LOGI("  pcm ring        %zu frames peak of %zu", pcm.peakFrames(), pcm.capacity());
+    LOGI("  encoder inputs  %zu / %zu / %.2f", encoderInputs.pushCount(), encoderInputs.maxDepthSeen(),
+         encoderInputs.averageDepth());
+    LOGI("  encoded buffers %zu / %zu / %.2f", encodedOutputs.pushCount(), encodedOutputs.maxDepthSeen(),
+         encodedOutputs.averageDepth());
+    LOGI("Audio stage sleeps waiting for work: extract=%zu stretch=%zu encode=%zu mux=%zu",
+         extractSleeps, stretchSleeps, encodeSleeps, muxSleeps);
+}
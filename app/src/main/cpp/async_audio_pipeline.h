@@ -0,0 +1,78 @@
+#pragma once
+
+#include "job_control.h"
+#include "media_backend.h"
+#include "pcm_ring_buffer.h"
+#include "segment_timeline.h"
+#include "spsc_queue.h"
+#include "time_stretcher.h"
+#include "waveform_peaks.h"
+
+#include <atomic>
+
+// Callback-driven audio path: extract -> decode -> time-stretch -> encode ->
+// mux run as separate stages joined by bounded SPSC queues, so neither codec
+// sits idle waiting for the other. The codecs push buffer indices from their
+// own callback threads; extraction, stretching and encoder feeding each get a
+// worker thread and muxing stays on the caller.
+class AsyncAudioPipeline {
+public:
+    AsyncAudioPipeline(MediaExtractor& extractor, MediaCodec& decoder, MediaCodec& encoder,
+                       TimeStretcher& stretcher, const SegmentTimeline& timeline,
+                       int32_t sampleRate, int32_t channels, const JobControl* control = nullptr);
+
+    // Installs the codec callbacks. Call before either codec is configured.
+    int attach();
+
+    // Also feeds every decoded buffer to tap. Call before run().
+    void setPeakTap(PeakAccumulator* tap) { peakTap = tap; }
+
+    // Drives the audio track to encoder EOS. The extractor must have only
+    // the audio track selected and both codecs must be started.
+    int run(MediaMuxer& muxer, size_t muxerTrack);
+
+    int encodedSamples() const { return encodedCount; }
+
+    // Per-stage queue depths and stall counts, to spot the bottleneck stage
+    void logStats() const;
+
+private:
+    struct CodecOutput {
+        size_t index;
+        SampleInfo info;
+    };
+
+    void extractStage();
+    void stretchStage();
+    void encodeStage();
+    void fail(const char* stage);
+    bool drainStretcher();
+
+    MediaExtractor& extractor;
+    MediaCodec& decoder;
+    MediaCodec& encoder;
+    TimeStretcher& stretcher;
+    const SegmentTimeline& timeline;
+    int32_t sampleRate;
+    int32_t channels;
+    const JobControl* control;
+    PeakAccumulator* peakTap = nullptr;
+
+    SpscQueue<size_t> decoderInputs;
+    SpscQueue<CodecOutput> decodedOutputs;
+    SpscQueue<size_t> encoderInputs;
+    SpscQueue<CodecOutput> encodedOutputs;
+    PcmRingBuffer pcm;
+
+    StageSignal extractSignal;
+    StageSignal stretchSignal;
+    StageSignal encodeSignal;
+    StageSignal muxSignal;
+
+    std::atomic<bool> failed{false};
+    size_t extractSleeps = 0;
+    size_t stretchSleeps = 0;
+    size_t encodeSleeps = 0;
+    size_t muxSleeps = 0;
+    int encodedCount = 0;
+};
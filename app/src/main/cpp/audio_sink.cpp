@@ -0,0 +1,36 @@
+#include "audio_sink.h"
+#include "pipeline_profiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+void BurstAudioSink::playedFrames(int64_t* frames, int64_t* atNs) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    *frames = std::max(played - (int64_t) queuedBursts * burst, (int64_t) 0);
+    *atNs = playedAtNs;
+}
+
+int64_t BurstAudioSink::underruns() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return underrunCount;
+}
+
+void BurstAudioSink::fillBurst(short* out) {
+    bool ended = source->isFinished();
+    size_t frames = source->read(out, burst);
+    memset(out + frames * channels, 0, (burst - frames) * channels * sizeof(short));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frames > 0) {
+        played += frames;
+        playedAtNs = PipelineProfiler::nowNs();
+    }
+    // Running dry after the last frame is the end of the preview, not an underrun
+    if (frames < (size_t) burst && !ended) underrunCount++;
+}
+
+void BurstAudioSink::resetCounters() {
+    std::lock_guard<std::mutex> lock(mutex);
+    played = 0;
+    playedAtNs = PipelineProfiler::nowNs();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "pcm_ring_buffer.h"
+
+#include <cstdint>
+#include <mutex>
+
+// Real-time PCM output for the preview. The sink pulls interleaved frames
+// from a PcmRingBuffer on its own callback thread, playing silence when the
+// ring runs dry, and reports how much real audio it has played so the
+// preview can use it as the master clock.
+class AudioSink {
+public:
+    virtual ~AudioSink() = default;
+
+    // Returns 0 on success. The ring must outlive the sink's playback.
+    virtual int open(int32_t sampleRate, int32_t channels, PcmRingBuffer* source) = 0;
+    virtual void close() = 0;
+
+    virtual int start() = 0;
+    virtual void pause() = 0;
+    // Pauses and drops audio queued in the device, e.g. before a seek
+    virtual void flush() = 0;
+
+    // Frames from the ring played since open() or the last flush(), and the
+    // CLOCK_MONOTONIC time of that count. Audio still queued in the device
+    // and silence played on underrun are not counted.
+    virtual void playedFrames(int64_t* frames, int64_t* atNs) const = 0;
+
+    // Device buffers that had to be padded with silence while playing
+    virtual int64_t underruns() const = 0;
+
+    // Frames the sink hands to the device per callback
+    virtual int32_t burstFrames() const = 0;
+};
+
+// Bookkeeping shared by sinks that play fixed-size bursts
+class BurstAudioSink : public AudioSink {
+public:
+    void playedFrames(int64_t* frames, int64_t* atNs) const override;
+    int64_t underruns() const override;
+    int32_t burstFrames() const override { return burst; }
+
+protected:
+    // Fills one burst from the ring, padding with silence. Runs on the device thread.
+    void fillBurst(short* out);
+    void resetCounters();
+
+    PcmRingBuffer* source = nullptr;
+    int32_t sampleRate = 0;
+    int32_t channels = 0;
+    int32_t burst = 0;
+    // Bursts handed to the device but not yet played
+    int32_t queuedBursts = 0;
+
+private:
+    mutable std::mutex mutex;
+    int64_t played = 0;
+    int64_t playedAtNs = 0;
+    int64_t underrunCount = 0;
+};
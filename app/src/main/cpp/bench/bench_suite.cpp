@@ -0,0 +1,473 @@
+#include "host_media_backend.h"
+#include "segment_timeline.h"
+#include "speed_pipeline.h"
+#include "synthetic_media.h"
+#include "time_stretcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+// End-to-end benchmark suite over deterministic synthetic inputs: segment
+// remapping, time stretching, the video remux path and the full pipeline,
+// across segment counts of 1 to 1000 and speeds of 0.25x to 4x, with the
+// video paths over GOPs of 1 (all intra) to 250 frames. Every case
+// reports throughput, latency percentiles and peak RSS as one JSON object per
+// line, so a run can be saved and used as the baseline of a later one.
+//
+// Gates, any failure makes the exit status 1:
+//   - stretch and pipeline cases must run faster than real time
+//   - with --baseline, a case fails if its throughput drops or its peak RSS
+//     grows by more than --tolerance, or its p99 latency grows by more than
+//     --latency-tolerance, against the case of the same name. p99 latencies
+//     under 100 us are not gated. Baselines only mean something when taken
+//     on the same machine, idle, with the same --quick setting.
+//
+// bench_suite [--quick] [--json <out.json>] [--baseline <in.json>]
+//             [--tolerance <fraction>] [--latency-tolerance <fraction>] [--work-dir <dir>]
+
+static const float SPEEDS[] = {0.25f, 0.5f, 1.0f, 2.0f, 4.0f};
+static const size_t SEGMENT_COUNTS[] = {1, 10, 100, 1000};
+// Frames per GOP of the synthetic video; decides how much of a cut is re-encoded
+static const int GOP_LENGTHS[] = {1, 30, 250};
+static const int32_t SAMPLE_RATES[] = {22050, 44100, 48000};
+static const int32_t CHANNEL_COUNTS[] = {1, 2, 6};
+static const size_t STRETCH_CHUNK_FRAMES = 1024;
+static const size_t REMAP_BATCH = 1000;
+static const double MIN_REALTIME = 1.0;
+// p99 latencies below this are mostly timer and scheduler noise
+static const double MIN_GATED_LATENCY_US = 100;
+// Each case keeps the fastest of its repetitions, which is what is stable
+// enough to compare between runs on a machine doing other work
+static const int REPEATS = 5;
+static const int QUICK_REPEATS = 3;
+
+struct CaseResult {
+    std::string name;
+    std::string unit;
+    double items = 0;
+    double seconds = 0;
+    // Source media seconds processed per wall second, 0 where it does not apply
+    double realtime = 0;
+    double p50Us = 0;
+    double p90Us = 0;
+    double p99Us = 0;
+    long peakRssKb = 0;
+    bool failed = false;
+
+    double throughput() const { return seconds > 0 ? items / seconds : 0; }
+};
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Nearest-rank percentiles of per-operation latencies
+static void setPercentiles(std::vector<double> latenciesUs, CaseResult* result) {
+    if (latenciesUs.empty()) return;
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+    auto rank = [&](double q) {
+        size_t index = (size_t) std::ceil(q * latenciesUs.size());
+        return latenciesUs[std::min(std::max(index, (size_t) 1), latenciesUs.size()) - 1];
+    };
+    result->p50Us = rank(0.50);
+    result->p90Us = rank(0.90);
+    result->p99Us = rank(0.99);
+}
+
+// Peak RSS is per case where the kernel lets us reset the high-water mark;
+// elsewhere it is the process peak so far
+static void resetPeakRss() {
+    if (FILE* file = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", file);
+        fclose(file);
+    }
+}
+
+static long peakRssKb() {
+    if (FILE* file = fopen("/proc/self/status", "r")) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), file)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) kb = atol(line + 6);
+        }
+        fclose(file);
+        if (kb >= 0) return kb;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// count equal segments over [0, durationUs), all at speed
+static std::vector<Segment> evenSegments(size_t count, int64_t durationUs, float speed) {
+    std::vector<Segment> segments;
+    for (size_t i = 0; i < count; i++) {
+        Segment segment;
+        segment.start = (float) (durationUs * i / count / 1e6);
+        segment.end = (float) (durationUs * (i + 1) / count / 1e6);
+        segment.speed = speed;
+        segments.push_back(segment);
+    }
+    return segments;
+}
+
+static char* caseName(char* buffer, size_t size, const char* format, ...) __attribute__((format(printf, 3, 4)));
+static char* caseName(char* buffer, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, size, format, args);
+    va_end(args);
+    return buffer;
+}
+
+// Source PTS remapped through a cursor, as every pipeline stage does per sample
+static CaseResult benchRemap(size_t segmentCount, float speed, int64_t durationUs, int passes) {
+    char name[96];
+    CaseResult result;
+    result.name = caseName(name, sizeof(name), "remap/segments=%zu/speed=%.2f", segmentCount, speed);
+    result.unit = "lookups/s";
+
+    SegmentTimeline timeline;
+    timeline.compile(evenSegments(segmentCount, durationUs, speed), durationUs);
+    // One lookup per audio sample of 1024 frames at 48 kHz
+    const int64_t stepUs = 21333;
+    const size_t lookups = (size_t) (durationUs / stepUs);
+    std::vector<double> latencies;
+    int64_t checksum = 0;
+
+    double begin = nowUs();
+    for (int pass = 0; pass < passes; pass++) {
+        SegmentTimeline::Cursor cursor(timeline);
+        for (size_t first = 0; first < lookups; first += REMAP_BATCH) {
+            double batchBegin = nowUs();
+            for (size_t i = first; i < std::min(first + REMAP_BATCH, lookups); i++) {
+                int64_t sourceUs = (int64_t) i * stepUs;
+                if (const TimelineSegment* segment = cursor.locate(sourceUs)) checksum += segment->toOutput(sourceUs);
+            }
+            latencies.push_back(nowUs() - batchBegin);
+        }
+    }
+    result.seconds = (nowUs() - begin) / 1e6;
+    result.items = (double) lookups * passes;
+    // Keeps the loop from being optimised away
+    result.failed = checksum < 0;
+    setPercentiles(latencies, &result);
+    return result;
+}
+
+// Write and drain in decoder-sized chunks; latency is per chunk
+static CaseResult benchStretch(int32_t sampleRate, int32_t channels, float speed, double inputSeconds) {
+    char name[96];
+    CaseResult result;
+    result.name = caseName(name, sizeof(name), "stretch/rate=%d/channels=%d/speed=%.2f", sampleRate, channels,
+                           speed);
+    result.unit = "frames/s";
+
+    size_t frames = (size_t) (inputSeconds * sampleRate);
+    std::vector<short> input = makeSyntheticPcm(frames, sampleRate, channels);
+    std::vector<short> chunk(STRETCH_CHUNK_FRAMES * 8 * channels);
+    std::vector<double> latencies;
+    size_t outputFrames = 0;
+
+    TimeStretcher stretcher(sampleRate, channels);
+    stretcher.setSpeed(speed);
+    auto drain = [&] {
+        while (size_t read = stretcher.read(chunk.data(), chunk.size() / channels)) outputFrames += read;
+    };
+    double begin = nowUs();
+    for (size_t first = 0; first < frames; first += STRETCH_CHUNK_FRAMES) {
+        double chunkBegin = nowUs();
+        stretcher.write(input.data() + first * channels, std::min(STRETCH_CHUNK_FRAMES, frames - first));
+        drain();
+        latencies.push_back(nowUs() - chunkBegin);
+    }
+    stretcher.flush();
+    drain();
+    result.seconds = (nowUs() - begin) / 1e6;
+    result.items = (double) frames;
+    result.realtime = inputSeconds / result.seconds;
+    result.failed = outputFrames == 0;
+    setPercentiles(latencies, &result);
+    return result;
+}
+
+// Host backend whose muxers timestamp every sample written, so a pipeline
+// run yields the gaps between consecutive output samples as its latencies
+class TimedBackend : public MediaBackend {
+public:
+    explicit TimedBackend(MediaBackend& backend) : backend(backend) {}
+
+    const char* name() const override { return backend.name(); }
+    std::unique_ptr<MediaFormat> createFormat() override { return backend.createFormat(); }
+    std::unique_ptr<MediaExtractor> createExtractor(const char* path) override {
+        return backend.createExtractor(path);
+    }
+    std::unique_ptr<MediaCodec> createDecoder(const char* mime) override { return backend.createDecoder(mime); }
+    std::unique_ptr<MediaCodec> createEncoder(const char* mime) override { return backend.createEncoder(mime); }
+    std::unique_ptr<MediaMuxer> createMuxer(const char* path) override {
+        std::unique_ptr<MediaMuxer> muxer = backend.createMuxer(path);
+        return muxer ? std::make_unique<TimedMuxer>(std::move(muxer), this) : nullptr;
+    }
+
+    // Gaps between writes since the last call, in us
+    std::vector<double> takeGaps() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<double> gaps;
+        for (size_t i = 1; i < writes.size(); i++) gaps.push_back(writes[i] - writes[i - 1]);
+        writes.clear();
+        return gaps;
+    }
+
+private:
+    class TimedMuxer : public MediaMuxer {
+    public:
+        TimedMuxer(std::unique_ptr<MediaMuxer> muxer, TimedBackend* owner) : muxer(std::move(muxer)), owner(owner) {}
+
+        ssize_t addTrack(const MediaFormat& format) override { return muxer->addTrack(format); }
+        int start() override { return muxer->start(); }
+        int writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) override {
+            int status = muxer->writeSampleData(track, data, info);
+            std::lock_guard<std::mutex> lock(owner->mutex);
+            owner->writes.push_back(nowUs());
+            return status;
+        }
+        int stop() override { return muxer->stop(); }
+        bool acceptsSampleViews() const override { return muxer->acceptsSampleViews(); }
+        bool acceptsInBandParameterSets() const override { return muxer->acceptsInBandParameterSets(); }
+
+    private:
+        std::unique_ptr<MediaMuxer> muxer;
+        TimedBackend* owner;
+    };
+
+    MediaBackend& backend;
+    std::mutex mutex;
+    std::vector<double> writes;
+};
+
+static CaseResult benchPipeline(TimedBackend& backend, const char* kind, const std::string& input,
+                                const std::string& output, int64_t durationUs, int gopLength, size_t segmentCount,
+                                float speed) {
+    char name[96];
+    CaseResult result;
+    result.name = caseName(name, sizeof(name), "%s/gop=%d/segments=%zu/speed=%.2f", kind, gopLength, segmentCount,
+                           speed);
+    result.unit = "samples/s";
+
+    PipelineOptions options;
+    backend.takeGaps();
+    double begin = nowUs();
+    int status = processSpeedVideo(backend, input.c_str(), output.c_str(),
+                                   evenSegments(segmentCount, durationUs, speed), options);
+    result.seconds = (nowUs() - begin) / 1e6;
+    std::vector<double> gaps = backend.takeGaps();
+    result.items = (double) gaps.size() + 1;
+    result.realtime = durationUs / 1e6 / result.seconds;
+    result.failed = status != 0;
+    setPercentiles(gaps, &result);
+    remove(output.c_str());
+    return result;
+}
+
+static std::string toJson(const CaseResult& result) {
+    char line[512];
+    snprintf(line, sizeof(line),
+             "{\"name\": \"%s\", \"unit\": \"%s\", \"items\": %.0f, \"seconds\": %.6f, \"throughput\": %.1f, "
+             "\"realtime\": %.2f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"peak_rss_kb\": %ld}",
+             result.name.c_str(), result.unit.c_str(), result.items, result.seconds, result.throughput(),
+             result.realtime, result.p50Us, result.p90Us, result.p99Us, result.peakRssKb);
+    return line;
+}
+
+// Value of "key": in a line this suite wrote, -1 if absent
+static double jsonNumber(const std::string& line, const char* key) {
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t at = line.find(pattern);
+    return at == std::string::npos ? -1 : atof(line.c_str() + at + pattern.size());
+}
+
+// Case lines of a previous run by name; false when it cannot be read or its
+// inputs were not the size of this run's
+static bool readBaseline(const char* path, bool quick, std::map<std::string, std::string>* cases) {
+    std::ifstream file(path);
+    std::string line;
+    const std::string key = "{\"name\": \"";
+    bool sameInputs = false;
+    while (std::getline(file, line)) {
+        if (line.find(quick ? "\"quick\": true" : "\"quick\": false") != std::string::npos) sameInputs = true;
+        size_t at = line.find(key);
+        if (at == std::string::npos) continue;
+        size_t end = line.find('"', at + key.size());
+        (*cases)[line.substr(at + key.size(), end - at - key.size())] = line;
+    }
+    return sameInputs && !cases->empty();
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    const char* jsonPath = nullptr;
+    const char* baselinePath = nullptr;
+    double tolerance = 0.15;
+    double latencyTolerance = 0.5;
+    std::string dir = ".";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--latency-tolerance") == 0 && i + 1 < argc) {
+            latencyTolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--work-dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--json <out.json>] [--baseline <in.json>] "
+                            "[--tolerance <fraction>] [--latency-tolerance <fraction>] [--work-dir <dir>]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    std::map<std::string, std::string> baseline;
+    if (baselinePath && !readBaseline(baselinePath, quick, &baseline)) {
+        fprintf(stderr, "%s is not a %s run of this suite\n", baselinePath, quick ? "--quick" : "full");
+        return 2;
+    }
+
+    // Quick runs keep the full speed and segment matrix over shorter inputs
+    const int64_t clipUs = (quick ? 5 : 20) * 1000000LL;
+    const double stretchSeconds = quick ? 2 : 10;
+    std::vector<int32_t> rates(std::begin(SAMPLE_RATES), std::end(SAMPLE_RATES));
+    std::vector<int32_t> channelCounts(std::begin(CHANNEL_COUNTS), std::end(CHANNEL_COUNTS));
+    if (quick) {
+        rates = {48000};
+        channelCounts = {2};
+    }
+
+    HostMediaBackend host;
+    TimedBackend backend(host);
+    std::string videoInput = dir + "/bench_suite_video.spdraw";
+    std::string avInput = dir + "/bench_suite_av.spdraw";
+    std::string output = dir + "/bench_suite_output.spdraw";
+    // Written again for every GOP length
+    auto writeInputs = [&](int gopLength) {
+        SyntheticVideoOptions video;
+        video.durationUs = clipUs;
+        video.gopLength = gopLength;
+        SyntheticAudioOptions audio;
+        if (writeSyntheticMedia(host, videoInput.c_str(), video, nullptr) != 0 ||
+            writeSyntheticMedia(host, avInput.c_str(), video, &audio) != 0) {
+            fprintf(stderr, "cannot write inputs under %s\n", dir.c_str());
+            return false;
+        }
+        return true;
+    };
+
+    std::vector<CaseResult> results;
+    const int repeats = quick ? QUICK_REPEATS : REPEATS;
+    auto run = [&](auto&& bench) {
+        resetPeakRss();
+        CaseResult result = bench();
+        for (int i = 1; i < repeats && !result.failed; i++) {
+            CaseResult again = bench();
+            if (again.failed || again.throughput() > result.throughput()) result = again;
+        }
+        result.peakRssKb = peakRssKb();
+        printf("%-44s %14.1f %-10s p99 %9.1f us  %s\n", result.name.c_str(), result.throughput(),
+                result.unit.c_str(), result.p99Us, result.failed ? "FAILED" : "");
+        fflush(stdout);
+        results.push_back(result);
+    };
+
+    for (size_t segments : SEGMENT_COUNTS) {
+        // An hour of source per pass
+        for (float speed : SPEEDS) run([&] { return benchRemap(segments, speed, 3600000000LL, quick ? 10 : 50); });
+    }
+    for (int32_t rate : rates) {
+        for (int32_t channels : channelCounts) {
+            for (float speed : SPEEDS) run([&] { return benchStretch(rate, channels, speed, stretchSeconds); });
+        }
+    }
+    for (int gop : GOP_LENGTHS) {
+        if (!writeInputs(gop)) return 1;
+        for (size_t segments : SEGMENT_COUNTS) {
+            for (float speed : SPEEDS) {
+                run([&] { return benchPipeline(backend, "remux", videoInput, output, clipUs, gop, segments, speed); });
+            }
+        }
+        for (size_t segments : SEGMENT_COUNTS) {
+            for (float speed : SPEEDS) {
+                run([&] {
+                    return benchPipeline(backend, "pipeline", avInput, output, clipUs, gop, segments, speed);
+                });
+            }
+        }
+    }
+    remove(videoInput.c_str());
+    remove(avInput.c_str());
+
+    // Gates
+    int failures = 0;
+    for (const CaseResult& result : results) {
+        if (result.failed) {
+            printf("FAIL %s: did not complete\n", result.name.c_str());
+            failures++;
+            continue;
+        }
+        if (result.realtime > 0 && result.realtime < MIN_REALTIME) {
+            printf("FAIL %s: %.2fx real time\n", result.name.c_str(), result.realtime);
+            failures++;
+        }
+        auto it = baseline.find(result.name);
+        if (it == baseline.end()) continue;
+        double throughput = jsonNumber(it->second, "throughput");
+        double p99Us = jsonNumber(it->second, "p99_us");
+        double rssKb = jsonNumber(it->second, "peak_rss_kb");
+        if (throughput > 0 && result.throughput() < throughput * (1 - tolerance)) {
+            printf("REGRESSION %s: throughput %.1f -> %.1f %s\n", result.name.c_str(), throughput,
+                    result.throughput(), result.unit.c_str());
+            failures++;
+        }
+        if (p99Us >= MIN_GATED_LATENCY_US && result.p99Us > p99Us * (1 + latencyTolerance)) {
+            printf("REGRESSION %s: p99 %.1f -> %.1f us\n", result.name.c_str(), p99Us, result.p99Us);
+            failures++;
+        }
+        if (rssKb > 0 && result.peakRssKb > rssKb * (1 + tolerance)) {
+            printf("REGRESSION %s: peak RSS %.0f -> %ld KiB\n", result.name.c_str(), rssKb,
+                    result.peakRssKb);
+            failures++;
+        }
+    }
+
+    if (jsonPath) {
+        FILE* json = fopen(jsonPath, "w");
+        if (!json) {
+            fprintf(stderr, "cannot write %s\n", jsonPath);
+            return 1;
+        }
+        fprintf(json, "{\n\"suite\": \"video_speed_editor\",\n\"quick\": %s,\n\"failures\": %d,\n\"cases\": [\n",
+                quick ? "true" : "false", failures);
+        for (size_t i = 0; i < results.size(); i++) {
+            fprintf(json, "%s%s\n", toJson(results[i]).c_str(), i + 1 < results.size() ? "," : "");
+        }
+        fprintf(json, "]\n}\n");
+        fclose(json);
+    }
+
+    printf("%zu cases, %d failures\n", results.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#include "codec_pool.h"
+#include "host_media_backend.h"
+#include "speed_pipeline.h"
+#include "synthetic_media.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Codec startup with and without the pool, over host codecs that sleep like
+// device codecs do while they are created, configured and started. Measures
+// time to first output sample of an audio decoder, then back-to-back
+// exports of a short clip on the segmented audio path the app uses.
+
+static const int RUNS = 5;
+static const int64_t CLIP_US = 2000000;
+
+static double msSince(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static Segment constantSpeed(float start, float end, float speed) {
+    Segment segment;
+    segment.start = start;
+    segment.end = end;
+    segment.speed = speed;
+    return segment;
+}
+
+// Lease to first decoded output, like the start of every export
+static double firstOutputMs(MediaBackend& media, const MediaFormat& format, const std::string& mime) {
+    auto begin = std::chrono::steady_clock::now();
+    std::unique_ptr<MediaCodec> decoder = media.createDecoder(mime.c_str());
+    if (!decoder || decoder->configure(format, false) != MEDIA_OK || decoder->start() != MEDIA_OK) return -1;
+    ssize_t inIndex = -1;
+    while (inIndex < 0) inIndex = decoder->dequeueInputBuffer(10000);
+    decoder->queueInputBuffer(inIndex, 0, 4096, 0, 0);
+    SampleInfo info;
+    while (decoder->dequeueOutputBuffer(&info, 10000) < 0) {}
+    double ms = msSince(begin);
+    decoder->stop();
+    return ms;
+}
+
+// codec_pool_bench [work dir] [create ms] [configure ms] [start ms]
+int main(int argc, char** argv) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+    HostCodecLatency latency;
+    latency.createUs = (argc > 2 ? atoll(argv[2]) : 80) * 1000;
+    latency.configureUs = (argc > 3 ? atoll(argv[3]) : 60) * 1000;
+    latency.startUs = (argc > 4 ? atoll(argv[4]) : 40) * 1000;
+
+    HostMediaBackend backend(latency);
+    std::string input = dir + "/codec_pool_bench_input.spdraw";
+    std::string output = dir + "/codec_pool_bench_output.spdraw";
+    SyntheticVideoOptions video;
+    video.durationUs = CLIP_US;
+    SyntheticAudioOptions audio;
+    if (writeSyntheticMedia(backend, input.c_str(), video, &audio) != 0) {
+        fprintf(stderr, "cannot write %s\n", input.c_str());
+        return 1;
+    }
+
+    std::unique_ptr<MediaFormat> audioFormat;
+    std::string mime;
+    std::unique_ptr<MediaExtractor> extractor = backend.createExtractor(input.c_str());
+    for (size_t i = 0; extractor && i < extractor->getTrackCount(); i++) {
+        std::unique_ptr<MediaFormat> format = extractor->getTrackFormat(i);
+        if (format && format->getString(MEDIA_KEY_MIME, &mime) && mime.compare(0, 6, "audio/") == 0) {
+            audioFormat = std::move(format);
+            break;
+        }
+    }
+    if (!audioFormat) return 1;
+
+    std::vector<Segment> segments = {constantSpeed(0, 0.5f, 1), constantSpeed(0.5f, 1.5f, 2),
+                                     constantSpeed(1.5f, 2, 0.5f)};
+    PipelineOptions options;
+    options.audioWorkers = 1;
+
+    int failures = 0;
+    CodecPool pool(backend);
+    for (int pooled = 0; pooled < 2; pooled++) {
+        MediaBackend& media = pooled ? (MediaBackend&) pool : backend;
+        const char* name = pooled ? "pooled" : "direct";
+        for (int run = 0; run < RUNS; run++) {
+            double ms = firstOutputMs(media, *audioFormat, mime);
+            if (ms < 0) failures++;
+            printf("%s first output  run %d  %8.1f ms\n", name, run, ms);
+        }
+        for (int run = 0; run < RUNS; run++) {
+            auto begin = std::chrono::steady_clock::now();
+            int result = processSpeedVideo(media, input.c_str(), output.c_str(), segments, options);
+            if (result != 0) failures++;
+            printf("%s export        run %d  %8.1f ms%s\n", name, run, msSince(begin), result ? "  FAILED" : "");
+        }
+    }
+    CodecPool::Stats stats = pool.stats();
+    printf("pool: created=%lld reused=%lld reconfigured=%lld evicted=%lld idle=%zu\n", (long long) stats.created,
+           (long long) stats.reused, (long long) stats.reconfigured, (long long) stats.evicted, pool.idleCount());
+
+    remove(input.c_str());
+    remove(output.c_str());
+    return failures == 0 ? 0 : 1;
+}
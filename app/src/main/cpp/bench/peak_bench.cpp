@@ -0,0 +1,78 @@
+#include "peak_kernels.h"
+#include "waveform_peaks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Waveform peak throughput per kernel set and channel layout, in input frames
+// per second. Every set's peaks are compared against scalar and any
+// difference fails the run, so this doubles as the equivalence test.
+
+static const int32_t SAMPLE_RATE = 48000;
+static const int32_t CHANNEL_COUNTS[] = {1, 2, 6};
+// Odd-sized, like decoder output, so bins straddle buffers and vector tails run
+static const size_t BUFFER_FRAMES = 1021;
+
+// Full-scale tone with fixed-seed noise, clipped so both extremes occur
+static std::vector<short> makeInput(size_t frames, int32_t channels) {
+    std::vector<short> pcm(frames * channels);
+    uint32_t seed = 54321;
+    for (size_t t = 0; t < frames; t++) {
+        double envelope = 0.5 + 0.6 * sin(2 * M_PI * 0.5 * t / SAMPLE_RATE);
+        for (int32_t c = 0; c < channels; c++) {
+            seed = seed * 1664525 + 1013904223;
+            double noise = ((seed >> 16) & 0xffff) / 65536.0 - 0.5;
+            double value = envelope * sin(2 * M_PI * 220 * (c + 1) * t / SAMPLE_RATE) * 32767 + noise * 4000;
+            pcm[t * channels + c] = (short) std::max(-32768.0, std::min(32767.0, value));
+        }
+    }
+    return pcm;
+}
+
+static std::vector<WaveformPeak> accumulate(const PeakKernels& kernels, const std::vector<short>& input,
+                                            int32_t channels, double* seconds) {
+    size_t frames = input.size() / channels;
+    PeakAccumulator accumulator(SAMPLE_RATE, channels, kernels);
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t first = 0; first < frames; first += BUFFER_FRAMES) {
+        size_t count = frames - first < BUFFER_FRAMES ? frames - first : BUFFER_FRAMES;
+        accumulator.add((int64_t) first * 1000000 / SAMPLE_RATE, input.data() + first * channels, count);
+    }
+    accumulator.finish();
+    *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return accumulator.peaks();
+}
+
+// peak_bench [input seconds]
+int main(int argc, char** argv) {
+    size_t frames = (size_t) ((argc > 1 ? atof(argv[1]) : 60.0) * SAMPLE_RATE);
+    std::vector<const PeakKernels*> sets = PeakKernels::supported();
+    int mismatches = 0;
+
+    for (int32_t channels : CHANNEL_COUNTS) {
+        std::vector<short> input = makeInput(frames, channels);
+        std::vector<WaveformPeak> reference;
+        for (const PeakKernels* kernels : sets) {
+            double seconds = 0;
+            std::vector<WaveformPeak> peaks = accumulate(*kernels, input, channels, &seconds);
+            bool match = true;
+            if (kernels == sets.front()) {
+                reference = peaks;
+            } else {
+                match = peaks.size() == reference.size();
+                for (size_t i = 0; match && i < peaks.size(); i++) {
+                    match = peaks[i].min == reference[i].min && peaks[i].max == reference[i].max &&
+                            peaks[i].rms == reference[i].rms;
+                }
+            }
+            if (!match) mismatches++;
+            printf("%-6s %d ch  %10.1f Mframes/s  %zu bins%s\n", kernels->name, channels,
+                   frames / seconds / 1e6, peaks.size(), match ? "" : "  MISMATCH");
+        }
+    }
+    return mismatches == 0 ? 0 : 1;
+}
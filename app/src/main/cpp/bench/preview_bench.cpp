@@ -0,0 +1,88 @@
+#include "host_audio_sink.h"
+#include "host_media_backend.h"
+#include "preview_engine.h"
+#include "synthetic_media.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// Headless real-time preview run over a synthetic 60 fps file with audio:
+// plays a 1x / 2x / 4x timeline, changes the first segment's speed while
+// playing, seeks, and plays to the end. The host surface reports how long
+// after their requested time frames reach a vsync, the engine how many were
+// late or skipped, and the host sink how often it ran dry.
+
+static const int64_t SOURCE_US = 8000000;
+static const int64_t REFRESH_NS = 16666667;
+
+static Segment constantSpeed(float start, float end, float speed) {
+    Segment segment;
+    segment.start = start;
+    segment.end = end;
+    segment.speed = speed;
+    return segment;
+}
+
+static void waitMs(int64_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// preview_bench [work dir]
+int main(int argc, char** argv) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+    std::string input = dir + "/preview_bench_input.spdraw";
+
+    HostMediaBackend backend;
+    SyntheticVideoOptions video;
+    video.durationUs = SOURCE_US;
+    video.fps = 60;
+    video.gopLength = 60;
+    SyntheticAudioOptions audioOptions;
+    if (writeSyntheticMedia(backend, input.c_str(), video, &audioOptions) != 0) {
+        fprintf(stderr, "cannot write %s\n", input.c_str());
+        return 1;
+    }
+
+    HostVideoSurface surface(REFRESH_NS);
+    HostAudioSink sink(240);
+    PreviewEngine engine(backend, &surface, &sink);
+    std::vector<Segment> segments = {constantSpeed(0, 3, 1), constantSpeed(3, 5, 2), constantSpeed(5, 8, 4)};
+    if (engine.open(input.c_str(), segments) != 0) return 1;
+
+    auto started = std::chrono::steady_clock::now();
+    engine.play();
+    waitMs(1000);
+    segments[0].speed = 1.5f;
+    engine.setSegments(segments);
+    waitMs(1000);
+    engine.seekTo(engine.durationUs() / 2);
+
+    int64_t limitMs = engine.durationUs() / 1000 + 3000;
+    while (!engine.hasEnded() && std::chrono::steady_clock::now() - started < std::chrono::milliseconds(limitMs)) {
+        waitMs(10);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    bool ended = engine.hasEnded();
+    PreviewStats stats = engine.stats();
+    engine.close();
+    remove(input.c_str());
+
+    HostVideoSurface::Stats shown = surface.stats();
+    printf("preview: wall=%.2fs ended=%s rendered=%lld late=%lld skipped=%lld underruns=%lld\n", seconds,
+           ended ? "yes" : "no", (long long) stats.framesRendered, (long long) stats.framesLate,
+           (long long) stats.framesSkipped, (long long) stats.audioUnderruns);
+    printf("release: lateness_avg_us=%.0f lateness_max_us=%lld\n",
+           stats.framesRendered ? (double) stats.latenessSumUs / stats.framesRendered : 0.0,
+           (long long) stats.latenessMaxUs);
+    printf("surface: shown=%lld replaced=%lld latency_avg_ms=%.2f latency_max_ms=%.2f\n",
+           (long long) shown.framesShown, (long long) shown.framesReplaced,
+           shown.framesShown ? shown.latencySumNs / 1e6 / shown.framesShown : 0.0, shown.latencyMaxNs / 1e6);
+
+    if (!ended || stats.framesRendered == 0) {
+        fprintf(stderr, "preview did not play to the end\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "editor_log.h"
+#include "host_media_backend.h"
+#include "sample_buffer_pool.h"
+#include "synthetic_media.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// Extract -> mux benchmark comparing the old per-sample 1 MiB allocation with
+// the pooled sample buffer. Heap traffic is counted through operator new.
+
+static std::atomic<size_t> heapAllocations{0};
+static std::atomic<size_t> heapBytes{0};
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    heapBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+struct RemuxResult {
+    size_t samples = 0;
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+    double seconds = 0;
+};
+
+static bool openTracks(HostMediaBackend& backend, const char* input, const char* output,
+                       std::unique_ptr<MediaExtractor>* extractor, std::unique_ptr<MediaMuxer>* muxer,
+                       int32_t* maxInputSize) {
+    *extractor = backend.createExtractor(input);
+    *muxer = backend.createMuxer(output);
+    if (!*extractor || !*muxer) return false;
+    std::unique_ptr<MediaFormat> format = (*extractor)->getTrackFormat(0);
+    format->getInt32(MEDIA_KEY_MAX_INPUT_SIZE, maxInputSize);
+    (*muxer)->addTrack(*format);
+    (*extractor)->selectTrack(0);
+    return (*muxer)->start() == MEDIA_OK;
+}
+
+// The loop processVideo used before the pool: a fresh 1 MiB buffer per sample
+static RemuxResult remuxLegacy(HostMediaBackend& backend, const char* input, const char* output) {
+    RemuxResult result;
+    std::unique_ptr<MediaExtractor> extractor;
+    std::unique_ptr<MediaMuxer> muxer;
+    int32_t maxInputSize = 0;
+    if (!openTracks(backend, input, output, &extractor, &muxer, &maxInputSize)) return result;
+
+    size_t allocationsBefore = heapAllocations.load();
+    size_t bytesBefore = heapBytes.load();
+    auto begin = std::chrono::steady_clock::now();
+    while (true) {
+        const size_t BUFFER_SIZE = 1024 * 1024;
+        uint8_t* buffer = new uint8_t[BUFFER_SIZE];
+        ssize_t sampleSize = extractor->readSampleData(buffer, BUFFER_SIZE);
+        if (sampleSize < 0) {
+            delete[] buffer;
+            break;
+        }
+        SampleInfo info = {0, (int32_t) sampleSize, extractor->getSampleTime(), extractor->getSampleFlags()};
+        muxer->writeSampleData(0, buffer, info);
+        delete[] buffer;
+        extractor->advance();
+        result.samples++;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result.allocations = heapAllocations.load() - allocationsBefore;
+    result.allocatedBytes = heapBytes.load() - bytesBefore;
+    muxer->stop();
+    return result;
+}
+
+static RemuxResult remuxPooled(HostMediaBackend& backend, const char* input, const char* output) {
+    RemuxResult result;
+    std::unique_ptr<MediaExtractor> extractor;
+    std::unique_ptr<MediaMuxer> muxer;
+    int32_t maxInputSize = 0;
+    if (!openTracks(backend, input, output, &extractor, &muxer, &maxInputSize)) return result;
+
+    size_t allocationsBefore = heapAllocations.load();
+    size_t bytesBefore = heapBytes.load();
+    auto begin = std::chrono::steady_clock::now();
+    SampleBufferPool pool(maxInputSize);
+    SampleBuffer* sampleBuffer = pool.acquire(maxInputSize);
+    while (true) {
+        ssize_t sampleSize = extractor->getSampleSize();
+        if (sampleSize < 0) break;
+        uint8_t* buffer = pool.reserve(sampleBuffer, sampleSize);
+        sampleSize = extractor->readSampleData(buffer, sampleBuffer->capacity());
+        if (sampleSize < 0) break;
+        SampleInfo info = {0, (int32_t) sampleSize, extractor->getSampleTime(), extractor->getSampleFlags()};
+        muxer->writeSampleData(0, buffer, info);
+        extractor->advance();
+        result.samples++;
+    }
+    pool.release(sampleBuffer);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result.allocations = heapAllocations.load() - allocationsBefore;
+    result.allocatedBytes = heapBytes.load() - bytesBefore;
+    muxer->stop();
+    return result;
+}
+
+static void report(const char* name, const RemuxResult& r) {
+    printf("%-8s samples=%zu allocations=%zu allocated_bytes=%zu samples_per_sec=%.0f\n",
+           name, r.samples, r.allocations, r.allocatedBytes, r.seconds > 0 ? r.samples / r.seconds : 0.0);
+}
+
+// remux_bench [work dir] [duration seconds]
+int main(int argc, char** argv) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    SyntheticVideoOptions video;
+    video.fps = 60;
+    video.durationUs = (argc > 2 ? atoll(argv[2]) : 600) * 1000000LL;
+
+    std::string input = dir + "/remux_bench_input.spdraw";
+    std::string output = dir + "/remux_bench_output.spdraw";
+
+    HostMediaBackend backend;
+    if (writeSyntheticMedia(backend, input.c_str(), video, nullptr) != 0) {
+        LOGE("Failed to write synthetic input %s", input.c_str());
+        return 1;
+    }
+
+    report("legacy", remuxLegacy(backend, input.c_str(), output.c_str()));
+    report("pooled", remuxPooled(backend, input.c_str(), output.c_str()));
+
+    remove(input.c_str());
+    remove(output.c_str());
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "stretch_kernels.h"
+#include "time_stretcher.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Time stretcher throughput per kernel set, speed and channel layout, in
+// input frames per second. Every set's output is compared against scalar and
+// any difference fails the run, so this doubles as the equivalence test.
+
+static const int32_t SAMPLE_RATE = 48000;
+static const size_t CHUNK_FRAMES = 1024;
+static const float SPEEDS[] = {0.25f, 0.5f, 0.75f, 1.5f, 2.0f, 3.0f, 4.0f};
+static const int32_t CHANNEL_COUNTS[] = {1, 2, 6};
+
+// Voiced-like input: a harmonic tone gliding between 100 and 300 Hz plus
+// fixed-seed noise, different per channel so downmixing is exercised
+static std::vector<short> makeInput(size_t frames, int32_t channels) {
+    std::vector<short> pcm(frames * channels);
+    uint32_t seed = 12345;
+    double phase = 0;
+    for (size_t t = 0; t < frames; t++) {
+        double pitch = 200 + 100 * sin(2 * M_PI * 0.25 * t / SAMPLE_RATE);
+        phase += 2 * M_PI * pitch / SAMPLE_RATE;
+        for (int32_t c = 0; c < channels; c++) {
+            seed = seed * 1664525 + 1013904223;
+            double noise = ((seed >> 16) & 0xffff) / 65536.0 - 0.5;
+            double value = 0;
+            for (int h = 1; h <= 4; h++) value += sin(h * phase + c) / h;
+            pcm[t * channels + c] = (short) (value * 12000 + noise * 2000);
+        }
+    }
+    return pcm;
+}
+
+static std::vector<short> stretch(const StretchKernels& kernels, const std::vector<short>& input,
+                                  int32_t channels, float speed, double* seconds) {
+    size_t frames = input.size() / channels;
+    std::vector<short> output;
+    std::vector<short> chunk(CHUNK_FRAMES * 8 * channels);
+    TimeStretcher stretcher(SAMPLE_RATE, channels, kernels);
+    stretcher.setSpeed(speed);
+
+    auto drain = [&] {
+        while (size_t read = stretcher.read(chunk.data(), chunk.size() / channels)) {
+            output.insert(output.end(), chunk.begin(), chunk.begin() + read * channels);
+        }
+    };
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t first = 0; first < frames; first += CHUNK_FRAMES) {
+        size_t count = frames - first < CHUNK_FRAMES ? frames - first : CHUNK_FRAMES;
+        stretcher.write(input.data() + first * channels, count);
+        drain();
+    }
+    stretcher.flush();
+    drain();
+    *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return output;
+}
+
+// stretch_bench [input seconds]
+int main(int argc, char** argv) {
+    size_t frames = (size_t) ((argc > 1 ? atof(argv[1]) : 10.0) * SAMPLE_RATE);
+    std::vector<const StretchKernels*> sets = StretchKernels::supported();
+    int mismatches = 0;
+
+    for (int32_t channels : CHANNEL_COUNTS) {
+        std::vector<short> input = makeInput(frames, channels);
+        for (float speed : SPEEDS) {
+            std::vector<short> reference;
+            for (const StretchKernels* kernels : sets) {
+                double seconds = 0;
+                std::vector<short> output = stretch(*kernels, input, channels, speed, &seconds);
+                bool match = true;
+                if (kernels == sets.front()) {
+                    reference = output;
+                } else {
+                    match = output == reference;
+                    if (!match) mismatches++;
+                }
+                printf("%-6s channels=%d speed=%.2f samples_per_sec=%.0f output_frames=%zu%s\n",
+                       kernels->name, channels, speed, seconds > 0 ? frames / seconds : 0.0,
+                       output.size() / channels, match ? "" : " MISMATCH");
+            }
+        }
+    }
+
+    if (mismatches) {
+        fprintf(stderr, "%d kernel runs differ from scalar\n", mismatches);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "synthetic_media.h"
+#include "editor_log.h"
+
+#include <cmath>
+#include <vector>
+
+static uint32_t nextRandom(uint32_t* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state;
+}
+
+int writeSyntheticMedia(MediaBackend& backend, const char* path,
+                        const SyntheticVideoOptions& video,
+                        const SyntheticAudioOptions* audio) {
+    std::unique_ptr<MediaMuxer> muxer = backend.createMuxer(path);
+    if (!muxer) return -1;
+
+    std::unique_ptr<MediaFormat> videoFormat = backend.createFormat();
+    videoFormat->setString(MEDIA_KEY_MIME, "video/avc");
+    videoFormat->setInt32(MEDIA_KEY_WIDTH, 1920);
+    videoFormat->setInt32(MEDIA_KEY_HEIGHT, 1080);
+    videoFormat->setInt32(MEDIA_KEY_FRAME_RATE, video.fps);
+    videoFormat->setInt32(MEDIA_KEY_MAX_INPUT_SIZE, (int32_t) video.keyFrameSize);
+    videoFormat->setInt64(MEDIA_KEY_DURATION, video.durationUs);
+    ssize_t videoTrack = muxer->addTrack(*videoFormat);
+
+    ssize_t audioTrack = -1;
+    if (audio) {
+        std::unique_ptr<MediaFormat> audioFormat = backend.createFormat();
+        audioFormat->setString(MEDIA_KEY_MIME, "audio/raw");
+        audioFormat->setInt32(MEDIA_KEY_SAMPLE_RATE, audio->sampleRate);
+        audioFormat->setInt32(MEDIA_KEY_CHANNEL_COUNT, audio->channels);
+        audioFormat->setInt32(MEDIA_KEY_MAX_INPUT_SIZE,
+                              audio->framesPerSample * audio->channels * (int32_t) sizeof(short));
+        audioFormat->setInt64(MEDIA_KEY_DURATION, video.durationUs);
+        audioTrack = muxer->addTrack(*audioFormat);
+    }
+
+    if (videoTrack < 0 || (audio && audioTrack < 0) || muxer->start() != MEDIA_OK) return -1;
+
+    std::vector<uint8_t> payload(video.keyFrameSize > video.frameSize ? video.keyFrameSize : video.frameSize);
+    uint32_t seed = 0x5eed;
+    for (uint8_t& b : payload) b = (uint8_t) (nextRandom(&seed) >> 24);
+
+    std::vector<short> pcm;
+    if (audio) pcm.resize((size_t) audio->framesPerSample * audio->channels);
+
+    int64_t frameCount = video.durationUs * video.fps / 1000000;
+    int64_t audioFrame = 0;
+    for (int64_t frame = 0; frame < frameCount; frame++) {
+        int64_t videoPts = frame * 1000000 / video.fps;
+
+        // Keep the file interleaved: emit all audio that starts before this frame
+        while (audio) {
+            int64_t audioPts = audioFrame * 1000000 / audio->sampleRate;
+            if (audioPts > videoPts || audioPts >= video.durationUs) break;
+            for (int i = 0; i < audio->framesPerSample; i++) {
+                double t = (double) (audioFrame + i) / audio->sampleRate;
+                short value = (short) (8000.0 * sin(2.0 * M_PI * 440.0 * t));
+                for (int c = 0; c < audio->channels; c++) pcm[(size_t) i * audio->channels + c] = value;
+            }
+            SampleInfo info = {0, (int32_t) (pcm.size() * sizeof(short)), audioPts, BUFFER_FLAG_KEY_FRAME};
+            if (muxer->writeSampleData(audioTrack, reinterpret_cast<uint8_t*>(pcm.data()), info) != MEDIA_OK) {
+                return -1;
+            }
+            audioFrame += audio->framesPerSample;
+        }
+
+        bool keyFrame = frame % video.gopLength == 0;
+        // Vary sizes a little so buffers see realistic spread
+        size_t size = keyFrame ? video.keyFrameSize : video.frameSize;
+        size -= nextRandom(&seed) % (size / 4 + 1);
+        SampleInfo info = {0, (int32_t) size, videoPts, keyFrame ? BUFFER_FLAG_KEY_FRAME : 0u};
+        if (muxer->writeSampleData(videoTrack, payload.data(), info) != MEDIA_OK) return -1;
+    }
+
+    return muxer->stop() == MEDIA_OK ? 0 : -1;
+}
+
+std::vector<short> makeSyntheticPcm(size_t frames, int sampleRate, int channels) {
+    std::vector<short> pcm(frames * channels);
+    uint32_t seed = 12345;
+    double phase = 0;
+    for (size_t t = 0; t < frames; t++) {
+        double pitch = 200 + 100 * sin(2 * M_PI * 0.25 * t / sampleRate);
+        phase += 2 * M_PI * pitch / sampleRate;
+        for (int c = 0; c < channels; c++) {
+            double noise = ((nextRandom(&seed) >> 16) & 0xffff) / 65536.0 - 0.5;
+            double value = 0;
+            for (int h = 1; h <= 4; h++) value += sin(h * phase + c) / h;
+            pcm[t * channels + c] = (short) (value * 12000 + noise * 2000);
+        }
+    }
+    return pcm;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "media_backend.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Deterministic synthetic inputs for the host benchmarks. Payload bytes come
+// from a fixed-seed generator so every run sees identical files.
+struct SyntheticVideoOptions {
+    int64_t durationUs = 60 * 1000000LL;
+    int fps = 30;
+    int gopLength = 30;
+    size_t keyFrameSize = 120 * 1024;
+    size_t frameSize = 12 * 1024;
+};
+
+struct SyntheticAudioOptions {
+    int sampleRate = 48000;
+    int channels = 2;
+    int framesPerSample = 1024;
+};
+
+// Writes a video track and, if audio is non-null, an interleaved audio/raw
+// PCM track to path. Returns 0 on success.
+int writeSyntheticMedia(MediaBackend& backend, const char* path,
+                        const SyntheticVideoOptions& video,
+                        const SyntheticAudioOptions* audio);
+
+// Voiced-like interleaved PCM: a harmonic tone gliding between 100 and
+// 300 Hz plus fixed-seed noise, phase-shifted per channel
+std::vector<short> makeSyntheticPcm(size_t frames, int sampleRate, int channels);
@@ -0,0 +1,357 @@
+#include "codec_pool.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Everything the pipeline sets on an audio codec; two formats with the same
+// key configure a codec the same way
+static std::string formatKey(const MediaFormat& format, bool encoder) {
+    std::string key = encoder ? "enc" : "dec";
+    std::string text;
+    if (format.getString(MEDIA_KEY_MIME, &text)) key += "|" + text;
+    for (const char* name : {MEDIA_KEY_SAMPLE_RATE, MEDIA_KEY_CHANNEL_COUNT, MEDIA_KEY_BIT_RATE,
+                             MEDIA_KEY_AAC_PROFILE, MEDIA_KEY_MAX_INPUT_SIZE}) {
+        int32_t value;
+        key += format.getInt32(name, &value) ? "|" + std::to_string(value) : "|-";
+    }
+    std::vector<uint8_t> csd;
+    if (format.getBuffer(MEDIA_KEY_CSD_0, &csd)) {
+        key += "|";
+        for (uint8_t byte : csd) {
+            char hex[3];
+            snprintf(hex, sizeof(hex), "%02x", byte);
+            key += hex;
+        }
+    }
+    return key;
+}
+
+// A leased codec. Lifecycle calls are mapped onto the warm instance; buffer
+// calls go straight through.
+class PooledCodec : public MediaCodec {
+public:
+    PooledCodec(CodecPool& pool, std::unique_ptr<CodecPool::Entry> entry) : pool(pool), entry(std::move(entry)) {}
+
+    ~PooledCodec() override {
+        bool reusable = !surface && !broken && (entry->callbackMode || entry->started);
+        pool.giveBack(std::move(entry), reusable);
+    }
+
+    int setCallbacks(const CodecCallbacks& callbacks) override {
+        // A warm polling codec goes back for the next polling lease
+        if (!entry->callbackMode && !entry->configKey.empty() && switchMode(true) != MEDIA_OK) return MEDIA_ERROR;
+        // Callbacks are only replaced on a stopped codec, which then needs configuring again
+        if (entry->started || !entry->configKey.empty()) {
+            entry->codec->stop();
+            entry->configKey.clear();
+            entry->started = false;
+        }
+        entry->callbackMode = true;
+        callbacksSet = true;
+        return check(entry->codec->setCallbacks(callbacks));
+    }
+
+    int configure(const MediaFormat& format, bool encoder) override {
+        if (entry->callbackMode && !callbacksSet && switchMode(false) != MEDIA_OK) return MEDIA_ERROR;
+        std::string key = formatKey(format, encoder);
+        if (entry->started && key == entry->configKey) return MEDIA_OK;
+        if (!entry->configKey.empty()) {
+            entry->codec->stop();
+            entry->started = false;
+            pool.countReconfigure();
+        }
+        entry->configKey.clear();
+        int status = check(entry->codec->configure(format, encoder));
+        if (status == MEDIA_OK) entry->configKey = key;
+        return status;
+    }
+
+    int configureSurface(const MediaFormat& format, void* displaySurface) override {
+        if (entry->callbackMode && !callbacksSet && switchMode(false) != MEDIA_OK) return MEDIA_ERROR;
+        surface = true;
+        if (!entry->configKey.empty()) entry->codec->stop();
+        entry->configKey.clear();
+        entry->started = false;
+        return check(entry->codec->configureSurface(format, displaySurface));
+    }
+
+    int start() override {
+        // A warm codec only needs its buffers back
+        if (entry->started) return check(entry->codec->flush());
+        int status = check(entry->codec->start());
+        entry->started = status == MEDIA_OK;
+        return status;
+    }
+
+    int stop() override {
+        // Callback and surface modes are not kept started, so they stop for real
+        if (entry->callbackMode || surface || !entry->started) {
+            entry->configKey.clear();
+            entry->started = false;
+            return entry->codec->stop();
+        }
+        return check(entry->codec->flush());
+    }
+
+    int flush() override { return check(entry->codec->flush()); }
+
+    ssize_t dequeueInputBuffer(int64_t timeoutUs) override { return entry->codec->dequeueInputBuffer(timeoutUs); }
+    uint8_t* getInputBuffer(size_t index, size_t* size) override { return entry->codec->getInputBuffer(index, size); }
+    int queueInputBuffer(size_t index, size_t offset, size_t size,
+                         int64_t presentationTimeUs, uint32_t flags) override {
+        return check(entry->codec->queueInputBuffer(index, offset, size, presentationTimeUs, flags));
+    }
+
+    ssize_t dequeueOutputBuffer(SampleInfo* info, int64_t timeoutUs) override {
+        return entry->codec->dequeueOutputBuffer(info, timeoutUs);
+    }
+    uint8_t* getOutputBuffer(size_t index, size_t* size) override {
+        return entry->codec->getOutputBuffer(index, size);
+    }
+    int releaseOutputBuffer(size_t index, bool render) override {
+        return check(entry->codec->releaseOutputBuffer(index, render));
+    }
+    int releaseOutputBufferAtTime(size_t index, int64_t renderTimeNs) override {
+        return check(entry->codec->releaseOutputBufferAtTime(index, renderTimeNs));
+    }
+    std::unique_ptr<MediaFormat> getOutputFormat() override { return entry->codec->getOutputFormat(); }
+
+private:
+    // Hands the codec back and continues on one of the other mode, pooled or new
+    int switchMode(bool callbackMode) {
+        std::unique_ptr<CodecPool::Entry> other = pool.take(entry->mime, entry->encoder, callbackMode, false);
+        if (!other) return fail(MEDIA_ERROR);
+        bool reusable = !surface && !broken && (entry->callbackMode || entry->started);
+        pool.giveBack(std::move(entry), reusable);
+        entry = std::move(other);
+        return MEDIA_OK;
+    }
+
+    // A failed call leaves the codec in a state not worth handing out again
+    int check(int status) {
+        if (status != MEDIA_OK) broken = true;
+        return status;
+    }
+
+    int fail(int status) {
+        broken = true;
+        return status;
+    }
+
+    CodecPool& pool;
+    std::unique_ptr<CodecPool::Entry> entry;
+    bool surface = false;
+    bool broken = false;
+    // Whether this lease set callbacks, as opposed to a previous one
+    bool callbacksSet = false;
+};
+
+CodecPool::CodecPool(MediaBackend& backend, size_t maxDecoders, size_t maxEncoders, int64_t idleTimeoutUs)
+        : backend(backend), maxInstances{maxDecoders, maxEncoders}, idleTimeoutNs(idleTimeoutUs * 1000) {
+    reaper = std::thread(&CodecPool::reaperLoop, this);
+}
+
+CodecPool::~CodecPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    reaper.join();
+    trim();
+}
+
+void CodecPool::setLimits(size_t maxDecoders, size_t maxEncoders, int64_t idleTimeoutUs) {
+    std::vector<std::unique_ptr<Entry>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxInstances[0] = maxDecoders;
+        maxInstances[1] = maxEncoders;
+        idleTimeoutNs = idleTimeoutUs * 1000;
+        // Oldest idle codecs go first until both kinds fit again
+        for (auto it = idle.begin(); it != idle.end();) {
+            bool kind = (*it)->encoder;
+            if (liveCount[kind] > maxInstances[kind]) {
+                liveCount[kind]--;
+                totals.evicted++;
+                evicted.push_back(std::move(*it));
+                it = idle.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    changed.notify_all();
+    release(evicted);
+}
+
+void CodecPool::trim() {
+    std::vector<std::unique_ptr<Entry>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        takeExpired(0, true, &evicted);
+    }
+    release(evicted);
+}
+
+CodecPool::Stats CodecPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals;
+}
+
+size_t CodecPool::idleCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+}
+
+std::unique_ptr<MediaCodec> CodecPool::lease(const char* mime, bool encoder) {
+    std::string type = mime;
+    if (type.compare(0, 6, "audio/") != 0) {
+        return encoder ? backend.createEncoder(mime) : backend.createDecoder(mime);
+    }
+
+    // Whether the caller will set callbacks is not known yet: a warm codec of
+    // either mode is better than a new one, and is swapped once it turns out wrong
+    std::unique_ptr<Entry> entry = take(type, encoder, false, true);
+    if (!entry) return nullptr;
+    return std::make_unique<PooledCodec>(*this, std::move(entry));
+}
+
+std::unique_ptr<CodecPool::Entry> CodecPool::take(const std::string& mime, bool encoder, bool callbackMode,
+                                                   bool eitherMode) {
+    std::vector<std::unique_ptr<Entry>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int pass = 0; pass < (eitherMode ? 2 : 1); pass++) {
+            bool mode = pass == 0 ? callbackMode : !callbackMode;
+            for (auto it = idle.rbegin(); it != idle.rend(); ++it) {
+                if ((*it)->mime != mime || (*it)->encoder != encoder || (*it)->callbackMode != mode) continue;
+                std::unique_ptr<Entry> entry = std::move(*it);
+                idle.erase(std::next(it).base());
+                totals.reused++;
+                return entry;
+            }
+        }
+        // Make room by dropping the oldest idle codec of the same kind
+        if (liveCount[encoder] >= maxInstances[encoder]) {
+            auto oldest = std::find_if(idle.begin(), idle.end(),
+                                       [encoder](const std::unique_ptr<Entry>& entry) {
+                                           return entry->encoder == encoder;
+                                       });
+            if (oldest != idle.end()) {
+                liveCount[encoder]--;
+                totals.evicted++;
+                evicted.push_back(std::move(*oldest));
+                idle.erase(oldest);
+            }
+        }
+        liveCount[encoder]++;
+    }
+    release(evicted);
+
+    // Created unlocked: this is the slow part the pool is there to avoid
+    std::unique_ptr<Entry> entry(new Entry());
+    entry->codec = create(mime, encoder);
+    if (!entry->codec) {
+        std::lock_guard<std::mutex> lock(mutex);
+        liveCount[encoder]--;
+        return nullptr;
+    }
+    entry->mime = mime;
+    entry->encoder = encoder;
+    return entry;
+}
+
+std::unique_ptr<MediaCodec> CodecPool::create(const std::string& mime, bool encoder) {
+    std::unique_ptr<MediaCodec> codec = encoder ? backend.createEncoder(mime.c_str())
+                                                : backend.createDecoder(mime.c_str());
+    if (codec) {
+        std::lock_guard<std::mutex> lock(mutex);
+        totals.created++;
+    }
+    return codec;
+}
+
+void CodecPool::giveBack(std::unique_ptr<Entry> entry, bool reusable) {
+    // Back to a clean started state, without any buffers of the last user. A
+    // callback-mode codec is stopped instead, so none of its callbacks outlive the lease.
+    if (reusable && entry->callbackMode) {
+        if (entry->started && entry->codec->stop() != MEDIA_OK) reusable = false;
+        entry->configKey.clear();
+        entry->started = false;
+    } else if (reusable && entry->codec->flush() != MEDIA_OK) {
+        reusable = false;
+    }
+
+    std::vector<std::unique_ptr<Entry>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bool kind = entry->encoder;
+        if (reusable && !stopping && liveCount[kind] <= maxInstances[kind]) {
+            entry->idleSinceNs = nowNs();
+            idle.push_back(std::move(entry));
+        } else {
+            liveCount[kind]--;
+            evicted.push_back(std::move(entry));
+        }
+    }
+    changed.notify_all();
+    release(evicted);
+}
+
+void CodecPool::countReconfigure() {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals.reconfigured++;
+}
+
+void CodecPool::takeExpired(int64_t now, bool all, std::vector<std::unique_ptr<Entry>>* expired) {
+    for (auto it = idle.begin(); it != idle.end();) {
+        if (all || now - (*it)->idleSinceNs >= idleTimeoutNs) {
+            liveCount[(*it)->encoder]--;
+            totals.evicted++;
+            expired->push_back(std::move(*it));
+            it = idle.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CodecPool::release(std::vector<std::unique_ptr<Entry>>& entries) {
+    for (std::unique_ptr<Entry>& entry : entries) {
+        if (entry->started) entry->codec->stop();
+        LOGV("Released pooled %s %s", entry->mime.c_str(), entry->encoder ? "encoder" : "decoder");
+    }
+    entries.clear();
+}
+
+// Sleeps until the oldest idle codec times out, then releases what has
+void CodecPool::reaperLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (idle.empty()) {
+            changed.wait(lock);
+            continue;
+        }
+        int64_t oldest = idle.front()->idleSinceNs;
+        for (const std::unique_ptr<Entry>& entry : idle) oldest = std::min(oldest, entry->idleSinceNs);
+        int64_t waitNs = oldest + idleTimeoutNs - nowNs();
+        if (waitNs > 0) {
+            changed.wait_for(lock, std::chrono::nanoseconds(waitNs));
+            continue;
+        }
+
+        std::vector<std::unique_ptr<Entry>> expired;
+        takeExpired(nowNs(), false, &expired);
+        lock.unlock();
+        release(expired);
+        lock.lock();
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "media_backend.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps audio codecs warm between exports. Decorates another backend so audio
+// decoders and encoders are leased from a pool instead of created, and go back
+// into it, still configured and started, when the caller drops them. A later
+// lease of the same mime and kind reuses one: configure() with the format it
+// already has is skipped and start() becomes a flush, while a different
+// format stops and reconfigures it, which still saves the creation. Video
+// codecs, extractors and muxers are passed through.
+//
+// A lease only goes back into the pool in a state the pool can hand out
+// again: not rendering to a surface, and without a failed call. Callback mode
+// cannot be switched off again, so codecs switched to it are pooled apart,
+// stopped. A lease starts on a warm codec of either mode and swaps it for one
+// of the other mode, pooled or new, when the caller turns out to want that:
+// callbacks set on a started polling codec, or a polling configure on a
+// callback-mode one. A callback-mode codec is given the new callbacks and is
+// configured and started again, which still saves the creation.
+//
+// Instances are capped per kind at what the device can run side by side.
+// Leases past the cap are still created, since whether that works is up to
+// the codec, but are released instead of pooled when they are dropped. Idle
+// codecs are released after idleTimeoutUs.
+class CodecPool : public MediaBackend {
+public:
+    struct Stats {
+        int64_t created = 0;
+        int64_t reused = 0;
+        int64_t reconfigured = 0;
+        int64_t evicted = 0;
+    };
+
+    explicit CodecPool(MediaBackend& backend, size_t maxDecoders = 4, size_t maxEncoders = 2,
+                       int64_t idleTimeoutUs = 30000000);
+    // Releases the idle codecs; every lease must have been dropped before
+    ~CodecPool() override;
+
+    void setLimits(size_t maxDecoders, size_t maxEncoders, int64_t idleTimeoutUs);
+    // Releases every idle codec now, e.g. when the system is low on memory
+    void trim();
+
+    Stats stats() const;
+    size_t idleCount() const;
+
+    const char* name() const override { return backend.name(); }
+    std::unique_ptr<MediaFormat> createFormat() override { return backend.createFormat(); }
+    std::unique_ptr<MediaExtractor> createExtractor(const char* path) override {
+        return backend.createExtractor(path);
+    }
+    std::unique_ptr<MediaCodec> createDecoder(const char* mime) override { return lease(mime, false); }
+    std::unique_ptr<MediaCodec> createEncoder(const char* mime) override { return lease(mime, true); }
+    std::unique_ptr<MediaMuxer> createMuxer(const char* path) override { return backend.createMuxer(path); }
+
+private:
+    friend class PooledCodec;
+
+    // One codec instance with the state it was left in
+    struct Entry {
+        std::unique_ptr<MediaCodec> codec;
+        std::string mime;
+        bool encoder;
+        // Format the codec is configured with, empty while it is not
+        std::string configKey;
+        bool started = false;
+        // Set once callbacks are; only callback-mode leases get it back
+        bool callbackMode = false;
+        int64_t idleSinceNs = 0;
+    };
+
+    std::unique_ptr<MediaCodec> lease(const char* mime, bool encoder);
+    // An idle entry of the mode (or with eitherMode, of the other one when none
+    // is idle), else a new unconfigured one; nullptr if creation fails
+    std::unique_ptr<Entry> take(const std::string& mime, bool encoder, bool callbackMode, bool eitherMode);
+    std::unique_ptr<MediaCodec> create(const std::string& mime, bool encoder);
+    void giveBack(std::unique_ptr<Entry> entry, bool reusable);
+    void countReconfigure();
+    // Removes idle entries past their timeout, or all of them, for release outside the lock
+    void takeExpired(int64_t nowNs, bool all, std::vector<std::unique_ptr<Entry>>* expired);
+    void release(std::vector<std::unique_ptr<Entry>>& entries);
+    void reaperLoop();
+
+    MediaBackend& backend;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    size_t maxInstances[2];
+    int64_t idleTimeoutNs;
+    // Live instances per kind, leased and idle, indexed by encoder
+    size_t liveCount[2] = {0, 0};
+    // Most recently returned last
+    std::vector<std::unique_ptr<Entry>> idle;
+    Stats totals;
+    bool stopping = false;
+    std::thread reaper;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+// Logging shared by the JNI entry points, the pipeline core and the backends.
+// On device this goes to logcat, the host build writes to stderr.
+#ifdef __ANDROID__
+#include <android/log.h>
+
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, "VideoSpeed", __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "VideoSpeed", __VA_ARGS__)
+#else
+#include <cstdio>
+
+#define LOGI(...) do { fprintf(stderr, "I/VideoSpeed: " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define LOGE(...) do { fprintf(stderr, "E/VideoSpeed: " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#endif
+
+// Per-sample progress logging from inside the processing loops. Compiled out
+// unless VIDEO_SPEED_VERBOSE_LOGS is defined, so release builds pay nothing.
+#ifdef VIDEO_SPEED_VERBOSE_LOGS
+#define LOGV(...) LOGI(__VA_ARGS__)
+#else
+#define LOGV(...) do { } while (0)
+#endif
@@ -0,0 +1,923 @@
+#include "fragmented_mp4_muxer.h"
+#include "editor_log.h"
+#include "nal_units.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const uint32_t VIDEO_TIMESCALE = 90000;
+// Video samples whose PTS are sorted to give decode times; deeper than any
+// B-frame pyramid encoders emit
+static const size_t VIDEO_REORDER_WINDOW = 16;
+// A fragment is cut early, off a keyframe if need be, once this much is buffered
+static const size_t MAX_FRAGMENT_BYTES = 64 * 1024 * 1024;
+// Read size of the faststart copy
+static const size_t COPY_CHUNK_SIZE = 1024 * 1024;
+
+static const uint32_t SAMPLE_FLAGS_SYNC = 0x02000000;
+static const uint32_t SAMPLE_FLAGS_NON_SYNC = 0x01010000;
+// trun: data offset, then per sample duration, size, flags and composition offset
+static const uint32_t TRUN_FLAGS = 0x000001 | 0x000100 | 0x000200 | 0x000400 | 0x000800;
+static const uint32_t TFHD_DEFAULT_BASE_IS_MOOF = 0x020000;
+
+static const uint8_t UNITY_MATRIX[36] = {
+        0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0, 0, 0,
+};
+
+static const int AAC_SAMPLE_RATES[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                       22050, 16000, 12000, 11025, 8000, 7350};
+
+namespace {
+
+// Appends big-endian fields and boxes to a byte vector; begin() returns the
+// position end() patches the box size into
+class BoxWriter {
+public:
+    explicit BoxWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void u8(uint32_t v) { out.push_back((uint8_t) v); }
+    void u16(uint32_t v) { u8(v >> 8); u8(v); }
+    void u24(uint32_t v) { u8(v >> 16); u16(v); }
+    void u32(uint32_t v) { u16(v >> 16); u16(v); }
+    void u64(uint64_t v) { u32((uint32_t) (v >> 32)); u32((uint32_t) v); }
+    void bytes(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), p, p + size);
+    }
+    void zeros(size_t count) { out.insert(out.end(), count, 0); }
+    void type(const char* fourcc) { bytes(fourcc, 4); }
+
+    size_t begin(const char* fourcc) {
+        size_t at = out.size();
+        u32(0);
+        type(fourcc);
+        return at;
+    }
+
+    size_t beginFull(const char* fourcc, uint8_t version, uint32_t flags) {
+        size_t at = begin(fourcc);
+        u32((uint32_t) version << 24 | flags);
+        return at;
+    }
+
+    void end(size_t at) { patch32(at, (uint32_t) (out.size() - at)); }
+
+    void patch32(size_t at, uint32_t v) {
+        for (int i = 0; i < 4; i++) out[at + i] = (uint8_t) (v >> (24 - 8 * i));
+    }
+
+    size_t size() const { return out.size(); }
+
+private:
+    std::vector<uint8_t>& out;
+};
+
+// Exp-Golomb reader over an RBSP, for the few SPS fields hvcC repeats
+class BitReader {
+public:
+    explicit BitReader(const std::vector<uint8_t>& data) : data(data) {}
+
+    uint32_t bits(int count) {
+        uint32_t value = 0;
+        for (int i = 0; i < count; i++) {
+            size_t byte = position / 8;
+            uint32_t bit = byte < data.size() ? (data[byte] >> (7 - position % 8)) & 1 : 0;
+            value = value << 1 | bit;
+            position++;
+        }
+        return value;
+    }
+
+    void skip(size_t count) { position += count; }
+
+    uint32_t ue() {
+        int zeros = 0;
+        while (bits(1) == 0 && zeros < 32) zeros++;
+        return zeros ? ((1u << zeros) - 1 + bits(zeros)) : 0;
+    }
+
+    bool overrun() const { return position > data.size() * 8; }
+
+private:
+    const std::vector<uint8_t>& data;
+    size_t position = 0;
+};
+
+struct HevcSpsInfo {
+    // general_profile_space .. general_level_idc, as stored
+    uint8_t profileTierLevel[12] = {};
+    uint32_t chromaFormat = 1;
+    uint32_t bitDepthLumaMinus8 = 0;
+    uint32_t bitDepthChromaMinus8 = 0;
+    uint32_t temporalLayers = 1;
+    bool temporalIdNested = false;
+};
+
+// Drops emulation prevention bytes, skipping the NAL header
+std::vector<uint8_t> unescapeRbsp(const uint8_t* nal, size_t size, size_t headerSize) {
+    std::vector<uint8_t> rbsp;
+    int zeros = 0;
+    for (size_t i = headerSize; i < size; i++) {
+        if (zeros >= 2 && nal[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+        rbsp.push_back(nal[i]);
+    }
+    return rbsp;
+}
+
+bool parseHevcSps(const uint8_t* nal, size_t size, HevcSpsInfo* info) {
+    std::vector<uint8_t> rbsp = unescapeRbsp(nal, size, 2);
+    if (rbsp.size() < 13) return false;
+    BitReader reader(rbsp);
+    reader.skip(4);
+    uint32_t maxSubLayersMinus1 = reader.bits(3);
+    info->temporalIdNested = reader.bits(1);
+    info->temporalLayers = maxSubLayersMinus1 + 1;
+    memcpy(info->profileTierLevel, rbsp.data() + 1, sizeof(info->profileTierLevel));
+    reader.skip(96);
+
+    bool profilePresent[8], levelPresent[8];
+    for (uint32_t i = 0; i < maxSubLayersMinus1; i++) {
+        profilePresent[i] = reader.bits(1);
+        levelPresent[i] = reader.bits(1);
+    }
+    if (maxSubLayersMinus1 > 0) reader.skip(2 * (8 - maxSubLayersMinus1));
+    for (uint32_t i = 0; i < maxSubLayersMinus1; i++) {
+        if (profilePresent[i]) reader.skip(88);
+        if (levelPresent[i]) reader.skip(8);
+    }
+
+    reader.ue();
+    info->chromaFormat = reader.ue();
+    if (info->chromaFormat == 3) reader.skip(1);
+    reader.ue();
+    reader.ue();
+    if (reader.bits(1)) {
+        for (int i = 0; i < 4; i++) reader.ue();
+    }
+    info->bitDepthLumaMinus8 = reader.ue();
+    info->bitDepthChromaMinus8 = reader.ue();
+    return !reader.overrun();
+}
+
+// The Annex-B NAL units of one or more codec-specific data buffers
+std::vector<std::pair<const uint8_t*, size_t>> parameterSets(const std::vector<const std::vector<uint8_t>*>& csds) {
+    std::vector<std::pair<const uint8_t*, size_t>> units;
+    for (const std::vector<uint8_t>* csd : csds) {
+        size_t pos = 0;
+        const uint8_t* nal;
+        size_t nalSize;
+        while (nextNalUnit(csd->data(), csd->size(), true, &pos, &nal, &nalSize)) {
+            if (nalSize > 0) units.push_back({nal, nalSize});
+        }
+    }
+    return units;
+}
+
+void writeAvcConfig(BoxWriter& w, const MediaFormat& format) {
+    std::vector<uint8_t> csd0, csd1;
+    format.getBuffer(MEDIA_KEY_CSD_0, &csd0);
+    format.getBuffer(MEDIA_KEY_CSD_1, &csd1);
+    std::vector<std::pair<const uint8_t*, size_t>> sps, pps;
+    for (const auto& unit : parameterSets({&csd0, &csd1})) {
+        int type = unit.first[0] & 0x1f;
+        if (type == 7) sps.push_back(unit);
+        if (type == 8) pps.push_back(unit);
+    }
+
+    size_t at = w.begin("avcC");
+    w.u8(1);
+    if (!sps.empty() && sps[0].second >= 4) {
+        w.bytes(sps[0].first + 1, 3);
+    } else {
+        w.zeros(3);
+    }
+    // 4-byte NAL lengths
+    w.u8(0xfc | 3);
+    w.u8(0xe0 | (uint32_t) sps.size());
+    for (const auto& unit : sps) {
+        w.u16((uint32_t) unit.second);
+        w.bytes(unit.first, unit.second);
+    }
+    w.u8((uint32_t) pps.size());
+    for (const auto& unit : pps) {
+        w.u16((uint32_t) unit.second);
+        w.bytes(unit.first, unit.second);
+    }
+    w.end(at);
+}
+
+// completenessAt receives where each array's array_completeness bit sits in out
+void writeHevcConfig(BoxWriter& w, const MediaFormat& format, std::vector<size_t>* completenessAt) {
+    std::vector<uint8_t> csd0;
+    format.getBuffer(MEDIA_KEY_CSD_0, &csd0);
+    std::vector<std::pair<const uint8_t*, size_t>> units = parameterSets({&csd0});
+    HevcSpsInfo sps;
+    for (const auto& unit : units) {
+        if (unit.second > 2 && ((unit.first[0] >> 1) & 0x3f) == 33 && parseHevcSps(unit.first, unit.second, &sps)) {
+            break;
+        }
+    }
+
+    size_t at = w.begin("hvcC");
+    w.u8(1);
+    w.bytes(sps.profileTierLevel, sizeof(sps.profileTierLevel));
+    w.u16(0xf000);
+    w.u8(0xfc);
+    w.u8(0xfc | sps.chromaFormat);
+    w.u8(0xf8 | sps.bitDepthLumaMinus8);
+    w.u8(0xf8 | sps.bitDepthChromaMinus8);
+    w.u16(0);
+    w.u8(sps.temporalLayers << 3 | (sps.temporalIdNested ? 4 : 0) | 3);
+
+    // One array per parameter set type, VPS, SPS then PPS
+    const int types[] = {32, 33, 34};
+    size_t arrays = 0;
+    for (int type : types) {
+        arrays += std::any_of(units.begin(), units.end(),
+                              [&](const auto& unit) { return ((unit.first[0] >> 1) & 0x3f) == type; });
+    }
+    w.u8((uint32_t) arrays);
+    for (int type : types) {
+        size_t count = std::count_if(units.begin(), units.end(),
+                                     [&](const auto& unit) { return ((unit.first[0] >> 1) & 0x3f) == type; });
+        if (!count) continue;
+        completenessAt->push_back(w.size());
+        w.u8(0x80 | type);
+        w.u16((uint32_t) count);
+        for (const auto& unit : units) {
+            if (((unit.first[0] >> 1) & 0x3f) != type) continue;
+            w.u16((uint32_t) unit.second);
+            w.bytes(unit.first, unit.second);
+        }
+    }
+    w.end(at);
+}
+
+// Descriptor lengths always take the 4-byte form, so they can be written up front
+void writeDescriptor(BoxWriter& w, uint8_t tag, size_t length) {
+    w.u8(tag);
+    w.u8(0x80 | (uint32_t) (length >> 21));
+    w.u8(0x80 | (uint32_t) ((length >> 14) & 0x7f));
+    w.u8(0x80 | (uint32_t) ((length >> 7) & 0x7f));
+    w.u8((uint32_t) (length & 0x7f));
+}
+
+void writeEsds(BoxWriter& w, const MediaFormat& format, int32_t sampleRate, int32_t channels) {
+    std::vector<uint8_t> config;
+    if (!format.getBuffer(MEDIA_KEY_CSD_0, &config) || config.empty()) {
+        // AudioSpecificConfig from the format: object type, rate index, channels
+        int32_t profile = 2;
+        format.getInt32(MEDIA_KEY_AAC_PROFILE, &profile);
+        int rateIndex = 15;
+        for (size_t i = 0; i < sizeof(AAC_SAMPLE_RATES) / sizeof(AAC_SAMPLE_RATES[0]); i++) {
+            if (AAC_SAMPLE_RATES[i] == sampleRate) rateIndex = (int) i;
+        }
+        config = {(uint8_t) (profile << 3 | rateIndex >> 1), (uint8_t) ((rateIndex & 1) << 7 | channels << 3)};
+    }
+    int32_t bitRate = 0;
+    format.getInt32(MEDIA_KEY_BIT_RATE, &bitRate);
+
+    size_t at = w.beginFull("esds", 0, 0);
+    size_t decoderConfig = 13 + 5 + config.size();
+    writeDescriptor(w, 0x03, 3 + 5 + decoderConfig + 5 + 1);
+    w.u16(0);
+    w.u8(0);
+    writeDescriptor(w, 0x04, decoderConfig);
+    // MPEG-4 audio, audio stream
+    w.u8(0x40);
+    w.u8(0x15);
+    w.u24(0);
+    w.u32((uint32_t) bitRate);
+    w.u32((uint32_t) bitRate);
+    writeDescriptor(w, 0x05, config.size());
+    w.bytes(config.data(), config.size());
+    writeDescriptor(w, 0x06, 1);
+    w.u8(2);
+    w.end(at);
+}
+
+void writeStts(BoxWriter& w, const std::vector<uint32_t>& durations) {
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    for (uint32_t duration : durations) {
+        if (!runs.empty() && runs.back().second == duration) {
+            runs.back().first++;
+        } else {
+            runs.push_back({1, duration});
+        }
+    }
+    size_t at = w.beginFull("stts", 0, 0);
+    w.u32((uint32_t) runs.size());
+    for (const auto& run : runs) {
+        w.u32(run.first);
+        w.u32(run.second);
+    }
+    w.end(at);
+}
+
+} // namespace
+
+FragmentedMp4Muxer::~FragmentedMp4Muxer() {
+    if (fd >= 0) close(fd);
+}
+
+std::unique_ptr<FragmentedMp4Muxer> FragmentedMp4Muxer::create(const char* path, int64_t fragmentDurationUs,
+                                                               bool faststart) {
+    // Read back by the faststart rewrite
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE("Cannot open output file: %s, error: %s", path, strerror(errno));
+        return nullptr;
+    }
+    return std::unique_ptr<FragmentedMp4Muxer>(new FragmentedMp4Muxer(fd, path, fragmentDurationUs, faststart));
+}
+
+ssize_t FragmentedMp4Muxer::addTrack(const MediaFormat& format) {
+    if (started) return MEDIA_ERROR;
+    std::string mime;
+    format.getString(MEDIA_KEY_MIME, &mime);
+
+    Track track;
+    BoxWriter w(track.sampleEntry);
+    if (mime == "video/avc" || mime == "video/hevc") {
+        int32_t frameRate = 30;
+        format.getInt32(MEDIA_KEY_WIDTH, &track.width);
+        format.getInt32(MEDIA_KEY_HEIGHT, &track.height);
+        format.getInt32(MEDIA_KEY_FRAME_RATE, &frameRate);
+        track.video = true;
+        track.hevc = mime == "video/hevc";
+        track.timescale = VIDEO_TIMESCALE;
+        track.reorderWindow = VIDEO_REORDER_WINDOW;
+        track.defaultDuration = VIDEO_TIMESCALE / (uint32_t) std::max(frameRate, 1);
+
+        size_t at = w.begin(mime == "video/avc" ? "avc1" : "hvc1");
+        w.zeros(6);
+        w.u16(1);
+        w.zeros(16);
+        w.u16((uint32_t) track.width);
+        w.u16((uint32_t) track.height);
+        // 72 dpi
+        w.u32(0x00480000);
+        w.u32(0x00480000);
+        w.u32(0);
+        w.u16(1);
+        w.zeros(32);
+        w.u16(0x18);
+        w.u16(0xffff);
+        if (mime == "video/avc") {
+            writeAvcConfig(w, format);
+        } else {
+            writeHevcConfig(w, format, &track.completenessAt);
+        }
+        w.end(at);
+    } else if (mime == "audio/mp4a-latm" || mime == "audio/raw") {
+        int32_t sampleRate = 0, channels = 0;
+        format.getInt32(MEDIA_KEY_SAMPLE_RATE, &sampleRate);
+        format.getInt32(MEDIA_KEY_CHANNEL_COUNT, &channels);
+        if (sampleRate <= 0 || channels <= 0) {
+            LOGE("Audio track without sample rate or channel count");
+            return MEDIA_ERROR;
+        }
+        track.video = false;
+        track.timescale = (uint32_t) sampleRate;
+        track.reorderWindow = 0;
+        track.defaultDuration = 1024;
+
+        size_t at = w.begin(mime == "audio/raw" ? "sowt" : "mp4a");
+        w.zeros(6);
+        w.u16(1);
+        w.zeros(8);
+        w.u16((uint32_t) channels);
+        w.u16(16);
+        w.u32(0);
+        // 16.16 fixed point; higher rates are only carried by the AudioSpecificConfig
+        w.u32(sampleRate < 65536 ? (uint32_t) sampleRate << 16 : 0);
+        if (mime == "audio/mp4a-latm") writeEsds(w, format, sampleRate, channels);
+        w.end(at);
+    } else {
+        LOGE("Fragmented MP4 output does not support %s", mime.c_str());
+        return MEDIA_ERROR;
+    }
+
+    if (anchorTrack < 0 || (track.video && !tracks[anchorTrack].video)) anchorTrack = (ssize_t) tracks.size();
+    tracks.push_back(std::move(track));
+    return (ssize_t) tracks.size() - 1;
+}
+
+int FragmentedMp4Muxer::start() {
+    if (started || tracks.empty()) return MEDIA_ERROR;
+    std::vector<uint8_t> head;
+    BoxWriter w(head);
+    size_t at = w.begin("ftyp");
+    w.type("iso6");
+    w.u32(0);
+    w.type("iso6");
+    w.type("isom");
+    w.type("mp41");
+    w.end(at);
+    std::vector<size_t> sampleEntryAt;
+    writeMoov(head, true, 0, false, &sampleEntryAt);
+    for (size_t i = 0; i < tracks.size(); i++) tracks[i].sampleEntryOffset = sampleEntryAt[i];
+
+    if (writeAt({{head.data(), head.size()}}) != MEDIA_OK) return MEDIA_ERROR;
+    started = true;
+    return MEDIA_OK;
+}
+
+void FragmentedMp4Muxer::appendSample(Track& track, const uint8_t* data, size_t size) {
+    if (!track.video) {
+        track.data.insert(track.data.end(), data, data + size);
+        return;
+    }
+    bool annexB = isAnnexB(data, size);
+    if (!annexB) {
+        track.data.insert(track.data.end(), data, data + size);
+        if (track.inBandParameterSets) return;
+    }
+    size_t pos = 0;
+    const uint8_t* nal;
+    size_t nalSize;
+    while (nextNalUnit(data, size, annexB, &pos, &nal, &nalSize)) {
+        if (nalSize == 0) continue;
+        if (!track.inBandParameterSets && isParameterSet(track, nal)) track.pendingEntryPatch = true;
+        if (!annexB) continue;
+        uint8_t length[4] = {(uint8_t) (nalSize >> 24), (uint8_t) (nalSize >> 16), (uint8_t) (nalSize >> 8),
+                             (uint8_t) nalSize};
+        track.data.insert(track.data.end(), length, length + 4);
+        track.data.insert(track.data.end(), nal, nal + nalSize);
+    }
+}
+
+bool FragmentedMp4Muxer::isParameterSet(const Track& track, const uint8_t* nal) {
+    if (track.hevc) {
+        int type = (nal[0] >> 1) & 0x3f;
+        return type >= 32 && type <= 34;
+    }
+    int type = nal[0] & 0x1f;
+    return type == 7 || type == 8;
+}
+
+// avc1 / hvc1 promise every parameter set is in the sample entry, which smart
+// cut breaks by putting the re-encoder's ahead of its keyframes. The moov went
+// out at start(), so the entry is switched to avc3 / hev1 in place; the
+// fourcc and the completeness bits keep its size.
+int FragmentedMp4Muxer::markInBandParameterSets(Track& track) {
+    track.pendingEntryPatch = false;
+    track.inBandParameterSets = true;
+    memcpy(track.sampleEntry.data() + 4, track.hevc ? "hev1" : "avc3", 4);
+    for (size_t at : track.completenessAt) track.sampleEntry[at] &= 0x7f;
+
+    if (pwrite(fd, track.sampleEntry.data(), track.sampleEntry.size(), (off_t) track.sampleEntryOffset) !=
+        (ssize_t) track.sampleEntry.size()) {
+        LOGE("Failed to update sample entry: %s", strerror(errno));
+        return MEDIA_ERROR;
+    }
+    LOGI("Samples carry parameter sets, sample entry is now %s", track.hevc ? "hev1" : "avc3");
+    return MEDIA_OK;
+}
+
+// Decode times are handed out in decode order and never go backwards
+void FragmentedMp4Muxer::assignDts(Track& track, int64_t pts) {
+    int64_t dts = track.lastDts == INT64_MIN ? pts : std::max(pts, track.lastDts + 1);
+    track.pending[track.assigned++].dts = dts;
+    track.lastDts = dts;
+}
+
+void FragmentedMp4Muxer::assignAll(Track& track) {
+    while (!track.unassignedPts.empty()) {
+        int64_t pts = track.unassignedPts.top();
+        track.unassignedPts.pop();
+        assignDts(track, pts);
+    }
+}
+
+int FragmentedMp4Muxer::writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) {
+    if (!started || track >= tracks.size()) return MEDIA_ERROR;
+    // Parameter sets are already in the sample entry
+    if (info.size <= 0 || (info.flags & BUFFER_FLAG_CODEC_CONFIG)) return MEDIA_OK;
+
+    Track& t = tracks[track];
+    bool sync = !t.video || (info.flags & BUFFER_FLAG_KEY_FRAME);
+    int64_t pts = (info.presentationTimeUs * t.timescale + 500000) / 1000000;
+    bool cut = (ssize_t) track == anchorTrack && sync && fragmentStartUs >= 0 &&
+               info.presentationTimeUs - fragmentStartUs >= fragmentDurationUs;
+    if (fragmentStartUs < 0) fragmentStartUs = info.presentationTimeUs;
+
+    // Nothing after a keyframe in decode order is shown before it, so the
+    // samples ahead of it can all be given their decode times
+    if (t.video && sync) assignAll(t);
+    size_t offset = t.data.size();
+    appendSample(t, data + info.offset, info.size);
+    if (t.pendingEntryPatch && markInBandParameterSets(t) != MEDIA_OK) return MEDIA_ERROR;
+    t.pending.push_back({offset, (uint32_t) (t.data.size() - offset), sync, pts, 0});
+    bufferedBytes += t.data.size() - offset;
+    if (t.video && sync) {
+        assignDts(t, pts);
+    } else {
+        t.unassignedPts.push(pts);
+        while (t.unassignedPts.size() > t.reorderWindow) {
+            int64_t next = t.unassignedPts.top();
+            t.unassignedPts.pop();
+            assignDts(t, next);
+        }
+    }
+
+    if (cut) {
+        fragmentStartUs = info.presentationTimeUs;
+        return flushFragment(false);
+    }
+    return bufferedBytes >= MAX_FRAGMENT_BYTES ? flushFragment(false) : MEDIA_OK;
+}
+
+int FragmentedMp4Muxer::flushFragment(bool final) {
+    // A sample's duration is known once the next one has a decode time
+    std::vector<size_t> counts(tracks.size());
+    size_t total = 0;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (final) assignAll(tracks[i]);
+        counts[i] = final ? tracks[i].pending.size() : tracks[i].assigned > 0 ? tracks[i].assigned - 1 : 0;
+        total += counts[i];
+    }
+    if (total == 0) return MEDIA_OK;
+
+    moof.clear();
+    BoxWriter w(moof);
+    size_t moofAt = w.begin("moof");
+    size_t mfhd = w.beginFull("mfhd", 0, 0);
+    w.u32(fragmentCount + 1);
+    w.end(mfhd);
+
+    std::vector<size_t> dataOffsetAt(tracks.size());
+    std::vector<size_t> bytes(tracks.size());
+    for (size_t i = 0; i < tracks.size(); i++) {
+        Track& t = tracks[i];
+        size_t count = counts[i];
+        if (!count) continue;
+        bytes[i] = count < t.pending.size() ? t.pending[count].offset : t.data.size();
+
+        size_t traf = w.begin("traf");
+        size_t tfhd = w.beginFull("tfhd", 0, TFHD_DEFAULT_BASE_IS_MOOF);
+        w.u32((uint32_t) i + 1);
+        w.end(tfhd);
+        size_t tfdt = w.beginFull("tfdt", 1, 0);
+        w.u64((uint64_t) std::max(t.pending[0].dts, (int64_t) 0));
+        w.end(tfdt);
+        size_t trun = w.beginFull("trun", 1, TRUN_FLAGS);
+        w.u32((uint32_t) count);
+        dataOffsetAt[i] = w.size();
+        w.u32(0);
+        for (size_t s = 0; s < count; s++) {
+            const PendingSample& sample = t.pending[s];
+            uint32_t duration = s + 1 < t.assigned ? (uint32_t) (t.pending[s + 1].dts - sample.dts)
+                                                   : t.lastDuration ? t.lastDuration : t.defaultDuration;
+            t.lastDuration = duration;
+            t.durationTicks += duration;
+            int32_t compositionOffset = (int32_t) (sample.pts - sample.dts);
+            w.u32(duration);
+            w.u32(sample.size);
+            w.u32(sample.sync ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+            w.u32((uint32_t) compositionOffset);
+            if (faststart) t.written.push_back({sample.size, duration, compositionOffset, sample.sync});
+        }
+        w.end(trun);
+        w.end(traf);
+    }
+    w.end(moofAt);
+
+    // Sample data offsets count from the start of moof
+    uint64_t mdatSize = 8;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (!counts[i]) continue;
+        w.patch32(dataOffsetAt[i], (uint32_t) (moof.size() + mdatSize));
+        runs.push_back({i, fileOffset + moof.size() + mdatSize, bytes[i], (uint32_t) counts[i]});
+        mdatSize += bytes[i];
+    }
+    uint8_t mdatHeader[8] = {(uint8_t) (mdatSize >> 24), (uint8_t) (mdatSize >> 16), (uint8_t) (mdatSize >> 8),
+                             (uint8_t) mdatSize, 'm', 'd', 'a', 't'};
+
+    std::vector<std::pair<const uint8_t*, size_t>> slices = {{moof.data(), moof.size()}, {mdatHeader, 8}};
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (counts[i]) slices.push_back({tracks[i].data.data(), bytes[i]});
+    }
+    if (writeAt(slices) != MEDIA_OK) return MEDIA_ERROR;
+
+    // Samples held back move to the front of their buffers
+    for (size_t i = 0; i < tracks.size(); i++) {
+        Track& t = tracks[i];
+        if (!counts[i]) continue;
+        t.data.erase(t.data.begin(), t.data.begin() + bytes[i]);
+        t.pending.erase(t.pending.begin(), t.pending.begin() + counts[i]);
+        for (PendingSample& sample : t.pending) sample.offset -= bytes[i];
+        t.assigned -= counts[i];
+        bufferedBytes -= bytes[i];
+    }
+    fragmentCount++;
+    return MEDIA_OK;
+}
+
+// Writes the slices at the end of the file with as few pwritev calls as possible
+int FragmentedMp4Muxer::writeAt(const std::vector<std::pair<const uint8_t*, size_t>>& slices) {
+    std::vector<iovec> iov;
+    for (const auto& slice : slices) {
+        if (slice.second) iov.push_back({const_cast<uint8_t*>(slice.first), slice.second});
+    }
+    size_t first = 0;
+    while (first < iov.size()) {
+        ssize_t written = pwritev(fd, &iov[first], (int) std::min(iov.size() - first, (size_t) IOV_MAX),
+                                  (off_t) fileOffset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            LOGE("Failed to write %s: %s", path.c_str(), strerror(errno));
+            return MEDIA_ERROR;
+        }
+        fileOffset += written;
+        // Drop what went out, which may end inside a slice
+        while (written > 0) {
+            if ((size_t) written >= iov[first].iov_len) {
+                written -= iov[first].iov_len;
+                first++;
+            } else {
+                iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + written;
+                iov[first].iov_len -= written;
+                written = 0;
+            }
+        }
+    }
+    return MEDIA_OK;
+}
+
+// The fragmented moov has empty sample tables and mvex; the faststart one has
+// every table, with chunk offsets for mdat payload starting at mdatOffset
+void FragmentedMp4Muxer::writeMoov(std::vector<uint8_t>& out, bool fragmented, uint64_t mdatOffset,
+                                   bool wideOffsets, std::vector<size_t>* sampleEntryAt) const {
+    BoxWriter w(out);
+    uint64_t movieDurationMs = 0;
+    for (const Track& t : tracks) {
+        if (!fragmented) movieDurationMs = std::max(movieDurationMs, (uint64_t) t.durationTicks * 1000 / t.timescale);
+    }
+
+    // New offset of every run once the runs are copied back to back
+    std::vector<uint64_t> runOffsets;
+    uint64_t position = mdatOffset;
+    for (const Run& run : runs) {
+        runOffsets.push_back(position);
+        position += run.size;
+    }
+
+    size_t moov = w.begin("moov");
+    size_t mvhd = w.beginFull("mvhd", 1, 0);
+    w.u64(0);
+    w.u64(0);
+    w.u32(1000);
+    w.u64(movieDurationMs);
+    w.u32(0x00010000);
+    w.u16(0x0100);
+    w.zeros(10);
+    w.bytes(UNITY_MATRIX, sizeof(UNITY_MATRIX));
+    w.zeros(24);
+    w.u32((uint32_t) tracks.size() + 1);
+    w.end(mvhd);
+
+    for (size_t i = 0; i < tracks.size(); i++) {
+        const Track& t = tracks[i];
+        uint64_t durationTicks = fragmented ? 0 : (uint64_t) t.durationTicks;
+
+        size_t trak = w.begin("trak");
+        // Enabled, in movie
+        size_t tkhd = w.beginFull("tkhd", 1, 3);
+        w.u64(0);
+        w.u64(0);
+        w.u32((uint32_t) i + 1);
+        w.u32(0);
+        w.u64(durationTicks * 1000 / t.timescale);
+        w.zeros(8);
+        w.u16(0);
+        w.u16(0);
+        w.u16(t.video ? 0 : 0x0100);
+        w.u16(0);
+        w.bytes(UNITY_MATRIX, sizeof(UNITY_MATRIX));
+        w.u32((uint32_t) t.width << 16);
+        w.u32((uint32_t) t.height << 16);
+        w.end(tkhd);
+
+        size_t mdia = w.begin("mdia");
+        size_t mdhd = w.beginFull("mdhd", 1, 0);
+        w.u64(0);
+        w.u64(0);
+        w.u32(t.timescale);
+        w.u64(durationTicks);
+        // 'und'
+        w.u16(0x55c4);
+        w.u16(0);
+        w.end(mdhd);
+        size_t hdlr = w.beginFull("hdlr", 0, 0);
+        w.u32(0);
+        w.type(t.video ? "vide" : "soun");
+        w.zeros(12);
+        const char* handlerName = t.video ? "VideoHandler" : "SoundHandler";
+        w.bytes(handlerName, strlen(handlerName) + 1);
+        w.end(hdlr);
+
+        size_t minf = w.begin("minf");
+        if (t.video) {
+            size_t vmhd = w.beginFull("vmhd", 0, 1);
+            w.zeros(8);
+            w.end(vmhd);
+        } else {
+            size_t smhd = w.beginFull("smhd", 0, 0);
+            w.zeros(4);
+            w.end(smhd);
+        }
+        size_t dinf = w.begin("dinf");
+        size_t dref = w.beginFull("dref", 0, 0);
+        w.u32(1);
+        // Self-contained
+        size_t url = w.beginFull("url ", 0, 1);
+        w.end(url);
+        w.end(dref);
+        w.end(dinf);
+
+        size_t stbl = w.begin("stbl");
+        size_t stsd = w.beginFull("stsd", 0, 0);
+        w.u32(1);
+        if (sampleEntryAt) sampleEntryAt->push_back(w.size());
+        w.bytes(t.sampleEntry.data(), t.sampleEntry.size());
+        w.end(stsd);
+
+        std::vector<uint32_t> durations;
+        bool anyOffset = false, negativeOffset = false, allSync = true;
+        for (const WrittenSample& s : t.written) {
+            durations.push_back(s.duration);
+            anyOffset |= s.compositionOffset != 0;
+            negativeOffset |= s.compositionOffset < 0;
+            allSync &= s.sync != 0;
+        }
+        if (fragmented) durations.clear();
+        writeStts(w, durations);
+
+        if (!fragmented && anyOffset) {
+            std::vector<std::pair<uint32_t, int32_t>> offsetRuns;
+            for (const WrittenSample& s : t.written) {
+                if (!offsetRuns.empty() && offsetRuns.back().second == s.compositionOffset) {
+                    offsetRuns.back().first++;
+                } else {
+                    offsetRuns.push_back({1, s.compositionOffset});
+                }
+            }
+            size_t ctts = w.beginFull("ctts", negativeOffset ? 1 : 0, 0);
+            w.u32((uint32_t) offsetRuns.size());
+            for (const auto& run : offsetRuns) {
+                w.u32(run.first);
+                w.u32((uint32_t) run.second);
+            }
+            w.end(ctts);
+        }
+
+        if (!fragmented && !allSync) {
+            std::vector<uint32_t> syncNumbers;
+            for (size_t s = 0; s < t.written.size(); s++) {
+                if (t.written[s].sync) syncNumbers.push_back((uint32_t) s + 1);
+            }
+            size_t stss = w.beginFull("stss", 0, 0);
+            w.u32((uint32_t) syncNumbers.size());
+            for (uint32_t number : syncNumbers) w.u32(number);
+            w.end(stss);
+        }
+
+        // One chunk per run of the track
+        std::vector<std::pair<uint32_t, uint32_t>> chunkRuns;
+        std::vector<uint64_t> chunkOffsets;
+        for (size_t r = 0; !fragmented && r < runs.size(); r++) {
+            if (runs[r].track != i) continue;
+            chunkOffsets.push_back(runOffsets[r]);
+            if (chunkRuns.empty() || chunkRuns.back().second != runs[r].samples) {
+                chunkRuns.push_back({(uint32_t) chunkOffsets.size(), runs[r].samples});
+            }
+        }
+        size_t stsc = w.beginFull("stsc", 0, 0);
+        w.u32((uint32_t) chunkRuns.size());
+        for (const auto& run : chunkRuns) {
+            w.u32(run.first);
+            w.u32(run.second);
+            w.u32(1);
+        }
+        w.end(stsc);
+
+        size_t stsz = w.beginFull("stsz", 0, 0);
+        w.u32(0);
+        w.u32(fragmented ? 0 : (uint32_t) t.written.size());
+        for (size_t s = 0; !fragmented && s < t.written.size(); s++) w.u32(t.written[s].size);
+        w.end(stsz);
+
+        size_t stco = w.beginFull(wideOffsets ? "co64" : "stco", 0, 0);
+        w.u32((uint32_t) chunkOffsets.size());
+        for (uint64_t offset : chunkOffsets) {
+            if (wideOffsets) {
+                w.u64(offset);
+            } else {
+                w.u32((uint32_t) offset);
+            }
+        }
+        w.end(stco);
+
+        w.end(stbl);
+        w.end(minf);
+        w.end(mdia);
+        w.end(trak);
+    }
+
+    if (fragmented) {
+        size_t mvex = w.begin("mvex");
+        for (size_t i = 0; i < tracks.size(); i++) {
+            size_t trex = w.beginFull("trex", 0, 0);
+            w.u32((uint32_t) i + 1);
+            w.u32(1);
+            w.zeros(12);
+            w.end(trex);
+        }
+        w.end(mvex);
+    }
+    w.end(moov);
+}
+
+// Copies every run into a new file behind a complete moov, then replaces the
+// fragmented file with it
+int FragmentedMp4Muxer::rewriteFaststart() {
+    uint64_t mdatPayload = 0;
+    for (const Run& run : runs) mdatPayload += run.size;
+
+    std::vector<uint8_t> head;
+    BoxWriter w(head);
+    size_t ftyp = w.begin("ftyp");
+    w.type("isom");
+    w.u32(0x200);
+    w.type("isom");
+    w.type("iso4");
+    w.type("mp41");
+    w.end(ftyp);
+    size_t ftypSize = head.size();
+
+    // Offsets change the values in moov, not its size, so it is laid out once to measure
+    size_t mdatHeaderSize = mdatPayload + 8 > UINT32_MAX ? 16 : 8;
+    std::vector<uint8_t> sized;
+    writeMoov(sized, false, 0, false);
+    bool wideOffsets = ftypSize + sized.size() + mdatHeaderSize + mdatPayload > UINT32_MAX;
+    if (wideOffsets) {
+        sized.clear();
+        writeMoov(sized, false, 0, true);
+    }
+    writeMoov(head, false, ftypSize + sized.size() + mdatHeaderSize, wideOffsets);
+    if (mdatHeaderSize == 16) {
+        w.u32(1);
+        w.type("mdat");
+        w.u64(mdatPayload + 16);
+    } else {
+        w.u32((uint32_t) (mdatPayload + 8));
+        w.type("mdat");
+    }
+
+    std::string temporary = path + ".tmp";
+    int out = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) return MEDIA_ERROR;
+    bool ok = write(out, head.data(), head.size()) == (ssize_t) head.size();
+    std::vector<uint8_t> buffer(COPY_CHUNK_SIZE);
+    for (size_t r = 0; ok && r < runs.size(); r++) {
+        for (uint64_t done = 0; ok && done < runs[r].size;) {
+            size_t chunk = (size_t) std::min((uint64_t) buffer.size(), runs[r].size - done);
+            ssize_t read = pread(fd, buffer.data(), chunk, (off_t) (runs[r].offset + done));
+            ok = read > 0 && write(out, buffer.data(), read) == read;
+            done += read > 0 ? read : 0;
+        }
+    }
+    ok = close(out) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return MEDIA_ERROR;
+    }
+    return MEDIA_OK;
+}
+
+int FragmentedMp4Muxer::stop() {
+    if (!started) return MEDIA_ERROR;
+    started = false;
+    int status = flushFragment(true);
+    LOGI("Fragmented MP4 %s: %u fragments, %llu bytes", path.c_str(), fragmentCount,
+         (unsigned long long) fileOffset);
+    // The fragmented file is complete and playable; a failed rewrite only loses faststart
+    if (status == MEDIA_OK && faststart && rewriteFaststart() != MEDIA_OK) {
+        LOGE("Faststart rewrite of %s failed, keeping the fragmented file", path.c_str());
+    }
+    close(fd);
+    fd = -1;
+    return status;
+}
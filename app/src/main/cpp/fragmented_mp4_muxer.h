@@ -0,0 +1,134 @@
+#pragma once
+
+#include "media_backend.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+// Streaming MP4 writer. ftyp and an empty moov go out at start(), then one
+// moof + mdat fragment at the first video keyframe after every
+// fragmentDurationUs, so the file is playable up to its last fragment while
+// it is still being written, and what is held in memory is one fragment's
+// samples, never the whole sample table. Each fragment goes out in a single
+// pwritev of moof, mdat header and one slice per track.
+//
+// Decode times are not part of SampleInfo: per track they are the sorted PTS
+// of a small reorder window, with signed composition offsets (trun v1), which
+// needs closed GOPs at fragment starts like every edit the pipeline makes.
+//
+// With faststart, stop() rewrites the fragments into a plain MP4 with moov
+// ahead of mdat, for players that do not handle fragments; this keeps 16
+// bytes per sample until then.
+//
+// Supports AVC, HEVC, AAC and audio/raw (16-bit little-endian PCM, as 'sowt').
+// Samples may be Annex-B or length-prefixed (MediaExtractor::sampleView()).
+// Video starts out as avc1 / hvc1 and turns into avc3 / hev1 at the first
+// parameter set found inside a sample.
+class FragmentedMp4Muxer : public MediaMuxer {
+public:
+    ~FragmentedMp4Muxer() override;
+
+    // Opens path for writing, nullptr on failure
+    static std::unique_ptr<FragmentedMp4Muxer> create(const char* path, int64_t fragmentDurationUs, bool faststart);
+
+    ssize_t addTrack(const MediaFormat& format) override;
+    int start() override;
+    int writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) override;
+    int stop() override;
+    bool acceptsSampleViews() const override { return true; }
+    bool acceptsInBandParameterSets() const override { return true; }
+
+    size_t fragmentsWritten() const { return fragmentCount; }
+
+private:
+    struct PendingSample {
+        // Into the track's data
+        size_t offset;
+        uint32_t size;
+        bool sync;
+        int64_t pts;
+        // In the track timescale; only valid for the first `assigned` samples
+        int64_t dts;
+    };
+
+    // Kept for the faststart rewrite
+    struct WrittenSample {
+        uint32_t size;
+        uint32_t duration;
+        int32_t compositionOffset;
+        uint32_t sync;
+    };
+
+    // One trun's samples, contiguous in the fragmented file
+    struct Run {
+        size_t track;
+        uint64_t offset;
+        uint64_t size;
+        uint32_t samples;
+    };
+
+    struct Track {
+        bool video;
+        uint32_t timescale;
+        bool hevc = false;
+        // The stsd entry, built once at addTrack(), and where it sits in the
+        // file's moov
+        std::vector<uint8_t> sampleEntry;
+        uint64_t sampleEntryOffset = 0;
+        // hvcC array headers within sampleEntry
+        std::vector<size_t> completenessAt;
+        // Parameter sets seen inside samples, and whether the file's sample
+        // entry still has to say so
+        bool inBandParameterSets = false;
+        bool pendingEntryPatch = false;
+        int32_t width = 0;
+        int32_t height = 0;
+        size_t reorderWindow;
+        // Used for the last sample, and for one alone in a track
+        uint32_t defaultDuration;
+
+        std::vector<uint8_t> data;
+        std::deque<PendingSample> pending;
+        size_t assigned = 0;
+        std::priority_queue<int64_t, std::vector<int64_t>, std::greater<int64_t>> unassignedPts;
+        int64_t lastDts = INT64_MIN;
+        uint32_t lastDuration = 0;
+        int64_t durationTicks = 0;
+        std::vector<WrittenSample> written;
+    };
+
+    FragmentedMp4Muxer(int fd, std::string path, int64_t fragmentDurationUs, bool faststart)
+            : fd(fd), path(std::move(path)), fragmentDurationUs(fragmentDurationUs), faststart(faststart) {}
+
+    // Appends data as length-prefixed NAL units for video, as is for audio
+    void appendSample(Track& track, const uint8_t* data, size_t size);
+    static bool isParameterSet(const Track& track, const uint8_t* nal);
+    int markInBandParameterSets(Track& track);
+    void assignDts(Track& track, int64_t pts);
+    void assignAll(Track& track);
+    // Writes every sample whose duration is known; with final, all of them
+    int flushFragment(bool final);
+    int writeAt(const std::vector<std::pair<const uint8_t*, size_t>>& slices);
+    void writeMoov(std::vector<uint8_t>& out, bool fragmented, uint64_t mdatOffset, bool wideOffsets,
+                   std::vector<size_t>* sampleEntryAt = nullptr) const;
+    int rewriteFaststart();
+
+    int fd;
+    std::string path;
+    int64_t fragmentDurationUs;
+    bool faststart;
+    std::vector<Track> tracks;
+    // Fragments are cut on this track's keyframes: the first video track, else the first
+    ssize_t anchorTrack = -1;
+    bool started = false;
+    int64_t fragmentStartUs = -1;
+    size_t bufferedBytes = 0;
+    uint64_t fileOffset = 0;
+    uint32_t fragmentCount = 0;
+    std::vector<Run> runs;
+    std::vector<uint8_t> moof;
+};
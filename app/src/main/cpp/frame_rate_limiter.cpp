@@ -0,0 +1,140 @@
+#include "frame_rate_limiter.h"
+#include "nal_units.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+
+// Kept frames closer than this fraction of the target interval count as too close
+static const int64_t SPACING_TOLERANCE_DIVISOR = 8;
+// Reference frames above cap * this over a GOP switch the next GOP to keyframes only
+static const int32_t KEYFRAME_ONLY_FACTOR = 2;
+static const size_t RECENT_KEPT_FRAMES = 16;
+
+VideoCodec videoCodecForMime(const std::string& mime) {
+    if (mime == "video/avc") return VideoCodec::Avc;
+    if (mime == "video/hevc") return VideoCodec::Hevc;
+    return VideoCodec::Other;
+}
+
+FrameDependency parseFrameDependency(VideoCodec codec, const uint8_t* data, size_t size) {
+    FrameDependency dependency = {false, 0};
+    if (codec == VideoCodec::Other || !data) return dependency;
+
+    bool annexB = isAnnexB(data, size);
+    bool sawSlice = false;
+    bool allDisposable = true;
+    size_t pos = 0;
+    const uint8_t* nal;
+    size_t nalSize;
+
+    while (nextNalUnit(data, size, annexB, &pos, &nal, &nalSize)) {
+        if (codec == VideoCodec::Avc) {
+            if (nalSize < 1) continue;
+            int type = nal[0] & 0x1f;
+            if (type < 1 || type > 5) continue;
+            sawSlice = true;
+            if (((nal[0] >> 5) & 3) != 0) allDisposable = false;
+        } else {
+            if (nalSize < 2) continue;
+            int type = (nal[0] >> 1) & 0x3f;
+            if (type > 31) continue;
+            sawSlice = true;
+            dependency.temporalId = std::max(dependency.temporalId, (nal[1] & 7) - 1);
+            // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved _N types are the even ones below 16
+            if (type > 14 || (type & 1)) allDisposable = false;
+        }
+    }
+
+    dependency.disposable = sawSlice && allDisposable;
+    return dependency;
+}
+
+static std::string mimeOf(const MediaFormat& format) {
+    std::string mime;
+    format.getString(MEDIA_KEY_MIME, &mime);
+    return mime;
+}
+
+FrameRateLimiter::FrameRateLimiter(const MediaFormat& format, int32_t maxFrameRate)
+        : codec(videoCodecForMime(mimeOf(format))) {
+    if (maxFrameRate > 0) minIntervalUs = 1000000 / maxFrameRate;
+    format.getInt32(MEDIA_KEY_FRAME_RATE, &sourceFrameRate);
+}
+
+void FrameRateLimiter::beginSegment(const TimelineSegment& segment) {
+    // A ramp may pass 1x anywhere inside, whatever its average
+    active = minIntervalUs > 0 && (segment.warp || segment.speedNum > segment.speedDen);
+    keptLayers = MAX_TEMPORAL_LAYERS;
+    // Output reference frames per second against the same limit the GOPs after get;
+    // a ramp goes by its average speed
+    keyOnly = active && sourceFrameRate > 0 &&
+              sourceFrameRate * (double) segment.speed * minIntervalUs > KEYFRAME_ONLY_FACTOR * 1000000.0;
+    gopStartUs = -1;
+    std::fill(std::begin(gopReferenceFrames), std::end(gopReferenceFrames), 0);
+    recentKept.clear();
+}
+
+bool FrameRateLimiter::spacedFromKept(int64_t outputPtsUs) const {
+    int64_t minSpacing = minIntervalUs - minIntervalUs / SPACING_TOLERANCE_DIVISOR;
+    for (int64_t kept : recentKept) {
+        if (std::llabs(outputPtsUs - kept) < minSpacing) return false;
+    }
+    return true;
+}
+
+void FrameRateLimiter::markKept(int64_t outputPtsUs) {
+    recentKept.push_back(outputPtsUs);
+    if (recentKept.size() > RECENT_KEPT_FRAMES) recentKept.pop_front();
+}
+
+bool FrameRateLimiter::keepCompressed(const uint8_t* data, size_t size, bool keyFrame, int64_t outputPtsUs) {
+    if (!active) return true;
+
+    if (keyFrame) {
+        // Pick this GOP's mode from how dense the previous GOP's reference frames were
+        if (gopStartUs >= 0 && outputPtsUs > gopStartUs) {
+            int64_t limit = (outputPtsUs - gopStartUs) * KEYFRAME_ONLY_FACTOR / minIntervalUs;
+            // Keep sub-layers from the base up while their reference frames fit
+            int64_t references = 0;
+            keptLayers = 0;
+            while (keptLayers < MAX_TEMPORAL_LAYERS && references + gopReferenceFrames[keptLayers] <= limit) {
+                references += gopReferenceFrames[keptLayers++];
+            }
+            keyOnly = keptLayers == 0;
+        }
+        gopStartUs = outputPtsUs;
+        std::fill(std::begin(gopReferenceFrames), std::end(gopReferenceFrames), 0);
+        gopReferenceFrames[0] = 1;
+
+        // Every other frame of the GOP depends on its keyframe
+        if (!keyOnly || spacedFromKept(outputPtsUs)) {
+            markKept(outputPtsUs);
+            return true;
+        }
+        dropped++;
+        return false;
+    }
+
+    FrameDependency dependency = parseFrameDependency(codec, data, size);
+    int layer = std::min(dependency.temporalId, MAX_TEMPORAL_LAYERS - 1);
+    if (!dependency.disposable) gopReferenceFrames[layer]++;
+
+    bool keep = !keyOnly && layer < keptLayers && (!dependency.disposable || spacedFromKept(outputPtsUs));
+    if (keep) {
+        markKept(outputPtsUs);
+    } else {
+        dropped++;
+    }
+    return keep;
+}
+
+bool FrameRateLimiter::keepDecoded(int64_t outputPtsUs) {
+    if (!active) return true;
+    if (!spacedFromKept(outputPtsUs)) {
+        dropped++;
+        return false;
+    }
+    markKept(outputPtsUs);
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "media_backend.h"
+#include "segment_timeline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+// What a compressed H.264 / HEVC frame means to the frames around it, read
+// from its NAL unit headers. Samples may be Annex-B or 4-byte length prefixed.
+struct FrameDependency {
+    // No later frame predicts from it: nal_ref_idc == 0 on every H.264
+    // slice, or only sub-layer non-reference (*_N) HEVC slices
+    bool disposable;
+    // Highest HEVC TemporalId among the slices, 0 for H.264
+    int temporalId;
+};
+
+enum class VideoCodec {
+    Avc,
+    Hevc,
+    Other,
+};
+
+VideoCodec videoCodecForMime(const std::string& mime);
+
+// Unparseable samples are reported as reference frames, so they are never dropped
+FrameDependency parseFrameDependency(VideoCodec codec, const uint8_t* data, size_t size);
+
+// Caps the output frame rate of speed-up segments. Compressed frames are
+// thinned by dropping disposable frames that land too close to a kept one;
+// when the reference frames alone still exceed the cap over a GOP, the next
+// GOP sheds its highest HEVC temporal sub-layers, which nothing below them
+// predicts from, and keeps only its keyframe once even the base layer is
+// too dense. The first GOP of a segment has no GOP before it, so its mode
+// comes from the source frame rate at the segment's speed, taking every
+// frame as a reference frame. Frames about to be re-encoded can all be
+// dropped freely. Segments at or below 1.0x pass through untouched.
+class FrameRateLimiter {
+public:
+    // format is the source track's; maxFrameRate <= 0 disables the limiter
+    FrameRateLimiter(const MediaFormat& format, int32_t maxFrameRate);
+
+    void beginSegment(const TimelineSegment& segment);
+
+    // True when non-keyframes are being dropped unseen, so their data need not be read
+    bool keyFramesOnly() const { return active && keyOnly; }
+
+    bool keepCompressed(const uint8_t* data, size_t size, bool keyFrame, int64_t outputPtsUs);
+    bool keepDecoded(int64_t outputPtsUs);
+
+    size_t droppedFrames() const { return dropped; }
+
+private:
+    bool spacedFromKept(int64_t outputPtsUs) const;
+    void markKept(int64_t outputPtsUs);
+
+    VideoCodec codec;
+    // 0 when the source does not say
+    int32_t sourceFrameRate = 0;
+    int64_t minIntervalUs = 0;
+    bool active = false;
+    bool keyOnly = false;
+
+    // Reference frames seen in the current GOP by temporal sub-layer, to
+    // pick the next GOP's mode
+    static const int MAX_TEMPORAL_LAYERS = 7;
+    int64_t gopStartUs = -1;
+    int gopReferenceFrames[MAX_TEMPORAL_LAYERS] = {};
+    // Frames with a TemporalId at or above this are dropped unseen
+    int keptLayers = MAX_TEMPORAL_LAYERS;
+
+    // Recently kept output PTS; frames arrive in decode order, so the
+    // nearest kept neighbour can be on either side
+    std::deque<int64_t> recentKept;
+    size_t dropped = 0;
+};
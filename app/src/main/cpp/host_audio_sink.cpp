@@ -0,0 +1,67 @@
+#include "host_audio_sink.h"
+
+#include <chrono>
+
+// Like a device queue, one burst is always in flight ahead of the one playing
+static const int32_t HOST_QUEUED_BURSTS = 1;
+
+int HostAudioSink::open(int32_t rate, int32_t channelCount, PcmRingBuffer* ring) {
+    if (device.joinable() || rate <= 0 || channelCount <= 0 || !ring) return -1;
+    sampleRate = rate;
+    channels = channelCount;
+    source = ring;
+    queuedBursts = HOST_QUEUED_BURSTS;
+    burstBuffer.resize((size_t) burst * channels);
+    resetCounters();
+    stopping = false;
+    device = std::thread(&HostAudioSink::deviceLoop, this);
+    return 0;
+}
+
+void HostAudioSink::close() {
+    if (!device.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    device.join();
+}
+
+int HostAudioSink::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    playing = true;
+    wakeup.notify_one();
+    return 0;
+}
+
+void HostAudioSink::pause() {
+    std::lock_guard<std::mutex> lock(mutex);
+    playing = false;
+}
+
+void HostAudioSink::flush() {
+    // Holding the lock also waits out a burst being filled
+    std::lock_guard<std::mutex> lock(mutex);
+    playing = false;
+    resetCounters();
+}
+
+void HostAudioSink::deviceLoop() {
+    const auto period = std::chrono::nanoseconds(1000000000LL * burst / sampleRate);
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        if (!playing) {
+            wakeup.wait(lock, [this] { return playing || stopping; });
+            next = std::chrono::steady_clock::now();
+        }
+        if (stopping) return;
+
+        fillBurst(burstBuffer.data());
+        next += period;
+        lock.unlock();
+        std::this_thread::sleep_until(next);
+        lock.lock();
+    }
+}
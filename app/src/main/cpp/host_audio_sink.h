@@ -0,0 +1,33 @@
+#pragma once
+
+#include "audio_sink.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Headless AudioSink for the host build. A thread stands in for the device
+// callback: it takes one burst from the ring every burst period in real time
+// and throws the audio away, so preview timing behaves as on a device.
+class HostAudioSink : public BurstAudioSink {
+public:
+    explicit HostAudioSink(int32_t framesPerBurst = 240) { burst = framesPerBurst; }
+    ~HostAudioSink() override { close(); }
+
+    int open(int32_t sampleRate, int32_t channels, PcmRingBuffer* source) override;
+    void close() override;
+    int start() override;
+    void pause() override;
+    void flush() override;
+
+private:
+    void deviceLoop();
+
+    std::vector<short> burstBuffer;
+    std::thread device;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool playing = false;
+    bool stopping = false;
+};
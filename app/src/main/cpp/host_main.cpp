@@ -0,0 +1,166 @@
+#include "editor_log.h"
+#include "host_media_backend.h"
+#include "job_engine.h"
+#include "speed_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static const int PROGRESS_INTERVAL_MS = 250;
+static const uint64_t RENDER_CACHE_BYTES = 4ULL << 30;
+
+// Speed of a segment: a constant like "2", or a ramp of time=speed keyframes
+// like "5=1~,5.8=0.5,6.2=0.5~,7=1.5", where ~ eases into the next keyframe
+static bool parseSpeed(const char* text, Segment* segment) {
+    if (!strchr(text, '=')) return sscanf(text, "%f", &segment->speed) == 1 && segment->speed > 0.0f;
+    segment->speed = 1.0f;
+    while (*text) {
+        SpeedKeyframe keyframe;
+        int used = 0;
+        if (sscanf(text, "%f=%f%n", &keyframe.time, &keyframe.speed, &used) != 2 || keyframe.speed <= 0.0f) {
+            return false;
+        }
+        text += used;
+        if (*text == '~') {
+            keyframe.interpolation = SpeedInterpolation::Bezier;
+            text++;
+        }
+        segment->ramp.push_back(keyframe);
+        if (*text == ',') {
+            text++;
+        } else if (*text) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Host runner: video_speed_host [--sync-audio] [--keyframe-cuts] [--no-passthrough]
+//                                 [--max-fps <n>] [--audio-workers <n>] [--progress] [--cancel-after <ms>]
+//                                 [--trace <trace.json>] [--index-cache <dir>] [--backend-demuxer]
+//                                 [--fmp4 [--fragment-ms <n>] [--faststart]] [--render-cache <dir>]
+//                                 [--peak-cache <dir>]
+//                                 <input> <output> <start:end:speed|ramp>...
+int main(int argc, char** argv) {
+    PipelineOptions options;
+    bool showProgress = false;
+    int cancelAfterMs = -1;
+    const char* tracePath = nullptr;
+    std::unique_ptr<SampleIndexCache> indexCache;
+    std::unique_ptr<SegmentRenderCache> renderCache;
+    std::unique_ptr<WaveformPeakCache> peakCache;
+    int first = 1;
+    while (first < argc) {
+        if (strcmp(argv[first], "--sync-audio") == 0) {
+            options.asyncAudio = false;
+            first++;
+        } else if (strcmp(argv[first], "--keyframe-cuts") == 0) {
+            options.smartCut = false;
+            first++;
+        } else if (strcmp(argv[first], "--no-passthrough") == 0) {
+            options.audioPassthrough = false;
+            first++;
+        } else if (strcmp(argv[first], "--max-fps") == 0 && first + 1 < argc) {
+            options.maxOutputFrameRate = atoi(argv[first + 1]);
+            first += 2;
+        } else if (strcmp(argv[first], "--audio-workers") == 0 && first + 1 < argc) {
+            options.audioWorkers = (size_t) atoi(argv[first + 1]);
+            first += 2;
+        } else if (strcmp(argv[first], "--progress") == 0) {
+            showProgress = true;
+            first++;
+        } else if (strcmp(argv[first], "--trace") == 0 && first + 1 < argc) {
+            tracePath = argv[first + 1];
+            first += 2;
+        } else if (strcmp(argv[first], "--index-cache") == 0 && first + 1 < argc) {
+            indexCache = std::make_unique<SampleIndexCache>(argv[first + 1]);
+            options.indexCache = indexCache.get();
+            first += 2;
+        } else if (strcmp(argv[first], "--backend-demuxer") == 0) {
+            options.mappedDemuxer = false;
+            first++;
+        } else if (strcmp(argv[first], "--fmp4") == 0) {
+            options.fragmentedOutput = true;
+            first++;
+        } else if (strcmp(argv[first], "--fragment-ms") == 0 && first + 1 < argc) {
+            options.fragmentDurationUs = atoll(argv[first + 1]) * 1000;
+            first += 2;
+        } else if (strcmp(argv[first], "--faststart") == 0) {
+            options.faststart = true;
+            first++;
+        } else if (strcmp(argv[first], "--render-cache") == 0 && first + 1 < argc) {
+            renderCache = std::make_unique<SegmentRenderCache>(argv[first + 1], RENDER_CACHE_BYTES);
+            options.renderCache = renderCache.get();
+            first += 2;
+        } else if (strcmp(argv[first], "--peak-cache") == 0 && first + 1 < argc) {
+            peakCache = std::make_unique<WaveformPeakCache>(argv[first + 1]);
+            options.peakCache = peakCache.get();
+            first += 2;
+        } else if (strcmp(argv[first], "--cancel-after") == 0 && first + 1 < argc) {
+            cancelAfterMs = atoi(argv[first + 1]);
+            first += 2;
+        } else {
+            break;
+        }
+    }
+    if (argc - first < 3) {
+        fprintf(stderr, "usage: %s [--sync-audio] [--keyframe-cuts] [--no-passthrough] [--max-fps <n>] "
+                        "[--audio-workers <n>] [--progress] [--cancel-after <ms>] "
+                        "[--trace <trace.json>] [--index-cache <dir>] [--backend-demuxer] "
+                        "[--fmp4 [--fragment-ms <n>] [--faststart]] [--render-cache <dir>] "
+                        "[--peak-cache <dir>] <input> <output> <start:end:speed|t=speed[~],...>...\n",
+                argv[0]);
+        return 2;
+    }
+
+    std::vector<Segment> segments;
+    for (int i = first + 2; i < argc; i++) {
+        Segment segment;
+        int used = 0;
+        if (sscanf(argv[i], "%f:%f:%n", &segment.start, &segment.end, &used) != 2 || used == 0 ||
+            !parseSpeed(argv[i] + used, &segment)) {
+            LOGE("Invalid segment: %s", argv[i]);
+            return 2;
+        }
+        segments.push_back(segment);
+    }
+
+    HostMediaBackend backend;
+    if (!showProgress && cancelAfterMs < 0) {
+        // Chrome trace JSON, loadable in chrome://tracing or ui.perfetto.dev
+        JobControl control;
+        if (tracePath) {
+            control.profiler()->enableTrace();
+            options.control = &control;
+        }
+        int result = processSpeedVideo(backend, argv[first], argv[first + 1], segments, options);
+        if (tracePath && !control.profiler()->writeChromeTrace(tracePath)) return 1;
+        return result == 0 ? 0 : 1;
+    }
+
+    // Same path the app takes: one job on the engine, polled until it finishes
+    JobEngine engine(backend, 1);
+    int64_t id = engine.submit({argv[first], argv[first + 1], segments, options});
+    auto started = std::chrono::steady_clock::now();
+    JobStatus status;
+    while (engine.poll(id, &status) && (status.state == JobState::Queued || status.state == JobState::Running)) {
+        if (showProgress) fprintf(stderr, "progress: %.1f%%\n", status.progress * 100.0f);
+        if (cancelAfterMs >= 0 && std::chrono::steady_clock::now() - started >=
+                                  std::chrono::milliseconds(cancelAfterMs)) {
+            engine.cancel(id);
+            cancelAfterMs = -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(
+                cancelAfterMs >= 0 ? std::min(cancelAfterMs, PROGRESS_INTERVAL_MS) : PROGRESS_INTERVAL_MS));
+    }
+    JobState state = engine.wait(id);
+    if (showProgress && state == JobState::Succeeded) fprintf(stderr, "progress: 100.0%%\n");
+    if (state == JobState::Cancelled) LOGI("Job cancelled");
+    return state == JobState::Succeeded ? 0 : 1;
+}
@@ -0,0 +1,627 @@
+#include "host_media_backend.h"
+#include "editor_log.h"
+#include "pipeline_profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const char HOST_MAGIC[8] = {'S', 'P', 'D', 'R', 'A', 'W', '0', '1'};
+static const size_t HOST_CODEC_BUFFERS = 4;
+static const size_t HOST_DEFAULT_BUFFER_SIZE = 256 * 1024;
+
+bool HostMediaFormat::getInt32(const char* key, int32_t* out) const {
+    auto it = values.find(key);
+    if (it == values.end() || it->second.type != 'i') return false;
+    *out = (int32_t) it->second.number;
+    return true;
+}
+
+bool HostMediaFormat::getInt64(const char* key, int64_t* out) const {
+    auto it = values.find(key);
+    if (it == values.end() || it->second.type != 'l') return false;
+    *out = it->second.number;
+    return true;
+}
+
+bool HostMediaFormat::getString(const char* key, std::string* out) const {
+    auto it = values.find(key);
+    if (it == values.end() || it->second.type != 's') return false;
+    *out = it->second.text;
+    return true;
+}
+
+bool HostMediaFormat::getBuffer(const char* key, std::vector<uint8_t>* out) const {
+    auto it = values.find(key);
+    if (it == values.end() || it->second.type != 'b') return false;
+    out->assign(it->second.text.begin(), it->second.text.end());
+    return true;
+}
+
+void HostMediaFormat::setInt32(const char* key, int32_t value) {
+    values[key] = {'i', value, {}};
+}
+
+void HostMediaFormat::setInt64(const char* key, int64_t value) {
+    values[key] = {'l', value, {}};
+}
+
+void HostMediaFormat::setString(const char* key, const char* value) {
+    values[key] = {'s', 0, value};
+}
+
+void HostMediaFormat::setBuffer(const char* key, const uint8_t* data, size_t size) {
+    values[key] = {'b', 0, std::string(reinterpret_cast<const char*>(data), size)};
+}
+
+// Buffers are stored as hex so the header stays line-oriented text
+static std::string toHex(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : bytes) {
+        out += digits[c >> 4];
+        out += digits[c & 15];
+    }
+    return out;
+}
+
+static bool fromHex(const std::string& hex, std::string* bytes) {
+    if (hex.size() % 2) return false;
+    bytes->clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        char* end;
+        std::string pair = hex.substr(i, 2);
+        long value = strtol(pair.c_str(), &end, 16);
+        if (*end) return false;
+        *bytes += (char) value;
+    }
+    return true;
+}
+
+std::string HostMediaFormat::serialize() const {
+    std::string out;
+    for (const auto& entry : values) {
+        out += entry.second.type;
+        out += ':';
+        out += entry.first;
+        out += '=';
+        if (entry.second.type == 's') {
+            out += entry.second.text;
+        } else if (entry.second.type == 'b') {
+            out += toHex(entry.second.text);
+        } else {
+            out += std::to_string(entry.second.number);
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+bool HostMediaFormat::parse(const std::string& text) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) end = text.size();
+        std::string line = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t eq = line.find('=');
+        if (line.size() < 3 || line[1] != ':' || eq == std::string::npos) return false;
+        std::string key = line.substr(2, eq - 2);
+        std::string value = line.substr(eq + 1);
+        char type = line[0];
+        if (type == 's') {
+            values[key] = {'s', 0, value};
+        } else if (type == 'i' || type == 'l') {
+            values[key] = {type, strtoll(value.c_str(), nullptr, 10), {}};
+        } else if (type == 'b') {
+            std::string bytes;
+            if (!fromHex(value, &bytes)) return false;
+            values[key] = {'b', 0, bytes};
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+struct HostSampleRecord {
+    uint32_t track;
+    uint32_t flags;
+    int64_t pts;
+    uint32_t size;
+    off_t offset;
+};
+
+static bool readFully(int fd, void* data, size_t size, off_t offset) {
+    uint8_t* out = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = pread(fd, out, size, offset);
+        if (n <= 0) return false;
+        out += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+class HostMediaExtractor : public MediaExtractor {
+public:
+    ~HostMediaExtractor() override {
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(const char* path) {
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            LOGE("Cannot open input file: %s, error: %s", path, strerror(errno));
+            return false;
+        }
+
+        char magic[8];
+        uint32_t trackCount;
+        off_t pos = 0;
+        if (!readFully(fd, magic, sizeof(magic), pos) || memcmp(magic, HOST_MAGIC, sizeof(magic)) != 0) {
+            LOGE("Not a host sample container: %s", path);
+            return false;
+        }
+        pos += sizeof(magic);
+        if (!readFully(fd, &trackCount, sizeof(trackCount), pos)) return false;
+        pos += sizeof(trackCount);
+
+        for (uint32_t i = 0; i < trackCount; i++) {
+            uint32_t length;
+            if (!readFully(fd, &length, sizeof(length), pos)) return false;
+            pos += sizeof(length);
+            std::string text(length, '\0');
+            if (!readFully(fd, &text[0], length, pos)) return false;
+            pos += length;
+
+            HostMediaFormat format;
+            if (!format.parse(text)) {
+                LOGE("Malformed track format %u in %s", i, path);
+                return false;
+            }
+            formats.push_back(format);
+        }
+
+        // Index every sample header up front, payloads are read on demand
+        while (true) {
+            uint8_t header[20];
+            if (!readFully(fd, header, sizeof(header), pos)) break;
+            HostSampleRecord record;
+            memcpy(&record.track, header, 4);
+            memcpy(&record.flags, header + 4, 4);
+            memcpy(&record.pts, header + 8, 8);
+            memcpy(&record.size, header + 16, 4);
+            record.offset = pos + sizeof(header);
+            if (record.track >= trackCount) {
+                LOGE("Sample references unknown track %u in %s", record.track, path);
+                return false;
+            }
+            records.push_back(record);
+            pos = record.offset + record.size;
+        }
+
+        selected.assign(trackCount, false);
+        cursor = records.size();
+        return true;
+    }
+
+    size_t getTrackCount() override {
+        return formats.size();
+    }
+
+    std::unique_ptr<MediaFormat> getTrackFormat(size_t track) override {
+        if (track >= formats.size()) return nullptr;
+        return std::make_unique<HostMediaFormat>(formats[track]);
+    }
+
+    int selectTrack(size_t track) override {
+        if (track >= selected.size()) return MEDIA_ERROR;
+        selected[track] = true;
+        // Like AMediaExtractor, a newly selected track starts from the beginning
+        cursor = nextSelected(0);
+        return MEDIA_OK;
+    }
+
+    int unselectTrack(size_t track) override {
+        if (track >= selected.size()) return MEDIA_ERROR;
+        selected[track] = false;
+        cursor = nextSelected(cursor);
+        return MEDIA_OK;
+    }
+
+    int seekTo(int64_t timeUs, MediaSeekMode mode) override {
+        size_t target = records.size();
+        for (size_t track = 0; track < selected.size(); track++) {
+            if (!selected[track]) continue;
+
+            size_t previous = records.size(), next = records.size();
+            for (size_t i = 0; i < records.size(); i++) {
+                const HostSampleRecord& r = records[i];
+                if (r.track != track || !(r.flags & SAMPLE_FLAG_SYNC)) continue;
+                if (r.pts <= timeUs) {
+                    previous = i;
+                } else {
+                    next = i;
+                    break;
+                }
+            }
+
+            size_t pick;
+            if (mode == MediaSeekMode::PreviousSync) {
+                pick = previous != records.size() ? previous : next;
+            } else if (mode == MediaSeekMode::NextSync) {
+                pick = next;
+                if (previous != records.size() && records[previous].pts == timeUs) pick = previous;
+            } else if (previous == records.size()) {
+                pick = next;
+            } else if (next == records.size()) {
+                pick = previous;
+            } else {
+                pick = (timeUs - records[previous].pts) <= (records[next].pts - timeUs) ? previous : next;
+            }
+            target = std::min(target, pick);
+        }
+        cursor = nextSelected(target);
+        return MEDIA_OK;
+    }
+
+    ssize_t readSampleData(uint8_t* buffer, size_t capacity) override {
+        if (cursor >= records.size()) return -1;
+        const HostSampleRecord& r = records[cursor];
+        if (r.size > capacity) {
+            LOGE("Sample of %u bytes does not fit buffer of %zu", r.size, capacity);
+            return -1;
+        }
+        if (!readFully(fd, buffer, r.size, r.offset)) return -1;
+        return r.size;
+    }
+
+    ssize_t getSampleSize() override {
+        return cursor < records.size() ? (ssize_t) records[cursor].size : -1;
+    }
+
+    int getSampleTrackIndex() override {
+        return cursor < records.size() ? (int) records[cursor].track : -1;
+    }
+
+    int64_t getSampleTime() override {
+        return cursor < records.size() ? records[cursor].pts : -1;
+    }
+
+    uint32_t getSampleFlags() override {
+        return cursor < records.size() ? records[cursor].flags : 0;
+    }
+
+    bool advance() override {
+        if (cursor >= records.size()) return false;
+        cursor = nextSelected(cursor + 1);
+        return cursor < records.size();
+    }
+
+    int fileDescriptor() const override {
+        return fd;
+    }
+
+private:
+    size_t nextSelected(size_t from) const {
+        while (from < records.size() && !selected[records[from].track]) from++;
+        return from;
+    }
+
+    int fd = -1;
+    std::vector<HostMediaFormat> formats;
+    std::vector<HostSampleRecord> records;
+    std::vector<bool> selected;
+    size_t cursor = 0;
+};
+
+// Passthrough codec: a queued input slot becomes the matching output slot and
+// is handed back to the input side once the caller releases it. In callback
+// mode a worker thread plays the role of the NDK codec looper.
+class HostPassthroughCodec : public MediaCodec {
+public:
+    explicit HostPassthroughCodec(const HostCodecLatency& latency) : latency(latency) {
+        simulate(latency.createUs);
+    }
+
+    ~HostPassthroughCodec() override {
+        stop();
+    }
+
+    int setCallbacks(const CodecCallbacks& codecCallbacks) override {
+        callbacks = codecCallbacks;
+        async = true;
+        return MEDIA_OK;
+    }
+
+    int configure(const MediaFormat& format, bool encoder) override {
+        simulate(latency.configureUs);
+        const HostMediaFormat& input = static_cast<const HostMediaFormat&>(format);
+        outputFormat = input;
+        std::string mime;
+        if (!encoder && input.getString(MEDIA_KEY_MIME, &mime)) {
+            outputFormat.setString(MEDIA_KEY_MIME, mime.compare(0, 6, "video/") == 0 ? "video/raw" : "audio/raw");
+        }
+
+        int32_t maxInputSize = 0;
+        size_t capacity = HOST_DEFAULT_BUFFER_SIZE;
+        if (input.getInt32(MEDIA_KEY_MAX_INPUT_SIZE, &maxInputSize) && maxInputSize > 0) {
+            capacity = std::max(capacity, (size_t) maxInputSize);
+        }
+        buffers.assign(HOST_CODEC_BUFFERS, std::vector<uint8_t>(capacity));
+        return MEDIA_OK;
+    }
+
+    int configureSurface(const MediaFormat& format, void* displaySurface) override {
+        surface = static_cast<HostVideoSurface*>(displaySurface);
+        return configure(format, false);
+    }
+
+    int start() override {
+        if (buffers.empty()) return MEDIA_ERROR;
+        simulate(latency.startUs);
+        flush();
+        if (async && !worker.joinable()) {
+            stopping = false;
+            worker = std::thread(&HostPassthroughCodec::deliverCallbacks, this);
+        }
+        return MEDIA_OK;
+    }
+
+    int stop() override {
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wakeup.notify_one();
+            worker.join();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        freeInputs.clear();
+        pending.clear();
+        return MEDIA_OK;
+    }
+
+    int flush() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeInputs.clear();
+        pending.clear();
+        for (size_t i = 0; i < buffers.size(); i++) freeInputs.push_back(i);
+        wakeup.notify_one();
+        return MEDIA_OK;
+    }
+
+    ssize_t dequeueInputBuffer(int64_t) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (async || freeInputs.empty()) return CODEC_INFO_TRY_AGAIN_LATER;
+        size_t index = freeInputs.front();
+        freeInputs.pop_front();
+        return index;
+    }
+
+    uint8_t* getInputBuffer(size_t index, size_t* size) override {
+        if (index >= buffers.size()) return nullptr;
+        *size = buffers[index].size();
+        return buffers[index].data();
+    }
+
+    int queueInputBuffer(size_t index, size_t offset, size_t size,
+                         int64_t presentationTimeUs, uint32_t flags) override {
+        if (index >= buffers.size() || offset + size > buffers[index].size()) return MEDIA_ERROR;
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back({index, {(int32_t) offset, (int32_t) size, presentationTimeUs, flags}});
+        wakeup.notify_one();
+        return MEDIA_OK;
+    }
+
+    ssize_t dequeueOutputBuffer(SampleInfo* info, int64_t) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (async || pending.empty()) return CODEC_INFO_TRY_AGAIN_LATER;
+        *info = pending.front().info;
+        size_t index = pending.front().index;
+        pending.pop_front();
+        return index;
+    }
+
+    uint8_t* getOutputBuffer(size_t index, size_t* size) override {
+        return getInputBuffer(index, size);
+    }
+
+    int releaseOutputBuffer(size_t index, bool render) override {
+        if (index >= buffers.size()) return MEDIA_ERROR;
+        if (render && surface) surface->render(PipelineProfiler::nowNs());
+        std::lock_guard<std::mutex> lock(mutex);
+        freeInputs.push_back(index);
+        wakeup.notify_one();
+        return MEDIA_OK;
+    }
+
+    int releaseOutputBufferAtTime(size_t index, int64_t renderTimeNs) override {
+        if (index >= buffers.size() || !surface) return MEDIA_ERROR;
+        surface->render(renderTimeNs);
+        std::lock_guard<std::mutex> lock(mutex);
+        freeInputs.push_back(index);
+        wakeup.notify_one();
+        return MEDIA_OK;
+    }
+
+    std::unique_ptr<MediaFormat> getOutputFormat() override {
+        return std::make_unique<HostMediaFormat>(outputFormat);
+    }
+
+private:
+    struct Pending {
+        size_t index;
+        SampleInfo info;
+    };
+
+    static void simulate(int64_t us) {
+        if (us > 0) std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    void deliverCallbacks() {
+        std::deque<size_t> inputs;
+        std::deque<Pending> outputs;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return stopping || !freeInputs.empty() || !pending.empty(); });
+                if (stopping) return;
+                inputs.swap(freeInputs);
+                outputs.swap(pending);
+            }
+            // Callbacks run unlocked, they call straight back into the codec
+            for (const Pending& output : outputs) callbacks.onOutputAvailable(output.index, output.info);
+            for (size_t index : inputs) callbacks.onInputAvailable(index);
+            inputs.clear();
+            outputs.clear();
+        }
+    }
+
+    HostCodecLatency latency;
+    HostMediaFormat outputFormat;
+    std::vector<std::vector<uint8_t>> buffers;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<size_t> freeInputs;
+    std::deque<Pending> pending;
+
+    bool async = false;
+    bool stopping = false;
+    CodecCallbacks callbacks;
+    std::thread worker;
+    HostVideoSurface* surface = nullptr;
+};
+
+class HostMediaMuxer : public MediaMuxer {
+public:
+    ~HostMediaMuxer() override {
+        if (file) fclose(file);
+    }
+
+    bool open(const char* path) {
+        file = fopen(path, "wb");
+        if (!file) {
+            LOGE("Cannot open output file: %s", path);
+            return false;
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        return true;
+    }
+
+    ssize_t addTrack(const MediaFormat& format) override {
+        if (started) return MEDIA_ERROR;
+        tracks.push_back(static_cast<const HostMediaFormat&>(format).serialize());
+        return tracks.size() - 1;
+    }
+
+    int start() override {
+        if (started) return MEDIA_ERROR;
+        uint32_t trackCount = tracks.size();
+        fwrite(HOST_MAGIC, 1, sizeof(HOST_MAGIC), file);
+        fwrite(&trackCount, sizeof(trackCount), 1, file);
+        for (const std::string& text : tracks) {
+            uint32_t length = text.size();
+            fwrite(&length, sizeof(length), 1, file);
+            fwrite(text.data(), 1, text.size(), file);
+        }
+        started = true;
+        return ferror(file) ? MEDIA_ERROR : MEDIA_OK;
+    }
+
+    int writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) override {
+        if (!started || track >= tracks.size() || info.size < 0) return MEDIA_ERROR;
+        uint8_t header[20];
+        uint32_t trackIndex = track;
+        uint32_t flags = info.flags & BUFFER_FLAG_KEY_FRAME;
+        uint32_t size = info.size;
+        memcpy(header, &trackIndex, 4);
+        memcpy(header + 4, &flags, 4);
+        memcpy(header + 8, &info.presentationTimeUs, 8);
+        memcpy(header + 16, &size, 4);
+        if (fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+            fwrite(data + info.offset, 1, size, file) != size) {
+            return MEDIA_ERROR;
+        }
+        return MEDIA_OK;
+    }
+
+    int stop() override {
+        if (!started) return MEDIA_ERROR;
+        started = false;
+        return fflush(file) == 0 ? MEDIA_OK : MEDIA_ERROR;
+    }
+
+private:
+    FILE* file = nullptr;
+    std::vector<std::string> tracks;
+    bool started = false;
+};
+
+} // namespace
+
+void HostVideoSurface::render(int64_t renderTimeNs) {
+    // Frames released late are shown at the next vsync after the release
+    int64_t requestedNs = std::max(renderTimeNs, PipelineProfiler::nowNs());
+    int64_t vsyncNs = (requestedNs + refreshIntervalNs - 1) / refreshIntervalNs * refreshIntervalNs;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (vsyncNs <= lastVsyncNs) {
+        // Same vsync as the previous frame, which is replaced before it is shown
+        totals.framesReplaced++;
+        totals.latencySumNs -= lastVsyncNs - lastRequestedNs;
+        vsyncNs = lastVsyncNs;
+    } else {
+        totals.framesShown++;
+    }
+    int64_t latencyNs = vsyncNs - renderTimeNs;
+    totals.latencySumNs += latencyNs;
+    totals.latencyMaxNs = std::max(totals.latencyMaxNs, latencyNs);
+    lastVsyncNs = vsyncNs;
+    lastRequestedNs = renderTimeNs;
+}
+
+HostVideoSurface::Stats HostVideoSurface::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals;
+}
+
+std::unique_ptr<MediaFormat> HostMediaBackend::createFormat() {
+    return std::make_unique<HostMediaFormat>();
+}
+
+std::unique_ptr<MediaExtractor> HostMediaBackend::createExtractor(const char* path) {
+    auto extractor = std::make_unique<HostMediaExtractor>();
+    if (!extractor->open(path)) return nullptr;
+    return extractor;
+}
+
+std::unique_ptr<MediaCodec> HostMediaBackend::createDecoder(const char*) {
+    return std::make_unique<HostPassthroughCodec>(codecLatency);
+}
+
+std::unique_ptr<MediaCodec> HostMediaBackend::createEncoder(const char*) {
+    return std::make_unique<HostPassthroughCodec>(codecLatency);
+}
+
+std::unique_ptr<MediaMuxer> HostMediaBackend::createMuxer(const char* path) {
+    auto muxer = std::make_unique<HostMediaMuxer>();
+    if (!muxer->open(path)) return nullptr;
+    return muxer;
+}
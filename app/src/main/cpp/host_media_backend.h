@@ -0,0 +1,93 @@
+#pragma once
+
+#include "media_backend.h"
+
+#include <map>
+#include <mutex>
+
+// Host stand-in for the NDK media stack, used by the video_speed_core build.
+//
+// Media lives in a small framed sample container instead of MP4, all fields
+// little endian:
+//   "SPDRAW01" u32 trackCount
+//   per track:  u32 length, then "<type>:<key>=<value>\n" lines (type i/l/s)
+//   per sample: u32 track, u32 flags, i64 ptsUs, u32 size, payload
+//
+// Codecs are passthroughs: audio/raw PCM goes through decoders unchanged and
+// the "encoder" hands its PCM input straight back as output, so the pipeline
+// exercises the same buffer traffic without a real codec. Their startup cost
+// is simulated with HostCodecLatency, zero unless set.
+
+class HostMediaFormat : public MediaFormat {
+public:
+    bool getInt32(const char* key, int32_t* out) const override;
+    bool getInt64(const char* key, int64_t* out) const override;
+    bool getString(const char* key, std::string* out) const override;
+    bool getBuffer(const char* key, std::vector<uint8_t>* out) const override;
+
+    void setInt32(const char* key, int32_t value) override;
+    void setInt64(const char* key, int64_t value) override;
+    void setString(const char* key, const char* value) override;
+    void setBuffer(const char* key, const uint8_t* data, size_t size) override;
+
+    std::string serialize() const;
+    bool parse(const std::string& text);
+
+private:
+    struct Value {
+        char type;
+        int64_t number;
+        std::string text;
+    };
+    std::map<std::string, Value> values;
+};
+
+// Headless display for decoders configured with configureSurface(). A
+// rendered frame is shown at the first vsync at or after its requested render
+// time; a frame superseded by a later one before its vsync is never shown,
+// like a real compositor. Latency is shown time minus requested time.
+class HostVideoSurface {
+public:
+    explicit HostVideoSurface(int64_t refreshIntervalNs = 16666667) : refreshIntervalNs(refreshIntervalNs) {}
+
+    struct Stats {
+        int64_t framesShown = 0;
+        int64_t framesReplaced = 0;
+        int64_t latencySumNs = 0;
+        int64_t latencyMaxNs = 0;
+    };
+
+    // Called by the codec when a buffer is released for rendering
+    void render(int64_t renderTimeNs);
+    Stats stats() const;
+
+private:
+    int64_t refreshIntervalNs;
+    mutable std::mutex mutex;
+    Stats totals;
+    int64_t lastVsyncNs = -1;
+    int64_t lastRequestedNs = 0;
+};
+
+// Time a host codec sleeps in each startup step, standing in for the
+// creation, configuration and start latency of a device codec
+struct HostCodecLatency {
+    int64_t createUs = 0;
+    int64_t configureUs = 0;
+    int64_t startUs = 0;
+};
+
+class HostMediaBackend : public MediaBackend {
+public:
+    explicit HostMediaBackend(HostCodecLatency codecLatency = HostCodecLatency()) : codecLatency(codecLatency) {}
+
+    const char* name() const override { return "host"; }
+    std::unique_ptr<MediaFormat> createFormat() override;
+    std::unique_ptr<MediaExtractor> createExtractor(const char* path) override;
+    std::unique_ptr<MediaCodec> createDecoder(const char* mime) override;
+    std::unique_ptr<MediaCodec> createEncoder(const char* mime) override;
+    std::unique_ptr<MediaMuxer> createMuxer(const char* path) override;
+
+private:
+    HostCodecLatency codecLatency;
+};
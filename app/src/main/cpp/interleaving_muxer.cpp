@@ -0,0 +1,169 @@
+#include "interleaving_muxer.h"
+#include "editor_log.h"
+
+#include <cstring>
+
+// Initial size of queued sample buffers when the format has no max input size;
+// they grow to the largest sample seen
+static const size_t QUEUED_SAMPLE_SIZE = 64 * 1024;
+
+InterleavingMuxer::InterleavingMuxer(std::unique_ptr<MediaMuxer> muxer, size_t maxQueuedPerTrack)
+        : muxer(std::move(muxer)), maxQueuedPerTrack(maxQueuedPerTrack) {}
+
+InterleavingMuxer::~InterleavingMuxer() {
+    if (started) stop();
+}
+
+ssize_t InterleavingMuxer::addTrack(const MediaFormat& format) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (started) return MEDIA_ERROR;
+    ssize_t index = muxer->addTrack(format);
+    if (index >= 0) {
+        if ((size_t) index >= tracks.size()) tracks.resize(index + 1);
+        int32_t maxInputSize = 0;
+        format.getInt32(MEDIA_KEY_MAX_INPUT_SIZE, &maxInputSize);
+        size_t initialSize = maxInputSize > 0 ? (size_t) maxInputSize : QUEUED_SAMPLE_SIZE;
+        tracks[index].pool = std::make_unique<SampleBufferPool>(initialSize);
+    }
+    return index;
+}
+
+int InterleavingMuxer::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (started) return MEDIA_ERROR;
+    int status = muxer->start();
+    if (status != MEDIA_OK) return status;
+    started = true;
+    writer = std::thread(&InterleavingMuxer::writerLoop, this);
+    return MEDIA_OK;
+}
+
+bool InterleavingMuxer::waitForRoom(std::unique_lock<std::mutex>& lock, size_t track) {
+    if (tracks[track].queue.size() >= maxQueuedPerTrack) {
+        // Producer back-pressure counts as mux stall time
+        ScopedStage wait(profilerOf(control), PipelineStage::Mux, true);
+        changed.wait(lock, [&] { return failed || tracks[track].queue.size() < maxQueuedPerTrack; });
+    }
+    return !failed;
+}
+
+SampleBuffer* InterleavingMuxer::acquire(size_t track, size_t size) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (track >= tracks.size() || !tracks[track].pool) return nullptr;
+    if (!waitForRoom(lock, track)) return nullptr;
+    return tracks[track].pool->acquire(size);
+}
+
+int InterleavingMuxer::submit(size_t track, SampleBuffer* buffer, const SampleInfo& info) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (track >= tracks.size()) return MEDIA_ERROR;
+    if (failed || tracks[track].finished) {
+        tracks[track].pool->release(buffer);
+        return MEDIA_ERROR;
+    }
+    tracks[track].queue.push_back({buffer, nullptr, info});
+    changed.notify_all();
+    return MEDIA_OK;
+}
+
+int InterleavingMuxer::submitView(size_t track, const uint8_t* data, const SampleInfo& info) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (track >= tracks.size() || !tracks[track].pool) return MEDIA_ERROR;
+    if (!waitForRoom(lock, track) || tracks[track].finished) return MEDIA_ERROR;
+    tracks[track].queue.push_back({nullptr, data, info});
+    changed.notify_all();
+    return MEDIA_OK;
+}
+
+int InterleavingMuxer::writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) {
+    SampleBuffer* buffer = acquire(track, info.size);
+    if (!buffer) return MEDIA_ERROR;
+    memcpy(buffer->data(), data + info.offset, info.size);
+    SampleInfo queued = info;
+    queued.offset = 0;
+    return submit(track, buffer, queued);
+}
+
+void InterleavingMuxer::discard(size_t track, SampleBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (track < tracks.size()) tracks[track].pool->release(buffer);
+}
+
+void InterleavingMuxer::finishTrack(size_t track) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (track >= tracks.size()) return;
+    tracks[track].finished = true;
+    changed.notify_all();
+}
+
+void InterleavingMuxer::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // The next sample can only be chosen once every open track has one queued
+        ssize_t next = -1;
+        bool waiting = false, pending = false;
+        for (size_t i = 0; i < tracks.size(); i++) {
+            const Track& t = tracks[i];
+            if (t.queue.empty()) {
+                if (!t.finished) waiting = true;
+                continue;
+            }
+            pending = true;
+            if (next < 0 || t.queue.front().info.presentationTimeUs <
+                            tracks[next].queue.front().info.presentationTimeUs) {
+                next = i;
+            }
+        }
+
+        if (failed || (!pending && !waiting)) break;
+        if (waiting) {
+            changed.wait(lock);
+            continue;
+        }
+
+        Queued sample = tracks[next].queue.front();
+        tracks[next].queue.pop_front();
+        changed.notify_all();
+
+        // The buffer is owned by this thread until released, so write unlocked
+        lock.unlock();
+        int status;
+        {
+            ScopedStage mux(profilerOf(control), PipelineStage::Mux);
+            status = muxer->writeSampleData(next, sample.buffer ? sample.buffer->data() : sample.view, sample.info);
+        }
+        if (control) control->profiler()->count(PipelineStage::Mux, 1, sample.info.size);
+        lock.lock();
+
+        if (sample.buffer) tracks[next].pool->release(sample.buffer);
+        if (status != MEDIA_OK) {
+            LOGE("Failed to write interleaved sample on track %zd, status: %d", next, status);
+            failed = true;
+            changed.notify_all();
+            break;
+        }
+        written++;
+        if (control) control->reportOutputTime(sample.info.presentationTimeUs);
+    }
+
+    // Drop whatever is left after a failure so producers are not left blocked
+    for (Track& t : tracks) {
+        for (const Queued& q : t.queue) {
+            if (q.buffer) t.pool->release(q.buffer);
+        }
+        t.queue.clear();
+    }
+}
+
+int InterleavingMuxer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!started) return MEDIA_ERROR;
+        for (Track& t : tracks) t.finished = true;
+        changed.notify_all();
+    }
+    writer.join();
+    started = false;
+    int status = muxer->stop();
+    return failed ? MEDIA_ERROR : status;
+}
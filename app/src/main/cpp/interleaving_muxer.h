@@ -0,0 +1,84 @@
+#pragma once
+
+#include "job_control.h"
+#include "media_backend.h"
+#include "sample_buffer_pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Muxer front end that lets each track be produced on its own thread. Samples
+// are queued per track in a bounded reorder buffer and a single writer thread
+// hands them to the real muxer in output-PTS order, so the file comes out
+// properly interleaved whatever the relative speed of the producers.
+//
+// Every track that is added must eventually be closed with finishTrack(),
+// otherwise the writer keeps waiting for its next sample.
+class InterleavingMuxer : public MediaMuxer {
+public:
+    InterleavingMuxer(std::unique_ptr<MediaMuxer> muxer, size_t maxQueuedPerTrack);
+    ~InterleavingMuxer() override;
+
+    ssize_t addTrack(const MediaFormat& format) override;
+    int start() override;
+    // Copies data into the track's queue; blocks while the queue is full
+    int writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) override;
+    // Flushes everything queued and stops the underlying muxer
+    int stop() override;
+    bool acceptsSampleViews() const override { return muxer->acceptsSampleViews(); }
+    bool acceptsInBandParameterSets() const override { return muxer->acceptsInBandParameterSets(); }
+
+    // Zero-copy path: fill a pooled buffer and hand it over with submit().
+    // acquire() blocks while the track's queue is full, and returns nullptr
+    // once the writer has failed.
+    SampleBuffer* acquire(size_t track, size_t size);
+    int submit(size_t track, SampleBuffer* buffer, const SampleInfo& info);
+    // Returns an acquired buffer that will not be submitted
+    void discard(size_t track, SampleBuffer* buffer);
+    // Queues a sample that is written from where it lies, e.g. a
+    // MediaExtractor::sampleView(); data must stay valid until stop().
+    // Blocks while the track's queue is full.
+    int submitView(size_t track, const uint8_t* data, const SampleInfo& info);
+    void finishTrack(size_t track);
+
+    // Reports the PTS of every sample written to control, and mux stage stats to its profiler
+    void setControl(JobControl* jobControl) { control = jobControl; }
+
+    size_t samplesWritten() const { return written; }
+
+private:
+    struct Queued {
+        // Pooled copy, or null for a submitted view
+        SampleBuffer* buffer;
+        const uint8_t* view;
+        SampleInfo info;
+    };
+
+    struct Track {
+        std::deque<Queued> queue;
+        // Sized from the track's max input size so a track's buffers never regrow
+        std::unique_ptr<SampleBufferPool> pool;
+        bool finished = false;
+    };
+
+    // Waits for room in the track's queue; false once the writer has failed
+    bool waitForRoom(std::unique_lock<std::mutex>& lock, size_t track);
+    void writerLoop();
+
+    std::unique_ptr<MediaMuxer> muxer;
+    size_t maxQueuedPerTrack;
+    JobControl* control = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    // Guarded by mutex: buffers are acquired by producers and released by the writer
+    std::vector<Track> tracks;
+    std::thread writer;
+    bool started = false;
+    bool failed = false;
+    size_t written = 0;
+};
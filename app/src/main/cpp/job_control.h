@@ -0,0 +1,59 @@
+#pragma once
+
+#include "pipeline_profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+// Shared between a running pipeline and whoever started it. The pipeline
+// reports how far the output has got and what each stage cost, and polls for
+// cancellation from its extraction and codec loops; the owner reads progress
+// and stats and may cancel from any thread.
+class JobControl {
+public:
+    JobControl() = default;
+    // Cancelled with parent as well as on its own, and records into the
+    // parent's stats, so one side of a job can be stopped on its own
+    explicit JobControl(const JobControl* parent) : parent(parent) {}
+
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool isCancelled() const {
+        return cancelled.load(std::memory_order_relaxed) || (parent && parent->isCancelled());
+    }
+
+    void setOutputDuration(int64_t durationUs) { outputDurationUs.store(durationUs, std::memory_order_relaxed); }
+
+    // Called with the PTS of every sample written; progress only moves forward
+    void reportOutputTime(int64_t ptsUs) {
+        int64_t current = outputUs.load(std::memory_order_relaxed);
+        while (ptsUs > current && !outputUs.compare_exchange_weak(current, ptsUs, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Fraction of the output timeline written so far, 0 while the duration is unknown
+    float progress() const {
+        int64_t duration = outputDurationUs.load(std::memory_order_relaxed);
+        if (duration <= 0) return 0.0f;
+        return std::min(1.0f, (float) outputUs.load(std::memory_order_relaxed) / duration);
+    }
+
+    // Instrumentation is bookkeeping, so stages holding a const control can still record into it
+    PipelineProfiler* profiler() const { return parent ? parent->profiler() : &stats; }
+
+private:
+    const JobControl* parent = nullptr;
+    std::atomic<bool> cancelled{false};
+    std::atomic<int64_t> outputDurationUs{0};
+    std::atomic<int64_t> outputUs{0};
+    mutable PipelineProfiler stats;
+};
+
+// Loops take an optional control; nullptr never cancels
+inline bool isCancelled(const JobControl* control) {
+    return control && control->isCancelled();
+}
+
+inline PipelineProfiler* profilerOf(const JobControl* control) {
+    return control ? control->profiler() : nullptr;
+}
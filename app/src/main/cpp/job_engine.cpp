@@ -0,0 +1,122 @@
+#include "job_engine.h"
+#include "editor_log.h"
+
+#include <cstdio>
+
+JobEngine::JobEngine(MediaBackend& backend, size_t workerCount) : backend(backend) {
+    if (workerCount == 0) workerCount = 1;
+    for (size_t i = 0; i < workerCount; i++) {
+        threads.emplace_back(&JobEngine::workerLoop, this);
+    }
+    LOGI("Job engine started with %zu workers", workerCount);
+}
+
+JobEngine::~JobEngine() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (auto& entry : jobs) entry.second->control.cancel();
+        changed.notify_all();
+    }
+    for (std::thread& thread : threads) thread.join();
+}
+
+int64_t JobEngine::submit(JobRequest request) {
+    auto job = std::make_shared<Job>();
+    job->request = std::move(request);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t id = nextId++;
+    job->id = id;
+    jobs[id] = job;
+    queue.push_back(job);
+    changed.notify_all();
+    LOGI("Queued job %lld: %s -> %s", (long long) id, job->request.inputPath.c_str(),
+         job->request.outputPath.c_str());
+    return id;
+}
+
+bool JobEngine::poll(int64_t id, JobStatus* status) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    status->state = it->second->state;
+    status->progress = it->second->state == JobState::Succeeded ? 1.0f : it->second->control.progress();
+    return true;
+}
+
+bool JobEngine::stats(int64_t id, PipelineStats* stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    *stats = it->second->control.profiler()->snapshot();
+    return true;
+}
+
+bool JobEngine::cancel(int64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    it->second->control.cancel();
+    return true;
+}
+
+JobState JobEngine::wait(int64_t id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return JobState::Failed;
+    std::shared_ptr<Job> job = it->second;
+    changed.wait(lock, [&] { return finished(*job); });
+    jobs.erase(id);
+    return job->state;
+}
+
+bool JobEngine::release(int64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    if (finished(*it->second)) {
+        jobs.erase(it);
+    } else {
+        it->second->released = true;
+    }
+    return true;
+}
+
+void JobEngine::finish(const std::shared_ptr<Job>& job, JobState state) {
+    job->state = state;
+    if (job->released) jobs.erase(job->id);
+    changed.notify_all();
+}
+
+void JobEngine::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) break;
+
+        std::shared_ptr<Job> job = queue.front();
+        queue.pop_front();
+        if (job->control.isCancelled()) {
+            finish(job, JobState::Cancelled);
+            continue;
+        }
+        job->state = JobState::Running;
+        lock.unlock();
+
+        PipelineOptions options = job->request.options;
+        options.control = &job->control;
+        int result = processSpeedVideo(backend, job->request.inputPath.c_str(), job->request.outputPath.c_str(),
+                                       job->request.segments, options);
+
+        JobState state = result == 0 ? JobState::Succeeded : JobState::Failed;
+        if (result != 0 && job->control.isCancelled()) {
+            state = JobState::Cancelled;
+            std::remove(job->request.outputPath.c_str());
+            LOGI("Job cancelled, removed %s", job->request.outputPath.c_str());
+        }
+
+        lock.lock();
+        finish(job, state);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "job_control.h"
+#include "media_backend.h"
+#include "segment_timeline.h"
+#include "speed_pipeline.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class JobState {
+    Queued = 0,
+    Running = 1,
+    Succeeded = 2,
+    Failed = 3,
+    Cancelled = 4,
+};
+
+struct JobRequest {
+    std::string inputPath;
+    std::string outputPath;
+    std::vector<Segment> segments;
+    PipelineOptions options;
+};
+
+struct JobStatus {
+    JobState state;
+    // Output timeline written so far, 0..1
+    float progress;
+};
+
+// Runs export jobs on a fixed pool of workers, at most workerCount at once
+// and the rest queued in submission order. The pool is meant to be sized to
+// the hardware codec instances the device can run side by side, since every
+// job holds its own decoders and encoders.
+//
+// Cancelling a queued job removes it before it starts; a running job stops
+// at its next cancellation check and its partial output file is deleted.
+class JobEngine {
+public:
+    JobEngine(MediaBackend& backend, size_t workerCount);
+    // Cancels everything still queued or running and joins the workers
+    ~JobEngine();
+
+    // Returns the new job's id, always > 0
+    int64_t submit(JobRequest request);
+
+    // Returns false for an unknown id
+    bool poll(int64_t id, JobStatus* status);
+    // Per-stage stats so far; final once the job has finished
+    bool stats(int64_t id, PipelineStats* stats);
+    bool cancel(int64_t id);
+
+    // Blocks until the job has finished and forgets it. Returns its final
+    // state, or Failed for an unknown id.
+    JobState wait(int64_t id);
+    // Forgets the job without waiting: at once if it has finished, otherwise
+    // as soon as it does. For owners that will never poll it again. Returns
+    // false for an unknown id.
+    bool release(int64_t id);
+
+    size_t workers() const { return threads.size(); }
+
+private:
+    struct Job {
+        int64_t id = 0;
+        JobRequest request;
+        JobControl control;
+        JobState state = JobState::Queued;
+        bool released = false;
+    };
+
+    static bool finished(const Job& job) {
+        return job.state != JobState::Queued && job.state != JobState::Running;
+    }
+    // Called with mutex held once the job has reached its final state
+    void finish(const std::shared_ptr<Job>& job, JobState state);
+    void workerLoop();
+
+    MediaBackend& backend;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<int64_t, std::shared_ptr<Job>> jobs;
+    std::deque<std::shared_ptr<Job>> queue;
+    int64_t nextId = 1;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Backend-neutral view of the extractor / codec / muxer calls the speed
+// pipeline needs. The shapes follow the NDK AMedia* API one to one so the
+// production backend is a thin wrapper; the host backend reimplements them
+// over plain files so the pipeline can be profiled off-device.
+
+// Status codes, 0 is success like AMEDIA_OK
+constexpr int MEDIA_OK = 0;
+constexpr int MEDIA_ERROR = -1;
+
+// Format keys. Values are the NDK AMEDIAFORMAT_KEY_* strings.
+constexpr const char* MEDIA_KEY_MIME = "mime";
+constexpr const char* MEDIA_KEY_SAMPLE_RATE = "sample-rate";
+constexpr const char* MEDIA_KEY_CHANNEL_COUNT = "channel-count";
+constexpr const char* MEDIA_KEY_BIT_RATE = "bitrate";
+constexpr const char* MEDIA_KEY_AAC_PROFILE = "aac-profile";
+constexpr const char* MEDIA_KEY_MAX_INPUT_SIZE = "max-input-size";
+constexpr const char* MEDIA_KEY_DURATION = "durationUs";
+constexpr const char* MEDIA_KEY_WIDTH = "width";
+constexpr const char* MEDIA_KEY_HEIGHT = "height";
+constexpr const char* MEDIA_KEY_FRAME_RATE = "frame-rate";
+constexpr const char* MEDIA_KEY_I_FRAME_INTERVAL = "i-frame-interval";
+constexpr const char* MEDIA_KEY_COLOR_FORMAT = "color-format";
+constexpr const char* MEDIA_KEY_STRIDE = "stride";
+constexpr const char* MEDIA_KEY_SLICE_HEIGHT = "slice-height";
+constexpr const char* MEDIA_KEY_PROFILE = "profile";
+constexpr const char* MEDIA_KEY_LEVEL = "level";
+// Codec-specific data, e.g. SPS / PPS for AVC, as Annex-B NAL units
+constexpr const char* MEDIA_KEY_CSD_0 = "csd-0";
+constexpr const char* MEDIA_KEY_CSD_1 = "csd-1";
+
+// Raw video layouts (MediaCodecInfo.CodecCapabilities.COLOR_Format*)
+constexpr int32_t COLOR_FORMAT_YUV420_PLANAR = 19;
+constexpr int32_t COLOR_FORMAT_YUV420_SEMI_PLANAR = 21;
+constexpr int32_t COLOR_FORMAT_YUV420_FLEXIBLE = 0x7F420888;
+
+// Extractor sample flags (AMEDIAEXTRACTOR_SAMPLE_FLAG_*)
+constexpr uint32_t SAMPLE_FLAG_SYNC = 1;
+
+// Codec buffer flags (AMEDIACODEC_BUFFER_FLAG_*)
+constexpr uint32_t BUFFER_FLAG_KEY_FRAME = 1;
+constexpr uint32_t BUFFER_FLAG_CODEC_CONFIG = 2;
+constexpr uint32_t BUFFER_FLAG_END_OF_STREAM = 4;
+
+// Negative dequeue results (AMEDIACODEC_INFO_*)
+constexpr ssize_t CODEC_INFO_TRY_AGAIN_LATER = -1;
+constexpr ssize_t CODEC_INFO_OUTPUT_FORMAT_CHANGED = -2;
+constexpr ssize_t CODEC_INFO_OUTPUT_BUFFERS_CHANGED = -3;
+
+enum class MediaSeekMode {
+    PreviousSync,
+    NextSync,
+    ClosestSync,
+};
+
+// Same layout as AMediaCodecBufferInfo
+struct SampleInfo {
+    int32_t offset;
+    int32_t size;
+    int64_t presentationTimeUs;
+    uint32_t flags;
+};
+
+class MediaFormat {
+public:
+    virtual ~MediaFormat() = default;
+
+    virtual bool getInt32(const char* key, int32_t* out) const = 0;
+    virtual bool getInt64(const char* key, int64_t* out) const = 0;
+    virtual bool getString(const char* key, std::string* out) const = 0;
+    virtual bool getBuffer(const char* key, std::vector<uint8_t>* out) const = 0;
+
+    virtual void setInt32(const char* key, int32_t value) = 0;
+    virtual void setInt64(const char* key, int64_t value) = 0;
+    virtual void setString(const char* key, const char* value) = 0;
+    virtual void setBuffer(const char* key, const uint8_t* data, size_t size) = 0;
+};
+
+class MediaExtractor {
+public:
+    virtual ~MediaExtractor() = default;
+
+    virtual size_t getTrackCount() = 0;
+    virtual std::unique_ptr<MediaFormat> getTrackFormat(size_t track) = 0;
+    virtual int selectTrack(size_t track) = 0;
+    virtual int unselectTrack(size_t track) = 0;
+    virtual int seekTo(int64_t timeUs, MediaSeekMode mode) = 0;
+
+    // Returns the number of bytes read, or a negative value at end of stream
+    virtual ssize_t readSampleData(uint8_t* buffer, size_t capacity) = 0;
+    // Size of the current sample without reading it, negative at end of stream
+    virtual ssize_t getSampleSize() = 0;
+    virtual int getSampleTrackIndex() = 0;
+    virtual int64_t getSampleTime() = 0;
+    virtual uint32_t getSampleFlags() = 0;
+    virtual bool advance() = 0;
+
+    // The current sample as stored in the container, valid for the lifetime
+    // of the extractor: AVC / HEVC NAL units keep their 4-byte length
+    // prefixes instead of the Annex-B start codes readSampleData() gives.
+    // nullptr when the extractor has no such view, which is the default.
+    virtual const uint8_t* sampleView(size_t* /* size */) { return nullptr; }
+    // Descriptor of the open source, owned by the extractor; -1 when it reads
+    // from something other than a file
+    virtual int fileDescriptor() const { return -1; }
+};
+
+// Asynchronous codec events, delivered on a codec-owned thread
+struct CodecCallbacks {
+    std::function<void(size_t index)> onInputAvailable;
+    std::function<void(size_t index, const SampleInfo& info)> onOutputAvailable;
+    std::function<void(int error)> onError;
+};
+
+class MediaCodec {
+public:
+    virtual ~MediaCodec() = default;
+
+    // Switches the codec to callback mode. Must be called before configure();
+    // the dequeue calls are not available afterwards.
+    virtual int setCallbacks(const CodecCallbacks& callbacks) = 0;
+
+    virtual int configure(const MediaFormat& format, bool encoder) = 0;
+    // Configures a decoder to render straight to a display surface: an
+    // ANativeWindow* on Android, a HostVideoSurface* on the host backend
+    virtual int configureSurface(const MediaFormat& format, void* surface) = 0;
+    virtual int start() = 0;
+    virtual int stop() = 0;
+    virtual int flush() = 0;
+
+    virtual ssize_t dequeueInputBuffer(int64_t timeoutUs) = 0;
+    virtual uint8_t* getInputBuffer(size_t index, size_t* size) = 0;
+    virtual int queueInputBuffer(size_t index, size_t offset, size_t size,
+                                 int64_t presentationTimeUs, uint32_t flags) = 0;
+
+    virtual ssize_t dequeueOutputBuffer(SampleInfo* info, int64_t timeoutUs) = 0;
+    virtual uint8_t* getOutputBuffer(size_t index, size_t* size) = 0;
+    virtual int releaseOutputBuffer(size_t index, bool render) = 0;
+    // Renders a surface-configured output buffer at a CLOCK_MONOTONIC time
+    virtual int releaseOutputBufferAtTime(size_t index, int64_t renderTimeNs) = 0;
+    virtual std::unique_ptr<MediaFormat> getOutputFormat() = 0;
+};
+
+class MediaMuxer {
+public:
+    virtual ~MediaMuxer() = default;
+
+    // Returns the muxer track index, or a negative value on failure
+    virtual ssize_t addTrack(const MediaFormat& format) = 0;
+    virtual int start() = 0;
+    virtual int writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) = 0;
+    virtual int stop() = 0;
+
+    // Takes MediaExtractor::sampleView() data as well as Annex-B samples
+    virtual bool acceptsSampleViews() const { return false; }
+    // Declares video tracks so that samples may carry parameter sets of
+    // their own (avc3 / hev1); otherwise every sample has to decode with the
+    // parameter sets of the track format alone
+    virtual bool acceptsInBandParameterSets() const { return false; }
+};
+
+// Factory for one media stack. Creation calls return nullptr on failure.
+class MediaBackend {
+public:
+    virtual ~MediaBackend() = default;
+
+    virtual const char* name() const = 0;
+    virtual std::unique_ptr<MediaFormat> createFormat() = 0;
+    virtual std::unique_ptr<MediaExtractor> createExtractor(const char* path) = 0;
+    virtual std::unique_ptr<MediaCodec> createDecoder(const char* mime) = 0;
+    virtual std::unique_ptr<MediaCodec> createEncoder(const char* mime) = 0;
+    virtual std::unique_ptr<MediaMuxer> createMuxer(const char* path) = 0;
+};
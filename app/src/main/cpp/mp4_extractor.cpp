@@ -0,0 +1,623 @@
+#include "mp4_extractor.h"
+#include "editor_log.h"
+#include "nal_units.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint8_t START_CODE[4] = {0, 0, 0, 1};
+
+static uint16_t be16(const uint8_t* p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t be32(const uint8_t* p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint64_t be64(const uint8_t* p) {
+    return (uint64_t) be32(p) << 32 | be32(p + 4);
+}
+
+static constexpr uint32_t fourcc(const char (&s)[5]) {
+    return (uint32_t) s[0] << 24 | (uint32_t) s[1] << 16 | (uint32_t) s[2] << 8 | (uint32_t) s[3];
+}
+
+static int64_t toUs(int64_t value, uint32_t timescale) {
+    return value * 1000000 / timescale;
+}
+
+namespace {
+
+struct Box {
+    uint32_t type;
+    const uint8_t* data;
+    size_t size;
+};
+
+// Walks the boxes of one payload, handling 64-bit and to-the-end sizes
+class BoxReader {
+public:
+    BoxReader(const uint8_t* data, size_t size) : p(data), end(data + size) {}
+
+    bool next(Box* box) {
+        if (end - p < 8) return false;
+        uint64_t size = be32(p);
+        size_t header = 8;
+        if (size == 1) {
+            if (end - p < 16) return false;
+            size = be64(p + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = end - p;
+        }
+        if (size < header || size > (uint64_t) (end - p)) return false;
+        box->type = be32(p + 4);
+        box->data = p + header;
+        box->size = (size_t) size - header;
+        p += size;
+        return true;
+    }
+
+    bool find(uint32_t type, Box* box) {
+        while (next(box)) {
+            if (box->type == type) return true;
+        }
+        return false;
+    }
+
+private:
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+bool findChild(const Box& parent, uint32_t type, Box* box) {
+    return BoxReader(parent.data, parent.size).find(type, box);
+}
+
+// MPEG-4 descriptor header: a tag and a length of up to four 7-bit groups
+bool readDescriptor(const uint8_t*& p, const uint8_t* end, uint8_t* tag, size_t* length) {
+    if (p >= end) return false;
+    *tag = *p++;
+    *length = 0;
+    for (int i = 0; i < 4; i++) {
+        if (p >= end) return false;
+        uint8_t b = *p++;
+        *length = *length << 7 | (b & 0x7f);
+        if (!(b & 0x80)) break;
+    }
+    return *length <= (size_t) (end - p);
+}
+
+} // namespace
+
+// Expands one trak into the per-sample table of a Track
+class Mp4Extractor::Parser {
+public:
+    Parser(const uint8_t* file, size_t fileSize, uint32_t movieTimescale)
+            : file(file), fileSize(fileSize), movieTimescale(movieTimescale) {}
+
+    // 1 if the trak became a track, 0 if it is not audio or video, -1 if malformed
+    int parseTrak(const Box& trak, Track* track) {
+        Box mdia, mdhd, hdlr, minf, stbl;
+        if (!findChild(trak, fourcc("mdia"), &mdia) || !findChild(mdia, fourcc("mdhd"), &mdhd) ||
+            !findChild(mdia, fourcc("hdlr"), &hdlr) || hdlr.size < 12) {
+            return -1;
+        }
+        uint32_t handler = be32(hdlr.data + 8);
+        if (handler != fourcc("vide") && handler != fourcc("soun")) return 0;
+        if (!findChild(mdia, fourcc("minf"), &minf) || !findChild(minf, fourcc("stbl"), &stbl)) return -1;
+
+        uint64_t mediaDuration;
+        if (mdhd.size >= 32 && mdhd.data[0] == 1) {
+            timescale = be32(mdhd.data + 20);
+            mediaDuration = be64(mdhd.data + 24);
+        } else if (mdhd.size >= 20) {
+            timescale = be32(mdhd.data + 12);
+            mediaDuration = be32(mdhd.data + 16);
+        } else {
+            return -1;
+        }
+        if (timescale == 0) return -1;
+        track->durationUs = toUs((int64_t) mediaDuration, timescale);
+
+        readEditList(trak);
+        int described = readSampleDescription(stbl, track);
+        if (described <= 0) return described;
+        return readSampleTables(stbl, track) ? 1 : -1;
+    }
+
+private:
+    // Only the common shape is honoured: optional leading empty edits, then
+    // one edit whose media time maps to the start of the presentation
+    void readEditList(const Box& trak) {
+        Box edts, elst;
+        if (!findChild(trak, fourcc("edts"), &edts) || !findChild(edts, fourcc("elst"), &elst) || elst.size < 8) {
+            return;
+        }
+        bool wide = elst.data[0] == 1;
+        size_t entrySize = wide ? 20 : 12;
+        uint32_t count = be32(elst.data + 4);
+        if ((uint64_t) count * entrySize > elst.size - 8 || movieTimescale == 0) return;
+        for (uint32_t i = 0; i < count; i++) {
+            const uint8_t* entry = elst.data + 8 + i * entrySize;
+            uint64_t segmentDuration = wide ? be64(entry) : be32(entry);
+            int64_t mediaTime = wide ? (int64_t) be64(entry + 8) : (int32_t) be32(entry + 4);
+            if (mediaTime == -1) {
+                emptyUs += toUs((int64_t) segmentDuration, movieTimescale);
+                continue;
+            }
+            editMediaTime = mediaTime;
+            break;
+        }
+    }
+
+    int readSampleDescription(const Box& stbl, Track* track) {
+        Box stsd, entry;
+        if (!findChild(stbl, fourcc("stsd"), &stsd) || stsd.size < 8) return -1;
+        if (!BoxReader(stsd.data + 8, stsd.size - 8).next(&entry)) return -1;
+
+        switch (entry.type) {
+            case fourcc("avc1"):
+            case fourcc("avc3"):
+                track->mime = "video/avc";
+                return readVisualEntry(entry, fourcc("avcC"), track);
+            case fourcc("hvc1"):
+            case fourcc("hev1"):
+                track->mime = "video/hevc";
+                return readVisualEntry(entry, fourcc("hvcC"), track);
+            case fourcc("mp4v"):
+                track->mime = "video/mp4v-es";
+                return readVisualEntry(entry, 0, track);
+            case fourcc("vp09"):
+                track->mime = "video/x-vnd.on2.vp9";
+                return readVisualEntry(entry, 0, track);
+            case fourcc("av01"):
+                track->mime = "video/av01";
+                return readVisualEntry(entry, 0, track);
+            case fourcc("mp4a"):
+                return readAudioEntry(entry, track);
+            case fourcc("sowt"):
+                track->mime = "audio/raw";
+                return readAudioEntry(entry, track);
+            default:
+                return 0;
+        }
+    }
+
+    int readVisualEntry(const Box& entry, uint32_t configType, Track* track) {
+        // VisualSampleEntry fields take 78 bytes before the child boxes
+        if (entry.size < 78) return -1;
+        track->width = be16(entry.data + 24);
+        track->height = be16(entry.data + 26);
+        if (!configType) return 1;
+
+        Box config;
+        Box children = {entry.type, entry.data + 78, entry.size - 78};
+        if (!findChild(children, configType, &config)) return -1;
+        return configType == fourcc("avcC") ? readAvcConfig(config, track) : readHevcConfig(config, track);
+    }
+
+    // avcC: SPS go to csd-0 and PPS to csd-1, as Annex-B
+    static int readAvcConfig(const Box& config, Track* track) {
+        const uint8_t* p = config.data;
+        const uint8_t* end = p + config.size;
+        if (config.size < 6) return -1;
+        track->nalLengthSize = (p[4] & 3) + 1;
+        p += 5;
+        for (std::vector<uint8_t>* csd : {&track->csd0, &track->csd1}) {
+            if (p >= end) return -1;
+            int count = csd == &track->csd0 ? *p & 0x1f : *p;
+            p++;
+            for (int i = 0; i < count; i++) {
+                if (end - p < 2 || be16(p) > end - p - 2) return -1;
+                size_t length = be16(p);
+                csd->insert(csd->end(), START_CODE, START_CODE + 4);
+                csd->insert(csd->end(), p + 2, p + 2 + length);
+                p += 2 + length;
+            }
+        }
+        return 1;
+    }
+
+    // hvcC: every VPS, SPS and PPS in one csd-0, as Annex-B
+    static int readHevcConfig(const Box& config, Track* track) {
+        if (config.size < 23) return -1;
+        track->nalLengthSize = (config.data[21] & 3) + 1;
+        const uint8_t* p = config.data + 23;
+        const uint8_t* end = config.data + config.size;
+        for (int array = 0; array < config.data[22]; array++) {
+            if (end - p < 3) return -1;
+            int count = be16(p + 1);
+            p += 3;
+            for (int i = 0; i < count; i++) {
+                if (end - p < 2 || be16(p) > end - p - 2) return -1;
+                size_t length = be16(p);
+                track->csd0.insert(track->csd0.end(), START_CODE, START_CODE + 4);
+                track->csd0.insert(track->csd0.end(), p + 2, p + 2 + length);
+                p += 2 + length;
+            }
+        }
+        return 1;
+    }
+
+    int readAudioEntry(const Box& entry, Track* track) {
+        // AudioSampleEntry is 28 bytes; QuickTime sound descriptions v1 and v2 are longer
+        if (entry.size < 28) return -1;
+        uint16_t version = be16(entry.data + 8);
+        size_t fields = version == 1 ? 44 : version == 2 ? 64 : 28;
+        if (entry.size < fields) return -1;
+        track->channels = be16(entry.data + 16);
+        track->sampleRate = (int32_t) (be32(entry.data + 24) >> 16);
+        if (entry.type != fourcc("mp4a")) return 1;
+
+        // MOV files keep esds inside a wave box
+        Box children = {entry.type, entry.data + fields, entry.size - fields};
+        Box esds, wave;
+        if (!findChild(children, fourcc("esds"), &esds) &&
+            !(findChild(children, fourcc("wave"), &wave) && findChild(wave, fourcc("esds"), &esds))) {
+            return -1;
+        }
+        return readEsds(esds, track);
+    }
+
+    static int readEsds(const Box& esds, Track* track) {
+        if (esds.size < 4) return -1;
+        const uint8_t* p = esds.data + 4;
+        const uint8_t* end = esds.data + esds.size;
+        uint8_t tag;
+        size_t length;
+        if (!readDescriptor(p, end, &tag, &length) || tag != 0x03 || length < 3) return -1;
+        end = p + length;
+        uint8_t esFlags = p[2];
+        p += 3;
+        if (esFlags & 0x80) p += 2;
+        if ((esFlags & 0x40) && p < end) p += 1 + *p;
+        if (esFlags & 0x20) p += 2;
+        if (p >= end || !readDescriptor(p, end, &tag, &length) || tag != 0x04 || length < 13) return -1;
+
+        uint8_t objectType = p[0];
+        track->bitRate = (int32_t) be32(p + 9);
+        const uint8_t* configEnd = p + length;
+        p += 13;
+        if (objectType == 0x40 || objectType == 0x66 || objectType == 0x67 || objectType == 0x68) {
+            track->mime = "audio/mp4a-latm";
+        } else if (objectType == 0x69 || objectType == 0x6b) {
+            track->mime = "audio/mpeg";
+        } else {
+            return 0;
+        }
+        if (p < configEnd && readDescriptor(p, configEnd, &tag, &length) && tag == 0x05) {
+            track->csd0.assign(p, p + length);
+        }
+        return 1;
+    }
+
+    bool readSampleTables(const Box& stbl, Track* track) {
+        Box stsz, stsc, stco, stts, ctts, stss;
+        bool wideOffsets = false;
+        if (!findChild(stbl, fourcc("stco"), &stco)) {
+            if (!findChild(stbl, fourcc("co64"), &stco)) return false;
+            wideOffsets = true;
+        }
+        if (!findChild(stbl, fourcc("stsz"), &stsz) || !findChild(stbl, fourcc("stsc"), &stsc) ||
+            !findChild(stbl, fourcc("stts"), &stts) || stsz.size < 12 || stsc.size < 8 || stco.size < 8 ||
+            stts.size < 8) {
+            return false;
+        }
+
+        // Sizes
+        uint32_t fixedSize = be32(stsz.data + 4);
+        uint32_t count = be32(stsz.data + 8);
+        if (fixedSize == 0 && (uint64_t) count * 4 > stsz.size - 12) return false;
+        std::vector<Sample>& samples = track->samples;
+        samples.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            samples[i].size = fixedSize ? fixedSize : be32(stsz.data + 12 + i * 4);
+            samples[i].flags = SAMPLE_FLAG_SYNC;
+            track->maxSampleSize = std::max(track->maxSampleSize, samples[i].size);
+        }
+
+        // Offsets: chunks are laid out by stsc runs, samples follow each other in a chunk
+        size_t offsetSize = wideOffsets ? 8 : 4;
+        uint32_t chunkCount = be32(stco.data + 4);
+        uint32_t runCount = be32(stsc.data + 4);
+        if ((uint64_t) chunkCount * offsetSize > stco.size - 8 || (uint64_t) runCount * 12 > stsc.size - 8) {
+            return false;
+        }
+        uint32_t sample = 0;
+        for (uint32_t run = 0; run < runCount && sample < count; run++) {
+            const uint8_t* entry = stsc.data + 8 + run * 12;
+            uint32_t firstChunk = be32(entry);
+            uint32_t perChunk = be32(entry + 4);
+            uint32_t lastChunk = run + 1 < runCount ? be32(entry + 12) - 1 : chunkCount;
+            if (firstChunk == 0 || lastChunk > chunkCount) return false;
+            for (uint32_t chunk = firstChunk; chunk <= lastChunk && sample < count; chunk++) {
+                const uint8_t* p = stco.data + 8 + (chunk - 1) * offsetSize;
+                uint64_t offset = wideOffsets ? be64(p) : be32(p);
+                for (uint32_t i = 0; i < perChunk && sample < count; i++, sample++) {
+                    // A co64 offset near 2^64 would wrap offset + size past the check
+                    if (offset > fileSize || samples[sample].size > fileSize - offset) return false;
+                    samples[sample].offset = offset;
+                    // At most fileSize now, so this cannot wrap either
+                    offset += samples[sample].size;
+                }
+            }
+        }
+        if (sample < count) return false;
+
+        // Decode times
+        uint32_t timeRuns = be32(stts.data + 4);
+        if ((uint64_t) timeRuns * 8 > stts.size - 8) return false;
+        int64_t dts = 0;
+        sample = 0;
+        for (uint32_t run = 0; run < timeRuns && sample < count; run++) {
+            uint32_t runLength = be32(stts.data + 8 + run * 8);
+            uint32_t delta = be32(stts.data + 12 + run * 8);
+            for (uint32_t i = 0; i < runLength && sample < count; i++, sample++) {
+                samples[sample].dtsUs = dts;
+                dts += delta;
+            }
+        }
+        if (sample < count) return false;
+
+        // Composition offsets are read as signed whatever the box version, as
+        // writers put negative offsets in version 0 boxes too
+        std::vector<int32_t> offsets;
+        if (findChild(stbl, fourcc("ctts"), &ctts) && ctts.size >= 8) {
+            uint32_t offsetRuns = be32(ctts.data + 4);
+            if ((uint64_t) offsetRuns * 8 > ctts.size - 8) return false;
+            offsets.reserve(count);
+            for (uint32_t run = 0; run < offsetRuns && offsets.size() < count; run++) {
+                uint32_t runLength = be32(ctts.data + 8 + run * 8);
+                int32_t offset = (int32_t) be32(ctts.data + 12 + run * 8);
+                for (uint32_t i = 0; i < runLength && offsets.size() < count; i++) offsets.push_back(offset);
+            }
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            int64_t decode = samples[i].dtsUs - editMediaTime;
+            int64_t composition = decode + (i < offsets.size() ? offsets[i] : 0);
+            samples[i].dtsUs = toUs(decode, timescale) + emptyUs;
+            samples[i].ptsUs = toUs(composition, timescale) + emptyUs;
+        }
+
+        // Without stss every sample is a sync sample
+        if (findChild(stbl, fourcc("stss"), &stss) && stss.size >= 8) {
+            uint32_t syncCount = be32(stss.data + 4);
+            if ((uint64_t) syncCount * 4 > stss.size - 8) return false;
+            for (Sample& s : samples) s.flags = 0;
+            for (uint32_t i = 0; i < syncCount; i++) {
+                uint32_t number = be32(stss.data + 8 + i * 4);
+                if (number == 0 || number > count) return false;
+                samples[number - 1].flags = SAMPLE_FLAG_SYNC;
+                track->syncSamples.push_back(number - 1);
+            }
+            std::sort(track->syncSamples.begin(), track->syncSamples.end());
+        }
+        return true;
+    }
+
+    const uint8_t* file;
+    size_t fileSize;
+    uint32_t movieTimescale;
+    uint32_t timescale = 0;
+    int64_t emptyUs = 0;
+    int64_t editMediaTime = 0;
+};
+
+Mp4Extractor::~Mp4Extractor() {
+    if (mapped) munmap(const_cast<uint8_t*>(mapped), mappedSize);
+}
+
+std::unique_ptr<Mp4Extractor> Mp4Extractor::open(MediaBackend& backend, int fd) {
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void* data = MAP_FAILED;
+    // Sources that do not fit the address space, e.g. on 32-bit devices, stay with the backend
+    if (fstat(fd, &st) == 0 && st.st_size >= 8 && (uint64_t) st.st_size <= SIZE_MAX) {
+        data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (data == MAP_FAILED) return nullptr;
+
+    std::unique_ptr<Mp4Extractor> extractor(new Mp4Extractor(backend));
+    extractor->mapped = static_cast<const uint8_t*>(data);
+    extractor->mappedSize = (size_t) st.st_size;
+    madvise(data, extractor->mappedSize, MADV_SEQUENTIAL);
+
+    // Only box headers are touched here; mdat is never read at open
+    BoxReader top(extractor->mapped, extractor->mappedSize);
+    Box box, moov = {0, nullptr, 0};
+    bool isMp4 = false;
+    while (top.next(&box)) {
+        if (box.type == fourcc("ftyp") || box.type == fourcc("moov")) isMp4 = true;
+        if (box.type == fourcc("moov")) moov = box;
+        if (box.type == fourcc("moof")) return nullptr;
+    }
+    Box mvex, mvhd;
+    if (!isMp4 || !moov.data || findChild(moov, fourcc("mvex"), &mvex) || !findChild(moov, fourcc("mvhd"), &mvhd) ||
+        mvhd.size < 20) {
+        return nullptr;
+    }
+    uint32_t movieTimescale = mvhd.data[0] == 1 ? (mvhd.size >= 24 ? be32(mvhd.data + 20) : 0) : be32(mvhd.data + 12);
+
+    BoxReader traks(moov.data, moov.size);
+    while (traks.find(fourcc("trak"), &box)) {
+        Track track;
+        Parser parser(extractor->mapped, extractor->mappedSize, movieTimescale);
+        int parsed = parser.parseTrak(box, &track);
+        if (parsed < 0) {
+            LOGE("Unsupported or malformed trak in fd %d", fd);
+            return nullptr;
+        }
+        if (parsed > 0 && !track.samples.empty()) extractor->tracks.push_back(std::move(track));
+    }
+    if (extractor->tracks.empty()) return nullptr;
+    LOGI("Mapped fd %d: %zu tracks, %lld bytes", fd, extractor->tracks.size(), (long long) st.st_size);
+    return extractor;
+}
+
+std::unique_ptr<MediaFormat> Mp4Extractor::getTrackFormat(size_t track) {
+    if (track >= tracks.size()) return nullptr;
+    const Track& t = tracks[track];
+    std::unique_ptr<MediaFormat> format = backend.createFormat();
+    format->setString(MEDIA_KEY_MIME, t.mime.c_str());
+    format->setInt64(MEDIA_KEY_DURATION, t.durationUs);
+    // Start codes may be longer than the length prefixes they replace
+    size_t maxSize = t.maxSampleSize;
+    if (t.nalLengthSize > 0 && t.nalLengthSize < 4) maxSize += maxSize / (t.nalLengthSize + 1) * (4 - t.nalLengthSize);
+    format->setInt32(MEDIA_KEY_MAX_INPUT_SIZE, (int32_t) maxSize);
+    if (t.mime.compare(0, 6, "video/") == 0) {
+        format->setInt32(MEDIA_KEY_WIDTH, t.width);
+        format->setInt32(MEDIA_KEY_HEIGHT, t.height);
+        if (t.durationUs > 0) {
+            format->setInt32(MEDIA_KEY_FRAME_RATE,
+                             (int32_t) ((t.samples.size() * 1000000 + t.durationUs / 2) / t.durationUs));
+        }
+    } else {
+        format->setInt32(MEDIA_KEY_SAMPLE_RATE, t.sampleRate);
+        format->setInt32(MEDIA_KEY_CHANNEL_COUNT, t.channels);
+        if (t.bitRate > 0) format->setInt32(MEDIA_KEY_BIT_RATE, t.bitRate);
+        if (t.mime == "audio/mp4a-latm" && !t.csd0.empty()) {
+            format->setInt32(MEDIA_KEY_AAC_PROFILE, t.csd0[0] >> 3);
+        }
+    }
+    if (!t.csd0.empty()) format->setBuffer(MEDIA_KEY_CSD_0, t.csd0.data(), t.csd0.size());
+    if (!t.csd1.empty()) format->setBuffer(MEDIA_KEY_CSD_1, t.csd1.data(), t.csd1.size());
+    return format;
+}
+
+int Mp4Extractor::selectTrack(size_t track) {
+    if (track >= tracks.size()) return MEDIA_ERROR;
+    tracks[track].selected = true;
+    updateCurrent();
+    return MEDIA_OK;
+}
+
+int Mp4Extractor::unselectTrack(size_t track) {
+    if (track >= tracks.size()) return MEDIA_ERROR;
+    tracks[track].selected = false;
+    updateCurrent();
+    return MEDIA_OK;
+}
+
+// Sync samples are taken to have increasing PTS in decode order, which holds
+// for every GOP structure encoders emit
+size_t Mp4Extractor::findSync(const Track& track, int64_t timeUs, MediaSeekMode mode) const {
+    bool allSync = track.syncSamples.empty();
+    size_t count = allSync ? track.samples.size() : track.syncSamples.size();
+    auto sampleAt = [&](size_t k) { return allSync ? k : (size_t) track.syncSamples[k]; };
+    auto ptsAt = [&](size_t k) { return track.samples[sampleAt(k)].ptsUs; };
+
+    // First candidate with PTS > timeUs, and the first with PTS >= timeUs
+    size_t after = 0, atOrAfter = 0;
+    for (size_t low = 0, high = count; low < high;) {
+        size_t mid = (low + high) / 2;
+        if (ptsAt(mid) <= timeUs) low = after = mid + 1; else high = mid;
+    }
+    atOrAfter = after > 0 && ptsAt(after - 1) == timeUs ? after - 1 : after;
+
+    size_t before = after > 0 ? after - 1 : 0;
+    switch (mode) {
+        case MediaSeekMode::PreviousSync:
+            return sampleAt(before);
+        case MediaSeekMode::NextSync:
+            return atOrAfter < count ? sampleAt(atOrAfter) : track.samples.size();
+        case MediaSeekMode::ClosestSync:
+        default:
+            if (atOrAfter >= count || after == 0) return sampleAt(std::min(before, count - 1));
+            return timeUs - ptsAt(before) <= ptsAt(atOrAfter) - timeUs ? sampleAt(before) : sampleAt(atOrAfter);
+    }
+}
+
+int Mp4Extractor::seekTo(int64_t timeUs, MediaSeekMode mode) {
+    for (Track& track : tracks) {
+        if (track.selected) track.cursor = findSync(track, timeUs, mode);
+    }
+    updateCurrent();
+    return MEDIA_OK;
+}
+
+void Mp4Extractor::updateCurrent() {
+    current = -1;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        const Track& t = tracks[i];
+        if (!t.selected || t.cursor >= t.samples.size()) continue;
+        if (current < 0 || t.samples[t.cursor].dtsUs < tracks[current].samples[tracks[current].cursor].dtsUs) {
+            current = (int) i;
+        }
+    }
+}
+
+const Mp4Extractor::Sample* Mp4Extractor::currentSample() const {
+    return current < 0 ? nullptr : &tracks[current].samples[tracks[current].cursor];
+}
+
+size_t Mp4Extractor::annexBSize(const Track& track, const Sample& sample) const {
+    size_t units;
+    if (track.nalLengthSize == 0 || track.nalLengthSize == 4 ||
+        !tilesAsNalUnits(mapped + sample.offset, sample.size, track.nalLengthSize, &units)) {
+        return sample.size;
+    }
+    return sample.size + units * (4 - track.nalLengthSize);
+}
+
+ssize_t Mp4Extractor::readSampleData(uint8_t* buffer, size_t capacity) {
+    const Sample* sample = currentSample();
+    if (!sample) return MEDIA_ERROR;
+    const Track& track = tracks[current];
+    const uint8_t* src = mapped + sample->offset;
+    size_t units;
+    if (track.nalLengthSize == 0 || !tilesAsNalUnits(src, sample->size, track.nalLengthSize, &units)) {
+        // Not NAL units, or not a clean run of them: handed out as stored
+        if (capacity < sample->size) return MEDIA_ERROR;
+        memcpy(buffer, src, sample->size);
+        return sample->size;
+    }
+
+    size_t size = sample->size + units * (4 - track.nalLengthSize);
+    if (capacity < size) return MEDIA_ERROR;
+    uint8_t* out = buffer;
+    for (size_t pos = 0; pos < sample->size;) {
+        size_t length = 0;
+        for (int i = 0; i < track.nalLengthSize; i++) length = length << 8 | src[pos + i];
+        pos += track.nalLengthSize;
+        memcpy(out, START_CODE, 4);
+        memcpy(out + 4, src + pos, length);
+        out += 4 + length;
+        pos += length;
+    }
+    return size;
+}
+
+const uint8_t* Mp4Extractor::sampleView(size_t* size) {
+    const Sample* sample = currentSample();
+    // Consumers of views expect 4-byte length prefixes
+    if (!sample || (tracks[current].nalLengthSize != 0 && tracks[current].nalLengthSize != 4)) return nullptr;
+    *size = sample->size;
+    return mapped + sample->offset;
+}
+
+ssize_t Mp4Extractor::getSampleSize() {
+    const Sample* sample = currentSample();
+    return sample ? (ssize_t) annexBSize(tracks[current], *sample) : MEDIA_ERROR;
+}
+
+int64_t Mp4Extractor::getSampleTime() {
+    const Sample* sample = currentSample();
+    return sample ? sample->ptsUs : -1;
+}
+
+uint32_t Mp4Extractor::getSampleFlags() {
+    const Sample* sample = currentSample();
+    return sample ? sample->flags : 0;
+}
+
+bool Mp4Extractor::advance() {
+    if (current < 0) return false;
+    tracks[current].cursor++;
+    updateCurrent();
+    return current >= 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "media_backend.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ISO-BMFF (MP4 / MOV) demuxer over a memory-mapped file. The sample tables
+// of every trak (stsz, stsc, stco / co64, stts, ctts, stss) are expanded once
+// at open, after which a sample is an offset into the mapping: sampleView()
+// hands it out in place, and readSampleData() is a single copy that turns the
+// NAL length prefixes into start codes like AMediaExtractor does.
+//
+// Tracks are the vide and soun traks in file order, which is how the NDK
+// extractor numbers the files it can play. Fragmented files (moof) are not
+// supported; open() returns nullptr for them so the caller can fall back to
+// the backend's extractor.
+class Mp4Extractor : public MediaExtractor {
+public:
+    ~Mp4Extractor() override;
+
+    // Maps the file open on fd, which stays with the caller and may be closed
+    // once this returns. Formats are created through backend. nullptr if fd
+    // cannot be mapped or is not an unfragmented ISO-BMFF file.
+    static std::unique_ptr<Mp4Extractor> open(MediaBackend& backend, int fd);
+
+    size_t getTrackCount() override { return tracks.size(); }
+    std::unique_ptr<MediaFormat> getTrackFormat(size_t track) override;
+    int selectTrack(size_t track) override;
+    int unselectTrack(size_t track) override;
+    int seekTo(int64_t timeUs, MediaSeekMode mode) override;
+
+    ssize_t readSampleData(uint8_t* buffer, size_t capacity) override;
+    ssize_t getSampleSize() override;
+    int getSampleTrackIndex() override { return current; }
+    int64_t getSampleTime() override;
+    uint32_t getSampleFlags() override;
+    bool advance() override;
+    const uint8_t* sampleView(size_t* size) override;
+
+private:
+    struct Sample {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t flags;
+        int64_t dtsUs;
+        int64_t ptsUs;
+    };
+
+    struct Track {
+        std::string mime;
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t sampleRate = 0;
+        int32_t channels = 0;
+        int32_t bitRate = 0;
+        int64_t durationUs = 0;
+        // Annex-B parameter sets for AVC / HEVC, the AudioSpecificConfig for AAC
+        std::vector<uint8_t> csd0;
+        std::vector<uint8_t> csd1;
+        // 1, 2 or 4 for NAL unit tracks, 0 when samples are not NAL units
+        int nalLengthSize = 0;
+        uint32_t maxSampleSize = 0;
+        std::vector<Sample> samples;
+        // Decode-order indices of the sync samples, empty when every sample is one
+        std::vector<uint32_t> syncSamples;
+        bool selected = false;
+        size_t cursor = 0;
+    };
+
+    class Parser;
+
+    Mp4Extractor(MediaBackend& backend) : backend(backend) {}
+    // Picks the selected track whose next sample has the lowest decode time
+    void updateCurrent();
+    size_t findSync(const Track& track, int64_t timeUs, MediaSeekMode mode) const;
+    const Sample* currentSample() const;
+    // Size once every length prefix is replaced by a 4-byte start code
+    size_t annexBSize(const Track& track, const Sample& sample) const;
+
+    MediaBackend& backend;
+    const uint8_t* mapped = nullptr;
+    size_t mappedSize = 0;
+    std::vector<Track> tracks;
+    int current = -1;
+};
@@ -0,0 +1,47 @@
+#include "nal_units.h"
+
+bool tilesAsNalUnits(const uint8_t* data, size_t size, int lengthSize, size_t* count) {
+    size_t pos = 0, units = 0;
+    while (pos < size) {
+        if (size - pos < (size_t) lengthSize) return false;
+        size_t length = 0;
+        for (int i = 0; i < lengthSize; i++) length = length << 8 | data[pos + i];
+        pos += lengthSize;
+        if (length == 0 || length > size - pos) return false;
+        pos += length;
+        units++;
+    }
+    if (count) *count = units;
+    return units > 0;
+}
+
+bool isAnnexB(const uint8_t* data, size_t size) {
+    bool startCode = (size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+                     (size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+    return startCode && !tilesAsNalUnits(data, size, 4);
+}
+
+bool nextNalUnit(const uint8_t* data, size_t size, bool annexB, size_t* pos, const uint8_t** nal, size_t* nalSize) {
+    if (annexB) {
+        size_t i = *pos;
+        while (i + 3 <= size && !(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)) i++;
+        if (i + 3 > size) return false;
+        size_t start = i + 3;
+        size_t end = start;
+        while (end + 3 <= size && !(data[end] == 0 && data[end + 1] == 0 && data[end + 2] <= 1)) end++;
+        if (end + 3 > size) end = size;
+        *nal = data + start;
+        *nalSize = end - start;
+        *pos = end;
+        return true;
+    }
+
+    if (*pos + 4 > size) return false;
+    size_t length = ((size_t) data[*pos] << 24) | ((size_t) data[*pos + 1] << 16) |
+                    ((size_t) data[*pos + 2] << 8) | data[*pos + 3];
+    if (length == 0 || *pos + 4 + length > size) return false;
+    *nal = data + *pos + 4;
+    *nalSize = length;
+    *pos += 4 + length;
+    return true;
+}
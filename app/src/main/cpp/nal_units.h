@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// H.264 / HEVC access unit framing. Samples reach the muxers either Annex-B
+// (start codes, from MediaExtractor::readSampleData() and encoders) or with
+// the 4-byte length prefixes they have inside an MP4 (sampleView()).
+
+// True if data is a run of NAL units with lengthSize-byte big-endian length
+// prefixes ending exactly at size; count receives the number of units
+bool tilesAsNalUnits(const uint8_t* data, size_t size, int lengthSize, size_t* count = nullptr);
+
+// Starts with a start code and is not a clean 4-byte length-prefixed run: a
+// unit of 256 to 511 bytes has a length prefix that looks like a start code
+bool isAnnexB(const uint8_t* data, size_t size);
+
+// Steps to the next NAL unit, returning false when there is none left.
+// Trailing zero bytes before a start code are not part of the unit.
+bool nextNalUnit(const uint8_t* data, size_t size, bool annexB, size_t* pos, const uint8_t** nal, size_t* nalSize);
@@ -0,0 +1,316 @@
+#include "ndk_media_backend.h"
+#include "editor_log.h"
+
+#include <media/NdkMediaExtractor.h>
+#include <media/NdkMediaCodec.h>
+#include <media/NdkMediaMuxer.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+NdkMediaFormat::~NdkMediaFormat() {
+    if (format) {
+        AMediaFormat_delete(format);
+    }
+}
+
+bool NdkMediaFormat::getInt32(const char* key, int32_t* out) const {
+    return AMediaFormat_getInt32(format, key, out);
+}
+
+bool NdkMediaFormat::getInt64(const char* key, int64_t* out) const {
+    return AMediaFormat_getInt64(format, key, out);
+}
+
+bool NdkMediaFormat::getString(const char* key, std::string* out) const {
+    const char* value;
+    if (!AMediaFormat_getString(format, key, &value)) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+bool NdkMediaFormat::getBuffer(const char* key, std::vector<uint8_t>* out) const {
+    void* data;
+    size_t size;
+    if (!AMediaFormat_getBuffer(format, key, &data, &size)) {
+        return false;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out->assign(bytes, bytes + size);
+    return true;
+}
+
+void NdkMediaFormat::setInt32(const char* key, int32_t value) {
+    AMediaFormat_setInt32(format, key, value);
+}
+
+void NdkMediaFormat::setInt64(const char* key, int64_t value) {
+    AMediaFormat_setInt64(format, key, value);
+}
+
+void NdkMediaFormat::setString(const char* key, const char* value) {
+    AMediaFormat_setString(format, key, value);
+}
+
+void NdkMediaFormat::setBuffer(const char* key, const uint8_t* data, size_t size) {
+    AMediaFormat_setBuffer(format, key, data, size);
+}
+
+namespace {
+
+class NdkMediaExtractor : public MediaExtractor {
+public:
+    NdkMediaExtractor(AMediaExtractor* extractor, int fd) : extractor(extractor), fd(fd) {}
+
+    ~NdkMediaExtractor() override {
+        AMediaExtractor_delete(extractor);
+        close(fd);
+    }
+
+    size_t getTrackCount() override {
+        return AMediaExtractor_getTrackCount(extractor);
+    }
+
+    std::unique_ptr<MediaFormat> getTrackFormat(size_t track) override {
+        AMediaFormat* fmt = AMediaExtractor_getTrackFormat(extractor, track);
+        if (!fmt) return nullptr;
+        return std::make_unique<NdkMediaFormat>(fmt);
+    }
+
+    int selectTrack(size_t track) override {
+        return AMediaExtractor_selectTrack(extractor, track);
+    }
+
+    int unselectTrack(size_t track) override {
+        return AMediaExtractor_unselectTrack(extractor, track);
+    }
+
+    int seekTo(int64_t timeUs, MediaSeekMode mode) override {
+        SeekMode ndkMode = AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC;
+        if (mode == MediaSeekMode::PreviousSync) {
+            ndkMode = AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC;
+        } else if (mode == MediaSeekMode::NextSync) {
+            ndkMode = AMEDIAEXTRACTOR_SEEK_NEXT_SYNC;
+        }
+        return AMediaExtractor_seekTo(extractor, timeUs, ndkMode);
+    }
+
+    ssize_t readSampleData(uint8_t* buffer, size_t capacity) override {
+        return AMediaExtractor_readSampleData(extractor, buffer, capacity);
+    }
+
+    ssize_t getSampleSize() override {
+        return AMediaExtractor_getSampleSize(extractor);
+    }
+
+    int getSampleTrackIndex() override {
+        return AMediaExtractor_getSampleTrackIndex(extractor);
+    }
+
+    int64_t getSampleTime() override {
+        return AMediaExtractor_getSampleTime(extractor);
+    }
+
+    uint32_t getSampleFlags() override {
+        return AMediaExtractor_getSampleFlags(extractor);
+    }
+
+    bool advance() override {
+        return AMediaExtractor_advance(extractor);
+    }
+
+    int fileDescriptor() const override {
+        return fd;
+    }
+
+private:
+    AMediaExtractor* extractor;
+    int fd;
+};
+
+class NdkMediaCodec : public MediaCodec {
+public:
+    explicit NdkMediaCodec(AMediaCodec* codec) : codec(codec) {}
+
+    ~NdkMediaCodec() override {
+        AMediaCodec_delete(codec);
+    }
+
+    int setCallbacks(const CodecCallbacks& codecCallbacks) override {
+        callbacks = codecCallbacks;
+        AMediaCodecOnAsyncNotifyCallback notify = {
+                onAsyncInputAvailable,
+                onAsyncOutputAvailable,
+                onAsyncFormatChanged,
+                onAsyncError,
+        };
+        return AMediaCodec_setAsyncNotifyCallback(codec, notify, this);
+    }
+
+    int configure(const MediaFormat& format, bool encoder) override {
+        return AMediaCodec_configure(codec, NdkMediaFormat::unwrap(format), nullptr, nullptr,
+                                     encoder ? AMEDIACODEC_CONFIGURE_FLAG_ENCODE : 0);
+    }
+
+    int configureSurface(const MediaFormat& format, void* surface) override {
+        return AMediaCodec_configure(codec, NdkMediaFormat::unwrap(format), static_cast<ANativeWindow*>(surface),
+                                     nullptr, 0);
+    }
+
+    int start() override { return AMediaCodec_start(codec); }
+    int stop() override { return AMediaCodec_stop(codec); }
+    int flush() override { return AMediaCodec_flush(codec); }
+
+    ssize_t dequeueInputBuffer(int64_t timeoutUs) override {
+        return AMediaCodec_dequeueInputBuffer(codec, timeoutUs);
+    }
+
+    uint8_t* getInputBuffer(size_t index, size_t* size) override {
+        return AMediaCodec_getInputBuffer(codec, index, size);
+    }
+
+    int queueInputBuffer(size_t index, size_t offset, size_t size,
+                         int64_t presentationTimeUs, uint32_t flags) override {
+        return AMediaCodec_queueInputBuffer(codec, index, offset, size, presentationTimeUs, flags);
+    }
+
+    ssize_t dequeueOutputBuffer(SampleInfo* info, int64_t timeoutUs) override {
+        static_assert(sizeof(SampleInfo) == sizeof(AMediaCodecBufferInfo), "SampleInfo layout");
+        return AMediaCodec_dequeueOutputBuffer(codec, reinterpret_cast<AMediaCodecBufferInfo*>(info),
+                                               timeoutUs);
+    }
+
+    uint8_t* getOutputBuffer(size_t index, size_t* size) override {
+        return AMediaCodec_getOutputBuffer(codec, index, size);
+    }
+
+    int releaseOutputBuffer(size_t index, bool render) override {
+        return AMediaCodec_releaseOutputBuffer(codec, index, render);
+    }
+
+    int releaseOutputBufferAtTime(size_t index, int64_t renderTimeNs) override {
+        return AMediaCodec_releaseOutputBufferAtTime(codec, index, renderTimeNs);
+    }
+
+    std::unique_ptr<MediaFormat> getOutputFormat() override {
+        AMediaFormat* fmt = AMediaCodec_getOutputFormat(codec);
+        if (!fmt) return nullptr;
+        return std::make_unique<NdkMediaFormat>(fmt);
+    }
+
+private:
+    static void onAsyncInputAvailable(AMediaCodec*, void* userdata, int32_t index) {
+        static_cast<NdkMediaCodec*>(userdata)->callbacks.onInputAvailable(index);
+    }
+
+    static void onAsyncOutputAvailable(AMediaCodec*, void* userdata, int32_t index,
+                                       AMediaCodecBufferInfo* bufferInfo) {
+        SampleInfo info = {bufferInfo->offset, bufferInfo->size,
+                           bufferInfo->presentationTimeUs, bufferInfo->flags};
+        static_cast<NdkMediaCodec*>(userdata)->callbacks.onOutputAvailable(index, info);
+    }
+
+    static void onAsyncFormatChanged(AMediaCodec*, void*, AMediaFormat* format) {
+        // The muxer track is added from getOutputFormat() before start
+        AMediaFormat_delete(format);
+    }
+
+    static void onAsyncError(AMediaCodec*, void* userdata, media_status_t error, int32_t actionCode,
+                             const char* detail) {
+        LOGE("Codec error %d (action %d): %s", error, actionCode, detail ? detail : "");
+        NdkMediaCodec* self = static_cast<NdkMediaCodec*>(userdata);
+        if (self->callbacks.onError) self->callbacks.onError(error);
+    }
+
+    AMediaCodec* codec;
+    CodecCallbacks callbacks;
+};
+
+class NdkMediaMuxer : public MediaMuxer {
+public:
+    NdkMediaMuxer(AMediaMuxer* muxer, int fd) : muxer(muxer), fd(fd) {}
+
+    ~NdkMediaMuxer() override {
+        AMediaMuxer_delete(muxer);
+        close(fd);
+    }
+
+    ssize_t addTrack(const MediaFormat& format) override {
+        return AMediaMuxer_addTrack(muxer, NdkMediaFormat::unwrap(format));
+    }
+
+    int start() override { return AMediaMuxer_start(muxer); }
+    int stop() override { return AMediaMuxer_stop(muxer); }
+
+    int writeSampleData(size_t track, const uint8_t* data, const SampleInfo& info) override {
+        return AMediaMuxer_writeSampleData(muxer, track, data,
+                                           reinterpret_cast<const AMediaCodecBufferInfo*>(&info));
+    }
+
+private:
+    AMediaMuxer* muxer;
+    int fd;
+};
+
+} // namespace
+
+std::unique_ptr<MediaFormat> NdkMediaBackend::createFormat() {
+    return std::make_unique<NdkMediaFormat>(AMediaFormat_new());
+}
+
+std::unique_ptr<MediaExtractor> NdkMediaBackend::createExtractor(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Cannot open input file: %s, error: %s", path, strerror(errno));
+        return nullptr;
+    }
+
+    AMediaExtractor* extractor = AMediaExtractor_new();
+    if (!extractor) {
+        LOGE("Failed to create media extractor");
+        close(fd);
+        return nullptr;
+    }
+
+    off_t fileSize = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    media_status_t status = AMediaExtractor_setDataSourceFd(extractor, fd, 0, fileSize);
+    if (status != AMEDIA_OK) {
+        LOGE("Failed to set data source for extractor, status: %d", status);
+        AMediaExtractor_delete(extractor);
+        close(fd);
+        return nullptr;
+    }
+    return std::make_unique<NdkMediaExtractor>(extractor, fd);
+}
+
+std::unique_ptr<MediaCodec> NdkMediaBackend::createDecoder(const char* mime) {
+    AMediaCodec* codec = AMediaCodec_createDecoderByType(mime);
+    if (!codec) return nullptr;
+    return std::make_unique<NdkMediaCodec>(codec);
+}
+
+std::unique_ptr<MediaCodec> NdkMediaBackend::createEncoder(const char* mime) {
+    AMediaCodec* codec = AMediaCodec_createEncoderByType(mime);
+    if (!codec) return nullptr;
+    return std::make_unique<NdkMediaCodec>(codec);
+}
+
+std::unique_ptr<MediaMuxer> NdkMediaBackend::createMuxer(const char* path) {
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOGE("Cannot open output file: %s", path);
+        return nullptr;
+    }
+
+    AMediaMuxer* muxer = AMediaMuxer_new(fd, AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
+    if (!muxer) {
+        LOGE("Failed to create media muxer");
+        close(fd);
+        return nullptr;
+    }
+    return std::make_unique<NdkMediaMuxer>(muxer, fd);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "media_backend.h"
+
+#include <media/NdkMediaFormat.h>
+
+// Production backend on top of the NDK AMediaExtractor / AMediaCodec / AMediaMuxer API
+class NdkMediaFormat : public MediaFormat {
+public:
+    // Takes ownership of format
+    explicit NdkMediaFormat(AMediaFormat* format) : format(format) {}
+    ~NdkMediaFormat() override;
+
+    bool getInt32(const char* key, int32_t* out) const override;
+    bool getInt64(const char* key, int64_t* out) const override;
+    bool getString(const char* key, std::string* out) const override;
+    bool getBuffer(const char* key, std::vector<uint8_t>* out) const override;
+
+    void setInt32(const char* key, int32_t value) override;
+    void setInt64(const char* key, int64_t value) override;
+    void setString(const char* key, const char* value) override;
+    void setBuffer(const char* key, const uint8_t* data, size_t size) override;
+
+    AMediaFormat* get() const { return format; }
+
+    // Every format handed to this backend was created by it
+    static AMediaFormat* unwrap(const MediaFormat& format) {
+        return static_cast<const NdkMediaFormat&>(format).get();
+    }
+
+private:
+    AMediaFormat* format;
+};
+
+class NdkMediaBackend : public MediaBackend {
+public:
+    const char* name() const override { return "ndk"; }
+    std::unique_ptr<MediaFormat> createFormat() override;
+    std::unique_ptr<MediaExtractor> createExtractor(const char* path) override;
+    std::unique_ptr<MediaCodec> createDecoder(const char* mime) override;
+    std::unique_ptr<MediaCodec> createEncoder(const char* mime) override;
+    std::unique_ptr<MediaMuxer> createMuxer(const char* path) override;
+};
@@ -0,0 +1,131 @@
+#include "opensl_audio_sink.h"
+#include "editor_log.h"
+
+// Two bursts in the queue: one playing, one ready
+static const int32_t QUEUE_BUFFERS = 2;
+
+static SLuint32 channelMask(int32_t channels) {
+    switch (channels) {
+        case 1: return SL_SPEAKER_FRONT_CENTER;
+        case 2: return SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT;
+        case 4: return SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT | SL_SPEAKER_BACK_LEFT | SL_SPEAKER_BACK_RIGHT;
+        case 6: return SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT | SL_SPEAKER_FRONT_CENTER |
+                       SL_SPEAKER_LOW_FREQUENCY | SL_SPEAKER_BACK_LEFT | SL_SPEAKER_BACK_RIGHT;
+        default: return 0;
+    }
+}
+
+int OpenSlAudioSink::open(int32_t rate, int32_t channelCount, PcmRingBuffer* ring) {
+    SLuint32 mask = channelMask(channelCount);
+    if (playerObject || rate <= 0 || mask == 0 || !ring) {
+        LOGE("Cannot open OpenSL ES sink: %d Hz, %d channels", rate, channelCount);
+        return -1;
+    }
+    sampleRate = rate;
+    channels = channelCount;
+    source = ring;
+    burst = requestedBurst > 0 ? requestedBurst : rate / 100;
+    queuedBursts = QUEUE_BUFFERS;
+    buffers.assign((size_t) burst * channels * QUEUE_BUFFERS, 0);
+    resetCounters();
+
+    do {
+        SLEngineItf engine;
+        if (slCreateEngine(&engineObject, 0, nullptr, 0, nullptr, nullptr) != SL_RESULT_SUCCESS ||
+            (*engineObject)->Realize(engineObject, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS ||
+            (*engineObject)->GetInterface(engineObject, SL_IID_ENGINE, &engine) != SL_RESULT_SUCCESS) {
+            LOGE("Failed to create OpenSL ES engine");
+            break;
+        }
+        if ((*engine)->CreateOutputMix(engine, &outputMixObject, 0, nullptr, nullptr) != SL_RESULT_SUCCESS ||
+            (*outputMixObject)->Realize(outputMixObject, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS) {
+            LOGE("Failed to create OpenSL ES output mix");
+            break;
+        }
+
+        SLDataLocator_AndroidSimpleBufferQueue queueLocator = {
+                SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, (SLuint32) QUEUE_BUFFERS};
+        SLDataFormat_PCM pcm = {
+                SL_DATAFORMAT_PCM, (SLuint32) channels, (SLuint32) sampleRate * 1000,
+                SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16, mask, SL_BYTEORDER_LITTLEENDIAN};
+        SLDataSource audioSource = {&queueLocator, &pcm};
+        SLDataLocator_OutputMix mixLocator = {SL_DATALOCATOR_OUTPUTMIX, outputMixObject};
+        SLDataSink audioSink = {&mixLocator, nullptr};
+
+        const SLInterfaceID ids[] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE};
+        const SLboolean required[] = {SL_BOOLEAN_TRUE};
+        if ((*engine)->CreateAudioPlayer(engine, &playerObject, &audioSource, &audioSink, 1, ids,
+                                         required) != SL_RESULT_SUCCESS ||
+            (*playerObject)->Realize(playerObject, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS ||
+            (*playerObject)->GetInterface(playerObject, SL_IID_PLAY, &player) != SL_RESULT_SUCCESS ||
+            (*playerObject)->GetInterface(playerObject, SL_IID_ANDROIDSIMPLEBUFFERQUEUE, &queue) !=
+                    SL_RESULT_SUCCESS ||
+            (*queue)->RegisterCallback(queue, onBufferDone, this) != SL_RESULT_SUCCESS) {
+            LOGE("Failed to create OpenSL ES player");
+            break;
+        }
+
+        LOGI("OpenSL ES sink: %d Hz, %d channels, %d-frame bursts", sampleRate, channels, burst);
+        return 0;
+    } while (false);
+
+    close();
+    return -1;
+}
+
+void OpenSlAudioSink::close() {
+    {
+        // Later callbacks become no-ops; OpenSL is not called under the lock
+        std::lock_guard<std::mutex> lock(callbackMutex);
+        primed = false;
+    }
+    if (player) (*player)->SetPlayState(player, SL_PLAYSTATE_STOPPED);
+    if (playerObject) (*playerObject)->Destroy(playerObject);
+    if (outputMixObject) (*outputMixObject)->Destroy(outputMixObject);
+    if (engineObject) (*engineObject)->Destroy(engineObject);
+    playerObject = nullptr;
+    outputMixObject = nullptr;
+    engineObject = nullptr;
+    player = nullptr;
+    queue = nullptr;
+}
+
+int OpenSlAudioSink::start() {
+    if (!player) return -1;
+    std::lock_guard<std::mutex> lock(callbackMutex);
+    if (!primed) {
+        // The queue only calls back for buffers it has, so it starts with a full queue
+        for (int32_t i = 0; i < QUEUE_BUFFERS; i++) enqueueBurst();
+        primed = true;
+    }
+    return (*player)->SetPlayState(player, SL_PLAYSTATE_PLAYING) == SL_RESULT_SUCCESS ? 0 : -1;
+}
+
+void OpenSlAudioSink::pause() {
+    if (player) (*player)->SetPlayState(player, SL_PLAYSTATE_PAUSED);
+}
+
+void OpenSlAudioSink::flush() {
+    if (!player) return;
+    {
+        // Waits out a callback still reading the ring, which the caller is about to reset
+        std::lock_guard<std::mutex> lock(callbackMutex);
+        primed = false;
+    }
+    (*player)->SetPlayState(player, SL_PLAYSTATE_STOPPED);
+    (*queue)->Clear(queue);
+    resetCounters();
+}
+
+void OpenSlAudioSink::enqueueBurst() {
+    short* buffer = buffers.data() + nextBuffer * burst * channels;
+    nextBuffer = (nextBuffer + 1) % QUEUE_BUFFERS;
+    fillBurst(buffer);
+    (*queue)->Enqueue(queue, buffer, (SLuint32) (burst * channels * sizeof(short)));
+}
+
+void OpenSlAudioSink::onBufferDone(SLAndroidSimpleBufferQueueItf, void* context) {
+    OpenSlAudioSink* sink = static_cast<OpenSlAudioSink*>(context);
+    std::lock_guard<std::mutex> lock(sink->callbackMutex);
+    if (sink->primed) sink->enqueueBurst();
+}
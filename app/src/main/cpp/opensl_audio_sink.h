@@ -0,0 +1,42 @@
+#pragma once
+
+#include "audio_sink.h"
+
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+#include <mutex>
+#include <vector>
+
+// AudioSink over an OpenSL ES buffer-queue player. Buffers are one device
+// burst long and only two are queued, which keeps the player on the
+// low-latency output path when the burst and sample rate match the device's
+// (AudioManager PROPERTY_OUTPUT_FRAMES_PER_BUFFER / PROPERTY_OUTPUT_SAMPLE_RATE).
+class OpenSlAudioSink : public BurstAudioSink {
+public:
+    // framesPerBurst <= 0 picks 10 ms at the stream's sample rate
+    explicit OpenSlAudioSink(int32_t framesPerBurst) : requestedBurst(framesPerBurst) {}
+    ~OpenSlAudioSink() override { close(); }
+
+    int open(int32_t sampleRate, int32_t channels, PcmRingBuffer* source) override;
+    void close() override;
+    int start() override;
+    void pause() override;
+    void flush() override;
+
+private:
+    static void onBufferDone(SLAndroidSimpleBufferQueueItf queue, void* context);
+    void enqueueBurst();
+
+    int32_t requestedBurst;
+    SLObjectItf engineObject = nullptr;
+    SLObjectItf outputMixObject = nullptr;
+    SLObjectItf playerObject = nullptr;
+    SLPlayItf player = nullptr;
+    SLAndroidSimpleBufferQueueItf queue = nullptr;
+
+    // Serialises the buffer-queue callback against flush() and close()
+    std::mutex callbackMutex;
+    std::vector<short> buffers;
+    size_t nextBuffer = 0;
+    bool primed = false;
+};
@@ -0,0 +1,564 @@
+#include "parallel_audio_stretcher.h"
+#include "editor_log.h"
+#include "time_stretcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+// Longest source span one unit covers, so a single long segment still spreads over the workers
+static const int64_t MAX_UNIT_US = 10000000;
+// Decoded before each unit and thrown away, covers AAC priming and stretcher warm-up
+static const int64_t PREROLL_US = 100000;
+// Decoded past each unit so there is audio to crossfade into the next one
+static const int64_t TAIL_US = 100000;
+static const int64_t CROSSFADE_US = 5000;
+static const int64_t CODEC_TIMEOUT_US = 10000;
+// 1.0x segments shorter than this are transcoded, an encoder session costs more than it saves
+static const int64_t MIN_COPY_US = 500000;
+// AAC-LC access units always carry this many frames per channel
+static const int64_t AAC_FRAME_SIZE = 1024;
+// Audio fed to the encoder around each transcoded stretch and dropped again
+static const size_t PRIMING_FRAMES = 2 * AAC_FRAME_SIZE;
+
+static int64_t usToFrames(int64_t us, int32_t sampleRate) {
+    return us * sampleRate / 1000000;
+}
+
+// Frames at the start of a decoded buffer that lie before timeUs
+static size_t framesBefore(int64_t bufferPtsUs, size_t frames, int64_t timeUs, int32_t sampleRate) {
+    if (timeUs <= bufferPtsUs) return 0;
+    int64_t n = ((timeUs - bufferPtsUs) * sampleRate + 999999) / 1000000;
+    return std::min((size_t) n, frames);
+}
+
+static void drainStretcher(TimeStretcher& stretcher, int32_t channels, std::vector<short>* out) {
+    size_t available = stretcher.available();
+    if (available == 0) return;
+    size_t used = out->size();
+    out->resize(used + available * channels);
+    stretcher.read(out->data() + used, available);
+}
+
+ParallelAudioStretcher::ParallelAudioStretcher(MediaBackend& backend, const char* inputPath, int audioTrack,
+                                               const MediaFormat& audioFormat, const SegmentTimeline& timeline,
+                                               int32_t sampleRate, int32_t channels, size_t workerCount,
+                                               bool passthrough, const JobControl* control)
+        : backend(backend), inputPath(inputPath), audioTrack(audioTrack), audioFormat(audioFormat),
+          timeline(timeline), sampleRate(sampleRate), channels(channels),
+          workerCount(std::max(workerCount, (size_t) 1)), passthrough(passthrough),
+          control(control) {
+    buildUnits();
+}
+
+static bool isCopyable(const TimelineSegment& segment) {
+    return !segment.warp && segment.speedNum == segment.speedDen && segment.sourceEndUs - segment.sourceStartUs >= MIN_COPY_US;
+}
+
+bool ParallelAudioStretcher::hasPassthroughSegments(const SegmentTimeline& timeline) {
+    return std::any_of(timeline.all().begin(), timeline.all().end(), isCopyable);
+}
+
+bool ParallelAudioStretcher::splitsIntoUnits(const SegmentTimeline& timeline) {
+    return timeline.size() > 1 ||
+           (timeline.size() == 1 && timeline[0].sourceEndUs - timeline[0].sourceStartUs > MAX_UNIT_US);
+}
+
+void ParallelAudioStretcher::setRenderCache(SegmentRenderCache* renderCache, std::string trackKey) {
+    cache = renderCache;
+    cacheTrackKey = std::move(trackKey);
+    units.clear();
+    results.clear();
+    buildUnits();
+}
+
+void ParallelAudioStretcher::buildUnits() {
+    for (size_t index = 0; index < timeline.size(); index++) {
+        const TimelineSegment& segment = timeline[index];
+        if (passthrough && isCopyable(segment)) {
+            units.push_back({segment.sourceStartUs, segment.sourceEndUs, usToFrames(segment.outputStartUs, sampleRate),
+                             usToFrames(segment.outputEndUs, sampleRate), segment.speedNum, segment.speedDen, true,
+                             index, nullptr});
+            continue;
+        }
+        if (cache) {
+            if (std::unique_ptr<CachedSegment> cached = cache->find(cache->keyFor(cacheTrackKey, segment))) {
+                cachedSegments.push_back(std::move(cached));
+                units.push_back({segment.sourceStartUs, segment.sourceEndUs,
+                                 usToFrames(segment.outputStartUs, sampleRate),
+                                 usToFrames(segment.outputEndUs, sampleRate), segment.speedNum, segment.speedDen,
+                                 false, index, cachedSegments.back().get()});
+                continue;
+            }
+        }
+        int64_t startUs = segment.sourceStartUs;
+        int64_t outputStartUs = segment.outputStartUs;
+        while (startUs < segment.sourceEndUs) {
+            int64_t endUs = std::min(startUs + MAX_UNIT_US, segment.sourceEndUs);
+            int64_t outputEndUs = endUs == segment.sourceEndUs ? segment.outputEndUs : segment.toOutput(endUs);
+            units.push_back({startUs, endUs, usToFrames(outputStartUs, sampleRate),
+                             usToFrames(outputEndUs, sampleRate), segment.speedNum, segment.speedDen, false,
+                             index, nullptr});
+            startUs = endUs;
+            outputStartUs = outputEndUs;
+        }
+    }
+    results.resize(units.size());
+}
+
+void ParallelAudioStretcher::fail(const char* what) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!failed) {
+        LOGE("Parallel audio failed: %s", what);
+        failed = true;
+    }
+    changed.notify_all();
+}
+
+int ParallelAudioStretcher::stretchUnit(MediaExtractor& extractor, MediaCodec& decoder,
+                                        const Unit& unit, UnitResult* result) {
+    const size_t frameBytes = channels * sizeof(short);
+    const int64_t fromUs = std::max(unit.sourceStartUs - PREROLL_US, (int64_t) 0);
+    const int64_t toUs = unit.sourceEndUs + TAIL_US;
+
+    if (extractor.seekTo(fromUs, MediaSeekMode::PreviousSync) != MEDIA_OK) {
+        LOGE("Failed to seek audio to %lld", (long long) fromUs);
+        return -1;
+    }
+    // Clears the previous unit's EOS so the decoder accepts input again
+    decoder.flush();
+
+    // A ramp sets the speed per block as it goes
+    const TimelineSegment& segment = timeline[unit.segment];
+    TimeStretcher stretcher(sampleRate, channels);
+    stretcher.setSpeed((float) unit.speedNum / unit.speedDen);
+
+    int64_t expectedFrames = unit.outputEndFrame - unit.outputStartFrame +
+                             usToFrames(PREROLL_US + TAIL_US, sampleRate) * unit.speedDen / unit.speedNum;
+    result->pcm.reserve(expectedFrames * channels);
+
+    int64_t leadInputFrames = 0;
+    int64_t decodedEndUs = fromUs;
+    bool inputDone = false;
+    bool outputDone = false;
+
+    while (!outputDone) {
+        if (isCancelled(control)) break;
+
+        if (!inputDone) {
+            ssize_t inIndex = decoder.dequeueInputBuffer(CODEC_TIMEOUT_US);
+            if (inIndex >= 0) {
+                size_t bufSize;
+                uint8_t* buf = decoder.getInputBuffer(inIndex, &bufSize);
+                if (!buf) break;
+                int64_t pts = extractor.getSampleTime();
+                ssize_t sampleSize = (pts < 0 || pts >= toUs) ? -1 : extractor.readSampleData(buf, bufSize);
+                if (sampleSize < 0) {
+                    decoder.queueInputBuffer(inIndex, 0, 0, 0, BUFFER_FLAG_END_OF_STREAM);
+                    inputDone = true;
+                } else {
+                    decoder.queueInputBuffer(inIndex, 0, sampleSize, pts, 0);
+                    extractor.advance();
+                }
+            }
+        }
+
+        SampleInfo info;
+        ssize_t outIndex = decoder.dequeueOutputBuffer(&info, inputDone ? CODEC_TIMEOUT_US : 0);
+        if (outIndex < 0) continue;
+
+        if (info.size > 0) {
+            size_t outSize;
+            uint8_t* outBuf = decoder.getOutputBuffer(outIndex, &outSize);
+            if (outBuf) {
+                const short* samples = reinterpret_cast<const short*>(outBuf + info.offset);
+                size_t frames = info.size / frameBytes;
+                int64_t pts = info.presentationTimeUs;
+                // Keep [fromUs, toUs) only; what precedes sourceStartUs is lead to trim after stretching
+                size_t first = framesBefore(pts, frames, fromUs, sampleRate);
+                size_t last = framesBefore(pts, frames, toUs, sampleRate);
+                size_t leadEnd = framesBefore(pts, frames, unit.sourceStartUs, sampleRate);
+                if (last > first) {
+                    ScopedStage stretch(profilerOf(control), PipelineStage::Stretch);
+                    if (segment.warp) {
+                        int64_t firstUs = pts + (int64_t) first * 1000000 / sampleRate;
+                        stretcher.write(samples + first * channels, last - first, *segment.warp,
+                                        firstUs - segment.sourceStartUs);
+                    } else {
+                        stretcher.write(samples + first * channels, last - first);
+                    }
+                    leadInputFrames += std::min(std::max(leadEnd, first), last) - first;
+                    drainStretcher(stretcher, channels, &result->pcm);
+                    if (control) {
+                        control->profiler()->count(PipelineStage::Stretch, 1, (last - first) * frameBytes);
+                    }
+                }
+                decodedEndUs = std::max(decodedEndUs, pts + (int64_t) frames * 1000000 / sampleRate);
+            }
+        }
+        decoder.releaseOutputBuffer(outIndex, false);
+
+        if (info.flags & BUFFER_FLAG_END_OF_STREAM) outputDone = true;
+    }
+
+    stretcher.flush();
+    drainStretcher(stretcher, channels, &result->pcm);
+
+    if (!outputDone) return -1;
+    if (segment.warp) {
+        int64_t leadUs = leadInputFrames * 1000000 / sampleRate;
+        result->leadFrames = (size_t) usToFrames(
+                segment.toOutput(unit.sourceStartUs) - segment.toOutput(unit.sourceStartUs - leadUs), sampleRate);
+    } else {
+        result->leadFrames = (size_t) (leadInputFrames * unit.speedDen / unit.speedNum);
+    }
+    result->sourceEnded = decodedEndUs < unit.sourceEndUs;
+    return 0;
+}
+
+void ParallelAudioStretcher::workerLoop() {
+    std::unique_ptr<MediaExtractor> extractor = backend.createExtractor(inputPath.c_str());
+    std::unique_ptr<MediaCodec> decoder;
+    {
+        // Formats are not guaranteed to be safe to read from several threads at once
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string mime;
+        audioFormat.getString(MEDIA_KEY_MIME, &mime);
+        decoder = backend.createDecoder(mime.c_str());
+        if (extractor && decoder && (decoder->configure(audioFormat, false) != MEDIA_OK || decoder->start() != MEDIA_OK)) {
+            decoder.reset();
+        }
+    }
+    if (!extractor || !decoder) {
+        fail("worker codec setup");
+        return;
+    }
+    extractor->selectTrack(audioTrack);
+
+    const size_t window = workerCount * 2;
+    while (true) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] {
+                return failed || nextUnit >= units.size() || nextUnit < consumedUnits + window;
+            });
+            if (failed || nextUnit >= units.size()) break;
+            index = nextUnit++;
+        }
+
+        // Copied and cached units are read by the stitcher itself
+        UnitResult result;
+        if (!units[index].copy && !units[index].cached && stretchUnit(*extractor, *decoder, units[index], &result) != 0) {
+            fail("stretch");
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        results[index] = std::move(result);
+        results[index].done = true;
+        changed.notify_all();
+    }
+
+    decoder->stop();
+}
+
+int ParallelAudioStretcher::drainEncoder(bool untilEndOfStream) {
+    while (!encoderEOS) {
+        SampleInfo info;
+        ssize_t index = encoder->dequeueOutputBuffer(&info, untilEndOfStream ? CODEC_TIMEOUT_US : 0);
+        if (index < 0) {
+            if (untilEndOfStream) continue;
+            return 0;
+        }
+
+        // In passthrough the track format comes from the source, so codec config is not muxed
+        bool keep = info.presentationTimeUs >= keepStartUs && info.presentationTimeUs < keepEndUs &&
+                    !(passthrough && (info.flags & BUFFER_FLAG_CODEC_CONFIG));
+        if (info.size > 0 && keep) {
+            size_t outSize;
+            uint8_t* outBuf = encoder->getOutputBuffer(index, &outSize);
+            if (!outBuf || muxer->writeSampleData(muxerTrack, outBuf, info) != MEDIA_OK) {
+                encoder->releaseOutputBuffer(index, false);
+                return -1;
+            }
+            if (recorder) recorder->append(outBuf, info);
+            encodedCount++;
+        }
+        encoder->releaseOutputBuffer(index, false);
+
+        if (info.flags & BUFFER_FLAG_END_OF_STREAM) {
+            LOGI("Audio encoder output EOS");
+            encoderEOS = true;
+        }
+    }
+    return 0;
+}
+
+int ParallelAudioStretcher::feedEncoder(const short* frames, size_t count) {
+    const size_t frameBytes = channels * sizeof(short);
+    size_t offset = 0;
+    while (offset < count) {
+        ssize_t index = encoder->dequeueInputBuffer(CODEC_TIMEOUT_US);
+        if (index < 0) {
+            if (drainEncoder(false) != 0) return -1;
+            continue;
+        }
+
+        size_t encSize;
+        uint8_t* encBuf = encoder->getInputBuffer(index, &encSize);
+        if (!encBuf || encSize < frameBytes) return -1;
+        size_t n = std::min(count - offset, encSize / frameBytes);
+        memcpy(encBuf, frames + offset * channels, n * frameBytes);
+        // PTS comes from a running frame count, like the async path
+        encoder->queueInputBuffer(index, 0, n * frameBytes, framesQueued * 1000000 / sampleRate, 0);
+        offset += n;
+        framesQueued += n;
+        sessionFed = true;
+
+        if (drainEncoder(false) != 0) return -1;
+    }
+    return 0;
+}
+
+// Sends EOS and drains, leaving the encoder flushed for the next session
+int ParallelAudioStretcher::endEncoderSession() {
+    while (true) {
+        ssize_t index = encoder->dequeueInputBuffer(CODEC_TIMEOUT_US);
+        if (index >= 0) {
+            encoder->queueInputBuffer(index, 0, 0, framesQueued * 1000000 / sampleRate, BUFFER_FLAG_END_OF_STREAM);
+            break;
+        }
+        if (drainEncoder(false) != 0) return -1;
+    }
+    if (drainEncoder(true) != 0) return -1;
+    encoder->flush();
+    encoderEOS = false;
+    sessionOpen = false;
+    sessionFed = false;
+    return 0;
+}
+
+int ParallelAudioStretcher::copyUnit(MediaExtractor& extractor, const Unit& unit) {
+    if (extractor.seekTo(unit.sourceStartUs, MediaSeekMode::PreviousSync) != MEDIA_OK) {
+        LOGE("Failed to seek audio to %lld", (long long) unit.sourceStartUs);
+        return -1;
+    }
+
+    // An access unit belongs to the segment holding its midpoint
+    const int64_t halfFrameUs = AAC_FRAME_SIZE * 500000 / sampleRate;
+    std::vector<uint8_t> buffer;
+    while (true) {
+        if (isCancelled(control)) return -1;
+
+        int64_t pts = extractor.getSampleTime();
+        if (pts < 0 || pts + halfFrameUs >= unit.sourceEndUs) break;
+        if (pts + halfFrameUs < unit.sourceStartUs) {
+            extractor.advance();
+            continue;
+        }
+
+        ssize_t sampleSize = extractor.getSampleSize();
+        if (sampleSize < 0) break;
+        if (buffer.size() < (size_t) sampleSize) buffer.resize(sampleSize);
+        sampleSize = extractor.readSampleData(buffer.data(), buffer.size());
+        if (sampleSize < 0) break;
+
+        SampleInfo info;
+        info.offset = 0;
+        info.size = sampleSize;
+        info.presentationTimeUs = framesWritten * 1000000 / sampleRate;
+        info.flags = (extractor.getSampleFlags() & SAMPLE_FLAG_SYNC) ? BUFFER_FLAG_KEY_FRAME : 0;
+        if (muxer->writeSampleData(muxerTrack, buffer.data(), info) != MEDIA_OK) return -1;
+
+        framesWritten += AAC_FRAME_SIZE;
+        copiedCount++;
+        extractor.advance();
+    }
+    return 0;
+}
+
+// Writes a cached segment's access units at the current output position
+int ParallelAudioStretcher::replayUnit(const Unit& unit) {
+    const CachedSegment& cached = *unit.cached;
+    const int64_t startUs = framesWritten * 1000000 / sampleRate;
+    for (size_t i = 0; i < cached.sampleCount(); i++) {
+        if (isCancelled(control)) return -1;
+        SampleInfo info;
+        info.offset = 0;
+        info.size = cached[i].size;
+        info.presentationTimeUs = startUs + cached[i].ptsUs;
+        info.flags = cached[i].flags;
+        if (muxer->writeSampleData(muxerTrack, cached[i].data, info) != MEDIA_OK) return -1;
+        cachedCount++;
+    }
+    // Recorded as frames * 1000000 / sampleRate, rounded down
+    framesWritten += (cached.durationUs() * sampleRate + 999999) / 1000000;
+    return 0;
+}
+
+int ParallelAudioStretcher::run(MediaCodec& audioEncoder, MediaMuxer& outputMuxer, size_t track) {
+    encoder = &audioEncoder;
+    muxer = &outputMuxer;
+    muxerTrack = track;
+
+    std::unique_ptr<MediaExtractor> copyExtractor;
+    if (std::any_of(units.begin(), units.end(), [](const Unit& unit) { return unit.copy; })) {
+        copyExtractor = backend.createExtractor(inputPath.c_str());
+        if (!copyExtractor) {
+            LOGE("Failed to create passthrough extractor");
+            return -1;
+        }
+        copyExtractor->selectTrack(audioTrack);
+    }
+
+    size_t threads = std::min(workerCount, std::max(units.size(), (size_t) 1));
+    LOGI("Stretching audio as %zu units on %zu workers%s", units.size(), threads,
+         copyExtractor ? ", copying 1.0x segments" : "");
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&ParallelAudioStretcher::workerLoop, this);
+    }
+
+    const size_t crossfadeFrames = (size_t) usToFrames(CROSSFADE_US, sampleRate);
+    std::vector<short> carry;
+    // Frames encoded since the current encoder session started
+    int64_t sessionFrames = 0;
+    int status = 0;
+
+    for (size_t i = 0; i < units.size() && status == 0; i++) {
+        UnitResult result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return failed || results[i].done; });
+            if (failed || isCancelled(control)) {
+                status = -1;
+                break;
+            }
+            result = std::move(results[i]);
+            consumedUnits = i + 1;
+            changed.notify_all();
+        }
+
+        if (units[i].copy || units[i].cached) {
+            if ((sessionOpen && sessionFed && endEncoderSession() != 0) ||
+                (units[i].copy ? copyUnit(*copyExtractor, units[i]) : replayUnit(units[i])) != 0) {
+                LOGE("Failed to %s audio segment at %lldus", units[i].copy ? "copy" : "replay",
+                     (long long) units[i].sourceStartUs);
+                status = -1;
+            }
+            sessionOpen = false;
+            carry.clear();
+            continue;
+        }
+
+        // With a render cache every transcoded segment is recorded, from its first unit to its session's end
+        bool segmentEnds = i + 1 == units.size() || units[i + 1].segment != units[i].segment;
+        if (cache && (i == 0 || units[i - 1].segment != units[i].segment)) {
+            recorder = cache->record(cache->keyFor(cacheTrackKey, timeline[units[i].segment]),
+                                     framesWritten * 1000000 / sampleRate);
+            recordStartFrame = framesWritten;
+        }
+
+        std::vector<short>& pcm = result.pcm;
+        size_t produced = pcm.size() / channels;
+        size_t lead = std::min(result.leadFrames, produced);
+
+        if (!sessionOpen) {
+            // Prime a fresh session with audio from before the unit; the
+            // encoder output for it lands before keepStartUs and is dropped
+            size_t priming = std::min(lead, PRIMING_FRAMES);
+            framesQueued = framesWritten - (int64_t) priming;
+            keepStartUs = framesWritten * 1000000 / sampleRate;
+            keepEndUs = INT64_MAX;
+            sessionOpen = true;
+            sessionFrames = 0;
+            if (feedEncoder(pcm.data() + (lead - priming) * channels, priming) != 0) {
+                status = -1;
+                break;
+            }
+        }
+
+        // Every unit contributes exactly its share of the output timeline,
+        // padded with silence if the stretcher came up short, unless the audio ran out.
+        // Measured from framesWritten so copied and replayed units' rounding is absorbed here.
+        size_t frames = (size_t) std::max(units[i].outputEndFrame - framesWritten, (int64_t) 0);
+        bool endSession = (i + 1 < units.size() && (units[i + 1].copy || units[i + 1].cached)) ||
+                          (cache && segmentEnds);
+        if (endSession) {
+            // The session has to end on an access unit boundary where copying or a replay resumes,
+            // and with a render cache where the segment ends
+            int64_t total = sessionFrames + (int64_t) frames;
+            int64_t aligned = std::max((total + AAC_FRAME_SIZE / 2) / AAC_FRAME_SIZE * AAC_FRAME_SIZE,
+                                       (sessionFrames + AAC_FRAME_SIZE - 1) / AAC_FRAME_SIZE * AAC_FRAME_SIZE);
+            frames = (size_t) (aligned - sessionFrames);
+        }
+        size_t available = produced - lead;
+        size_t bodyFrames = frames;
+        if (available < frames) {
+            if (result.sourceEnded) {
+                bodyFrames = available;
+            } else {
+                pcm.resize((lead + frames) * channels, 0);
+                produced = lead + frames;
+            }
+        }
+
+        // Blend the previous unit's tail into the start of this one to hide the seam
+        short* body = pcm.data() + lead * channels;
+        size_t fade = std::min(carry.size() / channels, bodyFrames);
+        for (size_t k = 0; k < fade; k++) {
+            float w = (float) (k + 1) / (fade + 1);
+            for (int32_t c = 0; c < channels; c++) {
+                size_t s = k * channels + c;
+                body[s] = (short) lrintf(body[s] * w + carry[s] * (1.0f - w));
+            }
+        }
+
+        if (feedEncoder(body, bodyFrames) != 0) {
+            LOGE("Failed to feed stitched audio to the encoder");
+            status = -1;
+            break;
+        }
+        framesWritten += bodyFrames;
+        sessionFrames += bodyFrames;
+
+        size_t tailStart = lead + bodyFrames;
+        if (endSession) {
+            // Trailing priming so the last kept access unit is complete; its output is dropped
+            keepEndUs = framesWritten * 1000000 / sampleRate;
+            size_t tailFrames = std::min(produced - tailStart, PRIMING_FRAMES);
+            if (feedEncoder(pcm.data() + tailStart * channels, tailFrames) != 0) {
+                status = -1;
+                break;
+            }
+            carry.clear();
+        } else {
+            size_t tailFrames = std::min(produced - tailStart, crossfadeFrames);
+            carry.assign(pcm.begin() + tailStart * channels, pcm.begin() + (tailStart + tailFrames) * channels);
+        }
+
+        if (cache && segmentEnds) {
+            if (sessionFed && endEncoderSession() != 0) {
+                status = -1;
+                break;
+            }
+            sessionOpen = false;
+            if (recorder) {
+                recorder->setDurationUs((framesWritten - recordStartFrame) * 1000000 / sampleRate);
+                cache->commit(std::move(recorder));
+            }
+        }
+    }
+
+    if (status != 0) fail("stitch");
+    for (std::thread& worker : workers) worker.join();
+    if (status != 0) return -1;
+
+    if (sessionOpen) {
+        LOGI("Sending EOS to audio encoder");
+        return endEncoderSession();
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "job_control.h"
+#include "media_backend.h"
+#include "segment_render_cache.h"
+#include "segment_timeline.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Segment-parallel audio path. The timeline is cut into work units at segment
+// boundaries (long segments are split further), and each unit is decoded and
+// time-stretched independently by a worker with its own extractor, decoder
+// and time stretcher. Units start with a pre-roll margin so decoder priming and
+// stretcher warm-up fall outside the kept audio, and carry a tail margin that is
+// crossfaded into the next unit at the seam. Finished units are stitched in
+// order on the caller and fed to the encoder, so the output length of every
+// unit is exact and A/V drift cannot build up across segments.
+//
+// With passthrough on, 1.0x segments skip the codecs entirely: their AAC
+// access units are copied to the muxer with new PTS. The encoder then runs
+// in sessions covering the transcoded stretches between them, primed with a
+// couple of frames of the neighbouring audio that are dropped again, and the
+// muxer track must be added with the source format.
+//
+// With a render cache, each transcoded segment is its own encoder session,
+// cut to whole access units without a crossfade into its neighbours, so it
+// can be recorded and later replayed on its own. Segments found in the cache
+// are replayed like copied ones. A replayed segment keeps the length it was
+// rendered at, which is within an access unit of its share of the timeline;
+// the next transcoded segment evens that out again.
+class ParallelAudioStretcher {
+public:
+    ParallelAudioStretcher(MediaBackend& backend, const char* inputPath, int audioTrack,
+                           const MediaFormat& audioFormat, const SegmentTimeline& timeline,
+                           int32_t sampleRate, int32_t channels, size_t workerCount,
+                           bool passthrough = false, const JobControl* control = nullptr);
+
+    // True if the timeline has a 1.0x segment long enough to be copied
+    static bool hasPassthroughSegments(const SegmentTimeline& timeline);
+    // True if the timeline is cut into more than one work unit; with just
+    // one there is nothing to run side by side or to cache apart
+    static bool splitsIntoUnits(const SegmentTimeline& timeline);
+
+    // Must be called before run(). trackKey identifies the source track and
+    // encoder settings, see SegmentRenderCache.
+    void setRenderCache(SegmentRenderCache* renderCache, std::string trackKey);
+
+    // Drives the (started, polling-mode) encoder to EOS, writing its output
+    // to muxerTrack. Returns 0 on success, -1 on failure.
+    int run(MediaCodec& encoder, MediaMuxer& muxer, size_t muxerTrack);
+
+    int encodedSamples() const { return encodedCount; }
+    int copiedSamples() const { return copiedCount; }
+    int cachedSamples() const { return cachedCount; }
+    size_t unitCount() const { return units.size(); }
+
+private:
+    struct Unit {
+        int64_t sourceStartUs;
+        int64_t sourceEndUs;
+        int64_t outputStartFrame;
+        int64_t outputEndFrame;
+        int32_t speedNum;
+        int32_t speedDen;
+        // Copied in the compressed domain instead of decoded and stretched
+        bool copy;
+        size_t segment;
+        // Replayed from the render cache, covering the whole segment
+        const CachedSegment* cached;
+    };
+
+    struct UnitResult {
+        std::vector<short> pcm;
+        size_t leadFrames = 0;
+        bool sourceEnded = false;
+        bool done = false;
+    };
+
+    void buildUnits();
+    void workerLoop();
+    int stretchUnit(MediaExtractor& extractor, MediaCodec& decoder, const Unit& unit, UnitResult* result);
+    void fail(const char* what);
+
+    int feedEncoder(const short* frames, size_t count);
+    int drainEncoder(bool untilEndOfStream);
+    int endEncoderSession();
+    int copyUnit(MediaExtractor& extractor, const Unit& unit);
+    int replayUnit(const Unit& unit);
+
+    MediaBackend& backend;
+    std::string inputPath;
+    int audioTrack;
+    const MediaFormat& audioFormat;
+    const SegmentTimeline& timeline;
+    int32_t sampleRate;
+    int32_t channels;
+    size_t workerCount;
+    bool passthrough;
+    const JobControl* control;
+
+    std::vector<Unit> units;
+    std::vector<UnitResult> results;
+
+    SegmentRenderCache* cache = nullptr;
+    std::string cacheTrackKey;
+    // Hits, owned here for the units that point at them
+    std::vector<std::unique_ptr<CachedSegment>> cachedSegments;
+    // The transcoded segment being recorded, if any, and where it started
+    std::unique_ptr<SegmentRecorder> recorder;
+    int64_t recordStartFrame = 0;
+
+    // Guards the unit hand-out and results; workers stay at most a window of
+    // units ahead of the stitcher so memory is bounded for long edits
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t nextUnit = 0;
+    size_t consumedUnits = 0;
+    bool failed = false;
+
+    // Encoder side, only touched by the thread in run()
+    MediaCodec* encoder = nullptr;
+    MediaMuxer* muxer = nullptr;
+    size_t muxerTrack = 0;
+    int64_t framesQueued = 0;
+    // Output timeline position in frames, copied and encoded audio alike
+    int64_t framesWritten = 0;
+    // Encoder outputs outside [keepStartUs, keepEndUs) are priming and dropped
+    int64_t keepStartUs = INT64_MIN;
+    int64_t keepEndUs = INT64_MAX;
+    bool sessionOpen = true;
+    bool sessionFed = false;
+    bool encoderEOS = false;
+    int encodedCount = 0;
+    int copiedCount = 0;
+    int cachedCount = 0;
+};
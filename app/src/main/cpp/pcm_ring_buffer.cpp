@@ -0,0 +1,71 @@
+#include "pcm_ring_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+PcmRingBuffer::PcmRingBuffer(int32_t channels, size_t minFrames) : channels(channels) {
+    size_t frames = 1;
+    while (frames < minFrames) frames <<= 1;
+    mask = frames - 1;
+    samples.resize(frames * channels);
+}
+
+size_t PcmRingBuffer::readableFrames() const {
+    return (size_t) (writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire));
+}
+
+size_t PcmRingBuffer::writableFrames() const {
+    return capacity() - readableFrames();
+}
+
+size_t PcmRingBuffer::fillFrom(TimeStretcher& stretcher) {
+    uint64_t tail = writeIndex.load(std::memory_order_relaxed);
+    size_t moved = 0;
+    while (true) {
+        size_t room = capacity() - (size_t) (tail - readIndex.load(std::memory_order_acquire));
+        if (room == 0) break;
+        // At most two passes: up to the end of the storage, then from its start
+        size_t offset = (size_t) (tail & mask);
+        size_t frames = stretcher.read(samples.data() + offset * channels, std::min(room, capacity() - offset));
+        if (frames == 0) break;
+        tail += frames;
+        moved += frames;
+        writeIndex.store(tail, std::memory_order_release);
+    }
+
+    size_t depth = readableFrames();
+    if (depth > peak.load(std::memory_order_relaxed)) peak.store(depth, std::memory_order_relaxed);
+    return moved;
+}
+
+size_t PcmRingBuffer::readForEncoder(uint8_t* buffer, size_t capacityBytes) {
+    const size_t frameBytes = channels * sizeof(short);
+    const size_t room = capacityBytes / frameBytes;
+    // Read before the data so a finished stream's tail is seen in full
+    bool tail = isFinished();
+    size_t frames = std::min(readableFrames(), room);
+    if (frames >= AAC_FRAME_SIZE) {
+        frames -= frames % AAC_FRAME_SIZE;
+    } else if (!tail && room >= AAC_FRAME_SIZE) {
+        return 0;
+    }
+    return read(reinterpret_cast<short*>(buffer), frames);
+}
+
+size_t PcmRingBuffer::read(short* out, size_t maxFrames) {
+    size_t frames = std::min(readableFrames(), maxFrames);
+    uint64_t head = readIndex.load(std::memory_order_relaxed);
+    size_t offset = (size_t) (head & mask);
+    size_t first = std::min(frames, capacity() - offset);
+    memcpy(out, samples.data() + offset * channels, first * channels * sizeof(short));
+    memcpy(out + first * channels, samples.data(), (frames - first) * channels * sizeof(short));
+    readIndex.store(head + frames, std::memory_order_release);
+    return frames;
+}
+
+void PcmRingBuffer::reset() {
+    writeIndex.store(0, std::memory_order_relaxed);
+    readIndex.store(0, std::memory_order_relaxed);
+    finished.store(false, std::memory_order_relaxed);
+    peak.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "time_stretcher.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lock-free single-producer / single-consumer ring of interleaved PCM frames
+// between the time stretcher and the AAC encoder. The stretcher writes into
+// the ring directly and the consumer copies straight into codec input
+// buffers in whole AAC frames. Positions are 64-bit frame counters that never
+// wrap, so the read position doubles as the PTS clock of the encoder input.
+class PcmRingBuffer {
+public:
+    // Frames per channel in one AAC-LC access unit
+    static constexpr size_t AAC_FRAME_SIZE = 1024;
+
+    // Capacity is rounded up to a power of two frames
+    PcmRingBuffer(int32_t channels, size_t minFrames);
+
+    size_t capacity() const { return mask + 1; }
+    size_t readableFrames() const;
+    size_t writableFrames() const;
+
+    // Producer: moves as many stretched frames as fit, returns how many.
+    // Whatever does not fit stays queued in the stretcher.
+    size_t fillFrom(TimeStretcher& stretcher);
+
+    // Producer: no more frames will be written
+    void finish() { finished.store(true, std::memory_order_release); }
+
+    // Consumer: true once finish() was called. Frames may still be readable.
+    bool isFinished() const { return finished.load(std::memory_order_acquire); }
+
+    // Consumer: copies the next chunk into an encoder input buffer, a multiple
+    // of AAC_FRAME_SIZE frames unless the buffer is smaller than one AAC frame
+    // or this is the tail of a finished stream. Returns the frames copied; 0
+    // while less than one AAC frame is buffered.
+    size_t readForEncoder(uint8_t* buffer, size_t capacityBytes);
+
+    // Consumer: copies up to maxFrames frames to out, returns how many
+    size_t read(short* out, size_t maxFrames);
+
+    // Empties the ring and restarts both counters. Only while neither side runs.
+    void reset();
+
+    // Frames handed to the consumer since the start; the PTS of the next chunk
+    int64_t readPosition() const { return (int64_t) readIndex.load(std::memory_order_relaxed); }
+
+    // Most frames ever buffered at once, written by the producer
+    size_t peakFrames() const { return peak.load(std::memory_order_relaxed); }
+
+private:
+    int32_t channels;
+    size_t mask;
+    std::vector<short> samples;
+    alignas(64) std::atomic<uint64_t> writeIndex{0};
+    alignas(64) std::atomic<uint64_t> readIndex{0};
+    std::atomic<bool> finished{false};
+    std::atomic<size_t> peak{0};
+};
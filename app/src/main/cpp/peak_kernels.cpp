@@ -0,0 +1,115 @@
+#include "peak_kernels.h"
+#include "editor_log.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+static void scalarAccumulate(const short* samples, size_t count, PeakStats* stats) {
+    int16_t min = stats->min;
+    int16_t max = stats->max;
+    uint64_t sumSquares = stats->sumSquares;
+    for (size_t i = 0; i < count; i++) {
+        min = std::min(min, (int16_t) samples[i]);
+        max = std::max(max, (int16_t) samples[i]);
+        sumSquares += (uint64_t) ((int32_t) samples[i] * samples[i]);
+    }
+    stats->min = min;
+    stats->max = max;
+    stats->sumSquares = sumSquares;
+}
+
+static const PeakKernels SCALAR_KERNELS = {"scalar", scalarAccumulate};
+
+// Lanes of the vector loops are folded into stats before the scalar tail
+static inline void foldLanes(const int16_t* mins, const int16_t* maxes, size_t lanes, uint64_t sumSquares,
+                             PeakStats* stats) {
+    for (size_t i = 0; i < lanes; i++) {
+        stats->min = std::min(stats->min, mins[i]);
+        stats->max = std::max(stats->max, maxes[i]);
+    }
+    stats->sumSquares += sumSquares;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// SSE2 is part of the x86-64 baseline and of the Android x86 ABI
+static void sse2Accumulate(const short* samples, size_t count, PeakStats* stats) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i min = _mm_set1_epi16(stats->min);
+    __m128i max = _mm_set1_epi16(stats->max);
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+        min = _mm_min_epi16(min, v);
+        max = _mm_max_epi16(max, v);
+        // Pairs of squares reach at most 2^31, exact when zero-extended
+        __m128i squares = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+    }
+    alignas(16) int16_t mins[8], maxes[8];
+    alignas(16) uint64_t sums[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(mins), min);
+    _mm_store_si128(reinterpret_cast<__m128i*>(maxes), max);
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), acc);
+    foldLanes(mins, maxes, 8, sums[0] + sums[1], stats);
+    scalarAccumulate(samples + i, count - i, stats);
+}
+
+static const PeakKernels SIMD_KERNELS = {"sse2", sse2Accumulate};
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+// NEON is mandatory on arm64-v8a and enabled for the armeabi-v7a ABI the app ships
+static void neonAccumulate(const short* samples, size_t count, PeakStats* stats) {
+    int16x8_t min = vdupq_n_s16(stats->min);
+    int16x8_t max = vdupq_n_s16(stats->max);
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(samples + i);
+        min = vminq_s16(min, v);
+        max = vmaxq_s16(max, v);
+        // Single squares stay below 2^31, so they widen as unsigned
+        int32x4_t low = vmull_s16(vget_low_s16(v), vget_low_s16(v));
+        int32x4_t high = vmull_s16(vget_high_s16(v), vget_high_s16(v));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(low));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(high));
+    }
+    int16_t mins[8], maxes[8];
+    vst1q_s16(mins, min);
+    vst1q_s16(maxes, max);
+    foldLanes(mins, maxes, 8, vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1), stats);
+    scalarAccumulate(samples + i, count - i, stats);
+}
+
+static const PeakKernels SIMD_KERNELS = {"neon", neonAccumulate};
+
+#endif
+
+const PeakKernels& PeakKernels::scalar() {
+    return SCALAR_KERNELS;
+}
+
+const PeakKernels& PeakKernels::best() {
+    static const PeakKernels* chosen = [] {
+        std::vector<const PeakKernels*> sets = supported();
+        LOGI("Waveform peak kernels: %s", sets.back()->name);
+        return sets.back();
+    }();
+    return *chosen;
+}
+
+std::vector<const PeakKernels*> PeakKernels::supported() {
+    std::vector<const PeakKernels*> sets = {&SCALAR_KERNELS};
+#if defined(__x86_64__) || defined(__i386__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+    sets.push_back(&SIMD_KERNELS);
+#endif
+    return sets;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Running extremes and energy of a run of 16-bit samples
+struct PeakStats {
+    int16_t min = INT16_MAX;
+    int16_t max = INT16_MIN;
+    uint64_t sumSquares = 0;
+};
+
+// Reduction behind the waveform peaks. Every implementation produces exactly
+// the same stats as the scalar reference.
+struct PeakKernels {
+    const char* name;
+
+    // Folds count samples into stats, channels alike
+    void (*accumulate)(const short* samples, size_t count, PeakStats* stats);
+
+    static const PeakKernels& scalar();
+    // The fastest set this CPU supports, picked once at first use
+    static const PeakKernels& best();
+    // Every set this CPU supports, scalar first
+    static std::vector<const PeakKernels*> supported();
+};
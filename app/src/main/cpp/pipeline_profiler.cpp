@@ -0,0 +1,126 @@
+#include "pipeline_profiler.h"
+#include "editor_log.h"
+
+#include <chrono>
+#include <cstdio>
+
+#ifdef __ANDROID__
+#include <android/trace.h>
+#endif
+
+// Polling dequeues return at once most of the time; shorter stalls are counted but not traced
+static const int64_t MIN_TRACED_STALL_NS = 50000;
+
+static const char* const STAGE_NAMES[PIPELINE_STAGE_COUNT] = {"extract", "decode", "stretch", "encode", "mux"};
+static const char* const STALL_NAMES[PIPELINE_STAGE_COUNT] = {
+        "extract wait", "decode wait", "stretch wait", "encode wait", "mux wait"};
+
+// Small stable ids for the trace viewer's thread lanes
+static uint32_t traceThreadId() {
+    static std::atomic<uint32_t> next{1};
+    thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+const char* pipelineStageName(PipelineStage stage) {
+    return STAGE_NAMES[(size_t) stage];
+}
+
+int64_t PipelineProfiler::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PipelineProfiler::count(PipelineStage stage, size_t samples, size_t bytes) {
+    Counters& c = counters[(size_t) stage];
+    c.samples.fetch_add(samples, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void PipelineProfiler::addBusy(PipelineStage stage, int64_t ns) {
+    counters[(size_t) stage].busyNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void PipelineProfiler::addStall(PipelineStage stage, int64_t ns) {
+    counters[(size_t) stage].stallNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+PipelineStats PipelineProfiler::snapshot() const {
+    PipelineStats stats;
+    for (size_t i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        const Counters& c = counters[i];
+        stats.stages[i].samples = c.samples.load(std::memory_order_relaxed);
+        stats.stages[i].bytes = c.bytes.load(std::memory_order_relaxed);
+        stats.stages[i].busyUs = c.busyNs.load(std::memory_order_relaxed) / 1000;
+        stats.stages[i].stallUs = c.stallNs.load(std::memory_order_relaxed) / 1000;
+    }
+    stats.wallUs = wallUs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void PipelineProfiler::log() const {
+    PipelineStats stats = snapshot();
+    LOGI("Pipeline stats over %lldus wall time (samples / bytes / busy us / stall us):", (long long) stats.wallUs);
+    for (size_t i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        const StageStats& s = stats.stages[i];
+        LOGI("  %-8s %8llu / %11llu / %9lld / %9lld", STAGE_NAMES[i], (unsigned long long) s.samples,
+             (unsigned long long) s.bytes, (long long) s.busyUs, (long long) s.stallUs);
+    }
+}
+
+void PipelineProfiler::traceEvent(PipelineStage stage, bool stall, int64_t startNs, int64_t durationNs) {
+    TraceEvent event = {(uint8_t) stage, stall, traceThreadId(), startNs - originNs, durationNs};
+    std::lock_guard<std::mutex> lock(traceMutex);
+    events.push_back(event);
+}
+
+bool PipelineProfiler::writeChromeTrace(const char* path) const {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        LOGE("Failed to open trace file %s", path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& e = events[i];
+        // Complete events; timestamps are microseconds with sub-microsecond precision
+        fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                      "\"ts\":%.3f,\"dur\":%.3f}",
+                i ? "," : "", e.stall ? STALL_NAMES[e.stage] : STAGE_NAMES[e.stage], STAGE_NAMES[e.stage],
+                e.thread, e.startNs / 1000.0, e.durationNs / 1000.0);
+    }
+    fputs("\n]}\n", file);
+    bool ok = fclose(file) == 0;
+    LOGI("Wrote %zu trace events to %s", events.size(), path);
+    return ok;
+}
+
+ScopedStage::ScopedStage(PipelineProfiler* profiler, PipelineStage stage, bool stall)
+        : profiler(profiler), stage(stage), stall(stall) {
+    if (!profiler) return;
+    startNs = PipelineProfiler::nowNs();
+#ifdef __ANDROID__
+    if (ATrace_isEnabled()) {
+        ATrace_beginSection(stall ? STALL_NAMES[(size_t) stage] : STAGE_NAMES[(size_t) stage]);
+        traced = true;
+    }
+#endif
+}
+
+ScopedStage::~ScopedStage() {
+    if (!profiler) return;
+    int64_t durationNs = PipelineProfiler::nowNs() - startNs;
+    if (stall) {
+        profiler->addStall(stage, durationNs);
+    } else {
+        profiler->addBusy(stage, durationNs);
+    }
+    if (profiler->isTracing() && (!stall || durationNs >= MIN_TRACED_STALL_NS)) {
+        profiler->traceEvent(stage, stall, startNs, durationNs);
+    }
+#ifdef __ANDROID__
+    if (traced) ATrace_endSection();
+#endif
+}
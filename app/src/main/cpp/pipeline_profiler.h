@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+enum class PipelineStage {
+    Extract = 0,
+    Decode,
+    Stretch,
+    Encode,
+    Mux,
+};
+
+static const size_t PIPELINE_STAGE_COUNT = 5;
+
+const char* pipelineStageName(PipelineStage stage);
+
+struct StageStats {
+    uint64_t samples = 0;
+    uint64_t bytes = 0;
+    // Time spent doing the stage's work
+    int64_t busyUs = 0;
+    // Time spent blocked on codec buffers, or on room downstream for the mux
+    int64_t stallUs = 0;
+};
+
+struct PipelineStats {
+    StageStats stages[PIPELINE_STAGE_COUNT];
+    int64_t wallUs = 0;
+};
+
+// Per-stage counters and timers for one pipeline run, updated lock-free from
+// any stage thread. Timed sections also show up as ATrace sections on device
+// and, once enableTrace() is called, are recorded as Chrome trace events that
+// writeChromeTrace() dumps for chrome://tracing or Perfetto.
+class PipelineProfiler {
+public:
+    static int64_t nowNs();
+
+    void count(PipelineStage stage, size_t samples, size_t bytes);
+    void addBusy(PipelineStage stage, int64_t ns);
+    void addStall(PipelineStage stage, int64_t ns);
+    void setWallTime(int64_t us) { wallUs.store(us, std::memory_order_relaxed); }
+
+    PipelineStats snapshot() const;
+    void log() const;
+
+    void enableTrace() { tracing.store(true, std::memory_order_relaxed); }
+    bool isTracing() const { return tracing.load(std::memory_order_relaxed); }
+    void traceEvent(PipelineStage stage, bool stall, int64_t startNs, int64_t durationNs);
+    // Returns false if the file could not be written
+    bool writeChromeTrace(const char* path) const;
+
+private:
+    struct Counters {
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<int64_t> busyNs{0};
+        std::atomic<int64_t> stallNs{0};
+    };
+
+    struct TraceEvent {
+        uint8_t stage;
+        bool stall;
+        uint32_t thread;
+        int64_t startNs;
+        int64_t durationNs;
+    };
+
+    Counters counters[PIPELINE_STAGE_COUNT];
+    std::atomic<int64_t> wallUs{0};
+    const int64_t originNs = nowNs();
+
+    std::atomic<bool> tracing{false};
+    mutable std::mutex traceMutex;
+    std::vector<TraceEvent> events;
+};
+
+// Times the enclosing scope as busy or stalled time of one stage. A null
+// profiler makes it a no-op.
+class ScopedStage {
+public:
+    ScopedStage(PipelineProfiler* profiler, PipelineStage stage, bool stall = false);
+    ~ScopedStage();
+
+    ScopedStage(const ScopedStage&) = delete;
+    ScopedStage& operator=(const ScopedStage&) = delete;
+
+private:
+    PipelineProfiler* profiler;
+    PipelineStage stage;
+    bool stall;
+    bool traced = false;
+    int64_t startNs = 0;
+};
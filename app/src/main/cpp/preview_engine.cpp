@@ -0,0 +1,488 @@
+#include "preview_engine.h"
+#include "editor_log.h"
+#include "pipeline_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+static const int64_t CODEC_TIMEOUT_US = 5000;
+// Stretched audio buffered ahead of the sink. Also bounds how long a live
+// speed change takes to be heard, so it stays short.
+static const size_t PREVIEW_RING_FRAMES = 8192;
+// Audio buffered before the sink starts after play or seek
+static const size_t PREROLL_FRAMES = 2048;
+static const int64_t PREROLL_TIMEOUT_NS = 500000000;
+// Frames are released this far ahead of their display time so the
+// compositor can latch them on the right vsync
+static const int64_t RENDER_LEAD_NS = 20000000;
+// Frames decoded later than this after their display time are dropped
+static const int64_t LATE_DROP_NS = 40000000;
+// Frames closer than this in output time would land on the same 60 Hz
+// refresh as the previous one, so decoding is all they get
+static const int64_t MIN_FRAME_SPACING_US = 12500;
+// Longest sleep between checks for pause, seek and close
+static const int64_t MAX_WAIT_NS = 10000000;
+static const auto BACKOFF = std::chrono::milliseconds(2);
+
+// Frames at the start of a decoded buffer that lie before timeUs
+static size_t framesBefore(int64_t bufferPtsUs, size_t frames, int64_t timeUs, int32_t sampleRate) {
+    if (timeUs <= bufferPtsUs) return 0;
+    int64_t n = ((timeUs - bufferPtsUs) * sampleRate + 999999) / 1000000;
+    return std::min((size_t) n, frames);
+}
+
+PreviewEngine::PreviewEngine(MediaBackend& backend, void* surface, AudioSink* audio)
+        : backend(backend), surface(surface), audio(audio) {}
+
+PreviewEngine::~PreviewEngine() {
+    close();
+}
+
+int PreviewEngine::open(const char* path, const std::vector<Segment>& segments) {
+    videoExtractor = backend.createExtractor(path);
+    if (!videoExtractor) {
+        LOGE("Preview: cannot open %s", path);
+        return -1;
+    }
+
+    ssize_t videoTrack = -1, audioTrack = -1;
+    std::unique_ptr<MediaFormat> videoFormat, audioFormat;
+    std::string videoMime, audioMime;
+    for (size_t i = 0; i < videoExtractor->getTrackCount(); i++) {
+        std::unique_ptr<MediaFormat> format = videoExtractor->getTrackFormat(i);
+        std::string mime;
+        if (!format || !format->getString(MEDIA_KEY_MIME, &mime)) continue;
+        if (videoTrack < 0 && mime.compare(0, 6, "video/") == 0) {
+            videoTrack = (ssize_t) i;
+            videoFormat = std::move(format);
+            videoMime = mime;
+        } else if (audioTrack < 0 && mime.compare(0, 6, "audio/") == 0) {
+            audioTrack = (ssize_t) i;
+            audioFormat = std::move(format);
+            audioMime = mime;
+        }
+    }
+    if (videoTrack < 0) {
+        LOGE("Preview: no video track");
+        return -1;
+    }
+    videoFormat->getInt64(MEDIA_KEY_DURATION, &sourceDurationUs);
+
+    auto compiled = std::make_shared<SegmentTimeline>();
+    if (!compiled->compile(segments, sourceDurationUs)) {
+        LOGE("Preview: invalid segments");
+        return -1;
+    }
+    timeline = compiled;
+
+    videoExtractor->selectTrack(videoTrack);
+    videoDecoder = backend.createDecoder(videoMime.c_str());
+    if (!videoDecoder || videoDecoder->configureSurface(*videoFormat, surface) != MEDIA_OK ||
+        videoDecoder->start() != MEDIA_OK) {
+        LOGE("Preview: cannot start %s decoder", videoMime.c_str());
+        return -1;
+    }
+
+    // Anything wrong on the audio side leaves a silent preview rather than none
+    if (audio && audioTrack >= 0 && audioFormat->getInt32(MEDIA_KEY_SAMPLE_RATE, &sampleRate) &&
+        audioFormat->getInt32(MEDIA_KEY_CHANNEL_COUNT, &channels)) {
+        audioExtractor = backend.createExtractor(path);
+        audioDecoder = backend.createDecoder(audioMime.c_str());
+        ring = std::make_unique<PcmRingBuffer>(channels, PREVIEW_RING_FRAMES);
+        if (!audioExtractor || audioExtractor->selectTrack(audioTrack) != MEDIA_OK || !audioDecoder ||
+            audioDecoder->configure(*audioFormat, false) != MEDIA_OK || audioDecoder->start() != MEDIA_OK ||
+            audio->open(sampleRate, channels, ring.get()) != 0) {
+            LOGE("Preview: audio unavailable, previewing without sound");
+            if (audioDecoder) audioDecoder->stop();
+            audioDecoder.reset();
+            audioExtractor.reset();
+            ring.reset();
+        } else {
+            stretcher = std::make_unique<TimeStretcher>(sampleRate, channels);
+        }
+    }
+    if (!audioDecoder) audio = nullptr;
+
+    LOGI("Preview: %s, %zu segments, %lld us, audio %s", path, segments.size(),
+         (long long) compiled->outputDurationUs(), audio ? "on" : "off");
+    return seekTo(0);
+}
+
+void PreviewEngine::close() {
+    stopWorkers();
+    if (audio) {
+        audio->close();
+        audio = nullptr;
+    }
+    if (videoDecoder) videoDecoder->stop();
+    if (audioDecoder) audioDecoder->stop();
+    videoDecoder.reset();
+    audioDecoder.reset();
+    videoExtractor.reset();
+    audioExtractor.reset();
+}
+
+int PreviewEngine::play() {
+    if (!videoDecoder) return -1;
+    waitForPreroll();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (playing) return 0;
+    playing = true;
+    wallBaseUs = pausedPositionUs;
+    wallAnchorNs = PipelineProfiler::nowNs();
+    if (audio) audio->start();
+    stateChanged.notify_all();
+    return 0;
+}
+
+void PreviewEngine::pause() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!playing) return;
+    pausedPositionUs = clockUs(PipelineProfiler::nowNs());
+    playing = false;
+    if (audio) audio->pause();
+    stateChanged.notify_all();
+}
+
+bool PreviewEngine::isPlaying() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return playing;
+}
+
+int PreviewEngine::seekTo(int64_t outputUs) {
+    if (!videoDecoder) return -1;
+    stopWorkers();
+
+    int64_t sourceUs = 0;
+    bool resume;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        outputUs = std::max(std::min(outputUs, timeline->outputDurationUs() - 1), (int64_t) 0);
+        timeline->outputToSource(outputUs, &sourceUs);
+        pausedPositionUs = outputUs;
+        audioBaseUs = outputUs;
+        wallBaseUs = outputUs;
+        wallAnchorNs = PipelineProfiler::nowNs();
+        seekTargetUs = outputUs;
+        audioStartUs = outputUs;
+        lastShownUs = -1;
+        firstFrameShown = false;
+        resume = playing;
+    }
+
+    videoDecoder->flush();
+    videoExtractor->seekTo(sourceUs, MediaSeekMode::PreviousSync);
+    videoInputDone = false;
+    videoDone = false;
+    running = true;
+    videoThread = std::thread(&PreviewEngine::videoLoop, this);
+
+    if (audio) {
+        restartAudio(sourceUs);
+        if (resume) {
+            waitForPreroll();
+            audio->start();
+        }
+    }
+    LOGI("Preview: seek to %lld us (source %lld us)", (long long) outputUs, (long long) sourceUs);
+    return 0;
+}
+
+int PreviewEngine::setSegments(const std::vector<Segment>& segments) {
+    if (!videoDecoder) return -1;
+    auto next = std::make_shared<SegmentTimeline>();
+    if (!next->compile(segments, sourceDurationUs)) {
+        LOGE("Preview: invalid segments");
+        return -1;
+    }
+
+    // Audio already stretched at the old speeds would put the audio clock
+    // out of step with the new timeline, so it is restarted at the mapped
+    // position. Video keeps decoding and just remaps the frames it gets.
+    stopAudioWorker();
+
+    int64_t sourceUs = 0, positionUs = 0;
+    bool resume;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        int64_t oldPositionUs = clockUs(PipelineProfiler::nowNs());
+        timeline->outputToSource(std::min(oldPositionUs, timeline->outputDurationUs() - 1), &sourceUs);
+        if (!next->sourceToOutput(sourceUs, &positionUs)) {
+            // The current source position was cut: continue at the next kept segment
+            positionUs = next->outputDurationUs();
+            for (const TimelineSegment& segment : next->all()) {
+                if (segment.sourceStartUs > sourceUs) {
+                    positionUs = segment.outputStartUs;
+                    sourceUs = segment.sourceStartUs;
+                    break;
+                }
+            }
+        }
+
+        int64_t shiftUs = positionUs - oldPositionUs;
+        pausedPositionUs = positionUs;
+        audioBaseUs = positionUs;
+        wallBaseUs += shiftUs;
+        seekTargetUs += shiftUs;
+        audioStartUs = positionUs;
+        if (lastShownUs >= 0) lastShownUs += shiftUs;
+        timeline = next;
+        resume = playing;
+        stateChanged.notify_all();
+    }
+
+    // Once the decoder has been sent EOS it cannot pick up a longer timeline
+    if (videoInputDone) return seekTo(positionUs);
+
+    if (audio) {
+        restartAudio(sourceUs);
+        if (resume) {
+            waitForPreroll();
+            audio->start();
+        }
+    }
+    LOGI("Preview: %zu segments, continuing at %lld us", segments.size(), (long long) positionUs);
+    return 0;
+}
+
+int64_t PreviewEngine::positionUs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!timeline) return 0;
+    return std::min(clockUs(PipelineProfiler::nowNs()), timeline->outputDurationUs());
+}
+
+int64_t PreviewEngine::durationUs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return timeline ? timeline->outputDurationUs() : 0;
+}
+
+bool PreviewEngine::hasEnded() const {
+    if (!videoDone) return false;
+    return !audio || (ring->isFinished() && ring->readableFrames() == 0);
+}
+
+PreviewStats PreviewEngine::stats() const {
+    PreviewStats stats;
+    stats.framesRendered = framesRendered;
+    stats.framesLate = framesLate;
+    stats.framesSkipped = framesSkipped;
+    stats.audioUnderruns = audio ? audio->underruns() : 0;
+    stats.latenessSumUs = latenessSumUs;
+    stats.latenessMaxUs = latenessMaxUs;
+    return stats;
+}
+
+int64_t PreviewEngine::clockUs(int64_t nowNs) const {
+    if (!playing) return pausedPositionUs;
+    if (!audio) return wallBaseUs + (nowNs - wallAnchorNs) / 1000;
+
+    int64_t frames, atNs;
+    audio->playedFrames(&frames, &atNs);
+    // Between device callbacks the clock runs on wall time, but no further
+    // than one burst so it stalls with the audio on an underrun
+    int64_t sinceNs = std::max(nowNs - atNs, (int64_t) 0);
+    bool audioEnded = ring->isFinished() && ring->readableFrames() == 0;
+    if (!audioEnded) sinceNs = std::min(sinceNs, (int64_t) 1000000000 * audio->burstFrames() / sampleRate);
+    return audioBaseUs + frames * 1000000 / sampleRate + sinceNs / 1000;
+}
+
+void PreviewEngine::stopWorkers() {
+    stopAudioWorker();
+    if (videoThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+            stateChanged.notify_all();
+        }
+        videoThread.join();
+    }
+}
+
+void PreviewEngine::stopAudioWorker() {
+    if (!audioThread.joinable()) return;
+    audioRunning = false;
+    audioThread.join();
+}
+
+void PreviewEngine::restartAudio(int64_t sourceUs) {
+    // The sink stops reading before the ring is reset under it
+    audio->flush();
+    ring->reset();
+    stretcher = std::make_unique<TimeStretcher>(sampleRate, channels);
+    audioDecoder->flush();
+    audioExtractor->seekTo(sourceUs, MediaSeekMode::PreviousSync);
+    audioRunning = true;
+    audioThread = std::thread(&PreviewEngine::audioLoop, this);
+}
+
+void PreviewEngine::waitForPreroll() {
+    if (!audio) return;
+    int64_t deadlineNs = PipelineProfiler::nowNs() + PREROLL_TIMEOUT_NS;
+    while (ring->readableFrames() < PREROLL_FRAMES && !ring->isFinished() &&
+           PipelineProfiler::nowNs() < deadlineNs) {
+        std::this_thread::sleep_for(BACKOFF);
+    }
+}
+
+void PreviewEngine::feedDecoder(MediaExtractor& extractor, MediaCodec& decoder, bool* inputDone) {
+    if (*inputDone) return;
+    ssize_t index = decoder.dequeueInputBuffer(0);
+    if (index < 0) return;
+    size_t capacity;
+    uint8_t* buffer = decoder.getInputBuffer(index, &capacity);
+    if (!buffer) return;
+
+    int64_t endUs;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        endUs = timeline->empty() ? 0 : timeline->all().back().sourceEndUs;
+    }
+    ssize_t size = extractor.readSampleData(buffer, capacity);
+    int64_t pts = extractor.getSampleTime();
+    // Nothing past the last segment is ever shown
+    if (size < 0 || pts >= endUs) {
+        decoder.queueInputBuffer(index, 0, 0, 0, BUFFER_FLAG_END_OF_STREAM);
+        *inputDone = true;
+        return;
+    }
+    decoder.queueInputBuffer(index, 0, size, pts, 0);
+    extractor.advance();
+}
+
+void PreviewEngine::videoLoop() {
+    bool inputDone = false;
+    while (running) {
+        feedDecoder(*videoExtractor, *videoDecoder, &inputDone);
+        if (inputDone) videoInputDone = true;
+
+        SampleInfo info;
+        ssize_t index = videoDecoder->dequeueOutputBuffer(&info, CODEC_TIMEOUT_US);
+        if (index < 0) continue;
+        if (info.flags & BUFFER_FLAG_END_OF_STREAM) {
+            videoDecoder->releaseOutputBuffer(index, false);
+            videoDone = true;
+            return;
+        }
+        presentFrame(index, info.presentationTimeUs);
+    }
+}
+
+void PreviewEngine::presentFrame(size_t index, int64_t sourceUs) {
+    std::unique_lock<std::mutex> lock(mutex);
+    int64_t outputUs = 0;
+    int64_t renderNs = -1;
+    bool show = false;
+    while (running) {
+        // Looked up on every pass, setSegments() may swap the timeline meanwhile
+        if (!timeline->sourceToOutput(sourceUs, &outputUs) || outputUs < seekTargetUs) break;
+        if (firstFrameShown && lastShownUs >= 0 && outputUs - lastShownUs < MIN_FRAME_SPACING_US) {
+            framesSkipped++;
+            break;
+        }
+        if (!playing) {
+            // The first frame after open or seek is shown right away as a still
+            if (!firstFrameShown) {
+                show = true;
+                break;
+            }
+            stateChanged.wait_for(lock, std::chrono::nanoseconds(MAX_WAIT_NS));
+            continue;
+        }
+
+        int64_t nowNs = PipelineProfiler::nowNs();
+        renderNs = nowNs + (outputUs - clockUs(nowNs)) * 1000;
+        int64_t waitNs = renderNs - RENDER_LEAD_NS - nowNs;
+        if (waitNs > 0) {
+            stateChanged.wait_for(lock, std::chrono::nanoseconds(std::min(waitNs, MAX_WAIT_NS)));
+            continue;
+        }
+        if (nowNs - renderNs > LATE_DROP_NS) {
+            framesLate++;
+            break;
+        }
+
+        int64_t latenessUs = std::max(nowNs - renderNs, (int64_t) 0) / 1000;
+        latenessSumUs += latenessUs;
+        if (latenessUs > latenessMaxUs) latenessMaxUs = latenessUs;
+        show = true;
+        break;
+    }
+    if (show) {
+        firstFrameShown = true;
+        lastShownUs = outputUs;
+        framesRendered++;
+    }
+    lock.unlock();
+
+    if (!show) {
+        videoDecoder->releaseOutputBuffer(index, false);
+    } else if (renderNs < 0) {
+        videoDecoder->releaseOutputBuffer(index, true);
+    } else {
+        videoDecoder->releaseOutputBufferAtTime(index, renderNs);
+    }
+}
+
+void PreviewEngine::audioLoop() {
+    bool inputDone = false, outputDone = false;
+    const size_t frameBytes = channels * sizeof(short);
+    while (audioRunning) {
+        ring->fillFrom(*stretcher);
+        if (stretcher->available() > 0) {
+            // Ring full: the sink drains a burst at a time
+            std::this_thread::sleep_for(BACKOFF);
+            continue;
+        }
+        if (outputDone) {
+            ring->finish();
+            return;
+        }
+
+        feedDecoder(*audioExtractor, *audioDecoder, &inputDone);
+        SampleInfo info;
+        ssize_t index = audioDecoder->dequeueOutputBuffer(&info, CODEC_TIMEOUT_US);
+        if (index < 0) continue;
+        size_t size;
+        uint8_t* data = audioDecoder->getOutputBuffer(index, &size);
+        if (data && info.size > 0) {
+            writeAudio(reinterpret_cast<const short*>(data + info.offset), info.size / frameBytes,
+                       info.presentationTimeUs);
+        }
+        audioDecoder->releaseOutputBuffer(index, false);
+        if (info.flags & BUFFER_FLAG_END_OF_STREAM) {
+            stretcher->flush();
+            outputDone = true;
+        }
+    }
+}
+
+void PreviewEngine::writeAudio(const short* samples, size_t frames, int64_t ptsUs) {
+    std::shared_ptr<const SegmentTimeline> snapshot;
+    int64_t startUs;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot = timeline;
+        startUs = audioStartUs;
+    }
+
+    // A buffer can straddle a cut or a speed change, so write it per segment
+    int64_t bufferEndUs = ptsUs + (int64_t) frames * 1000000 / sampleRate;
+    for (const TimelineSegment& segment : snapshot->all()) {
+        if (segment.sourceEndUs <= ptsUs || segment.outputEndUs <= startUs) continue;
+        if (segment.sourceStartUs >= bufferEndUs) break;
+
+        int64_t fromUs = segment.sourceStartUs;
+        if (startUs > segment.outputStartUs) fromUs = std::max(fromUs, segment.toSource(startUs));
+        size_t first = framesBefore(ptsUs, frames, fromUs, sampleRate);
+        size_t last = framesBefore(ptsUs, frames, segment.sourceEndUs, sampleRate);
+        if (first >= last) continue;
+        if (segment.warp) {
+            int64_t firstUs = ptsUs + (int64_t) first * 1000000 / sampleRate;
+            stretcher->write(samples + first * channels, last - first, *segment.warp,
+                             firstUs - segment.sourceStartUs);
+            continue;
+        }
+        if (stretcher->getSpeed() != segment.speed) stretcher->setSpeed(segment.speed);
+        stretcher->write(samples + first * channels, last - first);
+    }
+}
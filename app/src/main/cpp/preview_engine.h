@@ -0,0 +1,121 @@
+#pragma once
+
+#include "audio_sink.h"
+#include "media_backend.h"
+#include "pcm_ring_buffer.h"
+#include "segment_timeline.h"
+#include "time_stretcher.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct PreviewStats {
+    int64_t framesRendered = 0;
+    // Decoded too late for their display time and dropped
+    int64_t framesLate = 0;
+    // Dropped because a newer frame lands on the same refresh, e.g. at 4x
+    int64_t framesSkipped = 0;
+    int64_t audioUnderruns = 0;
+    // How far past its display time each frame was handed to the codec
+    int64_t latenessSumUs = 0;
+    int64_t latenessMaxUs = 0;
+};
+
+// Real-time preview of a segment list without exporting. Video decodes
+// straight to the surface and each frame is released with its display time,
+// so the compositor does the final scheduling. Audio is stretched into a
+// PcmRingBuffer that the AudioSink drains, and the sink's played-frame count
+// is the master clock; without audio the clock is wall time.
+//
+// The timeline is shared with the workers and can be swapped while playing,
+// so a speed change takes effect within a few frames without a seek.
+class PreviewEngine {
+public:
+    // surface is handed to MediaCodec::configureSurface(). audio may be null
+    // for a silent preview.
+    PreviewEngine(MediaBackend& backend, void* surface, AudioSink* audio);
+    ~PreviewEngine();
+
+    // Prepares the decoders and shows the first frame, paused at 0
+    int open(const char* path, const std::vector<Segment>& segments);
+    void close();
+
+    int play();
+    void pause();
+    bool isPlaying() const;
+
+    // outputUs is a position on the current timeline
+    int seekTo(int64_t outputUs);
+
+    // Live edit: playback continues from the same source position
+    int setSegments(const std::vector<Segment>& segments);
+
+    int64_t positionUs() const;
+    int64_t durationUs() const;
+    // Every frame and all audio up to the end of the timeline has played
+    bool hasEnded() const;
+    PreviewStats stats() const;
+
+private:
+    void stopWorkers();
+    void stopAudioWorker();
+    // Flushes the sink, ring and decoder and decodes again from sourceUs
+    void restartAudio(int64_t sourceUs);
+    void waitForPreroll();
+    void videoLoop();
+    void audioLoop();
+    void feedDecoder(MediaExtractor& extractor, MediaCodec& decoder, bool* inputDone);
+    void presentFrame(size_t index, int64_t sourceUs);
+    void writeAudio(const short* samples, size_t frames, int64_t ptsUs);
+    // Caller holds mutex
+    int64_t clockUs(int64_t nowNs) const;
+
+    MediaBackend& backend;
+    void* surface;
+    AudioSink* audio;
+
+    std::unique_ptr<MediaExtractor> videoExtractor;
+    std::unique_ptr<MediaExtractor> audioExtractor;
+    std::unique_ptr<MediaCodec> videoDecoder;
+    std::unique_ptr<MediaCodec> audioDecoder;
+    int64_t sourceDurationUs = -1;
+    int32_t sampleRate = 0;
+    int32_t channels = 0;
+    std::unique_ptr<PcmRingBuffer> ring;
+    std::unique_ptr<TimeStretcher> stretcher;
+
+    std::thread videoThread;
+    std::thread audioThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> audioRunning{false};
+    std::atomic<bool> videoInputDone{false};
+    std::atomic<bool> videoDone{false};
+
+    // Guards the timeline pointer and the clock
+    mutable std::mutex mutex;
+    std::condition_variable stateChanged;
+    std::shared_ptr<const SegmentTimeline> timeline;
+    bool playing = false;
+    int64_t pausedPositionUs = 0;
+    // Output time of the first frame the sink plays after a flush
+    int64_t audioBaseUs = 0;
+    // Wall clock used when there is no audio
+    int64_t wallBaseUs = 0;
+    int64_t wallAnchorNs = 0;
+    // Frames before this output time are decoded but not presented
+    int64_t seekTargetUs = 0;
+    // Audio before this output time is trimmed after a seek or live edit
+    int64_t audioStartUs = 0;
+    int64_t lastShownUs = -1;
+    bool firstFrameShown = false;
+
+    std::atomic<int64_t> framesRendered{0};
+    std::atomic<int64_t> framesLate{0};
+    std::atomic<int64_t> framesSkipped{0};
+    std::atomic<int64_t> latenessSumUs{0};
+    std::atomic<int64_t> latenessMaxUs{0};
+};
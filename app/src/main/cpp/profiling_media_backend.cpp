@@ -0,0 +1,135 @@
+#include "profiling_media_backend.h"
+
+namespace {
+
+class ProfilingExtractor : public MediaExtractor {
+public:
+    ProfilingExtractor(std::unique_ptr<MediaExtractor> extractor, PipelineProfiler* profiler)
+            : extractor(std::move(extractor)), profiler(profiler) {}
+
+    size_t getTrackCount() override { return extractor->getTrackCount(); }
+    std::unique_ptr<MediaFormat> getTrackFormat(size_t track) override { return extractor->getTrackFormat(track); }
+    int selectTrack(size_t track) override { return extractor->selectTrack(track); }
+    int unselectTrack(size_t track) override { return extractor->unselectTrack(track); }
+
+    int seekTo(int64_t timeUs, MediaSeekMode mode) override {
+        ScopedStage scope(profiler, PipelineStage::Extract);
+        return extractor->seekTo(timeUs, mode);
+    }
+
+    ssize_t readSampleData(uint8_t* buffer, size_t capacity) override {
+        ScopedStage scope(profiler, PipelineStage::Extract);
+        ssize_t size = extractor->readSampleData(buffer, capacity);
+        if (size >= 0) profiler->count(PipelineStage::Extract, 1, size);
+        return size;
+    }
+
+    const uint8_t* sampleView(size_t* size) override {
+        ScopedStage scope(profiler, PipelineStage::Extract);
+        const uint8_t* view = extractor->sampleView(size);
+        if (view) profiler->count(PipelineStage::Extract, 1, *size);
+        return view;
+    }
+
+    ssize_t getSampleSize() override { return extractor->getSampleSize(); }
+    int getSampleTrackIndex() override { return extractor->getSampleTrackIndex(); }
+    int64_t getSampleTime() override { return extractor->getSampleTime(); }
+    uint32_t getSampleFlags() override { return extractor->getSampleFlags(); }
+    bool advance() override { return extractor->advance(); }
+    int fileDescriptor() const override { return extractor->fileDescriptor(); }
+
+private:
+    std::unique_ptr<MediaExtractor> extractor;
+    PipelineProfiler* profiler;
+};
+
+class ProfilingCodec : public MediaCodec {
+public:
+    ProfilingCodec(std::unique_ptr<MediaCodec> codec, PipelineProfiler* profiler, PipelineStage stage)
+            : codec(std::move(codec)), profiler(profiler), stage(stage) {}
+
+    int setCallbacks(const CodecCallbacks& callbacks) override {
+        // In callback mode outputs are counted as they are announced
+        CodecCallbacks counted = callbacks;
+        if (callbacks.onOutputAvailable) {
+            counted.onOutputAvailable = [this, callbacks](size_t index, const SampleInfo& info) {
+                if (info.size > 0) profiler->count(stage, 1, info.size);
+                callbacks.onOutputAvailable(index, info);
+            };
+        }
+        return codec->setCallbacks(counted);
+    }
+
+    int configure(const MediaFormat& format, bool encoder) override { return codec->configure(format, encoder); }
+    int configureSurface(const MediaFormat& format, void* surface) override {
+        return codec->configureSurface(format, surface);
+    }
+    int start() override { return codec->start(); }
+    int stop() override { return codec->stop(); }
+    int flush() override { return codec->flush(); }
+
+    ssize_t dequeueInputBuffer(int64_t timeoutUs) override {
+        ScopedStage scope(profiler, stage, true);
+        return codec->dequeueInputBuffer(timeoutUs);
+    }
+
+    uint8_t* getInputBuffer(size_t index, size_t* size) override { return codec->getInputBuffer(index, size); }
+
+    int queueInputBuffer(size_t index, size_t offset, size_t size, int64_t presentationTimeUs,
+                         uint32_t flags) override {
+        ScopedStage scope(profiler, stage);
+        return codec->queueInputBuffer(index, offset, size, presentationTimeUs, flags);
+    }
+
+    ssize_t dequeueOutputBuffer(SampleInfo* info, int64_t timeoutUs) override {
+        ssize_t index;
+        {
+            ScopedStage scope(profiler, stage, true);
+            index = codec->dequeueOutputBuffer(info, timeoutUs);
+        }
+        if (index >= 0 && info->size > 0) profiler->count(stage, 1, info->size);
+        return index;
+    }
+
+    uint8_t* getOutputBuffer(size_t index, size_t* size) override { return codec->getOutputBuffer(index, size); }
+
+    int releaseOutputBuffer(size_t index, bool render) override {
+        ScopedStage scope(profiler, stage);
+        return codec->releaseOutputBuffer(index, render);
+    }
+
+    int releaseOutputBufferAtTime(size_t index, int64_t renderTimeNs) override {
+        ScopedStage scope(profiler, stage);
+        return codec->releaseOutputBufferAtTime(index, renderTimeNs);
+    }
+
+    std::unique_ptr<MediaFormat> getOutputFormat() override { return codec->getOutputFormat(); }
+
+private:
+    std::unique_ptr<MediaCodec> codec;
+    PipelineProfiler* profiler;
+    PipelineStage stage;
+};
+
+} // namespace
+
+std::unique_ptr<MediaExtractor> ProfilingMediaBackend::createExtractor(const char* path) {
+    return profile(backend.createExtractor(path));
+}
+
+std::unique_ptr<MediaExtractor> ProfilingMediaBackend::profile(std::unique_ptr<MediaExtractor> extractor) {
+    if (!extractor) return nullptr;
+    return std::make_unique<ProfilingExtractor>(std::move(extractor), profiler);
+}
+
+std::unique_ptr<MediaCodec> ProfilingMediaBackend::createDecoder(const char* mime) {
+    std::unique_ptr<MediaCodec> codec = backend.createDecoder(mime);
+    if (!codec) return nullptr;
+    return std::make_unique<ProfilingCodec>(std::move(codec), profiler, PipelineStage::Decode);
+}
+
+std::unique_ptr<MediaCodec> ProfilingMediaBackend::createEncoder(const char* mime) {
+    std::unique_ptr<MediaCodec> codec = backend.createEncoder(mime);
+    if (!codec) return nullptr;
+    return std::make_unique<ProfilingCodec>(std::move(codec), profiler, PipelineStage::Encode);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "media_backend.h"
+#include "pipeline_profiler.h"
+
+// Decorates another backend so every extractor read and codec call is
+// accounted to the extract, decode or encode stage of a PipelineProfiler.
+// Time spent in dequeue calls counts as stall time: it is time the caller
+// waited for a codec buffer. Muxers are passed through untouched, the mux
+// stage is measured by InterleavingMuxer.
+class ProfilingMediaBackend : public MediaBackend {
+public:
+    ProfilingMediaBackend(MediaBackend& backend, PipelineProfiler* profiler) : backend(backend), profiler(profiler) {}
+
+    const char* name() const override { return backend.name(); }
+    std::unique_ptr<MediaFormat> createFormat() override { return backend.createFormat(); }
+    std::unique_ptr<MediaExtractor> createExtractor(const char* path) override;
+    std::unique_ptr<MediaCodec> createDecoder(const char* mime) override;
+    std::unique_ptr<MediaCodec> createEncoder(const char* mime) override;
+    std::unique_ptr<MediaMuxer> createMuxer(const char* path) override { return backend.createMuxer(path); }
+
+    // Accounts an extractor created outside the backend, e.g. Mp4Extractor
+    std::unique_ptr<MediaExtractor> profile(std::unique_ptr<MediaExtractor> extractor);
+
+private:
+    MediaBackend& backend;
+    PipelineProfiler* profiler;
+};
@@ -0,0 +1,35 @@
+#include "sample_buffer_pool.h"
+
+bool SampleBuffer::reserve(size_t bytes) {
+    if (bytes <= size) return false;
+    size_t grown = size + size / 2;
+    size_t capacity = bytes > grown ? bytes : grown;
+    // Uninitialised on purpose: every byte is overwritten by the extractor
+    storage.reset(new uint8_t[capacity]);
+    size = capacity;
+    return true;
+}
+
+SampleBuffer* SampleBufferPool::acquire(size_t minCapacity) {
+    SampleBuffer* buffer;
+    if (!freeBuffers.empty()) {
+        buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+    } else {
+        buffers.push_back(std::make_unique<SampleBuffer>());
+        buffer = buffers.back().get();
+    }
+    reserve(buffer, minCapacity > initialCapacity ? minCapacity : initialCapacity);
+    return buffer;
+}
+
+void SampleBufferPool::release(SampleBuffer* buffer) {
+    freeBuffers.push_back(buffer);
+}
+
+uint8_t* SampleBufferPool::reserve(SampleBuffer* buffer, size_t bytes) {
+    if (buffer->reserve(bytes)) {
+        allocations++;
+    }
+    return buffer->data();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Reusable compressed-sample storage for the extract -> mux path. Buffers
+// start at the track's max-input-size and only reallocate when a sample is
+// larger than anything seen before, so steady-state remuxing does not touch
+// the heap. Not thread-safe; each track loop owns its pool.
+class SampleBuffer {
+public:
+    uint8_t* data() { return storage.get(); }
+    size_t capacity() const { return size; }
+
+    // Makes room for at least bytes, growing by 1.5x to amortise outliers.
+    // Contents are not preserved. Returns true if a reallocation happened.
+    bool reserve(size_t bytes);
+
+private:
+    std::unique_ptr<uint8_t[]> storage;
+    size_t size = 0;
+};
+
+class SampleBufferPool {
+public:
+    explicit SampleBufferPool(size_t initialCapacity) : initialCapacity(initialCapacity) {}
+
+    SampleBuffer* acquire(size_t minCapacity);
+    void release(SampleBuffer* buffer);
+
+    // Same as buffer->reserve(), but counted in allocationCount()
+    uint8_t* reserve(SampleBuffer* buffer, size_t bytes);
+
+    // Number of buffer (re)allocations made so far
+    size_t allocationCount() const { return allocations; }
+
+private:
+    size_t initialCapacity;
+    size_t allocations = 0;
+    std::vector<std::unique_ptr<SampleBuffer>> buffers;
+    std::vector<SampleBuffer*> freeBuffers;
+};
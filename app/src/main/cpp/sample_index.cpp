@@ -0,0 +1,291 @@
+#include "sample_index.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char INDEX_MAGIC[8] = {'S', 'P', 'I', 'D', 'X', '0', '0', '1'};
+
+struct IndexHeader {
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint32_t trackCount;
+    uint32_t pathLength;
+};
+
+struct IndexTrack {
+    uint32_t sampleCount;
+    uint32_t syncCount;
+    int64_t durationUs;
+    uint64_t samplesOffset;
+    uint64_t syncOffset;
+};
+
+static_assert(sizeof(IndexHeader) == 32, "IndexHeader is part of the file format");
+static_assert(sizeof(IndexTrack) == 32, "IndexTrack is part of the file format");
+static_assert(sizeof(SampleIndex::IndexedSample) == 16, "IndexedSample is part of the file format");
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+static bool statSource(const char* path, uint64_t* size, int64_t* mtimeNs) {
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    *size = (uint64_t) st.st_size;
+    *mtimeNs = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+SampleIndex::~SampleIndex() {
+    if (mapped) munmap(const_cast<uint8_t*>(mapped), mappedSize);
+}
+
+std::unique_ptr<SampleIndex> SampleIndex::build(MediaBackend& backend, const char* path) {
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    std::unique_ptr<MediaExtractor> extractor = backend.createExtractor(path);
+    if (!extractor || !statSource(path, &sourceSize, &sourceMtimeNs)) return nullptr;
+
+    size_t trackCount = extractor->getTrackCount();
+    std::vector<std::vector<IndexedSample>> samples(trackCount);
+    std::vector<std::vector<int64_t>> syncPts(trackCount);
+    for (size_t track = 0; track < trackCount; track++) extractor->selectTrack(track);
+
+    // Sizes and flags come from the container's tables, no sample data is read
+    while (true) {
+        int track = extractor->getSampleTrackIndex();
+        if (track < 0 || (size_t) track >= trackCount) break;
+        ssize_t size = extractor->getSampleSize();
+        int64_t pts = extractor->getSampleTime();
+        uint32_t flags = extractor->getSampleFlags();
+        samples[track].push_back({pts, (uint32_t) std::max(size, (ssize_t) 0), flags});
+        if (flags & SAMPLE_FLAG_SYNC) syncPts[track].push_back(pts);
+        if (!extractor->advance()) break;
+    }
+
+    // Lay the tables out exactly as they are saved, so a built index and a
+    // mapped one are read the same way
+    size_t size = sizeof(IndexHeader) + align8(strlen(path)) + trackCount * sizeof(IndexTrack);
+    std::vector<IndexTrack> tables(trackCount);
+    for (size_t track = 0; track < trackCount; track++) {
+        std::sort(syncPts[track].begin(), syncPts[track].end());
+        int64_t durationUs = 0;
+        for (const IndexedSample& sample : samples[track]) durationUs = std::max(durationUs, sample.ptsUs);
+
+        IndexTrack& table = tables[track];
+        table.sampleCount = (uint32_t) samples[track].size();
+        table.syncCount = (uint32_t) syncPts[track].size();
+        table.durationUs = durationUs;
+        table.samplesOffset = size;
+        size += table.sampleCount * sizeof(IndexedSample);
+        table.syncOffset = size;
+        size += table.syncCount * sizeof(int64_t);
+    }
+
+    std::unique_ptr<SampleIndex> index(new SampleIndex());
+    index->built.assign(size, 0);
+    uint8_t* out = index->built.data();
+    IndexHeader header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.sourceSize = sourceSize;
+    header.sourceMtimeNs = sourceMtimeNs;
+    header.trackCount = (uint32_t) trackCount;
+    header.pathLength = (uint32_t) strlen(path);
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), path, header.pathLength);
+    memcpy(out + sizeof(header) + align8(header.pathLength), tables.data(), trackCount * sizeof(IndexTrack));
+    for (size_t track = 0; track < trackCount; track++) {
+        memcpy(out + tables[track].samplesOffset, samples[track].data(),
+               samples[track].size() * sizeof(IndexedSample));
+        memcpy(out + tables[track].syncOffset, syncPts[track].data(), syncPts[track].size() * sizeof(int64_t));
+    }
+
+    if (!index->attach(index->built.data(), index->built.size())) return nullptr;
+    return index;
+}
+
+std::unique_ptr<SampleIndex> SampleIndex::load(const char* indexPath, const char* path) {
+    int fd = open(indexPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(IndexHeader)) {
+        data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+
+    std::unique_ptr<SampleIndex> index(new SampleIndex());
+    index->mapped = static_cast<const uint8_t*>(data);
+    index->mappedSize = (size_t) st.st_size;
+
+    if (!index->attach(index->mapped, index->mappedSize) || index->sourcePath != path || !index->isCurrent()) {
+        return nullptr;
+    }
+    return index;
+}
+
+bool SampleIndex::isCurrent() const {
+    uint64_t size;
+    int64_t mtimeNs;
+    return statSource(sourcePath.c_str(), &size, &mtimeNs) && size == sourceSize && mtimeNs == sourceMtimeNs;
+}
+
+// Validates the image and points the track views into it
+bool SampleIndex::attach(const uint8_t* data, size_t size) {
+    IndexHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0) return false;
+
+    size_t tablesOffset = sizeof(header) + align8(header.pathLength);
+    if (header.pathLength > size || tablesOffset + (size_t) header.trackCount * sizeof(IndexTrack) > size) {
+        return false;
+    }
+    sourcePath.assign(reinterpret_cast<const char*>(data + sizeof(header)), header.pathLength);
+    sourceSize = header.sourceSize;
+    sourceMtimeNs = header.sourceMtimeNs;
+
+    tracks.clear();
+    for (uint32_t track = 0; track < header.trackCount; track++) {
+        IndexTrack table;
+        memcpy(&table, data + tablesOffset + track * sizeof(IndexTrack), sizeof(table));
+        if (table.samplesOffset % 8 || table.syncOffset % 8 ||
+            table.samplesOffset + (uint64_t) table.sampleCount * sizeof(IndexedSample) > size ||
+            table.syncOffset + (uint64_t) table.syncCount * sizeof(int64_t) > size) {
+            return false;
+        }
+        tracks.push_back({table.sampleCount, table.syncCount, table.durationUs,
+                          reinterpret_cast<const IndexedSample*>(data + table.samplesOffset),
+                          reinterpret_cast<const int64_t*>(data + table.syncOffset)});
+    }
+    return true;
+}
+
+int SampleIndex::save(const char* indexPath) const {
+    const uint8_t* data = mapped ? mapped : built.data();
+    size_t size = mapped ? mappedSize : built.size();
+    std::string temporary = std::string(indexPath) + ".tmp";
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return -1;
+    bool written = fwrite(data, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), indexPath) != 0) {
+        remove(temporary.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int64_t SampleIndex::syncAtOrBefore(size_t track, int64_t timeUs) const {
+    const TrackView& view = tracks[track];
+    const int64_t* end = view.syncPts + view.syncCount;
+    const int64_t* it = std::upper_bound(view.syncPts, end, timeUs);
+    return it == view.syncPts ? -1 : *(it - 1);
+}
+
+int64_t SampleIndex::syncAtOrAfter(size_t track, int64_t timeUs) const {
+    const TrackView& view = tracks[track];
+    const int64_t* end = view.syncPts + view.syncCount;
+    const int64_t* it = std::lower_bound(view.syncPts, end, timeUs);
+    return it == end ? -1 : *it;
+}
+
+int64_t SampleIndex::closestSync(size_t track, int64_t timeUs) const {
+    int64_t before = syncAtOrBefore(track, timeUs);
+    int64_t after = syncAtOrAfter(track, timeUs);
+    if (before < 0) return after;
+    if (after < 0) return before;
+    return timeUs - before <= after - timeUs ? before : after;
+}
+
+SampleIndex::Estimate SampleIndex::estimate(const SegmentTimeline& timeline, int videoTrack, int audioTrack) const {
+    Estimate result;
+    result.durationUs = timeline.outputDurationUs();
+    if (videoTrack >= 0 && (size_t) videoTrack < tracks.size()) {
+        const TrackView& view = tracks[videoTrack];
+        for (uint32_t i = 0; i < view.sampleCount; i++) {
+            if (timeline.findBySource(view.samples[i].ptsUs) < 0) continue;
+            result.videoFrames++;
+            result.videoBytes += view.samples[i].size;
+        }
+    }
+    if (audioTrack >= 0 && (size_t) audioTrack < tracks.size()) {
+        const TrackView& view = tracks[audioTrack];
+        for (uint32_t i = 0; i < view.sampleCount; i++) {
+            ssize_t segment = timeline.findBySource(view.samples[i].ptsUs);
+            if (segment < 0) continue;
+            result.audioBytes += (int64_t) view.samples[i].size * timeline[segment].speedDen /
+                                 timeline[segment].speedNum;
+        }
+    }
+    return result;
+}
+
+std::shared_ptr<const SampleIndex> SampleIndexCache::get(MediaBackend& backend, const char* path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = loaded.find(path);
+    if (it != loaded.end() && it->second->isCurrent()) return it->second;
+
+    std::string indexPath = indexPathFor(path);
+    std::shared_ptr<const SampleIndex> index = SampleIndex::load(indexPath.c_str(), path);
+    if (index) {
+        LOGI("Sample index for %s loaded from %s", path, indexPath.c_str());
+    } else {
+        std::unique_ptr<SampleIndex> builtIndex = SampleIndex::build(backend, path);
+        if (!builtIndex) return nullptr;
+        if (builtIndex->save(indexPath.c_str()) != 0) LOGE("Failed to save sample index %s", indexPath.c_str());
+        LOGI("Sample index for %s built, %zu tracks", path, builtIndex->trackCount());
+        index = std::move(builtIndex);
+    }
+    loaded[path] = index;
+    return index;
+}
+
+// One file per source path, named by its 64-bit FNV-1a hash
+std::string SampleIndexCache::indexPathFor(const std::string& path) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : path) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.idx", (unsigned long long) hash);
+    return directory + name;
+}
+
+std::vector<Segment> snapSegmentsToKeyframes(const SampleIndex& index, int videoTrack,
+                                             const std::vector<Segment>& segments,
+                                             std::vector<size_t>* origins) {
+    if (origins) origins->clear();
+    if (videoTrack < 0 || (size_t) videoTrack >= index.trackCount()) {
+        for (size_t i = 0; origins && i < segments.size(); i++) origins->push_back(i);
+        return segments;
+    }
+    const int64_t lastUs = index.durationUs(videoTrack);
+    auto snap = [&](float seconds) {
+        int64_t timeUs = secToUs(seconds);
+        if (timeUs >= lastUs) return seconds;
+        int64_t syncUs = index.closestSync(videoTrack, timeUs);
+        return syncUs < 0 ? seconds : syncUs / 1000000.0f;
+    };
+
+    std::vector<Segment> snapped;
+    for (size_t i = 0; i < segments.size(); i++) {
+        Segment moved = segments[i];
+        moved.start = snap(segments[i].start);
+        moved.end = snap(segments[i].end);
+        if (moved.end <= moved.start) continue;
+        snapped.push_back(std::move(moved));
+        if (origins) origins->push_back(i);
+    }
+    return snapped;
+}
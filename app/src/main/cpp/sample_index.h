@@ -0,0 +1,113 @@
+#pragma once
+
+#include "media_backend.h"
+#include "segment_timeline.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Per-source table of every sample's PTS, size and sync flag, built once by
+// walking the extractor and kept on disk so later exports and scrubbing of
+// the same file can find keyframes and size ranges without touching the
+// container. Tracks are numbered like the extractor's.
+//
+// On disk the index is one flat little-endian file that is mmapped as is:
+//   IndexHeader, the source path padded to 8 bytes, one IndexTrack per
+//   track, then per track its IndexedSample array in decode order and its
+//   sync sample PTS (int64) in ascending order
+// It is only used while the source's path, size and mtime still match.
+class SampleIndex {
+public:
+    struct IndexedSample {
+        int64_t ptsUs;
+        uint32_t size;
+        uint32_t flags;
+    };
+
+    struct Estimate {
+        int64_t durationUs = 0;
+        int64_t videoFrames = 0;
+        int64_t videoBytes = 0;
+        int64_t audioBytes = 0;
+    };
+
+    ~SampleIndex();
+
+    // Walks every track of the source. Returns nullptr if it cannot be read.
+    static std::unique_ptr<SampleIndex> build(MediaBackend& backend, const char* path);
+    // Maps a saved index, nullptr if missing, corrupt or stale for path
+    static std::unique_ptr<SampleIndex> load(const char* indexPath, const char* path);
+    // Writes the index atomically (temporary file, then rename). Returns 0 on success.
+    int save(const char* indexPath) const;
+
+    // The source still has the size and mtime it was indexed at
+    bool isCurrent() const;
+
+    size_t trackCount() const { return tracks.size(); }
+    size_t sampleCount(size_t track) const { return tracks[track].sampleCount; }
+    const IndexedSample* samples(size_t track) const { return tracks[track].samples; }
+    // Last sample PTS of the track
+    int64_t durationUs(size_t track) const { return tracks[track].durationUs; }
+
+    // Sync sample lookups, -1 if there is none
+    int64_t syncAtOrBefore(size_t track, int64_t timeUs) const;
+    int64_t syncAtOrAfter(size_t track, int64_t timeUs) const;
+    // The one of the two nearest timeUs, earlier on a tie, like ClosestSync
+    int64_t closestSync(size_t track, int64_t timeUs) const;
+
+    // Output duration and payload size of an export. Video is counted as
+    // copied; audio at the source bitrate over the output duration.
+    Estimate estimate(const SegmentTimeline& timeline, int videoTrack, int audioTrack) const;
+
+private:
+    struct TrackView {
+        uint32_t sampleCount;
+        uint32_t syncCount;
+        int64_t durationUs;
+        const IndexedSample* samples;
+        const int64_t* syncPts;
+    };
+
+    SampleIndex() = default;
+    bool attach(const uint8_t* data, size_t size);
+
+    // Either an mmapped file or a freshly built image in the same layout
+    std::vector<uint8_t> built;
+    const uint8_t* mapped = nullptr;
+    size_t mappedSize = 0;
+    std::string sourcePath;
+    uint64_t sourceSize = 0;
+    int64_t sourceMtimeNs = 0;
+    std::vector<TrackView> tracks;
+};
+
+// Indexes by source path, in memory and under directory on disk. get()
+// builds and saves a missing or stale index, so the first export of a file
+// pays for one container walk and every later one loads it in O(1).
+class SampleIndexCache {
+public:
+    explicit SampleIndexCache(std::string directory) : directory(std::move(directory)) {}
+
+    // nullptr if the source cannot be indexed
+    std::shared_ptr<const SampleIndex> get(MediaBackend& backend, const char* path);
+
+private:
+    std::string indexPathFor(const std::string& path) const;
+
+    std::string directory;
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const SampleIndex>> loaded;
+};
+
+// Moves every segment boundary to the nearest video keyframe, so the edges
+// need no re-encoding. Adjacent segments stay adjacent; a boundary at or past
+// the last sample stays put, and segments that collapse are dropped. Ramp
+// keyframes keep their source times. origins, if given, receives the input
+// index of every segment kept.
+std::vector<Segment> snapSegmentsToKeyframes(const SampleIndex& index, int videoTrack,
+                                             const std::vector<Segment>& segments,
+                                             std::vector<size_t>* origins = nullptr);
@@ -0,0 +1,227 @@
+#include "segment_render_cache.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char SEGMENT_MAGIC[8] = {'S', 'P', 'S', 'E', 'G', '0', '0', '1'};
+static const char SEGMENT_SUFFIX[] = ".seg";
+
+struct SegmentHeader {
+    char magic[8];
+    uint32_t sampleCount;
+    uint32_t reserved;
+    int64_t durationUs;
+};
+
+struct RecordHeader {
+    int64_t ptsUs;
+    uint32_t size;
+    uint32_t flags;
+};
+
+static_assert(sizeof(SegmentHeader) == 24, "SegmentHeader is part of the file format");
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader is part of the file format");
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+static uint64_t fnv1a(const std::string& text) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool endsWith(const char* name, const char* suffix) {
+    size_t length = strlen(name), suffixLength = strlen(suffix);
+    return length > suffixLength && strcmp(name + length - suffixLength, suffix) == 0;
+}
+
+CachedSegment::~CachedSegment() {
+    if (mapped) munmap(const_cast<uint8_t*>(mapped), mappedSize);
+}
+
+std::unique_ptr<CachedSegment> CachedSegment::load(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SegmentHeader)) {
+        data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+
+    std::unique_ptr<CachedSegment> segment(new CachedSegment());
+    segment->mapped = static_cast<const uint8_t*>(data);
+    segment->mappedSize = (size_t) st.st_size;
+
+    SegmentHeader header;
+    memcpy(&header, segment->mapped, sizeof(header));
+    if (memcmp(header.magic, SEGMENT_MAGIC, sizeof(header.magic)) != 0) return nullptr;
+    segment->duration = header.durationUs;
+
+    // Sample sizes are walked once so a truncated file is caught here, not mid-replay
+    size_t offset = sizeof(header);
+    segment->samples.reserve(header.sampleCount);
+    for (uint32_t i = 0; i < header.sampleCount; i++) {
+        RecordHeader record;
+        if (segment->mappedSize - offset < sizeof(record)) return nullptr;
+        memcpy(&record, segment->mapped + offset, sizeof(record));
+        offset += sizeof(record);
+        if (segment->mappedSize - offset < record.size) return nullptr;
+        segment->samples.push_back({record.ptsUs, record.flags, record.size, segment->mapped + offset});
+        offset += std::min(align8(record.size), segment->mappedSize - offset);
+    }
+    return segment;
+}
+
+SegmentRecorder::~SegmentRecorder() {
+    if (file) {
+        fclose(file);
+        remove(temporary.c_str());
+    }
+}
+
+void SegmentRecorder::append(const uint8_t* data, const SampleInfo& info) {
+    if (!ok || info.size <= 0 || (info.flags & BUFFER_FLAG_CODEC_CONFIG)) return;
+    static const uint8_t padding[8] = {};
+    RecordHeader record = {info.presentationTimeUs - baseUs, (uint32_t) info.size, info.flags};
+    size_t pad = align8(info.size) - info.size;
+    ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+         fwrite(data + info.offset, 1, info.size, file) == (size_t) info.size &&
+         fwrite(padding, 1, pad, file) == pad;
+    count++;
+    bytes += sizeof(record) + info.size + pad;
+}
+
+SegmentRenderCache::SegmentRenderCache(std::string directory, uint64_t maxBytes)
+        : directory(std::move(directory)), maxBytes(maxBytes) {
+    mkdir(this->directory.c_str(), 0700);
+}
+
+std::string SegmentRenderCache::sourceKey(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return std::string();
+    char identity[64];
+    snprintf(identity, sizeof(identity), "|%llu|%lld", (unsigned long long) st.st_size,
+             (long long) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+    return path + std::string(identity);
+}
+
+std::string SegmentRenderCache::keyFor(const std::string& trackKey, const TimelineSegment& segment) const {
+    char range[96];
+    snprintf(range, sizeof(range), "|%lld|%lld|%d/%d", (long long) segment.sourceStartUs,
+             (long long) segment.sourceEndUs, segment.speedNum, segment.speedDen);
+    // Ramps with the same average speed still render differently
+    if (segment.warp) {
+        size_t used = strlen(range);
+        snprintf(range + used, sizeof(range) - used, "|ramp%016llx", (unsigned long long) segment.warp->hash());
+    }
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long) fnv1a(trackKey + range));
+    return key;
+}
+
+// One file per key, named by the 64-bit FNV-1a hash of the key text
+std::string SegmentRenderCache::pathFor(const std::string& key) const {
+    return directory + "/" + key + SEGMENT_SUFFIX;
+}
+
+std::unique_ptr<CachedSegment> SegmentRenderCache::find(const std::string& key) {
+    std::string path = pathFor(key);
+    std::unique_ptr<CachedSegment> segment = CachedSegment::load(path.c_str());
+    // The mtime is the entry's last use for eviction
+    if (segment) utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    return segment;
+}
+
+std::unique_ptr<SegmentRecorder> SegmentRenderCache::record(const std::string& key, int64_t baseUs) {
+    // Concurrent jobs rendering the same segment each write their own file; the last rename wins
+    static std::atomic<uint32_t> serial(0);
+    std::string path = pathFor(key);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", (int) getpid(), serial++);
+    std::string temporary = path + suffix;
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        LOGE("Failed to create render cache entry %s", temporary.c_str());
+        return nullptr;
+    }
+    // The header is rewritten with the final counts at commit
+    SegmentHeader header = {};
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        remove(temporary.c_str());
+        return nullptr;
+    }
+    return std::unique_ptr<SegmentRecorder>(new SegmentRecorder(file, path, temporary, baseUs));
+}
+
+int SegmentRenderCache::commit(std::unique_ptr<SegmentRecorder> recorder) {
+    SegmentHeader header = {};
+    memcpy(header.magic, SEGMENT_MAGIC, sizeof(header.magic));
+    header.sampleCount = recorder->count;
+    header.durationUs = recorder->duration;
+    bool ok = recorder->ok && fseek(recorder->file, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, recorder->file) == 1;
+    ok = fclose(recorder->file) == 0 && ok;
+    recorder->file = nullptr;
+    if (!ok || rename(recorder->temporary.c_str(), recorder->path.c_str()) != 0) {
+        LOGE("Failed to write render cache entry %s", recorder->path.c_str());
+        remove(recorder->temporary.c_str());
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    totalBytes += sizeof(header) + recorder->bytes;
+    if (!scanned || totalBytes > maxBytes) evict();
+    return 0;
+}
+
+// Rescans the directory and deletes entries by last use until it fits
+void SegmentRenderCache::evict() {
+    struct Entry {
+        std::string path;
+        uint64_t size;
+        int64_t usedNs;
+    };
+    std::vector<Entry> entries;
+    totalBytes = 0;
+    scanned = true;
+
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return;
+    while (struct dirent* item = readdir(dir)) {
+        if (!endsWith(item->d_name, SEGMENT_SUFFIX)) continue;
+        std::string path = directory + "/" + item->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) continue;
+        entries.push_back({path, (uint64_t) st.st_size,
+                           (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec});
+        totalBytes += (uint64_t) st.st_size;
+    }
+    closedir(dir);
+    if (totalBytes <= maxBytes) return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.usedNs < b.usedNs; });
+    size_t removed = 0;
+    for (const Entry& entry : entries) {
+        if (totalBytes <= maxBytes) break;
+        if (remove(entry.path.c_str()) != 0) continue;
+        totalBytes -= entry.size;
+        removed++;
+    }
+    LOGI("Render cache evicted %zu entries, %llu bytes left", removed, (unsigned long long) totalBytes);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "media_backend.h"
+#include "segment_timeline.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One track's output for one segment as it went to the muxer, every sample
+// with its PTS relative to where the segment started in the output. Loaded
+// from the cache as an mmapped file and replayed in place.
+//
+// On disk: SegmentHeader, then per sample a RecordHeader followed by its data
+// padded to 8 bytes.
+class CachedSegment {
+public:
+    struct Sample {
+        int64_t ptsUs;
+        uint32_t flags;
+        uint32_t size;
+        const uint8_t* data;
+    };
+
+    ~CachedSegment();
+
+    // nullptr if missing or corrupt
+    static std::unique_ptr<CachedSegment> load(const char* path);
+
+    size_t sampleCount() const { return samples.size(); }
+    const Sample& operator[](size_t index) const { return samples[index]; }
+    // Output time the segment covered when it was rendered
+    int64_t durationUs() const { return duration; }
+
+private:
+    CachedSegment() = default;
+
+    const uint8_t* mapped = nullptr;
+    size_t mappedSize = 0;
+    int64_t duration = 0;
+    std::vector<Sample> samples;
+};
+
+// Streams the samples of a segment being rendered to a temporary file in the
+// CachedSegment layout; SegmentRenderCache::commit() publishes it. Dropped
+// without a commit, e.g. on failure or cancellation, nothing is cached.
+class SegmentRecorder {
+public:
+    ~SegmentRecorder();
+
+    // Samples flagged as codec config are left out; replays carry their
+    // parameter sets in-band
+    void append(const uint8_t* data, const SampleInfo& info);
+    void setDurationUs(int64_t durationUs) { duration = durationUs; }
+
+private:
+    friend class SegmentRenderCache;
+
+    SegmentRecorder(FILE* file, std::string path, std::string temporary, int64_t baseUs)
+            : file(file), path(std::move(path)), temporary(std::move(temporary)), baseUs(baseUs) {}
+
+    FILE* file;
+    std::string path;
+    std::string temporary;
+    int64_t baseUs;
+    int64_t duration = 0;
+    uint32_t count = 0;
+    uint64_t bytes = 0;
+    bool ok = true;
+};
+
+// Content-addressed store of rendered segments under directory. A key covers
+// everything one track's output for a segment depends on: the source file
+// (path, size, mtime), the track and its encoder settings, given as the
+// trackKey string, and the segment's source range and speed, but not where
+// it lands in the output. An export whose segment list changed in one place
+// renders that segment and replays every other one from here.
+//
+// Entries are written atomically; once the directory holds more than
+// maxBytes the least recently used ones are deleted.
+class SegmentRenderCache {
+public:
+    SegmentRenderCache(std::string directory, uint64_t maxBytes);
+
+    // Identity of the source for track keys, empty if it cannot be stat'ed
+    static std::string sourceKey(const char* path);
+
+    std::string keyFor(const std::string& trackKey, const TimelineSegment& segment) const;
+
+    // nullptr on a miss
+    std::unique_ptr<CachedSegment> find(const std::string& key);
+    // nullptr if the temporary file cannot be created. baseUs is subtracted
+    // from every recorded PTS.
+    std::unique_ptr<SegmentRecorder> record(const std::string& key, int64_t baseUs);
+    // Returns 0 once the entry is visible to find()
+    int commit(std::unique_ptr<SegmentRecorder> recorder);
+
+private:
+    std::string pathFor(const std::string& key) const;
+    // Called with mutex held
+    void evict();
+
+    std::string directory;
+    uint64_t maxBytes;
+    std::mutex mutex;
+    // Size of the entries on disk, from a directory scan at the first commit
+    uint64_t totalBytes = 0;
+    bool scanned = false;
+};
@@ -0,0 +1,172 @@
+#include "segment_timeline.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+// Monotonic queries walk this many segments before switching to binary search
+static const size_t CURSOR_LINEAR_STEPS = 4;
+
+static int64_t floorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+static int64_t secToUsExact(float s) {
+    return (int64_t) llround((double) s * 1000000.0);
+}
+
+int64_t TimelineSegment::toOutput(int64_t sourceUs) const {
+    if (warp) return outputStartUs + warp->toOutput(sourceUs - sourceStartUs);
+    return outputStartUs + floorDiv((sourceUs - sourceStartUs) * speedDen, speedNum);
+}
+
+int64_t TimelineSegment::toSource(int64_t outputUs) const {
+    if (warp) return sourceStartUs + warp->toSource(outputUs - outputStartUs);
+    return sourceStartUs + floorDiv((outputUs - outputStartUs) * speedNum, speedDen);
+}
+
+// Average speed of a ramp as the rational the rest of the timeline uses
+static void setAverageSpeed(TimelineSegment* t) {
+    int64_t sourceUs = t->sourceEndUs - t->sourceStartUs;
+    int64_t num = std::max<int64_t>(1, llround((double) sourceUs * SPEED_DENOMINATOR /
+                                               std::max<int64_t>(t->warp->outputDurationUs(), 1)));
+    int64_t divisor = std::gcd(num, (int64_t) SPEED_DENOMINATOR);
+    t->speedNum = (int32_t) (num / divisor);
+    t->speedDen = (int32_t) (SPEED_DENOMINATOR / divisor);
+    t->speed = (float) t->speedNum / (float) t->speedDen;
+}
+
+bool SegmentTimeline::compile(const std::vector<Segment>& input, int64_t sourceDurationUs) {
+    segments.clear();
+    gaps = false;
+    ramps = false;
+
+    std::vector<TimelineSegment> compiled;
+    compiled.reserve(input.size());
+    for (size_t i = 0; i < input.size(); i++) {
+        const Segment& s = input[i];
+        if (s.ramp.empty() && (!(s.speed > 0.0f) || !std::isfinite(s.speed))) {
+            LOGE("Segment %zu has invalid speed %.3f", i, s.speed);
+            return false;
+        }
+
+        TimelineSegment t = {};
+        t.sourceStartUs = std::max<int64_t>(0, secToUsExact(s.start));
+        t.sourceEndUs = secToUsExact(s.end);
+        if (sourceDurationUs > 0) {
+            t.sourceEndUs = std::min(t.sourceEndUs, sourceDurationUs);
+        }
+        if (t.sourceEndUs <= t.sourceStartUs) {
+            // Entirely past the end of the media, or an empty range
+            if (sourceDurationUs > 0 && t.sourceStartUs >= sourceDurationUs) continue;
+            LOGE("Segment %zu has empty range %.3f-%.3f", i, s.start, s.end);
+            return false;
+        }
+
+        if (!s.ramp.empty()) {
+            // Built over the range as clipped, keyframe times stay where they are in the source
+            t.warp = TimeWarp::build(s.ramp, t.sourceStartUs, t.sourceEndUs);
+            if (!t.warp) {
+                LOGE("Segment %zu has an invalid speed ramp", i);
+                return false;
+            }
+            setAverageSpeed(&t);
+            compiled.push_back(std::move(t));
+            continue;
+        }
+
+        int64_t num = std::max<int64_t>(1, llround((double) s.speed * SPEED_DENOMINATOR));
+        int64_t divisor = std::gcd(num, (int64_t) SPEED_DENOMINATOR);
+        t.speedNum = (int32_t) (num / divisor);
+        t.speedDen = (int32_t) (SPEED_DENOMINATOR / divisor);
+        t.speed = (float) t.speedNum / (float) t.speedDen;
+        compiled.push_back(std::move(t));
+    }
+
+    std::sort(compiled.begin(), compiled.end(),
+              [](const TimelineSegment& a, const TimelineSegment& b) {
+                  return a.sourceStartUs < b.sourceStartUs;
+              });
+
+    int64_t outputUs = 0;
+    for (size_t i = 0; i < compiled.size(); i++) {
+        TimelineSegment& t = compiled[i];
+        if (i > 0) {
+            int64_t previousEnd = compiled[i - 1].sourceEndUs;
+            if (t.sourceStartUs < previousEnd) {
+                LOGE("Segments overlap at %lldus", (long long) t.sourceStartUs);
+                return false;
+            }
+            if (t.sourceStartUs > previousEnd) gaps = true;
+        } else if (t.sourceStartUs > 0) {
+            gaps = true;
+        }
+        t.outputStartUs = outputUs;
+        t.outputEndUs = t.toOutput(t.sourceEndUs);
+        outputUs = t.outputEndUs;
+    }
+
+    ramps = std::any_of(compiled.begin(), compiled.end(), [](const TimelineSegment& t) { return t.warp; });
+    segments = std::move(compiled);
+    return true;
+}
+
+ssize_t SegmentTimeline::findBySource(int64_t sourceUs) const {
+    auto it = std::upper_bound(segments.begin(), segments.end(), sourceUs,
+                               [](int64_t us, const TimelineSegment& t) { return us < t.sourceEndUs; });
+    if (it == segments.end() || sourceUs < it->sourceStartUs) return -1;
+    return it - segments.begin();
+}
+
+ssize_t SegmentTimeline::findByOutput(int64_t outputUs) const {
+    auto it = std::upper_bound(segments.begin(), segments.end(), outputUs,
+                               [](int64_t us, const TimelineSegment& t) { return us < t.outputEndUs; });
+    if (it == segments.end() || outputUs < it->outputStartUs) return -1;
+    return it - segments.begin();
+}
+
+bool SegmentTimeline::sourceToOutput(int64_t sourceUs, int64_t* outputUs) const {
+    ssize_t index = findBySource(sourceUs);
+    if (index < 0) return false;
+    *outputUs = segments[index].toOutput(sourceUs);
+    return true;
+}
+
+bool SegmentTimeline::outputToSource(int64_t outputUs, int64_t* sourceUs) const {
+    ssize_t index = findByOutput(outputUs);
+    if (index < 0) return false;
+    *sourceUs = segments[index].toSource(outputUs);
+    return true;
+}
+
+const TimelineSegment* SegmentTimeline::Cursor::locate(int64_t sourceUs) {
+    const std::vector<TimelineSegment>& all = timeline.segments;
+
+    // position is the first segment ending after the previous query
+    if (sourceUs < lastUs) {
+        position = std::upper_bound(all.begin(), all.end(), sourceUs,
+                                    [](int64_t us, const TimelineSegment& t) { return us < t.sourceEndUs; })
+                   - all.begin();
+    } else {
+        size_t steps = 0;
+        while (position < all.size() && all[position].sourceEndUs <= sourceUs) {
+            if (++steps > CURSOR_LINEAR_STEPS) {
+                position = std::upper_bound(all.begin() + position, all.end(), sourceUs,
+                                            [](int64_t us, const TimelineSegment& t) { return us < t.sourceEndUs; })
+                           - all.begin();
+                break;
+            }
+            position++;
+        }
+    }
+    lastUs = sourceUs;
+
+    if (position < all.size() && all[position].sourceStartUs <= sourceUs) {
+        current = position;
+        return &all[position];
+    }
+    current = -1;
+    return nullptr;
+}
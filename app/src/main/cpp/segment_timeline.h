@@ -0,0 +1,98 @@
+#pragma once
+
+#include "time_warp.h"
+
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+// Segment as passed in from Java, in float seconds
+struct Segment {
+    float start;
+    float end;
+    float speed;
+    // Speed ramp replacing the constant speed when not empty
+    std::vector<SpeedKeyframe> ramp;
+};
+
+static inline int64_t secToUs(float s) {
+    return (int64_t) (s * 1000000.0f);
+}
+
+// Speeds are kept as rationals over this denominator before reduction, so
+// 1.5x is exactly 3/2 and remapping never goes through floating point
+constexpr int32_t SPEED_DENOMINATOR = 1000;
+
+// One compiled segment. Source time [sourceStartUs, sourceEndUs) plays at
+// speedNum/speedDen and lands at [outputStartUs, outputEndUs) in the output.
+// A ramped segment remaps through its warp instead, and its speed fields
+// hold the average speed over the segment.
+struct TimelineSegment {
+    int64_t sourceStartUs;
+    int64_t sourceEndUs;
+    int64_t outputStartUs;
+    int64_t outputEndUs;
+    int32_t speedNum;
+    int32_t speedDen;
+    float speed;
+    std::shared_ptr<const TimeWarp> warp;
+
+    // Monotonic in source time, also valid slightly outside the segment
+    int64_t toOutput(int64_t sourceUs) const;
+    int64_t toSource(int64_t outputUs) const;
+
+    // Playback speed at sourceUs
+    float speedAt(int64_t sourceUs) const {
+        return warp ? warp->speedAt(sourceUs - sourceStartUs) : speed;
+    }
+};
+
+// Segment list compiled once per export: sorted, validated, in integer
+// microseconds with cumulative output offsets. Source time that falls in a
+// gap between segments is cut from the output.
+class SegmentTimeline {
+public:
+    // Returns false (and leaves the timeline empty) for empty ranges,
+    // non-positive speeds, invalid ramps or overlapping segments. A positive
+    // sourceDurationUs clips segments to the media length.
+    bool compile(const std::vector<Segment>& segments, int64_t sourceDurationUs = -1);
+
+    size_t size() const { return segments.size(); }
+    bool empty() const { return segments.empty(); }
+    const TimelineSegment& operator[](size_t index) const { return segments[index]; }
+    const std::vector<TimelineSegment>& all() const { return segments; }
+
+    int64_t outputDurationUs() const { return segments.empty() ? 0 : segments.back().outputEndUs; }
+    bool hasGaps() const { return gaps; }
+    bool hasRamps() const { return ramps; }
+
+    // O(log n) lookups. Return the segment index, or -1 for a gap / out of range.
+    ssize_t findBySource(int64_t sourceUs) const;
+    ssize_t findByOutput(int64_t outputUs) const;
+
+    bool sourceToOutput(int64_t sourceUs, int64_t* outputUs) const;
+    bool outputToSource(int64_t outputUs, int64_t* sourceUs) const;
+
+    // Lookup state for callers walking source time forwards. Monotonic queries
+    // are amortised O(1); a backwards jump falls back to binary search.
+    class Cursor {
+    public:
+        explicit Cursor(const SegmentTimeline& timeline) : timeline(timeline) {}
+
+        // Segment containing sourceUs, or nullptr in a gap
+        const TimelineSegment* locate(int64_t sourceUs);
+        ssize_t index() const { return current; }
+
+    private:
+        const SegmentTimeline& timeline;
+        ssize_t current = -1;
+        size_t position = 0;
+        int64_t lastUs = INT64_MIN;
+    };
+
+private:
+    std::vector<TimelineSegment> segments;
+    bool gaps = false;
+    bool ramps = false;
+};
@@ -0,0 +1,506 @@
+#include "smart_cut_remuxer.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const int64_t CODEC_TIMEOUT_US = 10000;
+// Only the first re-encoded frame of each run needs to be a keyframe
+static const int32_t REENCODE_I_FRAME_INTERVAL = 1;
+static const int32_t DEFAULT_FRAME_RATE = 30;
+// Returned by reencodeRange() when no encoder could be set up, before anything was written
+static const int REENCODE_UNAVAILABLE = 1;
+
+// Copies one decoded frame into an encoder input buffer laid out tightly at
+// the same size. Unknown layouts are copied byte for byte.
+static size_t copyFrame(const uint8_t* src, size_t srcSize, int32_t colorFormat, int32_t width, int32_t height,
+                        int32_t stride, int32_t sliceHeight, uint8_t* dst, size_t dstCapacity) {
+    bool planar = colorFormat == COLOR_FORMAT_YUV420_PLANAR;
+    bool semiPlanar = colorFormat == COLOR_FORMAT_YUV420_SEMI_PLANAR;
+    size_t packedSize = (size_t) width * height * 3 / 2;
+    if ((!planar && !semiPlanar) || packedSize > dstCapacity ||
+        (size_t) stride * sliceHeight * 3 / 2 > srcSize) {
+        size_t size = std::min(srcSize, dstCapacity);
+        memcpy(dst, src, size);
+        return size;
+    }
+
+    for (int32_t row = 0; row < height; row++) {
+        memcpy(dst + (size_t) row * width, src + (size_t) row * stride, width);
+    }
+    const uint8_t* chroma = src + (size_t) stride * sliceHeight;
+    uint8_t* out = dst + (size_t) width * height;
+    if (semiPlanar) {
+        for (int32_t row = 0; row < height / 2; row++) {
+            memcpy(out + (size_t) row * width, chroma + (size_t) row * stride, width);
+        }
+    } else {
+        // U plane then V plane, each at half stride
+        const uint8_t* v = chroma + (size_t) (stride / 2) * (sliceHeight / 2);
+        uint8_t* outV = out + (size_t) (width / 2) * (height / 2);
+        for (int32_t row = 0; row < height / 2; row++) {
+            memcpy(out + (size_t) row * (width / 2), chroma + (size_t) row * (stride / 2), width / 2);
+            memcpy(outV + (size_t) row * (width / 2), v + (size_t) row * (stride / 2), width / 2);
+        }
+    }
+    return packedSize;
+}
+
+SmartCutRemuxer::SmartCutRemuxer(MediaBackend& backend, MediaExtractor& extractor, int track,
+                                 const MediaFormat& format, const SegmentTimeline& timeline,
+                                 InterleavingMuxer& muxer, size_t muxerTrack, int32_t maxFrameRate,
+                                 const JobControl* control, const SampleIndex* index)
+        : backend(backend), extractor(extractor), track(track), format(format), timeline(timeline),
+          muxer(muxer), muxerTrack(muxerTrack), limiter(format, maxFrameRate),
+          control(control), index(index), useViews(muxer.acceptsSampleViews()),
+          inBandConfig(muxer.acceptsInBandParameterSets()) {
+    format.getInt64(MEDIA_KEY_DURATION, &durationUs);
+    std::vector<uint8_t> csd;
+    if (format.getBuffer(MEDIA_KEY_CSD_0, &csd)) sourceConfig = csd;
+    if (format.getBuffer(MEDIA_KEY_CSD_1, &csd)) sourceConfig.insert(sourceConfig.end(), csd.begin(), csd.end());
+}
+
+SmartCutRemuxer::~SmartCutRemuxer() {
+    if (encoder) encoder->stop();
+    if (decoder) decoder->stop();
+}
+
+void SmartCutRemuxer::setRenderCache(SegmentRenderCache* renderCache, std::string trackKey) {
+    cache = renderCache;
+    cacheTrackKey = std::move(trackKey);
+}
+
+int SmartCutRemuxer::run() {
+    LOGI("Processing video track with frame-accurate cuts...");
+    extractor.selectTrack(track);
+
+    for (size_t i = 0; i < timeline.size(); i++) {
+        const TimelineSegment& segment = timeline[i];
+        std::string key;
+        if (cache) {
+            key = cache->keyFor(cacheTrackKey, segment);
+            if (std::unique_ptr<CachedSegment> cached = cache->find(key)) {
+                LOGI("Video segment %zu replayed from the render cache: %zu frames", i, cached->sampleCount());
+                if (replaySegment(*cached, segment) != 0) return -1;
+                continue;
+            }
+            recorder = cache->record(key, segment.outputStartUs);
+            // Whatever comes before, the segment's first keyframe carries parameter sets
+            if (inBandConfig && !sourceConfig.empty()) pendingConfig = &sourceConfig;
+        }
+
+        LOGI("Processing video segment %zu: %lldus-%lldus at speed %d/%d", i,
+             (long long) segment.sourceStartUs, (long long) segment.sourceEndUs, segment.speedNum, segment.speedDen);
+        limiter.beginSegment(segment);
+        if (processSegment(segment) != 0) {
+            if (isCancelled(control)) {
+                LOGI("Video track cancelled");
+            } else {
+                LOGE("Failed to cut video segment %zu", i);
+            }
+            return -1;
+        }
+
+        if (recorder) {
+            recorder->setDurationUs(segment.outputEndUs - segment.outputStartUs);
+            cache->commit(std::move(recorder));
+        }
+    }
+
+    LOGI("Video track completed: %d frames copied, %d re-encoded, %d from the render cache, %zu dropped for "
+         "the frame-rate cap across %zu segments, output duration: %lldus", copiedCount, reencodedCount,
+         cachedCount, limiter.droppedFrames(), timeline.size(), (long long) timeline.outputDurationUs());
+    return 0;
+}
+
+// Cached samples carry their own parameter sets; the segment after needs the source's again
+int SmartCutRemuxer::replaySegment(const CachedSegment& cached, const TimelineSegment& segment) {
+    for (size_t i = 0; i < cached.sampleCount(); i++) {
+        if (isCancelled(control)) return -1;
+        const CachedSegment::Sample& sample = cached[i];
+        SampleBuffer* buffer = muxer.acquire(muxerTrack, sample.size);
+        if (!buffer) {
+            LOGE("Muxer stopped accepting video samples");
+            return -1;
+        }
+        memcpy(buffer->data(), sample.data, sample.size);
+
+        SampleInfo info;
+        info.offset = 0;
+        info.size = sample.size;
+        info.presentationTimeUs = segment.outputStartUs + sample.ptsUs;
+        info.flags = sample.flags;
+        if (muxer.submit(muxerTrack, buffer, info) != MEDIA_OK) {
+            LOGE("Failed to write cached video sample");
+            return -1;
+        }
+        cachedCount++;
+    }
+    pendingConfig = inBandConfig && !sourceConfig.empty() ? &sourceConfig : nullptr;
+    return 0;
+}
+
+// Time of the sync sample the extractor lands on, or -1 past the last one
+int64_t SmartCutRemuxer::syncTime(int64_t timeUs, MediaSeekMode mode) {
+    if (index) {
+        // Same answers as the extractor: PreviousSync falls forward before the first keyframe
+        if (mode == MediaSeekMode::NextSync) return index->syncAtOrAfter(track, timeUs);
+        if (mode == MediaSeekMode::ClosestSync) return index->closestSync(track, timeUs);
+        int64_t syncUs = index->syncAtOrBefore(track, timeUs);
+        return syncUs >= 0 ? syncUs : index->syncAtOrAfter(track, timeUs);
+    }
+    if (extractor.seekTo(timeUs, mode) != MEDIA_OK) return -1;
+    return extractor.getSampleTime();
+}
+
+int SmartCutRemuxer::processSegment(const TimelineSegment& segment) {
+    const int64_t startUs = segment.sourceStartUs;
+    const int64_t endUs = segment.sourceEndUs;
+    const bool toTrackEnd = durationUs > 0 && endUs >= durationUs;
+
+    // Whole GOPs run from the first keyframe at or after the start to the last
+    // one at or before the end; a segment reaching the end of the track keeps
+    // its final GOP whole as well
+    int64_t headSyncUs = syncTime(startUs, MediaSeekMode::PreviousSync);
+    int64_t copyStartUs = headSyncUs == startUs ? startUs : syncTime(startUs, MediaSeekMode::NextSync);
+    int64_t copyEndUs = toTrackEnd ? INT64_MAX : syncTime(endUs, MediaSeekMode::PreviousSync);
+    if (headSyncUs < 0) headSyncUs = 0;
+
+    int status;
+    if (copyStartUs < 0 || copyStartUs >= endUs || copyEndUs <= copyStartUs) {
+        // No whole GOP inside the segment
+        status = reencodeRange(headSyncUs, startUs, endUs, segment);
+        if (status == REENCODE_UNAVAILABLE) status = copyRange(headSyncUs, endUs, false, segment);
+        return status;
+    }
+
+    if (startUs < copyStartUs) {
+        status = reencodeRange(headSyncUs, startUs, copyStartUs, segment);
+        if (status == REENCODE_UNAVAILABLE) status = copyRange(headSyncUs, copyStartUs, true, segment);
+        if (status != 0) return status;
+    }
+
+    status = copyRange(copyStartUs, copyEndUs, true, segment);
+    if (status != 0) return status;
+
+    if (copyEndUs < endUs) {
+        status = reencodeRange(copyEndUs, copyEndUs, endUs, segment);
+        if (status == REENCODE_UNAVAILABLE) status = copyRange(copyEndUs, endUs, false, segment);
+    }
+    return status;
+}
+
+// Copies samples from the keyframe at syncUs. With endOnSync the run stops at
+// the first keyframe at or past endUs, otherwise at the first frame past it.
+int SmartCutRemuxer::copyRange(int64_t syncUs, int64_t endUs, bool endOnSync, const TimelineSegment& segment) {
+    if (extractor.seekTo(syncUs, MediaSeekMode::PreviousSync) != MEDIA_OK) {
+        LOGE("Failed to seek video to %lld", (long long) syncUs);
+        return -1;
+    }
+
+    while (true) {
+        if (isCancelled(control)) return -1;
+
+        ssize_t sampleSize = extractor.getSampleSize();
+        int64_t pts = extractor.getSampleTime();
+        uint32_t flags = extractor.getSampleFlags();
+        if (sampleSize < 0 || pts < 0) break;
+        if (pts >= endUs && (!endOnSync || (flags & SAMPLE_FLAG_SYNC))) break;
+
+        bool key = flags & SAMPLE_FLAG_SYNC;
+        int64_t outputPts = segment.toOutput(pts);
+        if (!key && limiter.keyFramesOnly()) {
+            limiter.keepCompressed(nullptr, 0, false, outputPts);
+            extractor.advance();
+            continue;
+        }
+
+        // Parameter sets go in front of the first keyframe after a re-encoded run
+        size_t prefix = key && pendingConfig ? pendingConfig->size() : 0;
+
+        // Without a prefix, a muxer that takes container samples gets them in place
+        SampleBuffer* buffer = nullptr;
+        size_t viewSize = 0;
+        const uint8_t* data = !prefix && useViews ? extractor.sampleView(&viewSize) : nullptr;
+        if (data) {
+            sampleSize = viewSize;
+        } else {
+            buffer = muxer.acquire(muxerTrack, prefix + sampleSize);
+            if (!buffer) {
+                LOGE("Muxer stopped accepting video samples");
+                return -1;
+            }
+            if (prefix) memcpy(buffer->data(), pendingConfig->data(), prefix);
+            sampleSize = extractor.readSampleData(buffer->data() + prefix, buffer->capacity() - prefix);
+            if (sampleSize < 0) {
+                muxer.discard(muxerTrack, buffer);
+                break;
+            }
+            data = buffer->data() + prefix;
+        }
+        if (!limiter.keepCompressed(data, sampleSize, key, outputPts)) {
+            if (buffer) muxer.discard(muxerTrack, buffer);
+            extractor.advance();
+            continue;
+        }
+        if (key) pendingConfig = nullptr;
+
+        SampleInfo info;
+        info.offset = 0;
+        info.size = prefix + sampleSize;
+        info.presentationTimeUs = outputPts;
+        info.flags = key ? BUFFER_FLAG_KEY_FRAME : 0;
+        if (submitSample(buffer, data, info) != MEDIA_OK) {
+            LOGE("Failed to write video sample at %lld", (long long) pts);
+            return -1;
+        }
+        copiedCount++;
+        extractor.advance();
+    }
+    return 0;
+}
+
+int SmartCutRemuxer::openDecoder() {
+    std::string mime;
+    format.getString(MEDIA_KEY_MIME, &mime);
+    decoder = backend.createDecoder(mime.c_str());
+    if (!decoder || decoder->configure(format, false) != MEDIA_OK || decoder->start() != MEDIA_OK) {
+        LOGE("Failed to set up a %s decoder for smart cut", mime.c_str());
+        decoder.reset();
+        return -1;
+    }
+    return 0;
+}
+
+// Sets up an encoder matching the source for the frames the decoder produces.
+// Needs the decoder's output format, so it runs at the first kept frame.
+int SmartCutRemuxer::openEncoderSession() {
+    std::string mime;
+    format.getString(MEDIA_KEY_MIME, &mime);
+    std::unique_ptr<MediaFormat> decoded = decoder->getOutputFormat();
+
+    FrameLayout& layout = decodedLayout;
+    layout = {0, 0, 0, 0, 0};
+    format.getInt32(MEDIA_KEY_WIDTH, &layout.width);
+    format.getInt32(MEDIA_KEY_HEIGHT, &layout.height);
+    if (decoded) {
+        decoded->getInt32(MEDIA_KEY_WIDTH, &layout.width);
+        decoded->getInt32(MEDIA_KEY_HEIGHT, &layout.height);
+        decoded->getInt32(MEDIA_KEY_COLOR_FORMAT, &layout.colorFormat);
+    }
+    layout.stride = layout.width;
+    layout.sliceHeight = layout.height;
+    if (decoded) {
+        decoded->getInt32(MEDIA_KEY_STRIDE, &layout.stride);
+        decoded->getInt32(MEDIA_KEY_SLICE_HEIGHT, &layout.sliceHeight);
+    }
+
+    int32_t frameRate = DEFAULT_FRAME_RATE, bitRate = 0, value;
+    format.getInt32(MEDIA_KEY_FRAME_RATE, &frameRate);
+    if (!format.getInt32(MEDIA_KEY_BIT_RATE, &bitRate) || bitRate <= 0) {
+        // Roughly what cameras record at, so the re-encoded frames do not stand out
+        bitRate = (int32_t) std::min((int64_t) layout.width * layout.height * frameRate / 4, (int64_t) INT32_MAX);
+    }
+
+    std::unique_ptr<MediaFormat> encoderFormat = backend.createFormat();
+    encoderFormat->setString(MEDIA_KEY_MIME, mime.c_str());
+    encoderFormat->setInt32(MEDIA_KEY_WIDTH, layout.width);
+    encoderFormat->setInt32(MEDIA_KEY_HEIGHT, layout.height);
+    encoderFormat->setInt32(MEDIA_KEY_FRAME_RATE, frameRate);
+    encoderFormat->setInt32(MEDIA_KEY_BIT_RATE, bitRate);
+    encoderFormat->setInt32(MEDIA_KEY_I_FRAME_INTERVAL, REENCODE_I_FRAME_INTERVAL);
+    if (layout.colorFormat != 0) encoderFormat->setInt32(MEDIA_KEY_COLOR_FORMAT, layout.colorFormat);
+    if (format.getInt32(MEDIA_KEY_PROFILE, &value)) encoderFormat->setInt32(MEDIA_KEY_PROFILE, value);
+    if (format.getInt32(MEDIA_KEY_LEVEL, &value)) encoderFormat->setInt32(MEDIA_KEY_LEVEL, value);
+
+    if (!encoder) encoder = backend.createEncoder(mime.c_str());
+    if (!encoder || encoder->configure(*encoderFormat, true) != MEDIA_OK || encoder->start() != MEDIA_OK) {
+        LOGE("Failed to set up a %s encoder matching the source", mime.c_str());
+        encoder.reset();
+        return -1;
+    }
+    encoderOpen = true;
+    encoderEOS = false;
+    return 0;
+}
+
+int SmartCutRemuxer::encodeFrame(const uint8_t* frame, const SampleInfo& info, int64_t outputPtsUs) {
+    while (true) {
+        ssize_t index = encoder->dequeueInputBuffer(CODEC_TIMEOUT_US);
+        if (index >= 0) {
+            size_t capacity;
+            uint8_t* buf = encoder->getInputBuffer(index, &capacity);
+            if (!buf) return -1;
+            const FrameLayout& l = decodedLayout;
+            size_t size = copyFrame(frame + info.offset, info.size, l.colorFormat, l.width, l.height,
+                                    l.stride, l.sliceHeight, buf, capacity);
+            return encoder->queueInputBuffer(index, 0, size, outputPtsUs, 0) == MEDIA_OK ? 0 : -1;
+        }
+        if (drainEncoder(false) != 0) return -1;
+    }
+}
+
+int SmartCutRemuxer::endEncoderSession() {
+    while (true) {
+        ssize_t index = encoder->dequeueInputBuffer(CODEC_TIMEOUT_US);
+        if (index >= 0) {
+            encoder->queueInputBuffer(index, 0, 0, 0, BUFFER_FLAG_END_OF_STREAM);
+            break;
+        }
+        if (drainEncoder(false) != 0) return -1;
+    }
+    int status = drainEncoder(true);
+    encoder->stop();
+    encoderOpen = false;
+    return status;
+}
+
+int SmartCutRemuxer::drainEncoder(bool untilEndOfStream) {
+    while (!encoderEOS) {
+        SampleInfo info;
+        ssize_t index = encoder->dequeueOutputBuffer(&info, untilEndOfStream ? CODEC_TIMEOUT_US : 0);
+        if (index < 0) {
+            if (untilEndOfStream) continue;
+            return 0;
+        }
+
+        size_t size;
+        uint8_t* data = encoder->getOutputBuffer(index, &size);
+        int status = 0;
+        if (data && info.size > 0) {
+            if (info.flags & BUFFER_FLAG_CODEC_CONFIG) {
+                encoderConfig.assign(data + info.offset, data + info.offset + info.size);
+                if (inBandConfig) {
+                    // Goes in-band in front of this session's first keyframe
+                    pendingConfig = &encoderConfig;
+                } else if (encoderConfig != sourceConfig) {
+                    // Nothing of this session is written yet, the config comes first
+                    configMismatch = true;
+                    status = -1;
+                }
+            } else {
+                status = writeSample(data + info.offset, info.size, info.presentationTimeUs,
+                                     info.flags & BUFFER_FLAG_KEY_FRAME);
+                reencodedCount++;
+            }
+        }
+        encoder->releaseOutputBuffer(index, false);
+        if (status != 0) return -1;
+
+        if (info.flags & BUFFER_FLAG_END_OF_STREAM) encoderEOS = true;
+    }
+    return 0;
+}
+
+int SmartCutRemuxer::writeSample(const uint8_t* data, size_t size, int64_t ptsUs, uint32_t flags) {
+    bool key = flags & BUFFER_FLAG_KEY_FRAME;
+    size_t prefix = key && pendingConfig ? pendingConfig->size() : 0;
+    SampleBuffer* buffer = muxer.acquire(muxerTrack, prefix + size);
+    if (!buffer) return -1;
+    if (prefix) memcpy(buffer->data(), pendingConfig->data(), prefix);
+    memcpy(buffer->data() + prefix, data, size);
+    if (key) pendingConfig = nullptr;
+
+    SampleInfo info;
+    info.offset = 0;
+    info.size = prefix + size;
+    info.presentationTimeUs = ptsUs;
+    info.flags = flags;
+    return submitSample(buffer, nullptr, info);
+}
+
+int SmartCutRemuxer::submitSample(SampleBuffer* buffer, const uint8_t* view, const SampleInfo& info) {
+    // Recorded first: a submitted buffer belongs to the muxer
+    if (recorder) recorder->append(buffer ? buffer->data() : view, info);
+    return buffer ? muxer.submit(muxerTrack, buffer, info) : muxer.submitView(muxerTrack, view, info);
+}
+
+// Decodes from the keyframe at syncUs and re-encodes the frames in [fromUs, toUs)
+int SmartCutRemuxer::reencodeRange(int64_t syncUs, int64_t fromUs, int64_t toUs, const TimelineSegment& segment) {
+    if (!reencodeAvailable) return REENCODE_UNAVAILABLE;
+    int status = reencodeFrames(syncUs, fromUs, toUs, segment);
+    if (status != 0 && configMismatch) {
+        // The same encoder would disagree at every other edge too
+        LOGE("Encoder parameter sets differ from the source's and cannot go in-band, cutting video on keyframes");
+        encoder->stop();
+        encoderOpen = false;
+        reencodeAvailable = false;
+        return REENCODE_UNAVAILABLE;
+    }
+    return status;
+}
+
+int SmartCutRemuxer::reencodeFrames(int64_t syncUs, int64_t fromUs, int64_t toUs,
+                                    const TimelineSegment& segment) {
+    if (!decoder && openDecoder() != 0) {
+        LOGE("Smart cut unavailable, cutting video on keyframes");
+        reencodeAvailable = false;
+        return REENCODE_UNAVAILABLE;
+    }
+    if (extractor.seekTo(syncUs, MediaSeekMode::PreviousSync) != MEDIA_OK) {
+        LOGE("Failed to seek video to %lld", (long long) syncUs);
+        return -1;
+    }
+    decoder->flush();
+
+    bool inputDone = false;
+    bool decoderDone = false;
+    bool firstSample = true;
+    bool wroteAny = false;
+
+    while (!decoderDone) {
+        if (isCancelled(control)) return -1;
+
+        if (!inputDone) {
+            ssize_t inIndex = decoder->dequeueInputBuffer(CODEC_TIMEOUT_US);
+            if (inIndex >= 0) {
+                size_t bufSize;
+                uint8_t* buf = decoder->getInputBuffer(inIndex, &bufSize);
+                if (!buf) return -1;
+                int64_t pts = extractor.getSampleTime();
+                uint32_t flags = extractor.getSampleFlags();
+                // Everything shown before toUs is decodable once the next keyframe at or past it is reached
+                bool stop = pts < 0 || (!firstSample && (flags & SAMPLE_FLAG_SYNC) && pts >= toUs);
+                ssize_t sampleSize = stop ? -1 : extractor.readSampleData(buf, bufSize);
+                if (sampleSize < 0) {
+                    decoder->queueInputBuffer(inIndex, 0, 0, 0, BUFFER_FLAG_END_OF_STREAM);
+                    inputDone = true;
+                } else {
+                    decoder->queueInputBuffer(inIndex, 0, sampleSize, pts, 0);
+                    extractor.advance();
+                    firstSample = false;
+                }
+            }
+        }
+
+        SampleInfo info;
+        ssize_t outIndex = decoder->dequeueOutputBuffer(&info, inputDone ? CODEC_TIMEOUT_US : 0);
+        if (outIndex >= 0) {
+            int status = 0;
+            int64_t pts = info.presentationTimeUs;
+            if (info.size > 0 && pts >= fromUs && pts < toUs && limiter.keepDecoded(segment.toOutput(pts))) {
+                if (!encoderOpen && openEncoderSession() != 0) {
+                    decoder->releaseOutputBuffer(outIndex, false);
+                    if (wroteAny) return -1;
+                    LOGE("Smart cut unavailable, cutting video on keyframes");
+                    reencodeAvailable = false;
+                    return REENCODE_UNAVAILABLE;
+                }
+                size_t size;
+                uint8_t* frame = decoder->getOutputBuffer(outIndex, &size);
+                status = frame ? encodeFrame(frame, info, segment.toOutput(pts)) : -1;
+                wroteAny = true;
+            }
+            decoder->releaseOutputBuffer(outIndex, false);
+            if (status != 0) return -1;
+            if (info.flags & BUFFER_FLAG_END_OF_STREAM) decoderDone = true;
+        }
+
+        if (encoderOpen && drainEncoder(false) != 0) return -1;
+    }
+
+    if (encoderOpen && endEncoderSession() != 0) return -1;
+    // The copied GOP that follows needs the source parameter sets back
+    if (wroteAny && inBandConfig && !sourceConfig.empty()) pendingConfig = &sourceConfig;
+    return 0;
+}
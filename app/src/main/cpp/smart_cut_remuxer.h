@@ -0,0 +1,117 @@
+#pragma once
+
+#include "frame_rate_limiter.h"
+#include "interleaving_muxer.h"
+#include "job_control.h"
+#include "media_backend.h"
+#include "sample_index.h"
+#include "segment_render_cache.h"
+#include "segment_timeline.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Frame-accurate video cutting. Whole GOPs inside a segment are copied in the
+// compressed domain; the partial GOPs at segment edges are decoded from their
+// keyframe and re-encoded with an encoder set up like the source, keeping only
+// the frames inside the segment. When the muxer takes in-band parameter sets,
+// they are repeated at every switch between copied and re-encoded frames so
+// each run decodes on its own. Otherwise the track format's parameter sets
+// have to serve both, so the encoder must emit exactly the source's.
+//
+// If no matching encoder can be set up, edges fall back to keyframe-accurate
+// cuts: the partial GOP is copied from its keyframe.
+//
+// With a frame-rate cap, speed-up segments are thinned on the way through,
+// see FrameRateLimiter. With a SampleIndex of the source, keyframe times are
+// looked up instead of found by seeking the extractor.
+//
+// With a render cache, segments rendered before are replayed from it, and
+// the others are recorded into it as they are cut. With in-band parameter
+// sets every segment then starts with them, so a cached one decodes wherever
+// it lands.
+class SmartCutRemuxer {
+public:
+    SmartCutRemuxer(MediaBackend& backend, MediaExtractor& extractor, int track, const MediaFormat& format,
+                    const SegmentTimeline& timeline, InterleavingMuxer& muxer, size_t muxerTrack,
+                    int32_t maxFrameRate = 0, const JobControl* control = nullptr,
+                    const SampleIndex* index = nullptr);
+    ~SmartCutRemuxer();
+
+    // trackKey identifies the source track and settings, see SegmentRenderCache
+    void setRenderCache(SegmentRenderCache* renderCache, std::string trackKey);
+
+    // Returns 0 on success, -1 on failure
+    int run();
+
+    int copiedFrames() const { return copiedCount; }
+    int cachedFrames() const { return cachedCount; }
+    int reencodedFrames() const { return reencodedCount; }
+    size_t droppedFrames() const { return limiter.droppedFrames(); }
+
+private:
+    struct FrameLayout {
+        int32_t colorFormat;
+        int32_t width;
+        int32_t height;
+        int32_t stride;
+        int32_t sliceHeight;
+    };
+
+    int processSegment(const TimelineSegment& segment);
+    int replaySegment(const CachedSegment& cached, const TimelineSegment& segment);
+    int64_t syncTime(int64_t timeUs, MediaSeekMode mode);
+    int copyRange(int64_t syncUs, int64_t endUs, bool endOnSync, const TimelineSegment& segment);
+    int reencodeRange(int64_t syncUs, int64_t fromUs, int64_t toUs, const TimelineSegment& segment);
+    int reencodeFrames(int64_t syncUs, int64_t fromUs, int64_t toUs, const TimelineSegment& segment);
+
+    int openDecoder();
+    int openEncoderSession();
+    int encodeFrame(const uint8_t* frame, const SampleInfo& info, int64_t outputPtsUs);
+    int endEncoderSession();
+    int drainEncoder(bool untilEndOfStream);
+    int writeSample(const uint8_t* data, size_t size, int64_t ptsUs, uint32_t flags);
+    // Hands a filled buffer, or a view when buffer is null, to the muxer and the recorder
+    int submitSample(SampleBuffer* buffer, const uint8_t* view, const SampleInfo& info);
+
+    MediaBackend& backend;
+    MediaExtractor& extractor;
+    int track;
+    const MediaFormat& format;
+    const SegmentTimeline& timeline;
+    InterleavingMuxer& muxer;
+    size_t muxerTrack;
+    int64_t durationUs = -1;
+    FrameRateLimiter limiter;
+    const JobControl* control;
+    const SampleIndex* index;
+    // Copied samples go to the muxer as extractor views
+    const bool useViews;
+    // Parameter sets may be written in front of keyframes
+    const bool inBandConfig;
+
+    SegmentRenderCache* cache = nullptr;
+    std::string cacheTrackKey;
+    // The segment being recorded, if any
+    std::unique_ptr<SegmentRecorder> recorder;
+
+    std::unique_ptr<MediaCodec> decoder;
+    std::unique_ptr<MediaCodec> encoder;
+    bool reencodeAvailable = true;
+    // The encoder emitted parameter sets the track format does not have
+    bool configMismatch = false;
+    bool encoderOpen = false;
+    bool encoderEOS = false;
+    FrameLayout decodedLayout;
+
+    // Source parameter sets, and the ones the current encoder session emitted
+    std::vector<uint8_t> sourceConfig;
+    std::vector<uint8_t> encoderConfig;
+    // Prepended to the next keyframe written
+    const std::vector<uint8_t>* pendingConfig = nullptr;
+
+    int copiedCount = 0;
+    int reencodedCount = 0;
+    int cachedCount = 0;
+};
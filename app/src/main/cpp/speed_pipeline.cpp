@@ -0,0 +1,699 @@
+#include "speed_pipeline.h"
+#include "async_audio_pipeline.h"
+#include "editor_log.h"
+#include "fragmented_mp4_muxer.h"
+#include "frame_rate_limiter.h"
+#include "interleaving_muxer.h"
+#include "mp4_extractor.h"
+#include "parallel_audio_stretcher.h"
+#include "pcm_ring_buffer.h"
+#include "profiling_media_backend.h"
+#include "smart_cut_remuxer.h"
+#include "time_stretcher.h"
+#include "waveform_peaks.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// Samples each track may queue in the mux reorder buffer before its producer waits
+static const size_t MUX_REORDER_DEPTH = 16;
+// Stretched audio buffered ahead of the encoder; the stretcher's own queue absorbs the rest
+static const size_t AUDIO_RING_FRAMES = 16 * PcmRingBuffer::AAC_FRAME_SIZE;
+// Encoder input buffers are sized to hold this many AAC frames
+static const size_t ENCODER_INPUT_AAC_FRAMES = 4;
+
+// Remuxes the selected segments of the video track, remapping PTS through the
+// timeline, with cuts on the keyframe before each segment start. Runs on its
+// own thread with its own extractor.
+static int remuxVideoTrack(MediaExtractor& extractor, int videoTrack, const MediaFormat& videoFormat,
+                           const SegmentTimeline& timeline, int32_t maxFrameRate,
+                           InterleavingMuxer& muxer, size_t videoTrackIndex, const JobControl* control) {
+    LOGI("Processing video track with segments...");
+    extractor.selectTrack(videoTrack);
+
+    FrameRateLimiter limiter(videoFormat, maxFrameRate);
+    const bool useViews = muxer.acceptsSampleViews();
+
+    int videoSampleCount = 0;
+    bool videoEOS = false;
+    size_t currentSegment = 0;
+    int status;
+
+    // Process video segments
+    while (!videoEOS && currentSegment < timeline.size()) {
+        const TimelineSegment& segment = timeline[currentSegment];
+        LOGI("Processing video segment %zu: %lldus-%lldus at speed %d/%d",
+             currentSegment, (long long)segment.sourceStartUs, (long long)segment.sourceEndUs,
+             segment.speedNum, segment.speedDen);
+
+        limiter.beginSegment(segment);
+
+        // Seek to segment start
+        int64_t segmentStartUs = segment.sourceStartUs;
+        int64_t segmentEndUs = segment.sourceEndUs;
+
+        status = extractor.seekTo(segmentStartUs, MediaSeekMode::ClosestSync);
+        if (status != MEDIA_OK) {
+            LOGE("Failed to seek to segment start: %lld", (long long)segmentStartUs);
+            return -1;
+        }
+
+        bool segmentComplete = false;
+        int segmentSampleCount = 0;
+
+        while (!videoEOS && !segmentComplete) {
+            if (isCancelled(control)) {
+                LOGI("Video track cancelled");
+                return -1;
+            }
+
+            ssize_t sampleSize = extractor.getSampleSize();
+            if (sampleSize < 0) {
+                videoEOS = true;
+                break;
+            }
+
+            int64_t pts = extractor.getSampleTime();
+            uint32_t flags = extractor.getSampleFlags();
+
+            // Check if we've reached the end of this segment
+            if (pts >= segmentEndUs) {
+                segmentComplete = true;
+                extractor.advance(); // Move to next sample for next segment
+                break;
+            }
+
+            // Calculate output PTS based on speed
+            int64_t finalPts = segment.toOutput(pts);
+            bool keyFrame = flags & SAMPLE_FLAG_SYNC;
+            if (!keyFrame && limiter.keyFramesOnly()) {
+                limiter.keepCompressed(nullptr, 0, false, finalPts);
+                extractor.advance();
+                continue;
+            }
+
+            // A muxer that takes container samples gets them where they lie in the mapped source
+            SampleBuffer* buffer = nullptr;
+            size_t viewSize = 0;
+            const uint8_t* data = useViews ? extractor.sampleView(&viewSize) : nullptr;
+            if (data) {
+                sampleSize = viewSize;
+            } else {
+                // Read straight into a pooled mux buffer; blocks while the reorder buffer is full
+                buffer = muxer.acquire(videoTrackIndex, sampleSize);
+                if (!buffer) {
+                    LOGE("Muxer stopped accepting video samples");
+                    return -1;
+                }
+                sampleSize = extractor.readSampleData(buffer->data(), buffer->capacity());
+                if (sampleSize < 0) {
+                    muxer.discard(videoTrackIndex, buffer);
+                    videoEOS = true;
+                    break;
+                }
+                data = buffer->data();
+            }
+
+            if (!limiter.keepCompressed(data, sampleSize, keyFrame, finalPts)) {
+                if (buffer) muxer.discard(videoTrackIndex, buffer);
+                extractor.advance();
+                continue;
+            }
+
+            SampleInfo info;
+            info.offset = 0;
+            info.size = sampleSize;
+            info.presentationTimeUs = finalPts;
+            info.flags = flags;
+
+            status = buffer ? muxer.submit(videoTrackIndex, buffer, info)
+                            : muxer.submitView(videoTrackIndex, data, info);
+
+            if (status != MEDIA_OK) {
+                LOGE("Failed to write video sample, status: %d", status);
+                return -1;
+            }
+
+            extractor.advance();
+            videoSampleCount++;
+            segmentSampleCount++;
+
+            if (segmentSampleCount % 100 == 0) {
+                LOGV("Segment %zu: processed %d samples, PTS: %lld -> %lld",
+                     currentSegment, segmentSampleCount, (long long)pts, (long long)finalPts);
+            }
+        }
+
+        LOGI("Completed video segment %zu: %d samples, duration: %lldus -> %lldus",
+             currentSegment, segmentSampleCount, (long long)(segmentEndUs - segmentStartUs),
+             (long long)(segment.outputEndUs - segment.outputStartUs));
+
+        currentSegment++;
+    }
+
+    LOGI("Video track completed: %d samples across %zu segments (%zu dropped for the frame-rate cap), "
+         "total output duration: %lldus", videoSampleCount, timeline.size(), limiter.droppedFrames(),
+         (long long)timeline.outputDurationUs());
+    return 0;
+}
+
+// Hands whole AAC frames from the ring to the encoder until either runs dry.
+// Audio that does not fit stays buffered for the next pass, and EOS follows
+// once input is done and the stretcher and ring are both empty.
+static int feedSyncEncoder(MediaCodec& encoder, PcmRingBuffer& ring, TimeStretcher& stretcher,
+                           int32_t sampleRate, int32_t channels, bool inputDone, bool* eosSent) {
+    const size_t frameBytes = channels * sizeof(short);
+    while (!*eosSent) {
+        ring.fillFrom(stretcher);
+        if (inputDone && stretcher.available() == 0) ring.finish();
+        if (ring.readableFrames() < PcmRingBuffer::AAC_FRAME_SIZE && !ring.isFinished()) return 0;
+
+        ssize_t encInIndex = encoder.dequeueInputBuffer(10000);
+        if (encInIndex < 0) return 0;
+        size_t encSize;
+        uint8_t* encBuf = encoder.getInputBuffer(encInIndex, &encSize);
+        if (!encBuf || encSize < frameBytes) {
+            LOGE("Audio encoder input buffer unavailable");
+            return -1;
+        }
+
+        // PTS comes from the ring's frame counter, not from accumulated per-buffer durations
+        int64_t pts = ring.readPosition() * 1000000 / sampleRate;
+        size_t frames = ring.readForEncoder(encBuf, encSize);
+        if (frames == 0) {
+            encoder.queueInputBuffer(encInIndex, 0, 0, pts, BUFFER_FLAG_END_OF_STREAM);
+            *eosSent = true;
+            LOGI("Sent EOS to audio encoder");
+            return 0;
+        }
+        encoder.queueInputBuffer(encInIndex, 0, frames * frameBytes, pts, 0);
+    }
+    return 0;
+}
+
+// Single-threaded audio loop polling both codecs, used when asyncAudio is off
+static int runSyncAudio(MediaExtractor& extractor, MediaCodec& audioDecoder, MediaCodec& audioEncoder,
+                        TimeStretcher& stretcher, const SegmentTimeline& timeline,
+                        int32_t sampleRate, int32_t channels,
+                        MediaMuxer& muxer, size_t audioTrackIndex, const JobControl* control,
+                        PeakAccumulator* peakTap) {
+    // Audio processing state
+    bool audioEOS = false;
+    bool decoderEOS = false;
+    bool decoderOutputEOS = false;
+    bool encoderEOSSent = false;
+    int audioSampleCount = 0;
+    SegmentTimeline::Cursor audioCursor(timeline);
+    ssize_t currentAudioSegment = -1;
+    PcmRingBuffer ring(channels, AUDIO_RING_FRAMES);
+
+    // Process entire audio track, adjusting speed based on current time
+    while (!audioEOS) {
+        if (isCancelled(control)) {
+            LOGI("Audio track cancelled");
+            return -1;
+        }
+
+        // Feed data to decoder
+        if (!decoderEOS) {
+            ssize_t inIndex = audioDecoder.dequeueInputBuffer(10000);
+            if (inIndex >= 0) {
+                size_t bufSize;
+                uint8_t* buf = audioDecoder.getInputBuffer(inIndex, &bufSize);
+                if (buf) {
+                    ssize_t sampleSize = extractor.readSampleData(buf, bufSize);
+                    if (sampleSize < 0) {
+                        decoderEOS = true;
+                        audioDecoder.queueInputBuffer(inIndex, 0, 0, 0, BUFFER_FLAG_END_OF_STREAM);
+                        LOGI("Sent EOS to audio decoder");
+                    } else {
+                        int64_t pts = extractor.getSampleTime();
+                        audioDecoder.queueInputBuffer(inIndex, 0, sampleSize, pts, 0);
+                        extractor.advance();
+                    }
+                }
+            }
+        }
+
+        // Process decoder output, unless the encoder is too far behind to take more
+        SampleInfo decInfo;
+        ssize_t outIndex = CODEC_INFO_TRY_AGAIN_LATER;
+        if (!decoderOutputEOS && stretcher.available() < ring.capacity()) {
+            outIndex = audioDecoder.dequeueOutputBuffer(&decInfo, 10000);
+        }
+
+        if (outIndex >= 0) {
+            if (decInfo.size > 0) {
+                size_t outSize;
+                uint8_t* outBuf = audioDecoder.getOutputBuffer(outIndex, &outSize);
+                const short* samples = outBuf ? reinterpret_cast<const short*>(outBuf + decInfo.offset) : nullptr;
+                size_t sampleCount = decInfo.size / (channels * sizeof(short));
+                // The tap sees the whole track, gaps included
+                if (samples && peakTap) peakTap->add(decInfo.presentationTimeUs, samples, sampleCount);
+                // Audio in a gap between segments is cut, like the video
+                const TimelineSegment* audioSegment = audioCursor.locate(decInfo.presentationTimeUs);
+                if (samples && audioSegment) {
+                    // Switch speed when the audio PTS enters a new segment
+                    if (audioCursor.index() != currentAudioSegment) {
+                        currentAudioSegment = audioCursor.index();
+                        stretcher.setSpeed(audioSegment->speed);
+                        LOGI("Audio switched to segment %zd: speed %.2fx at PTS %lld",
+                             currentAudioSegment, audioSegment->speed, (long long)decInfo.presentationTimeUs);
+                    }
+
+                    // Time-stretch; the output is picked up by the encoder feed below
+                    {
+                        ScopedStage stretch(profilerOf(control), PipelineStage::Stretch);
+                        if (audioSegment->warp) {
+                            stretcher.write(samples, sampleCount, *audioSegment->warp,
+                                            decInfo.presentationTimeUs - audioSegment->sourceStartUs);
+                        } else {
+                            stretcher.write(samples, sampleCount);
+                        }
+                    }
+                    if (control) control->profiler()->count(PipelineStage::Stretch, 1, decInfo.size);
+                }
+            }
+
+            audioDecoder.releaseOutputBuffer(outIndex, false);
+
+            if (decInfo.flags & BUFFER_FLAG_END_OF_STREAM) {
+                LOGI("Audio decoder output EOS");
+                // Flush the stretcher's buffered tail
+                stretcher.flush();
+                decoderOutputEOS = true;
+            }
+        }
+
+        if (feedSyncEncoder(audioEncoder, ring, stretcher, sampleRate, channels, decoderOutputEOS,
+                            &encoderEOSSent) != 0) {
+            return -1;
+        }
+
+        // Process encoder output
+        SampleInfo encInfo;
+        ssize_t encOutIndex = audioEncoder.dequeueOutputBuffer(&encInfo, 0);
+        while (encOutIndex >= 0) {
+            size_t encOutSize;
+            uint8_t* encBuf = audioEncoder.getOutputBuffer(encOutIndex, &encOutSize);
+
+            if (encBuf && (encInfo.size > 0)) {
+                muxer.writeSampleData(audioTrackIndex, encBuf, encInfo);
+                audioSampleCount++;
+            }
+
+            audioEncoder.releaseOutputBuffer(encOutIndex, false);
+
+            if (encInfo.flags & BUFFER_FLAG_END_OF_STREAM) {
+                LOGI("Audio encoder output EOS");
+                audioEOS = true;
+            }
+
+            encOutIndex = audioEncoder.dequeueOutputBuffer(&encInfo, 0);
+        }
+
+        if (audioSampleCount % 100 == 0 && audioSampleCount > 0) {
+            LOGV("Processed %d audio samples, current segment: %zd", audioSampleCount, currentAudioSegment);
+        }
+    }
+
+    LOGI("Audio track completed: %d samples, %lld PCM frames encoded (ring peak %zu frames)",
+         audioSampleCount, (long long) ring.readPosition(), ring.peakFrames());
+    return 0;
+}
+
+// Mp4Extractor over the source reference already has open, when it parses the
+// source and numbers its tracks like reference, which the rest of the job relies on
+static std::unique_ptr<MediaExtractor> openMappedExtractor(ProfilingMediaBackend& media, MediaExtractor& reference,
+                                                           int videoTrack) {
+    std::unique_ptr<Mp4Extractor> mapped = Mp4Extractor::open(media, reference.fileDescriptor());
+    if (!mapped || mapped->getTrackCount() != reference.getTrackCount()) return nullptr;
+    std::string mime, expected;
+    mapped->getTrackFormat(videoTrack)->getString(MEDIA_KEY_MIME, &mime);
+    reference.getTrackFormat(videoTrack)->getString(MEDIA_KEY_MIME, &expected);
+    if (mime != expected) return nullptr;
+    return media.profile(std::move(mapped));
+}
+
+int processSpeedVideo(MediaBackend& backend,
+                      const char* inputPath,
+                      const char* outputPath,
+                      const std::vector<Segment>& segments,
+                      const PipelineOptions& options) {
+
+    std::unique_ptr<MediaExtractor> extractor;
+    std::unique_ptr<MediaExtractor> videoExtractor;
+    std::unique_ptr<MediaCodec> audioDecoder;
+    std::unique_ptr<MediaCodec> audioEncoder;
+    std::unique_ptr<InterleavingMuxer> muxer;
+    std::unique_ptr<AsyncAudioPipeline> asyncAudio;
+    std::unique_ptr<TimeStretcher> timeStretcher;
+    std::unique_ptr<PeakAccumulator> peakTap;
+    std::unique_ptr<MediaFormat> audioFormat;
+    std::unique_ptr<MediaFormat> videoFormat;
+
+    int result = -1;
+
+    // Runs without a caller-supplied control still collect stats
+    JobControl localControl;
+    JobControl* control = options.control ? options.control : &localControl;
+    ProfilingMediaBackend media(backend, control->profiler());
+    // Stopped early when the video side fails, so audio does not finish a dead export
+    JobControl audioControl(control);
+    int64_t startNs = PipelineProfiler::nowNs();
+
+    LOGI("Starting video processing with segments (%s backend): %s -> %s",
+         backend.name(), inputPath, outputPath);
+
+    do {
+        // Create extractor on the input file
+        extractor = media.createExtractor(inputPath);
+        if (!extractor) {
+            LOGE("Failed to create media extractor");
+            break;
+        }
+
+        // Find tracks
+        int trackCount = extractor->getTrackCount();
+        int audioTrack = -1, videoTrack = -1;
+
+        for (int i = 0; i < trackCount; i++) {
+            std::unique_ptr<MediaFormat> fmt = extractor->getTrackFormat(i);
+            std::string mime;
+            if (fmt && fmt->getString(MEDIA_KEY_MIME, &mime)) {
+                if (mime.find("audio/") != std::string::npos) {
+                    audioTrack = i;
+                    audioFormat = std::move(fmt);
+                    LOGI("Found audio track: %d", i);
+                } else if (mime.find("video/") != std::string::npos) {
+                    videoTrack = i;
+                    videoFormat = std::move(fmt);
+                    LOGI("Found video track: %d", i);
+                }
+            }
+        }
+
+        if (videoTrack < 0) {
+            LOGE("No video track found");
+            break;
+        }
+
+        // Compile the segment list once; every sample below is remapped through it
+        int64_t sourceDurationUs = -1;
+        videoFormat->getInt64(MEDIA_KEY_DURATION, &sourceDurationUs);
+        SegmentTimeline timeline;
+        if (!timeline.compile(segments, sourceDurationUs)) {
+            LOGE("Invalid segment list");
+            break;
+        }
+        LOGI("Timeline: %zu segments, output duration %lldus%s", timeline.size(),
+             (long long)timeline.outputDurationUs(), timeline.hasGaps() ? ", with cuts" : "");
+        control->setOutputDuration(timeline.outputDurationUs());
+
+        std::shared_ptr<const SampleIndex> index;
+        if (options.indexCache) index = options.indexCache->get(backend, inputPath);
+        if (index && index->trackCount() == (size_t) trackCount) {
+            SampleIndex::Estimate estimate = index->estimate(timeline, videoTrack, audioTrack);
+            LOGI("Estimated output: %lldus, %lld video frames, %lld video bytes, %lld audio bytes",
+                 (long long) estimate.durationUs, (long long) estimate.videoFrames,
+                 (long long) estimate.videoBytes, (long long) estimate.audioBytes);
+        } else {
+            index.reset();
+        }
+
+        // Cache keys carry the source identity; a source that cannot be stat'ed is not cached
+        std::string sourceKey = options.renderCache ? SegmentRenderCache::sourceKey(inputPath) : std::string();
+        SegmentRenderCache* renderCache = sourceKey.empty() ? nullptr : options.renderCache;
+
+        // Create muxer
+        std::unique_ptr<MediaMuxer> outputMuxer;
+        if (options.fragmentedOutput) {
+            outputMuxer = FragmentedMp4Muxer::create(outputPath, options.fragmentDurationUs, options.faststart);
+        } else {
+            outputMuxer = media.createMuxer(outputPath);
+        }
+        if (!outputMuxer) {
+            LOGE("Failed to create media muxer");
+            break;
+        }
+        muxer = std::make_unique<InterleavingMuxer>(std::move(outputMuxer), MUX_REORDER_DEPTH);
+        muxer->setControl(control);
+
+        // Each track is read by its own extractor on its own thread. The mapping only
+        // pays off when the muxer takes its sample views; otherwise every sample is
+        // copied either way and the backend's extractor is kept.
+        if (options.mappedDemuxer && muxer->acceptsSampleViews()) {
+            videoExtractor = openMappedExtractor(media, *extractor, videoTrack);
+            LOGI("Video read from %s", videoExtractor ? "a mapping of the source" : "the backend extractor");
+        }
+        if (!videoExtractor) videoExtractor = media.createExtractor(inputPath);
+        if (!videoExtractor) {
+            LOGE("Failed to create video extractor");
+            break;
+        }
+
+        // Add video track
+        ssize_t videoTrackIndex = muxer->addTrack(*videoFormat);
+        if (videoTrackIndex < 0) {
+            LOGE("Failed to add video track to muxer");
+            break;
+        }
+        LOGI("Added video track to muxer with index: %zd", videoTrackIndex);
+
+        ssize_t audioTrackIndex = -1;
+        int32_t sampleRate = 0, channels = 0, bitRate = 0;
+        bool audioPassthrough = false;
+        bool segmentedAudio = false;
+        int status;
+
+        // Setup audio if available
+        if (audioTrack >= 0) {
+            audioFormat->getInt32(MEDIA_KEY_SAMPLE_RATE, &sampleRate);
+            audioFormat->getInt32(MEDIA_KEY_CHANNEL_COUNT, &channels);
+
+            LOGI("Audio config: sampleRate=%d, channels=%d", sampleRate, channels);
+
+            // Copied and re-encoded access units share one track, so
+            // passthrough needs a source the encoder can match exactly
+            std::string audioMime;
+            audioFormat->getString(MEDIA_KEY_MIME, &audioMime);
+            int32_t sourceProfile = 2, sourceBitRate = 0;
+            audioFormat->getInt32(MEDIA_KEY_AAC_PROFILE, &sourceProfile);
+            audioFormat->getInt32(MEDIA_KEY_BIT_RATE, &sourceBitRate);
+            audioPassthrough = options.audioPassthrough && audioMime == "audio/mp4a-latm" && sourceProfile == 2 &&
+                               ParallelAudioStretcher::hasPassthroughSegments(timeline);
+
+            // Create encoder format, keeping the source bitrate when it is known
+            std::unique_ptr<MediaFormat> encoderFormat = media.createFormat();
+            encoderFormat->setString(MEDIA_KEY_MIME, "audio/mp4a-latm");
+            encoderFormat->setInt32(MEDIA_KEY_SAMPLE_RATE, sampleRate);
+            encoderFormat->setInt32(MEDIA_KEY_CHANNEL_COUNT, channels);
+            bitRate = sourceBitRate > 0 ? sourceBitRate : 128000;
+            encoderFormat->setInt32(MEDIA_KEY_BIT_RATE, bitRate);
+            encoderFormat->setInt32(MEDIA_KEY_AAC_PROFILE, 2);
+            // Room for whole AAC frames, so each input buffer is encoded without a remainder
+            encoderFormat->setInt32(MEDIA_KEY_MAX_INPUT_SIZE,
+                                    (int32_t) (ENCODER_INPUT_AAC_FRAMES * PcmRingBuffer::AAC_FRAME_SIZE *
+                                               channels * sizeof(short)));
+
+            // Create audio encoder
+            audioEncoder = media.createEncoder("audio/mp4a-latm");
+            if (!audioEncoder) {
+                LOGE("Failed to create audio encoder");
+                break;
+            }
+
+            // Parallel, passthrough and cached modes give every worker its own decoder and
+            // stretcher; a timeline of a single unit gains nothing from workers or the
+            // cache and goes through the pipelined stages instead
+            segmentedAudio = audioPassthrough || ((options.audioWorkers > 1 || renderCache) &&
+                                                  ParallelAudioStretcher::splitsIntoUnits(timeline));
+            if (!segmentedAudio) {
+                // Create audio decoder
+                audioDecoder = media.createDecoder(audioMime.c_str());
+                if (!audioDecoder) {
+                    LOGE("Failed to create audio decoder");
+                    break;
+                }
+
+                timeStretcher = std::make_unique<TimeStretcher>(sampleRate, channels);
+                LOGI("Time stretcher created for segment-based processing");
+
+                // The whole track goes through the decoder anyway, so the waveform comes for free
+                if (options.peakCache && !options.peakCache->find(inputPath)) {
+                    peakTap = std::make_unique<PeakAccumulator>(sampleRate, channels);
+                }
+            }
+
+            // Callback mode has to be chosen before the codecs are configured
+            if (!segmentedAudio && options.asyncAudio) {
+                asyncAudio = std::make_unique<AsyncAudioPipeline>(*extractor, *audioDecoder, *audioEncoder,
+                                                                  *timeStretcher, timeline, sampleRate, channels,
+                                                                  &audioControl);
+                if (asyncAudio->attach() != 0) {
+                    break;
+                }
+                asyncAudio->setPeakTap(peakTap.get());
+            }
+
+            status = audioEncoder->configure(*encoderFormat, true);
+            if (status != MEDIA_OK) {
+                LOGE("Failed to configure audio encoder, status: %d", status);
+                break;
+            }
+
+            status = audioEncoder->start();
+            if (status != MEDIA_OK) {
+                LOGE("Failed to start audio encoder, status: %d", status);
+                break;
+            }
+
+            // Get encoder output format and add to muxer
+            std::unique_ptr<MediaFormat> outputFormat = audioEncoder->getOutputFormat();
+            if (outputFormat) {
+                audioTrackIndex = muxer->addTrack(audioPassthrough ? *audioFormat : *outputFormat);
+                LOGI("Added audio track to muxer with index: %zd", audioTrackIndex);
+            } else {
+                LOGE("Failed to get encoder output format");
+                break;
+            }
+
+            if (audioDecoder) {
+                status = audioDecoder->configure(*audioFormat, false);
+                if (status != MEDIA_OK) {
+                    LOGE("Failed to configure audio decoder, status: %d", status);
+                    break;
+                }
+
+                status = audioDecoder->start();
+                if (status != MEDIA_OK) {
+                    LOGE("Failed to start audio decoder, status: %d", status);
+                    break;
+                }
+            }
+        }
+
+        // Start muxer
+        status = muxer->start();
+        if (status != MEDIA_OK) {
+            LOGE("Failed to start muxer, status: %d", status);
+            break;
+        }
+        LOGI("Muxer started successfully");
+
+        // ===== VIDEO AND AUDIO IN PARALLEL =====
+        // Wall time is max(video, audio); the muxer interleaves the two by output PTS
+        int videoResult = -1;
+        std::thread videoThread([&] {
+            if (options.smartCut) {
+                SmartCutRemuxer remuxer(media, *videoExtractor, videoTrack, *videoFormat, timeline,
+                                        *muxer, videoTrackIndex, options.maxOutputFrameRate, control,
+                                        index.get());
+                if (renderCache) {
+                    // Samples are recorded as the muxer takes them, length-prefixed
+                    // views included, so its framing is part of the key
+                    char settings[96];
+                    snprintf(settings, sizeof(settings), "|%s|video|%d|%d|%s", backend.name(), videoTrack,
+                             options.maxOutputFrameRate, muxer->acceptsSampleViews() ? "views" : "annexb");
+                    remuxer.setRenderCache(renderCache, sourceKey + settings);
+                }
+                videoResult = remuxer.run();
+            } else {
+                videoResult = remuxVideoTrack(*videoExtractor, videoTrack, *videoFormat, timeline,
+                                              options.maxOutputFrameRate, *muxer, videoTrackIndex,
+                                              control);
+            }
+            if (videoResult != 0) audioControl.cancel();
+            muxer->finishTrack(videoTrackIndex);
+        });
+
+        int audioResult = 0;
+        if (audioTrack >= 0) {
+            LOGI("Processing audio track with dynamic speed adjustment...");
+            extractor->selectTrack(audioTrack);
+
+            if (segmentedAudio) {
+                ParallelAudioStretcher stretcher(media, inputPath, audioTrack, *audioFormat, timeline,
+                                                 sampleRate, channels, std::max(options.audioWorkers, (size_t) 1),
+                                                 audioPassthrough, &audioControl);
+                if (renderCache) {
+                    char settings[96];
+                    snprintf(settings, sizeof(settings), "|%s|audio|%d|%d|%d|%d", backend.name(), audioTrack,
+                             sampleRate, channels, bitRate);
+                    stretcher.setRenderCache(renderCache, sourceKey + settings);
+                }
+                audioResult = stretcher.run(*audioEncoder, *muxer, audioTrackIndex);
+                LOGI("Audio track completed: %d encoded, %d copied and %d cached samples from %zu units",
+                     stretcher.encodedSamples(), stretcher.copiedSamples(), stretcher.cachedSamples(),
+                     stretcher.unitCount());
+            } else if (asyncAudio) {
+                LOGI("Running audio stages asynchronously");
+                audioResult = asyncAudio->run(*muxer, audioTrackIndex);
+                asyncAudio->logStats();
+                LOGI("Audio track completed: %d samples", asyncAudio->encodedSamples());
+            } else {
+                audioResult = runSyncAudio(*extractor, *audioDecoder, *audioEncoder, *timeStretcher, timeline,
+                                           sampleRate, channels, *muxer, audioTrackIndex, &audioControl,
+                                           peakTap.get());
+            }
+            muxer->finishTrack(audioTrackIndex);
+        } else {
+            LOGI("No audio track, video-only output created");
+        }
+
+        videoThread.join();
+        result = (videoResult == 0 && audioResult == 0) ? 0 : -1;
+
+        if (peakTap && audioResult == 0) {
+            std::unique_ptr<WaveformPeaks> peaks = WaveformPeaks::build(inputPath, *peakTap);
+            if (peaks) {
+                LOGI("Waveform taken from the export decode, %zu levels", peaks->levelCount());
+                options.peakCache->store(inputPath, std::move(peaks));
+            }
+        }
+
+    } while (false);
+
+    // Cleanup
+    LOGI("Starting cleanup...");
+
+    if (muxer) {
+        if (muxer->stop() != MEDIA_OK && result == 0) {
+            LOGE("Failed to finalize output");
+            result = -1;
+        }
+        LOGI("Muxer wrote %zu interleaved samples", muxer->samplesWritten());
+        muxer.reset();
+    }
+
+    if (audioEncoder) {
+        audioEncoder->stop();
+        audioEncoder.reset();
+    }
+
+    if (audioDecoder) {
+        audioDecoder->stop();
+        audioDecoder.reset();
+    }
+
+    // Codec callbacks point into the async stages, so they go after the codecs
+    asyncAudio.reset();
+
+    videoExtractor.reset();
+    extractor.reset();
+
+    control->profiler()->setWallTime((PipelineProfiler::nowNs() - startNs) / 1000);
+    control->profiler()->log();
+
+    if (result == 0) {
+        LOGI("Successfully processed video with segment-based speed adjustment");
+    } else if (isCancelled(control)) {
+        LOGI("Video processing cancelled");
+    } else {
+        LOGE("Video processing failed");
+    }
+
+    return result;
+}
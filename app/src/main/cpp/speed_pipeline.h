@@ -0,0 +1,63 @@
+#pragma once
+
+#include "job_control.h"
+#include "media_backend.h"
+#include "sample_index.h"
+#include "segment_render_cache.h"
+#include "segment_timeline.h"
+#include "waveform_peaks.h"
+
+#include <vector>
+
+struct PipelineOptions {
+    // Drive the audio codecs through callbacks with decode, stretch, encode
+    // and mux on separate threads instead of polling dequeues on one thread
+    bool asyncAudio = true;
+    // Above 1, audio is split at segment boundaries and stretched on this
+    // many workers in parallel, unless the timeline makes a single work unit;
+    // asyncAudio is then ignored
+    size_t audioWorkers = 0;
+    // Copy the source AAC access units of 1.0x segments instead of
+    // re-encoding them. Only used when the source is AAC-LC; when it is,
+    // audio runs on the segmented path as with audioWorkers.
+    bool audioPassthrough = true;
+    // Cut video on exact frames, re-encoding only the partial GOPs at segment
+    // edges. When off, cuts snap to the keyframe before each segment start.
+    bool smartCut = true;
+    // Upper bound on the output frame rate of speed-up segments, reached by
+    // dropping frames; 0 leaves every frame in
+    int32_t maxOutputFrameRate = 0;
+    // Receives progress and is polled for cancellation; may be null
+    JobControl* control = nullptr;
+    // Source sample indexes; keyframes are then looked up instead of found
+    // by seeking. May be null.
+    SampleIndexCache* indexCache = nullptr;
+    // Read the video track with Mp4Extractor straight from a mapping of the
+    // source when the muxer takes sample views (fragmentedOutput). Sources it
+    // cannot parse, and other muxers, stay on the backend's extractor.
+    bool mappedDemuxer = true;
+    // Write fragmented MP4 with FragmentedMp4Muxer instead of the backend's
+    // muxer, cutting a fragment at the first keyframe after each interval
+    bool fragmentedOutput = false;
+    int64_t fragmentDurationUs = 2000000;
+    // With fragmentedOutput, rewrite the finished file with moov up front
+    bool faststart = false;
+    // Rendered segments, replayed when an export repeats a segment of the
+    // same source at the same speed. Audio then runs on the segmented path,
+    // again unless the timeline makes a single work unit; video is only
+    // cached with smartCut. May be null.
+    SegmentRenderCache* renderCache = nullptr;
+    // Source waveforms. When the source has none yet and the audio is
+    // decoded as one whole track (not on the segmented path), its peaks are
+    // taken on the way and stored on success. May be null.
+    WaveformPeakCache* peakCache = nullptr;
+};
+
+// Remuxes the video track and time-stretches the audio track of inputPath
+// according to segments, writing the result to outputPath through backend.
+// Returns 0 on success, -1 on failure or cancellation.
+int processSpeedVideo(MediaBackend& backend,
+                      const char* inputPath,
+                      const char* outputPath,
+                      const std::vector<Segment>& segments,
+                      const PipelineOptions& options = PipelineOptions());
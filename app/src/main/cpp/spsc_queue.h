@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free single-producer / single-consumer ring. Capacity is
+// rounded up to a power of two. Also keeps the counters the pipeline logs to
+// show which stage is the bottleneck.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t minCapacity) {
+        size_t capacity = 1;
+        while (capacity < minCapacity) capacity <<= 1;
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    bool tryPush(const T& value) {
+        size_t tail = writeIndex.load(std::memory_order_relaxed);
+        size_t head = readIndex.load(std::memory_order_acquire);
+        if (tail - head > mask) return false;
+        slots[tail & mask] = value;
+        writeIndex.store(tail + 1, std::memory_order_release);
+
+        // Producer-side bookkeeping, only written from this thread
+        size_t depth = tail + 1 - head;
+        if (depth > maxDepth.load(std::memory_order_relaxed)) {
+            maxDepth.store(depth, std::memory_order_relaxed);
+        }
+        pushes.store(pushes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        depthSum.store(depthSum.load(std::memory_order_relaxed) + depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool tryPop(T* value) {
+        size_t head = readIndex.load(std::memory_order_relaxed);
+        if (head == writeIndex.load(std::memory_order_acquire)) return false;
+        *value = slots[head & mask];
+        readIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return readIndex.load(std::memory_order_acquire) == writeIndex.load(std::memory_order_acquire);
+    }
+
+    bool full() const {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire) > mask;
+    }
+
+    size_t size() const {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask + 1; }
+    size_t maxDepthSeen() const { return maxDepth.load(std::memory_order_relaxed); }
+    size_t pushCount() const { return pushes.load(std::memory_order_relaxed); }
+    double averageDepth() const {
+        size_t n = pushCount();
+        return n ? (double) depthSum.load(std::memory_order_relaxed) / n : 0.0;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> writeIndex{0};
+    alignas(64) std::atomic<size_t> readIndex{0};
+    std::atomic<size_t> maxDepth{0};
+    std::atomic<size_t> pushes{0};
+    std::atomic<size_t> depthSum{0};
+};
+
+// Parks a stage thread while its input queues are empty (or its output is
+// full) without putting a lock on the data path: producers only take the
+// mutex when the consumer is actually asleep.
+class StageSignal {
+public:
+    void notify() {
+        // Orders the caller's queue write before reading the sleeping flag
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            condition.notify_one();
+        }
+    }
+
+    // Blocks until ready() holds. Returns the number of times it had to sleep.
+    template <typename Ready>
+    size_t wait(Ready ready) {
+        size_t sleeps = 0;
+        for (int spin = 0; spin < 64; spin++) {
+            if (ready()) return sleeps;
+            std::this_thread::yield();
+        }
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready()) {
+                sleeping.store(false, std::memory_order_relaxed);
+                return sleeps;
+            }
+            sleeps++;
+            // The timeout only guards against a lost wakeup, notify() is the normal path
+            condition.wait_for(lock, std::chrono::milliseconds(5));
+            sleeping.store(false, std::memory_order_relaxed);
+            if (ready()) return sleeps;
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<bool> sleeping{false};
+};
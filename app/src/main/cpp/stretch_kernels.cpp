@@ -0,0 +1,46 @@
+#include "stretch_kernels.h"
+#include "editor_log.h"
+
+#include <cstdlib>
+
+static uint32_t scalarSumAbsDiff(const short* a, const short* b, size_t count) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += (uint32_t) std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+static void scalarOverlapAdd(short* out, const short* down, const short* up, size_t frames, int32_t channels) {
+    int32_t step = overlapStep(frames);
+    for (size_t t = 0; t < frames; t++) {
+        int32_t weight = (int32_t) (t * step) >> 16;
+        for (int32_t c = 0; c < channels; c++) {
+            size_t i = t * channels + c;
+            out[i] = overlapMix(down[i], up[i], weight);
+        }
+    }
+}
+
+static const StretchKernels SCALAR_KERNELS = {"scalar", scalarSumAbsDiff, scalarOverlapAdd};
+
+const StretchKernels& StretchKernels::scalar() {
+    return SCALAR_KERNELS;
+}
+
+const StretchKernels& StretchKernels::best() {
+    static const StretchKernels* chosen = [] {
+        std::vector<const StretchKernels*> sets = supported();
+        LOGI("Time stretch kernels: %s", sets.back()->name);
+        return sets.back();
+    }();
+    return *chosen;
+}
+
+std::vector<const StretchKernels*> StretchKernels::supported() {
+    std::vector<const StretchKernels*> sets = {&SCALAR_KERNELS};
+    for (const StretchKernels* set : {sse2StretchKernels(), avx2StretchKernels(), neonStretchKernels()}) {
+        if (set) sets.push_back(set);
+    }
+    return sets;
+}
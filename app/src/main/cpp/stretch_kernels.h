@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Inner loops of the time stretcher. Every implementation produces exactly
+// the same output as the scalar reference, so any of them can be swapped in.
+struct StretchKernels {
+    const char* name;
+
+    // Sum of |a[i] - b[i]| over count samples, the pitch search's AMDF term
+    uint32_t (*sumAbsDiff)(const short* a, const short* b, size_t count);
+
+    // Crossfades frames interleaved frames from down (fading out) into up
+    // (fading in). The weight of up at frame t is (t * step) >> 16 in Q14,
+    // with step = (1 << 30) / frames, and the mix is rounded to nearest.
+    void (*overlapAdd)(short* out, const short* down, const short* up, size_t frames, int32_t channels);
+
+    static const StretchKernels& scalar();
+    // The fastest set this CPU supports, picked once at first use
+    static const StretchKernels& best();
+    // Every set this CPU supports, scalar first
+    static std::vector<const StretchKernels*> supported();
+};
+
+// Per-ISA sets; null when not built for or not supported by this CPU
+const StretchKernels* sse2StretchKernels();
+const StretchKernels* avx2StretchKernels();
+const StretchKernels* neonStretchKernels();
+
+// Fixed-point crossfade shared by the implementations
+static const int32_t OVERLAP_WEIGHT_BITS = 14;
+
+inline int32_t overlapStep(size_t frames) {
+    return (int32_t) ((1u << 30) / frames);
+}
+
+inline short overlapMix(short down, short up, int32_t weight) {
+    return (short) ((down * ((1 << OVERLAP_WEIGHT_BITS) - weight) + up * weight +
+                     (1 << (OVERLAP_WEIGHT_BITS - 1))) >> OVERLAP_WEIGHT_BITS);
+}
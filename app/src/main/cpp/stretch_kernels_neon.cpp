@@ -0,0 +1,76 @@
+#include "stretch_kernels.h"
+
+// NEON is mandatory on arm64-v8a and enabled for the armeabi-v7a ABI the app ships
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+static uint32_t neonSumAbsDiff(const short* a, const short* b, size_t count) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t va = vld1q_s16(a + i);
+        int16x8_t vb = vld1q_s16(b + i);
+        // vabd's 16-bit result is exact when read as unsigned
+        uint16x8_t diff = vreinterpretq_u16_s16(vabdq_s16(va, vb));
+        acc = vpadalq_u16(acc, diff);
+    }
+    uint32x2_t pair = vadd_u32(vget_low_u32(acc), vget_high_u32(acc));
+    uint32_t sum = vget_lane_u32(vpadd_u32(pair, pair), 0);
+    for (; i < count; i++) sum += (uint32_t) (a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]);
+    return sum;
+}
+
+static inline int16x4_t neonMix(int16x4_t down, int16x4_t up, int32x4_t raw) {
+    int32x4_t weight = vshrq_n_s32(raw, 16);
+    int32x4_t inverse = vsubq_s32(vdupq_n_s32(1 << OVERLAP_WEIGHT_BITS), weight);
+    int32x4_t mixed = vmulq_s32(vmovl_s16(down), inverse);
+    mixed = vmlaq_s32(mixed, vmovl_s16(up), weight);
+    mixed = vaddq_s32(mixed, vdupq_n_s32(1 << (OVERLAP_WEIGHT_BITS - 1)));
+    return vmovn_s32(vshrq_n_s32(mixed, OVERLAP_WEIGHT_BITS));
+}
+
+static void neonOverlapAdd(short* out, const short* down, const short* up, size_t frames, int32_t channels) {
+    const int32_t step = overlapStep(frames);
+    const size_t total = frames * channels;
+    size_t i = 0;
+    if (channels <= 8) {
+        // Weights repeat every lcm(8, channels) interleaved samples
+        size_t block = 8;
+        while (block % channels) block += 8;
+        const int32_t blockStep = (int32_t) (block / channels) * step;
+        int32_t offsets[64];
+        for (size_t j = 0; j < block; j++) offsets[j] = (int32_t) (j / channels) * step;
+
+        int32x4_t base = vdupq_n_s32(0);
+        for (; i + block <= total; i += block) {
+            for (size_t j = 0; j < block; j += 8) {
+                int16x8_t d = vld1q_s16(down + i + j);
+                int16x8_t u = vld1q_s16(up + i + j);
+                int16x4_t lo = neonMix(vget_low_s16(d), vget_low_s16(u), vaddq_s32(base, vld1q_s32(offsets + j)));
+                int16x4_t hi = neonMix(vget_high_s16(d), vget_high_s16(u),
+                                       vaddq_s32(base, vld1q_s32(offsets + j + 4)));
+                vst1q_s16(out + i + j, vcombine_s16(lo, hi));
+            }
+            base = vaddq_s32(base, vdupq_n_s32(blockStep));
+        }
+    }
+    for (; i < total; i++) {
+        int32_t weight = (int32_t) ((i / channels) * step) >> 16;
+        out[i] = overlapMix(down[i], up[i], weight);
+    }
+}
+
+static const StretchKernels NEON_KERNELS = {"neon", neonSumAbsDiff, neonOverlapAdd};
+
+const StretchKernels* neonStretchKernels() {
+    return &NEON_KERNELS;
+}
+
+#else
+
+const StretchKernels* neonStretchKernels() {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include "stretch_kernels.h"
+
+// SSE2 is part of the x86-64 baseline; AVX2 is compiled per function and
+// only picked when the CPU reports it.
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// Interleaved layouts repeat every lcm(vector width, channels) samples, so
+// per-sample crossfade weights are built from a table over one such block
+static const int32_t MAX_VECTOR_CHANNELS = 8;
+static const size_t MAX_WEIGHT_BLOCK = 112;
+
+static size_t weightBlock(size_t width, int32_t channels) {
+    size_t block = width;
+    while (block % channels) block += width;
+    return block;
+}
+
+static void fillWeightOffsets(int32_t* offsets, size_t block, int32_t channels, int32_t step) {
+    for (size_t j = 0; j < block; j++) offsets[j] = (int32_t) (j / channels) * step;
+}
+
+static void overlapTail(short* out, const short* down, const short* up, size_t from, size_t total,
+                        int32_t channels, int32_t step) {
+    for (size_t i = from; i < total; i++) {
+        int32_t weight = (int32_t) ((i / channels) * step) >> 16;
+        out[i] = overlapMix(down[i], up[i], weight);
+    }
+}
+
+static uint32_t sse2SumAbsDiff(const short* a, const short* b, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        // max - min is the absolute difference as an unsigned 16-bit value
+        __m128i diff = _mm_sub_epi16(_mm_max_epi16(va, vb), _mm_min_epi16(va, vb));
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(diff, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(diff, zero));
+    }
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    uint32_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < count; i++) sum += (uint32_t) (a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]);
+    return sum;
+}
+
+// (16384 - w, w) as the low and high halves of each 32-bit lane, ready for madd
+static inline __m128i sse2WeightPairs(__m128i raw) {
+    __m128i weight = _mm_srli_epi32(raw, 16);
+    return _mm_or_si128(_mm_slli_epi32(weight, 16),
+                        _mm_sub_epi32(_mm_set1_epi32(1 << OVERLAP_WEIGHT_BITS), weight));
+}
+
+static inline __m128i sse2Mix(__m128i pairs, __m128i weights) {
+    __m128i mixed = _mm_madd_epi16(pairs, weights);
+    return _mm_srai_epi32(_mm_add_epi32(mixed, _mm_set1_epi32(1 << (OVERLAP_WEIGHT_BITS - 1))),
+                          OVERLAP_WEIGHT_BITS);
+}
+
+static void sse2OverlapAdd(short* out, const short* down, const short* up, size_t frames, int32_t channels) {
+    const int32_t step = overlapStep(frames);
+    const size_t total = frames * channels;
+    size_t i = 0;
+    if (channels <= MAX_VECTOR_CHANNELS) {
+        const size_t block = weightBlock(8, channels);
+        const int32_t blockStep = (int32_t) (block / channels) * step;
+        alignas(16) int32_t offsets[MAX_WEIGHT_BLOCK];
+        fillWeightOffsets(offsets, block, channels, step);
+
+        __m128i base = _mm_setzero_si128();
+        for (; i + block <= total; i += block) {
+            for (size_t j = 0; j < block; j += 8) {
+                __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + i + j));
+                __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + i + j));
+                __m128i w0 = sse2WeightPairs(
+                        _mm_add_epi32(base, _mm_load_si128(reinterpret_cast<const __m128i*>(offsets + j))));
+                __m128i w1 = sse2WeightPairs(
+                        _mm_add_epi32(base, _mm_load_si128(reinterpret_cast<const __m128i*>(offsets + j + 4))));
+                __m128i lo = sse2Mix(_mm_unpacklo_epi16(d, u), w0);
+                __m128i hi = sse2Mix(_mm_unpackhi_epi16(d, u), w1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + j), _mm_packs_epi32(lo, hi));
+            }
+            base = _mm_add_epi32(base, _mm_set1_epi32(blockStep));
+        }
+    }
+    overlapTail(out, down, up, i, total, channels, step);
+}
+
+__attribute__((target("avx2")))
+static uint32_t avx2SumAbsDiff(const short* a, const short* b, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i diff = _mm256_sub_epi16(_mm256_max_epi16(va, vb), _mm256_min_epi16(va, vb));
+        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(diff, zero));
+        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(diff, zero));
+    }
+    alignas(32) uint32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    uint32_t sum = 0;
+    for (uint32_t lane : lanes) sum += lane;
+    for (; i < count; i++) sum += (uint32_t) (a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]);
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2WeightPairs(__m256i raw) {
+    __m256i weight = _mm256_srli_epi32(raw, 16);
+    return _mm256_or_si256(_mm256_slli_epi32(weight, 16),
+                           _mm256_sub_epi32(_mm256_set1_epi32(1 << OVERLAP_WEIGHT_BITS), weight));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2Mix(__m256i pairs, __m256i weights) {
+    __m256i mixed = _mm256_madd_epi16(pairs, weights);
+    return _mm256_srai_epi32(_mm256_add_epi32(mixed, _mm256_set1_epi32(1 << (OVERLAP_WEIGHT_BITS - 1))),
+                             OVERLAP_WEIGHT_BITS);
+}
+
+__attribute__((target("avx2")))
+static void avx2OverlapAdd(short* out, const short* down, const short* up, size_t frames, int32_t channels) {
+    const int32_t step = overlapStep(frames);
+    const size_t total = frames * channels;
+    size_t i = 0;
+    if (channels <= MAX_VECTOR_CHANNELS) {
+        const size_t block = weightBlock(16, channels);
+        const int32_t blockStep = (int32_t) (block / channels) * step;
+        alignas(32) int32_t offsets[MAX_WEIGHT_BLOCK];
+        fillWeightOffsets(offsets, block, channels, step);
+
+        __m256i base = _mm256_setzero_si256();
+        for (; i + block <= total; i += block) {
+            for (size_t j = 0; j < block; j += 16) {
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(down + i + j));
+                __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + i + j));
+                __m256i first = _mm256_add_epi32(base, _mm256_load_si256(
+                        reinterpret_cast<const __m256i*>(offsets + j)));
+                __m256i second = _mm256_add_epi32(base, _mm256_load_si256(
+                        reinterpret_cast<const __m256i*>(offsets + j + 8)));
+                // 256-bit unpacks work per 128-bit half: lo holds samples 0-3 and 8-11, hi 4-7 and 12-15
+                __m256i wLo = avx2WeightPairs(_mm256_permute2x128_si256(first, second, 0x20));
+                __m256i wHi = avx2WeightPairs(_mm256_permute2x128_si256(first, second, 0x31));
+                __m256i lo = avx2Mix(_mm256_unpacklo_epi16(d, u), wLo);
+                __m256i hi = avx2Mix(_mm256_unpackhi_epi16(d, u), wHi);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + j), _mm256_packs_epi32(lo, hi));
+            }
+            base = _mm256_add_epi32(base, _mm256_set1_epi32(blockStep));
+        }
+    }
+    overlapTail(out, down, up, i, total, channels, step);
+}
+
+static const StretchKernels SSE2_KERNELS = {"sse2", sse2SumAbsDiff, sse2OverlapAdd};
+static const StretchKernels AVX2_KERNELS = {"avx2", avx2SumAbsDiff, avx2OverlapAdd};
+
+const StretchKernels* sse2StretchKernels() {
+    return &SSE2_KERNELS;
+}
+
+const StretchKernels* avx2StretchKernels() {
+    return __builtin_cpu_supports("avx2") ? &AVX2_KERNELS : nullptr;
+}
+
+#else
+
+const StretchKernels* sse2StretchKernels() {
+    return nullptr;
+}
+
+const StretchKernels* avx2StretchKernels() {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include "codec_pool.h"
+#include "host_media_backend.h"
+#include "test_check.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Which leases CodecPool hands warm codecs to, and which codecs it takes back
+
+static const char* AAC = "audio/mp4a-latm";
+
+static std::unique_ptr<MediaFormat> audioFormat(MediaBackend& backend, int32_t sampleRate) {
+    std::unique_ptr<MediaFormat> format = backend.createFormat();
+    format->setString(MEDIA_KEY_MIME, AAC);
+    format->setInt32(MEDIA_KEY_SAMPLE_RATE, sampleRate);
+    format->setInt32(MEDIA_KEY_CHANNEL_COUNT, 2);
+    return format;
+}
+
+static bool startDecoder(MediaCodec& codec, const MediaFormat& format) {
+    return codec.configure(format, false) == MEDIA_OK && codec.start() == MEDIA_OK;
+}
+
+static void testWarmReuse(HostMediaBackend& backend) {
+    CodecPool pool(backend);
+    std::unique_ptr<MediaFormat> format = audioFormat(backend, 44100);
+    for (int i = 0; i < 3; i++) {
+        std::unique_ptr<MediaCodec> decoder = pool.createDecoder(AAC);
+        CHECK(decoder && startDecoder(*decoder, *format));
+    }
+    CodecPool::Stats stats = pool.stats();
+    CHECK_EQ(stats.created, 1);
+    CHECK_EQ(stats.reused, 2);
+    CHECK_EQ(stats.reconfigured, 0);
+    CHECK_EQ(pool.idleCount(), 1);
+
+    // Same codec, another format: configured again rather than created
+    {
+        std::unique_ptr<MediaCodec> decoder = pool.createDecoder(AAC);
+        CHECK(decoder && startDecoder(*decoder, *audioFormat(backend, 48000)));
+    }
+    stats = pool.stats();
+    CHECK_EQ(stats.created, 1);
+    CHECK_EQ(stats.reconfigured, 1);
+
+    // Encoders are a kind of their own
+    {
+        std::unique_ptr<MediaCodec> encoder = pool.createEncoder(AAC);
+        CHECK(encoder && encoder->configure(*format, true) == MEDIA_OK && encoder->start() == MEDIA_OK);
+    }
+    CHECK_EQ(pool.stats().created, 2);
+    CHECK_EQ(pool.idleCount(), 2);
+
+    pool.trim();
+    CHECK_EQ(pool.idleCount(), 0);
+}
+
+static void testNotPooled(HostMediaBackend& backend) {
+    CodecPool pool(backend);
+    std::unique_ptr<MediaFormat> format = audioFormat(backend, 44100);
+
+    // Video codecs pass straight through
+    pool.createDecoder("video/avc");
+    CHECK_EQ(pool.stats().created, 0);
+
+    // Never started, or after a failed call
+    pool.createDecoder(AAC)->configure(*format, false);
+    CHECK_EQ(pool.idleCount(), 0);
+    {
+        std::unique_ptr<MediaCodec> decoder = pool.createDecoder(AAC);
+        CHECK(decoder->start() != MEDIA_OK);
+        CHECK(decoder->configure(*format, false) == MEDIA_OK && decoder->start() == MEDIA_OK);
+    }
+    CHECK_EQ(pool.idleCount(), 0);
+
+    // Rendering to a surface
+    {
+        std::unique_ptr<MediaCodec> decoder = pool.createDecoder(AAC);
+        CHECK(decoder->configureSurface(*format, nullptr) == MEDIA_OK && decoder->start() == MEDIA_OK);
+    }
+    CHECK_EQ(pool.idleCount(), 0);
+}
+
+static void testCap(HostMediaBackend& backend) {
+    CodecPool pool(backend, 1, 1);
+    std::unique_ptr<MediaFormat> format = audioFormat(backend, 44100);
+    {
+        std::unique_ptr<MediaCodec> first = pool.createDecoder(AAC);
+        std::unique_ptr<MediaCodec> second = pool.createDecoder(AAC);
+        CHECK(first && second && startDecoder(*first, *format) && startDecoder(*second, *format));
+    }
+    CHECK_EQ(pool.stats().created, 2);
+    CHECK_EQ(pool.idleCount(), 1);
+}
+
+static void testCallbackMode(HostMediaBackend& backend) {
+    CodecPool pool(backend);
+    std::unique_ptr<MediaFormat> format = audioFormat(backend, 44100);
+    std::atomic<int> firstInputs(0), secondInputs(0);
+
+    auto runAsync = [&](std::atomic<int>& inputs) {
+        std::unique_ptr<MediaCodec> decoder = pool.createDecoder(AAC);
+        CodecCallbacks callbacks;
+        callbacks.onInputAvailable = [&inputs](size_t) { inputs++; };
+        callbacks.onOutputAvailable = [](size_t, const SampleInfo&) {};
+        callbacks.onError = [](int) {};
+        CHECK(decoder->setCallbacks(callbacks) == MEDIA_OK && startDecoder(*decoder, *format));
+        for (int i = 0; i < 100 && inputs == 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        CHECK(inputs > 0);
+    };
+
+    runAsync(firstInputs);
+    CHECK_EQ(pool.stats().created, 1);
+    CHECK_EQ(pool.idleCount(), 1);
+
+    // The callback-mode codec comes back with the new lease's callbacks only
+    int firstSeen = firstInputs;
+    runAsync(secondInputs);
+    CHECK_EQ(pool.stats().created, 1);
+    CHECK_EQ(pool.stats().reused, 1);
+    CHECK_EQ(firstInputs, firstSeen);
+
+    // A polling lease handed the callback-mode codec trades it for a polling one
+    {
+        std::unique_ptr<MediaCodec> decoder = pool.createDecoder(AAC);
+        CHECK(startDecoder(*decoder, *format));
+        CHECK(decoder->dequeueInputBuffer(0) >= 0);
+    }
+    CHECK_EQ(pool.stats().created, 2);
+    CHECK_EQ(pool.idleCount(), 2);
+
+    // And a callback lease handed the warm polling codec trades it for the idle callback-mode one
+    std::atomic<int> thirdInputs(0);
+    runAsync(thirdInputs);
+    CHECK_EQ(pool.stats().created, 2);
+    CHECK_EQ(pool.idleCount(), 2);
+}
+
+int main() {
+    HostMediaBackend backend;
+    testWarmReuse(backend);
+    testNotPooled(backend);
+    testCap(backend);
+    testCallbackMode(backend);
+    return testResult();
+}
@@ -0,0 +1,177 @@
+#include "fragmented_mp4_muxer.h"
+#include "host_media_backend.h"
+#include "mp4_extractor.h"
+#include "test_check.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Files written by FragmentedMp4Muxer, rewritten with faststart, read back by
+// Mp4Extractor: every sample comes back with its time, flags and bytes
+
+static const int VIDEO_FRAMES = 90;
+static const int GOP_FRAMES = 30;
+static const int64_t FRAME_US = 33333;
+// Video times are stored in 90 kHz ticks, audio ones in samples
+static const int64_t VIDEO_TICK_US = 12;
+static const int AUDIO_FRAMES = 130;
+static const int32_t SAMPLE_RATE = 44100;
+static const uint8_t SPS[] = {0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1e, 0xda, 0x02, 0x80, 0xbf, 0xe5};
+static const uint8_t PPS[] = {0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80};
+// AAC LC, 44.1 kHz, stereo
+static const uint8_t AUDIO_CONFIG[] = {0x12, 0x10};
+
+struct Written {
+    std::vector<uint8_t> data;
+    int64_t timeUs;
+    bool sync;
+};
+
+// One Annex-B slice NAL, IDR on keyframes, with a payload particular to the frame
+static std::vector<uint8_t> videoFrame(int frame, bool sync) {
+    std::vector<uint8_t> data = {0, 0, 0, 1, (uint8_t) (sync ? 0x65 : 0x41)};
+    size_t size = 200 + (size_t) (frame * 37 % 500);
+    for (size_t i = 0; i < size; i++) data.push_back((uint8_t) (0x80 | ((frame + i) & 0x7f)));
+    return data;
+}
+
+static std::vector<uint8_t> audioFrame(int frame) {
+    std::vector<uint8_t> data(100 + (size_t) (frame * 13 % 200));
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t) (frame * 7 + i);
+    return data;
+}
+
+static bool writeFile(MediaBackend& backend, const std::string& path, bool faststart,
+                      std::vector<Written>* video, std::vector<Written>* audio) {
+    std::unique_ptr<FragmentedMp4Muxer> muxer = FragmentedMp4Muxer::create(path.c_str(), 1000000, faststart);
+    if (!muxer) return false;
+
+    std::unique_ptr<MediaFormat> videoFormat = backend.createFormat();
+    videoFormat->setString(MEDIA_KEY_MIME, "video/avc");
+    videoFormat->setInt32(MEDIA_KEY_WIDTH, 320);
+    videoFormat->setInt32(MEDIA_KEY_HEIGHT, 240);
+    videoFormat->setInt32(MEDIA_KEY_FRAME_RATE, 30);
+    videoFormat->setBuffer(MEDIA_KEY_CSD_0, SPS, sizeof(SPS));
+    videoFormat->setBuffer(MEDIA_KEY_CSD_1, PPS, sizeof(PPS));
+    std::unique_ptr<MediaFormat> audioFormat = backend.createFormat();
+    audioFormat->setString(MEDIA_KEY_MIME, "audio/mp4a-latm");
+    audioFormat->setInt32(MEDIA_KEY_SAMPLE_RATE, SAMPLE_RATE);
+    audioFormat->setInt32(MEDIA_KEY_CHANNEL_COUNT, 2);
+    audioFormat->setBuffer(MEDIA_KEY_CSD_0, AUDIO_CONFIG, sizeof(AUDIO_CONFIG));
+
+    ssize_t videoTrack = muxer->addTrack(*videoFormat);
+    ssize_t audioTrack = muxer->addTrack(*audioFormat);
+    if (videoTrack < 0 || audioTrack < 0 || muxer->start() != MEDIA_OK) return false;
+
+    // Interleaved roughly in time, as the pipeline writes them
+    int v = 0, a = 0;
+    while (v < VIDEO_FRAMES || a < AUDIO_FRAMES) {
+        int64_t videoUs = v * FRAME_US;
+        int64_t audioUs = (int64_t) a * 1024 * 1000000 / SAMPLE_RATE;
+        if (v < VIDEO_FRAMES && (a >= AUDIO_FRAMES || videoUs <= audioUs)) {
+            bool sync = v % GOP_FRAMES == 0;
+            Written sample = {videoFrame(v, sync), videoUs, sync};
+            SampleInfo info = {0, (int32_t) sample.data.size(), videoUs, sync ? SAMPLE_FLAG_SYNC : 0u};
+            if (muxer->writeSampleData((size_t) videoTrack, sample.data.data(), info) != MEDIA_OK) return false;
+            video->push_back(std::move(sample));
+            v++;
+        } else {
+            Written sample = {audioFrame(a), audioUs, true};
+            SampleInfo info = {0, (int32_t) sample.data.size(), audioUs, SAMPLE_FLAG_SYNC};
+            if (muxer->writeSampleData((size_t) audioTrack, sample.data.data(), info) != MEDIA_OK) return false;
+            audio->push_back(std::move(sample));
+            a++;
+        }
+    }
+    return muxer->stop() == MEDIA_OK;
+}
+
+static std::unique_ptr<Mp4Extractor> openMapped(MediaBackend& backend, const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    // The mapping outlives the descriptor
+    std::unique_ptr<Mp4Extractor> extractor = Mp4Extractor::open(backend, fd);
+    close(fd);
+    return extractor;
+}
+
+static void checkTrack(Mp4Extractor& extractor, size_t track, const std::vector<Written>& written, bool video) {
+    for (size_t i = 0; i < extractor.getTrackCount(); i++) extractor.unselectTrack(i);
+    extractor.selectTrack(track);
+    CHECK(extractor.seekTo(0, MediaSeekMode::PreviousSync) == MEDIA_OK);
+
+    std::vector<uint8_t> buffer(4096);
+    size_t count = 0;
+    for (; count < written.size(); count++) {
+        const Written& expected = written[count];
+        ssize_t size = extractor.readSampleData(buffer.data(), buffer.size());
+        if (size < 0) break;
+        CHECK_EQ(extractor.getSampleTrackIndex(), track);
+        CHECK(std::llabs(extractor.getSampleTime() - expected.timeUs) <= (video ? VIDEO_TICK_US : 0));
+        CHECK_EQ((extractor.getSampleFlags() & SAMPLE_FLAG_SYNC) != 0, expected.sync);
+        CHECK_EQ(size, expected.data.size());
+        CHECK(memcmp(buffer.data(), expected.data.data(), expected.data.size()) == 0);
+
+        // The view keeps the container's 4-byte length prefix in place of the start code
+        size_t viewSize = 0;
+        const uint8_t* view = extractor.sampleView(&viewSize);
+        CHECK(view != nullptr);
+        if (view && viewSize == expected.data.size()) {
+            size_t skip = video ? 4 : 0;
+            if (video) CHECK_EQ(((uint32_t) view[0] << 24 | view[1] << 16 | view[2] << 8 | view[3]), viewSize - 4);
+            CHECK(memcmp(view + skip, expected.data.data() + skip, viewSize - skip) == 0);
+        }
+        extractor.advance();
+    }
+    CHECK_EQ(count, written.size());
+    CHECK(extractor.getSampleSize() < 0);
+}
+
+int main(int argc, char** argv) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+    HostMediaBackend backend;
+
+    std::vector<Written> video, audio;
+    std::string path = dir + "/mp4_round_trip.mp4";
+    CHECK(writeFile(backend, path, true, &video, &audio));
+    std::unique_ptr<Mp4Extractor> extractor = openMapped(backend, path);
+    CHECK(extractor != nullptr);
+    if (extractor) {
+        CHECK_EQ(extractor->getTrackCount(), 2);
+        std::unique_ptr<MediaFormat> format = extractor->getTrackFormat(0);
+        std::string mime;
+        int32_t width = 0, sampleRate = 0;
+        std::vector<uint8_t> csd;
+        CHECK(format->getString(MEDIA_KEY_MIME, &mime) && mime == "video/avc");
+        CHECK(format->getInt32(MEDIA_KEY_WIDTH, &width) && width == 320);
+        CHECK(format->getBuffer(MEDIA_KEY_CSD_0, &csd) && csd == std::vector<uint8_t>(SPS, SPS + sizeof(SPS)));
+        CHECK(format->getBuffer(MEDIA_KEY_CSD_1, &csd) && csd == std::vector<uint8_t>(PPS, PPS + sizeof(PPS)));
+        format = extractor->getTrackFormat(1);
+        CHECK(format->getString(MEDIA_KEY_MIME, &mime) && mime == "audio/mp4a-latm");
+        CHECK(format->getInt32(MEDIA_KEY_SAMPLE_RATE, &sampleRate) && sampleRate == SAMPLE_RATE);
+
+        checkTrack(*extractor, 0, video, true);
+        checkTrack(*extractor, 1, audio, false);
+
+        // Seeks land on the keyframe at or before the target
+        extractor->selectTrack(0);
+        extractor->unselectTrack(1);
+        CHECK(extractor->seekTo(45 * FRAME_US, MediaSeekMode::PreviousSync) == MEDIA_OK);
+        CHECK(std::llabs(extractor->getSampleTime() - 30 * FRAME_US) <= VIDEO_TICK_US);
+    }
+    unlink(path.c_str());
+
+    // Fragments are left to the backend's extractor
+    video.clear();
+    audio.clear();
+    path = dir + "/mp4_round_trip_fragmented.mp4";
+    CHECK(writeFile(backend, path, false, &video, &audio));
+    CHECK(openMapped(backend, path) == nullptr);
+    unlink(path.c_str());
+
+    return testResult();
+}
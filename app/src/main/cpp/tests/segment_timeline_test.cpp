@@ -0,0 +1,91 @@
+#include "segment_timeline.h"
+#include "test_check.h"
+
+// Mapping between source and output time through compiled segment lists
+
+static Segment constantSpeed(float start, float end, float speed) {
+    Segment segment;
+    segment.start = start;
+    segment.end = end;
+    segment.speed = speed;
+    return segment;
+}
+
+static void testConstantSpeeds() {
+    SegmentTimeline timeline;
+    CHECK(timeline.compile({constantSpeed(0, 2, 1), constantSpeed(2, 5, 1.5f), constantSpeed(5, 6, 0.5f)}));
+    CHECK_EQ(timeline.size(), 3);
+    CHECK(!timeline.hasGaps());
+    // 2s + 3s / 1.5 + 1s / 0.5
+    CHECK_EQ(timeline.outputDurationUs(), 6000000);
+    CHECK_EQ(timeline[1].speedNum, 3);
+    CHECK_EQ(timeline[1].speedDen, 2);
+
+    int64_t us = -1;
+    CHECK(timeline.sourceToOutput(1000000, &us));
+    CHECK_EQ(us, 1000000);
+    CHECK(timeline.sourceToOutput(3500000, &us));
+    CHECK_EQ(us, 3000000);
+    CHECK(timeline.sourceToOutput(5500000, &us));
+    CHECK_EQ(us, 5000000);
+    CHECK(timeline.outputToSource(3000000, &us));
+    CHECK_EQ(us, 3500000);
+    CHECK(!timeline.sourceToOutput(6000000, &us));
+}
+
+static void testGapsAreCut() {
+    SegmentTimeline timeline;
+    // Out of order on purpose: compile() sorts
+    CHECK(timeline.compile({constantSpeed(4, 6, 2), constantSpeed(1, 2, 1)}));
+    CHECK(timeline.hasGaps());
+    CHECK_EQ(timeline.outputDurationUs(), 2000000);
+    CHECK_EQ(timeline.findBySource(500000), -1);
+    CHECK_EQ(timeline.findBySource(3000000), -1);
+    CHECK_EQ(timeline.findBySource(4000000), 1);
+
+    int64_t us = -1;
+    CHECK(timeline.sourceToOutput(4000000, &us));
+    CHECK_EQ(us, 1000000);
+    CHECK_EQ(timeline.findByOutput(1999999), 1);
+    CHECK_EQ(timeline.findByOutput(2000000), -1);
+}
+
+static void testInvalidLists() {
+    SegmentTimeline timeline;
+    CHECK(!timeline.compile({constantSpeed(0, 2, 1), constantSpeed(1, 3, 1)}));
+    CHECK(timeline.empty());
+    CHECK(!timeline.compile({constantSpeed(0, 2, 0)}));
+    CHECK(!timeline.compile({constantSpeed(2, 2, 1)}));
+    // Clipped to the media, and dropped entirely past its end
+    CHECK(timeline.compile({constantSpeed(0, 10, 2), constantSpeed(12, 14, 1)}, 4000000));
+    CHECK_EQ(timeline.size(), 1);
+    CHECK_EQ(timeline.outputDurationUs(), 2000000);
+}
+
+static void testRoundTripIsMonotonic() {
+    SegmentTimeline timeline;
+    CHECK(timeline.compile({constantSpeed(0, 1, 0.3f), constantSpeed(1, 3, 1.7f), constantSpeed(3, 4, 4)}));
+    int64_t lastOutput = -1;
+    SegmentTimeline::Cursor cursor(timeline);
+    for (int64_t sourceUs = 0; sourceUs < 4000000; sourceUs += 33367) {
+        int64_t outputUs = -1, back = -1;
+        CHECK(timeline.sourceToOutput(sourceUs, &outputUs));
+        CHECK(outputUs >= lastOutput);
+        lastOutput = outputUs;
+        // Output times are floored, so mapping back lands at most one speed step early
+        CHECK(timeline.outputToSource(outputUs, &back));
+        CHECK(back <= sourceUs && sourceUs - back <= 4);
+        const TimelineSegment* segment = cursor.locate(sourceUs);
+        CHECK(segment == &timeline[timeline.findBySource(sourceUs)]);
+    }
+    // A backwards jump still finds the right segment
+    CHECK(cursor.locate(500000) == &timeline[0]);
+}
+
+int main() {
+    testConstantSpeeds();
+    testGapsAreCut();
+    testInvalidLists();
+    testRoundTripIsMonotonic();
+    return testResult();
+}
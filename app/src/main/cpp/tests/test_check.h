@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal checks for the host tests. A failed check reports itself and the
+// test carries on; main() returns testResult() for ctest.
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline int testResult() {
+    if (testFailures() > 0) fprintf(stderr, "%d checks failed\n", testFailures());
+    return testFailures() > 0 ? 1 : 0;
+}
+
+#define CHECK(condition)                                                                 \
+    do {                                                                                 \
+        if (!(condition)) {                                                              \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            testFailures()++;                                                            \
+        }                                                                                \
+    } while (0)
+
+// For integers of any width
+#define CHECK_EQ(actual, expected)                                                                  \
+    do {                                                                                            \
+        long long actual_ = (long long) (actual), expected_ = (long long) (expected);              \
+        if (actual_ != expected_) {                                                                 \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, actual_, \
+                    expected_);                                                                     \
+            testFailures()++;                                                                       \
+        }                                                                                           \
+    } while (0)
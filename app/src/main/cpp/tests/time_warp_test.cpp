@@ -0,0 +1,87 @@
+#include "segment_timeline.h"
+#include "test_check.h"
+#include "time_warp.h"
+
+#include <cmath>
+#include <cstdlib>
+
+// Speed ramps: the warp table against closed forms, and ramped segments in a timeline
+
+static SpeedKeyframe keyframe(float time, float speed) {
+    SpeedKeyframe k;
+    k.time = time;
+    k.speed = speed;
+    return k;
+}
+
+static void testConstantRampMatchesSpeed() {
+    std::shared_ptr<const TimeWarp> warp = TimeWarp::build({keyframe(0, 2)}, 0, 3000000);
+    CHECK(warp != nullptr);
+    if (!warp) return;
+    CHECK_EQ(warp->sourceDurationUs(), 3000000);
+    CHECK_EQ(warp->outputDurationUs(), 1500000);
+    CHECK_EQ(warp->toOutput(1000000), 500000);
+    CHECK_EQ(warp->toSource(500000), 1000000);
+    // Past the end the mapping carries on at the last speed
+    CHECK_EQ(warp->toOutput(4000000), 2000000);
+}
+
+static void testLinearRamp() {
+    // Speed 1 + t over [0, 2s]: output time is the integral of 1 / (1 + t), ln 3
+    std::shared_ptr<const TimeWarp> warp = TimeWarp::build({keyframe(0, 1), keyframe(2, 3)}, 0, 2000000);
+    CHECK(warp != nullptr);
+    if (!warp) return;
+    CHECK(std::llabs(warp->outputDurationUs() - llround(std::log(3.0) * 1000000.0)) <= 2);
+    CHECK(std::fabs(warp->speedAt(1000000) - 2.0f) < 1e-4f);
+
+    int64_t lastUs = -1;
+    for (int64_t sourceUs = 0; sourceUs <= 2000000; sourceUs += 12345) {
+        int64_t outputUs = warp->toOutput(sourceUs);
+        CHECK(outputUs >= lastUs);
+        lastUs = outputUs;
+        CHECK(std::llabs(outputUs - llround(std::log1p(sourceUs / 1e6) * 1e6)) <= 2);
+        CHECK(std::llabs(warp->toSource(outputUs) - sourceUs) <= 3);
+    }
+}
+
+static void testInvalidRamps() {
+    CHECK(TimeWarp::build({}, 0, 1000000) == nullptr);
+    CHECK(TimeWarp::build({keyframe(0, 0)}, 0, 1000000) == nullptr);
+    CHECK(TimeWarp::build({keyframe(1, 1), keyframe(0, 2)}, 0, 1000000) == nullptr);
+    CHECK(TimeWarp::build({keyframe(0, 1)}, 1000000, 1000000) == nullptr);
+}
+
+static void testRampedSegment() {
+    Segment constant;
+    constant.start = 0;
+    constant.end = 1;
+    constant.speed = 1;
+    Segment ramped;
+    ramped.start = 1;
+    ramped.end = 3;
+    ramped.speed = 1;
+    // Keyframe times are in source seconds, not relative to the segment
+    ramped.ramp = {keyframe(1, 1), keyframe(3, 3)};
+
+    SegmentTimeline timeline;
+    CHECK(timeline.compile({constant, ramped}));
+    CHECK(timeline.hasRamps());
+    CHECK_EQ(timeline.size(), 2);
+    CHECK_EQ(timeline[1].outputStartUs, 1000000);
+    CHECK_EQ(timeline[1].outputEndUs, 1000000 + timeline[1].warp->outputDurationUs());
+
+    int64_t outputUs = -1, sourceUs = -1;
+    CHECK(timeline.sourceToOutput(2000000, &outputUs));
+    CHECK(std::llabs(outputUs - llround((1.0 + std::log(2.0)) * 1000000.0)) <= 2);
+    CHECK(timeline.outputToSource(outputUs, &sourceUs));
+    CHECK(std::llabs(sourceUs - 2000000) <= 3);
+    CHECK(std::fabs(timeline[1].speedAt(2000000) - 2.0f) < 1e-4f);
+}
+
+int main() {
+    testConstantRampMatchesSpeed();
+    testLinearRamp();
+    testInvalidRamps();
+    testRampedSegment();
+    return testResult();
+}
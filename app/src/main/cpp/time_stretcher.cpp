@@ -0,0 +1,237 @@
+#include "time_stretcher.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Pitch range searched for the period, in Hz
+static const int32_t MIN_PITCH = 65;
+static const int32_t MAX_PITCH = 400;
+// The coarse AMDF pass runs on audio downsampled to about this rate
+static const int32_t AMDF_FREQ = 4000;
+// Speeds this close to 1.0 copy the input through untouched
+static const float MIN_STRETCH_SPEED = 0.99999f;
+static const float MAX_STRETCH_SPEED = 1.00001f;
+// Input frames written at one speed while following a ramp, about 5 ms at 48 kHz
+static const size_t RAMP_BLOCK_FRAMES = 256;
+
+TimeStretcher::TimeStretcher(int32_t sampleRate, int32_t channels, const StretchKernels& kernels)
+        : kernels(kernels), sampleRate(sampleRate), channels(channels) {
+    minPeriod = std::max(sampleRate / MAX_PITCH, 1);
+    maxPeriod = std::max((size_t) (sampleRate / MIN_PITCH), minPeriod);
+    maxRequired = 2 * maxPeriod;
+    downSampled.resize(maxRequired);
+}
+
+void TimeStretcher::write(const short* frames, size_t count) {
+    size_t needed = (inputFrames + count) * channels;
+    if (input.size() < needed) input.resize(needed);
+    memcpy(input.data() + inputFrames * channels, frames, count * channels * sizeof(short));
+    inputFrames += count;
+    process();
+}
+
+void TimeStretcher::write(const short* frames, size_t count, const TimeWarp& warp, int64_t sourceOffsetUs) {
+    for (size_t done = 0; done < count;) {
+        size_t block = std::min(count - done, RAMP_BLOCK_FRAMES);
+        // Speed at the middle of the block
+        speed = warp.speedAt(sourceOffsetUs + (int64_t) (done + block / 2) * 1000000 / sampleRate);
+        // Near 1x a copy run spans many periods; end one planned at the old
+        // speed where the new speed's would, or the ramp lags behind
+        if (remainingInputToCopy > 0) {
+            size_t copied = copyRun - remainingInputToCopy;
+            size_t run = copyRunFrames(copyPeriod);
+            remainingInputToCopy = run > copied ? std::min(remainingInputToCopy, run - copied) : 0;
+        }
+        write(frames + done * channels, block);
+        done += block;
+    }
+}
+
+size_t TimeStretcher::read(short* out, size_t maxFrames) {
+    size_t frames = std::min(outputFrames, maxFrames);
+    if (frames == 0) return 0;
+    memcpy(out, output.data(), frames * channels * sizeof(short));
+    outputFrames -= frames;
+    memmove(output.data(), output.data() + frames * channels, outputFrames * channels * sizeof(short));
+    return frames;
+}
+
+void TimeStretcher::flush() {
+    size_t expected = outputFrames + (size_t) (inputFrames / speed + 0.5f);
+
+    // Silence lets the last pitch periods of real input be processed
+    size_t padding = 2 * maxRequired;
+    size_t needed = (inputFrames + padding) * channels;
+    if (input.size() < needed) input.resize(needed);
+    std::fill(input.begin() + inputFrames * channels, input.begin() + needed, 0);
+    inputFrames += padding;
+    process();
+
+    outputFrames = std::min(outputFrames, expected);
+    inputFrames = 0;
+    remainingInputToCopy = 0;
+}
+
+void TimeStretcher::process() {
+    if (speed > MIN_STRETCH_SPEED && speed < MAX_STRETCH_SPEED) {
+        memcpy(growOutput(inputFrames), input.data(), inputFrames * channels * sizeof(short));
+        inputFrames = 0;
+        return;
+    }
+    changeSpeed();
+}
+
+void TimeStretcher::changeSpeed() {
+    if (inputFrames < maxRequired) return;
+
+    size_t position = 0;
+    do {
+        if (remainingInputToCopy > 0) {
+            position += copyInputToOutput(position);
+        } else {
+            const short* samples = input.data() + position * channels;
+            size_t period = findPitchPeriod(samples);
+            if (speed > 1.0f) {
+                position += period + skipPitchPeriod(samples, period);
+            } else {
+                position += insertPitchPeriod(samples, period);
+            }
+        }
+    } while (position + maxRequired <= inputFrames);
+
+    inputFrames -= position;
+    memmove(input.data(), input.data() + position * channels, inputFrames * channels * sizeof(short));
+}
+
+size_t TimeStretcher::copyInputToOutput(size_t position) {
+    size_t frames = std::min(remainingInputToCopy, maxRequired);
+    memcpy(growOutput(frames), input.data() + position * channels, frames * channels * sizeof(short));
+    remainingInputToCopy -= frames;
+    return frames;
+}
+
+// Input copied unchanged after each crossfade, so that on average the speed
+// comes out right; none outside [0.5, 2) where crossfades alone do
+size_t TimeStretcher::copyRunFrames(size_t period) const {
+    if (speed > 1.0f && speed < 2.0f) return (size_t) (period * (2.0f - speed) / (speed - 1.0f));
+    if (speed >= 0.5f && speed < 1.0f) return (size_t) (period * (2.0f * speed - 1.0f) / (1.0f - speed));
+    return 0;
+}
+
+// Crossfades one period into the next, dropping a period of input
+size_t TimeStretcher::skipPitchPeriod(const short* samples, size_t period) {
+    size_t frames;
+    if (speed >= 2.0f) {
+        frames = (size_t) (period / (speed - 1.0f));
+    } else {
+        frames = period;
+        remainingInputToCopy = copyRun = copyRunFrames(period);
+        copyPeriod = period;
+    }
+    short* out = growOutput(frames);
+    if (frames > 0) kernels.overlapAdd(out, samples, samples + period * channels, frames, channels);
+    return frames;
+}
+
+// Emits one period, then crossfades back into it, repeating a period of input
+size_t TimeStretcher::insertPitchPeriod(const short* samples, size_t period) {
+    size_t frames;
+    if (speed < 0.5f) {
+        frames = (size_t) (period * speed / (1.0f - speed));
+    } else {
+        frames = period;
+        remainingInputToCopy = copyRun = copyRunFrames(period);
+        copyPeriod = period;
+    }
+    short* out = growOutput(period + frames);
+    memcpy(out, samples, period * channels * sizeof(short));
+    if (frames > 0) {
+        kernels.overlapAdd(out + period * channels, samples + period * channels, samples, frames, channels);
+    }
+    return frames;
+}
+
+// Coarse search on the downsampled mono mix, refined at full rate around the hit
+size_t TimeStretcher::findPitchPeriod(const short* samples) {
+    size_t skip = sampleRate > AMDF_FREQ ? (size_t) (sampleRate / AMDF_FREQ) : 1;
+    uint32_t minDiff;
+    uint32_t maxDiff;
+    size_t period;
+
+    if (channels == 1 && skip == 1) {
+        period = findPitchPeriodInRange(samples, minPeriod, maxPeriod, &minDiff, &maxDiff);
+    } else {
+        downSample(samples, skip);
+        period = findPitchPeriodInRange(downSampled.data(), std::max(minPeriod / skip, (size_t) 1),
+                                        maxPeriod / skip, &minDiff, &maxDiff);
+        if (skip != 1) {
+            period *= skip;
+            size_t lo = period > minPeriod + (skip << 2) ? period - (skip << 2) : minPeriod;
+            size_t hi = std::min(period + (skip << 2), maxPeriod);
+            if (channels == 1) {
+                period = findPitchPeriodInRange(samples, lo, hi, &minDiff, &maxDiff);
+            } else {
+                downSample(samples, 1);
+                period = findPitchPeriodInRange(downSampled.data(), lo, hi, &minDiff, &maxDiff);
+            }
+        }
+    }
+
+    size_t result = prevPeriodBetter(minDiff, maxDiff) ? prevPeriod : period;
+    prevMinDiff = minDiff;
+    prevPeriod = period;
+    return result;
+}
+
+// AMDF: the period whose shifted copy differs least per sample. Also reports
+// the worst match, which tells how clearly periodic the audio is.
+size_t TimeStretcher::findPitchPeriodInRange(const short* samples, size_t lo, size_t hi,
+                                             uint32_t* minDiff, uint32_t* maxDiff) const {
+    size_t bestPeriod = 0;
+    size_t worstPeriod = 255;
+    uint64_t bestDiff = 1;
+    uint64_t worstDiff = 0;
+
+    for (size_t period = lo; period <= hi; period++) {
+        uint64_t diff = kernels.sumAbsDiff(samples, samples + period, period);
+        if (bestPeriod == 0 || diff * bestPeriod < bestDiff * period) {
+            bestDiff = diff;
+            bestPeriod = period;
+        }
+        if (diff * worstPeriod > worstDiff * period) {
+            worstDiff = diff;
+            worstPeriod = period;
+        }
+    }
+    *minDiff = (uint32_t) (bestDiff / bestPeriod);
+    *maxDiff = (uint32_t) (worstDiff / worstPeriod);
+    return bestPeriod;
+}
+
+// Keeps the previous period when the new one is a much weaker match, which
+// avoids audible jumps on noisy or unvoiced audio
+bool TimeStretcher::prevPeriodBetter(uint32_t minDiff, uint32_t maxDiff) const {
+    if (minDiff == 0 || prevPeriod == 0) return false;
+    if (maxDiff > (uint64_t) minDiff * 3) return false;
+    if ((uint64_t) minDiff * 2 <= (uint64_t) prevMinDiff * 3) return false;
+    return true;
+}
+
+// Averages skip frames of every channel into one mono sample
+void TimeStretcher::downSample(const short* samples, size_t skip) {
+    size_t count = maxRequired / skip;
+    size_t perValue = skip * channels;
+    for (size_t i = 0; i < count; i++) {
+        int32_t sum = 0;
+        for (size_t j = 0; j < perValue; j++) sum += *samples++;
+        downSampled[i] = (short) (sum / (int32_t) perValue);
+    }
+}
+
+short* TimeStretcher::growOutput(size_t frames) {
+    size_t needed = (outputFrames + frames) * channels;
+    if (output.size() < needed) output.resize(needed);
+    short* out = output.data() + outputFrames * channels;
+    outputFrames += frames;
+    return out;
+}
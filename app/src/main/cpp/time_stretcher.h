@@ -0,0 +1,72 @@
+#pragma once
+
+#include "stretch_kernels.h"
+#include "time_warp.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pitch-preserving time stretcher for interleaved 16-bit PCM, following the
+// pitch-synchronous overlap-add scheme of the sonic library: find the pitch
+// period by AMDF on a downsampled mono mix, then drop (speed > 1) or repeat
+// (speed < 1) whole periods with a crossfade. The hot loops go through a
+// StretchKernels set, so the SIMD builds stay bit-exact with scalar.
+class TimeStretcher {
+public:
+    TimeStretcher(int32_t sampleRate, int32_t channels, const StretchKernels& kernels = StretchKernels::best());
+
+    void setSpeed(float newSpeed) { speed = newSpeed; }
+    float getSpeed() const { return speed; }
+
+    // Queues count interleaved frames and stretches whatever is ready
+    void write(const short* frames, size_t count);
+    // Same, for frames starting sourceOffsetUs into warp's range: the speed
+    // follows the ramp, set anew for every short block of input
+    void write(const short* frames, size_t count, const TimeWarp& warp, int64_t sourceOffsetUs);
+
+    // Copies up to maxFrames stretched frames to out, returns how many
+    size_t read(short* out, size_t maxFrames);
+
+    // Stretched frames ready to read
+    size_t available() const { return outputFrames; }
+
+    // Stretches the buffered tail, padded with silence and trimmed back to
+    // the expected length, so every written frame reaches the output
+    void flush();
+
+private:
+    void process();
+    void changeSpeed();
+    size_t copyInputToOutput(size_t position);
+    size_t copyRunFrames(size_t period) const;
+    size_t skipPitchPeriod(const short* samples, size_t period);
+    size_t insertPitchPeriod(const short* samples, size_t period);
+    size_t findPitchPeriod(const short* samples);
+    size_t findPitchPeriodInRange(const short* samples, size_t lo, size_t hi,
+                                  uint32_t* minDiff, uint32_t* maxDiff) const;
+    bool prevPeriodBetter(uint32_t minDiff, uint32_t maxDiff) const;
+    void downSample(const short* samples, size_t skip);
+    short* growOutput(size_t frames);
+
+    const StretchKernels& kernels;
+    int32_t sampleRate;
+    int32_t channels;
+    float speed = 1.0f;
+
+    size_t minPeriod;
+    size_t maxPeriod;
+    size_t maxRequired;
+
+    std::vector<short> input;
+    std::vector<short> output;
+    std::vector<short> downSampled;
+    size_t inputFrames = 0;
+    size_t outputFrames = 0;
+    size_t remainingInputToCopy = 0;
+    // Length and pitch period of the copy run remainingInputToCopy counts down
+    size_t copyRun = 0;
+    size_t copyPeriod = 0;
+    size_t prevPeriod = 0;
+    uint32_t prevMinDiff = 0;
+};
@@ -0,0 +1,142 @@
+#include "time_warp.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Source time between table points; fine enough that interpolating linearly
+// between them is off by well under a microsecond for any usable ramp
+static const int64_t WARP_STEP_US = 1000;
+// Table size cap, long ramps get coarser steps instead
+static const int64_t WARP_MAX_STEPS = 1 << 18;
+static const int BEZIER_ITERATIONS = 24;
+
+static float clamp01(float value) {
+    return std::min(std::max(value, 0.0f), 1.0f);
+}
+
+// y on the easing curve at x, found by bisection; x is monotonic in the
+// curve parameter since both handles have x in [0, 1]
+static float bezierEase(float x, float x1, float y1, float x2, float y2) {
+    auto coordinate = [](float p, float a, float b) {
+        float q = 1.0f - p;
+        return 3.0f * q * q * p * a + 3.0f * q * p * p * b + p * p * p;
+    };
+    float lo = 0.0f, hi = 1.0f, p = x;
+    for (int i = 0; i < BEZIER_ITERATIONS; i++) {
+        p = (lo + hi) * 0.5f;
+        if (coordinate(p, x1, x2) < x) {
+            lo = p;
+        } else {
+            hi = p;
+        }
+    }
+    return coordinate(p, y1, y2);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::shared_ptr<const TimeWarp> TimeWarp::build(const std::vector<SpeedKeyframe>& keyframes,
+                                                int64_t sourceStartUs, int64_t sourceEndUs) {
+    if (keyframes.empty() || sourceEndUs <= sourceStartUs) return nullptr;
+
+    std::shared_ptr<TimeWarp> warp(new TimeWarp());
+    for (size_t i = 0; i < keyframes.size(); i++) {
+        const SpeedKeyframe& k = keyframes[i];
+        if (!(k.speed > 0.0f) || !std::isfinite(k.speed) || !std::isfinite(k.time) ||
+            (i > 0 && k.time < keyframes[i - 1].time)) {
+            LOGE("Invalid speed keyframe %zu: %.3fx at %.3f", i, k.speed, k.time);
+            return nullptr;
+        }
+        // Eased speed stays between the two keyframes' speeds
+        warp->keys.push_back({llround((double) k.time * 1000000.0) - sourceStartUs, k.speed, k.interpolation,
+                              clamp01(k.x1), clamp01(k.y1), clamp01(k.x2), clamp01(k.y2)});
+    }
+
+    warp->spanUs = sourceEndUs - sourceStartUs;
+    warp->stepUs = std::max(WARP_STEP_US, (warp->spanUs + WARP_MAX_STEPS - 1) / WARP_MAX_STEPS);
+    size_t points = (size_t) ((warp->spanUs + warp->stepUs - 1) / warp->stepUs) + 1;
+
+    // Simpson's rule over every step; 1 / speed is smooth between keyframes
+    warp->table.resize(points);
+    warp->table[0] = 0;
+    double outputUs = 0;
+    double previous = 1.0 / warp->speedAt(0);
+    for (size_t i = 1; i < points; i++) {
+        int64_t fromUs = warp->pointUs(i - 1);
+        int64_t toUs = warp->pointUs(i);
+        double middle = 1.0 / warp->speedAt((fromUs + toUs) / 2);
+        double next = 1.0 / warp->speedAt(toUs);
+        outputUs += (toUs - fromUs) * (previous + 4.0 * middle + next) / 6.0;
+        previous = next;
+        warp->table[i] = llround(outputUs);
+    }
+
+    uint64_t hash = fnv1a(14695981039346656037ULL, &warp->spanUs, sizeof(warp->spanUs));
+    for (const Key& key : warp->keys) {
+        int32_t interpolation = (int32_t) key.interpolation;
+        hash = fnv1a(hash, &key.offsetUs, sizeof(key.offsetUs));
+        hash = fnv1a(hash, &key.speed, sizeof(key.speed));
+        hash = fnv1a(hash, &interpolation, sizeof(interpolation));
+        if (key.interpolation == SpeedInterpolation::Bezier) {
+            float handles[] = {key.x1, key.y1, key.x2, key.y2};
+            hash = fnv1a(hash, handles, sizeof(handles));
+        }
+    }
+    warp->curveHash = hash;
+
+    LOGI("Speed ramp over %lldus: %zu keyframes, %zu table points, output %lldus", (long long) warp->spanUs,
+         warp->keys.size(), points, (long long) warp->outputDurationUs());
+    return warp;
+}
+
+int64_t TimeWarp::pointUs(size_t index) const {
+    return std::min((int64_t) index * stepUs, spanUs);
+}
+
+int64_t TimeWarp::toOutput(int64_t sourceOffsetUs) const {
+    if (sourceOffsetUs <= 0) return (int64_t) floor(sourceOffsetUs / (double) speedAt(0));
+    if (sourceOffsetUs >= spanUs) {
+        return table.back() + (int64_t) floor((sourceOffsetUs - spanUs) / (double) speedAt(spanUs));
+    }
+    size_t index = (size_t) (sourceOffsetUs / stepUs);
+    int64_t fromUs = pointUs(index);
+    int64_t widthUs = pointUs(index + 1) - fromUs;
+    return table[index] + (table[index + 1] - table[index]) * (sourceOffsetUs - fromUs) / widthUs;
+}
+
+int64_t TimeWarp::toSource(int64_t outputOffsetUs) const {
+    if (outputOffsetUs <= 0) return (int64_t) floor(outputOffsetUs * (double) speedAt(0));
+    if (outputOffsetUs >= table.back()) {
+        return spanUs + (int64_t) floor((outputOffsetUs - table.back()) * (double) speedAt(spanUs));
+    }
+    // First point past outputOffsetUs; the one before it is at or below
+    size_t index = std::upper_bound(table.begin(), table.end(), outputOffsetUs) - table.begin() - 1;
+    int64_t fromUs = pointUs(index);
+    int64_t widthUs = table[index + 1] - table[index];
+    if (widthUs <= 0) return fromUs;
+    return fromUs + (pointUs(index + 1) - fromUs) * (outputOffsetUs - table[index]) / widthUs;
+}
+
+float TimeWarp::speedAt(int64_t sourceOffsetUs) const {
+    // Matches the extrapolation of toOutput() outside the range
+    sourceOffsetUs = std::min(std::max(sourceOffsetUs, (int64_t) 0), spanUs);
+    auto next = std::upper_bound(keys.begin(), keys.end(), sourceOffsetUs,
+                                 [](int64_t us, const Key& key) { return us < key.offsetUs; });
+    if (next == keys.begin()) return keys.front().speed;
+    if (next == keys.end()) return keys.back().speed;
+
+    const Key& from = *(next - 1);
+    float progress = (float) (sourceOffsetUs - from.offsetUs) / (float) (next->offsetUs - from.offsetUs);
+    if (from.interpolation == SpeedInterpolation::Bezier) {
+        progress = bezierEase(progress, from.x1, from.y1, from.x2, from.y2);
+    }
+    return from.speed + (next->speed - from.speed) * progress;
+}
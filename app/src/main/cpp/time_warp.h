@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class SpeedInterpolation : int32_t {
+    Linear = 0,
+    // Eased by the keyframe's cubic Bezier handles
+    Bezier = 1,
+};
+
+// Keyframe of a speed ramp, in source seconds like Segment. Speed before the
+// first keyframe and after the last one stays at theirs.
+struct SpeedKeyframe {
+    float time;
+    float speed;
+    // How speed moves on to the next keyframe
+    SpeedInterpolation interpolation = SpeedInterpolation::Linear;
+    // Bezier easing as in CSS cubic-bezier(x1, y1, x2, y2): progress in time
+    // on x, progress from this speed to the next on y
+    float x1 = 0.42f;
+    float y1 = 0.0f;
+    float x2 = 0.58f;
+    float y2 = 1.0f;
+};
+
+// A speed ramp over one segment, compiled once into a table of the output
+// time reached at every step of source time: the integral of 1 / speed. The
+// table is dense enough to interpolate linearly, so remapping a sample is one
+// lookup either way, and it is the single place output times come from, so
+// video and audio agree on where every source instant lands.
+//
+// Offsets are relative to the segment's source and output starts. Outside
+// the range the mapping carries on at the speed of its end.
+class TimeWarp {
+public:
+    // nullptr for speeds that are not positive and finite, or keyframe times
+    // out of order
+    static std::shared_ptr<const TimeWarp> build(const std::vector<SpeedKeyframe>& keyframes,
+                                                 int64_t sourceStartUs, int64_t sourceEndUs);
+
+    int64_t sourceDurationUs() const { return spanUs; }
+    int64_t outputDurationUs() const { return table.back(); }
+    size_t tableSize() const { return table.size(); }
+
+    int64_t toOutput(int64_t sourceOffsetUs) const;
+    int64_t toSource(int64_t outputOffsetUs) const;
+
+    // The curve itself, not the table, for the time stretchers
+    float speedAt(int64_t sourceOffsetUs) const;
+
+    // Identifies the curve over the segment, for cache keys
+    uint64_t hash() const { return curveHash; }
+
+private:
+    struct Key {
+        int64_t offsetUs;
+        float speed;
+        SpeedInterpolation interpolation;
+        float x1, y1, x2, y2;
+    };
+
+    int64_t pointUs(size_t index) const;
+
+    std::vector<Key> keys;
+    int64_t spanUs = 0;
+    int64_t stepUs = 0;
+    // Output offset at source offsets 0, stepUs, 2 * stepUs, ... and spanUs last
+    std::vector<int64_t> table;
+    uint64_t curveHash = 0;
+};
@@ -1,561 +1,455 @@
 #include <jni.h>
-#include <android/log.h>
-#include <media/NdkMediaExtractor.h>
-#include <media/NdkMediaCodec.h>
-#include <media/NdkMediaMuxer.h>
-#include "sonic/sonic.h"
+#include <android/native_window_jni.h>
+#include "codec_pool.h"
+#include "editor_log.h"
+#include "job_engine.h"
+#include "ndk_media_backend.h"
+#include "opensl_audio_sink.h"
+#include "preview_engine.h"
+#include "sample_index.h"
+#include "segment_render_cache.h"
+#include "speed_pipeline.h"
+#include "waveform_peaks.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
-#include <asm-generic/fcntl.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/stat.h>
-
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, "VideoSpeed", __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "VideoSpeed", __VA_ARGS__)
-
-struct Segment {
-    float start;
-    float end;
-    float speed;
-};
 
-static inline int64_t secToUs(float s) {
-    return (int64_t) (s * 1000000.0f);
+// One engine per process, created by initJobEngine() or on first use
+static NdkMediaBackend backend;
+// Audio codecs stay warm between exports; sized by initCodecPool()
+static CodecPool codecPool(backend);
+static std::mutex engineMutex;
+static std::unique_ptr<JobEngine> engine;
+// Set once by initSampleIndexCache(), then shared by every export
+static std::unique_ptr<SampleIndexCache> indexCache;
+// Set once by initRenderCache()
+static std::unique_ptr<SegmentRenderCache> renderCache;
+// Set once by initWaveformCache(); its peaks back the buffers getWaveform() returns
+static std::unique_ptr<WaveformPeakCache> peakCache;
+
+static JobEngine& jobEngine(size_t workers = 1) {
+    std::lock_guard<std::mutex> lock(engineMutex);
+    if (!engine) engine = std::make_unique<JobEngine>(codecPool, workers);
+    return *engine;
 }
 
-extern "C"
-JNIEXPORT jint JNICALL
-Java_com_luongtd14_speedapplication_activities_EditActivity_processVideo(
-        JNIEnv *env, jclass clazz,
-        jstring jInput,
-        jstring jOutput,
-        jfloatArray jStarts,
-        jfloatArray jEnds,
-        jfloatArray jSpeeds) {
-
-    const char* inputPath = env->GetStringUTFChars(jInput, nullptr);
-    const char* outputPath = env->GetStringUTFChars(jOutput, nullptr);
-
-    AMediaExtractor* extractor = nullptr;
-    AMediaCodec* audioDecoder = nullptr;
-    AMediaCodec* audioEncoder = nullptr;
-    AMediaMuxer* muxer = nullptr;
-    sonicStream sonic = nullptr;
-    AMediaFormat* audioFormat = nullptr;
-    AMediaFormat* videoFormat = nullptr;
-
-    int result = -1;
-
-    LOGI("Starting video processing with segments: %s -> %s", inputPath, outputPath);
-
-    do {
-        // Process segments data
-        jsize n = env->GetArrayLength(jStarts);
-        std::vector<Segment> segments(n);
-        jfloat *starts = env->GetFloatArrayElements(jStarts, nullptr);
-        jfloat *ends   = env->GetFloatArrayElements(jEnds, nullptr);
-        jfloat *speeds = env->GetFloatArrayElements(jSpeeds, nullptr);
-
-        for (int i = 0; i < n; i++) {
-            segments[i] = {starts[i], ends[i], speeds[i]};
-            LOGI("Segment %d: %.2f -> %.2f speed %.2f", i, starts[i], ends[i], speeds[i]);
-        }
-
-        env->ReleaseFloatArrayElements(jStarts, starts, 0);
-        env->ReleaseFloatArrayElements(jEnds, ends, 0);
-        env->ReleaseFloatArrayElements(jSpeeds, speeds, 0);
+static SampleIndexCache* sampleIndexCache() {
+    std::lock_guard<std::mutex> lock(engineMutex);
+    return indexCache.get();
+}
 
-        // Create extractor
-        extractor = AMediaExtractor_new();
-        if (!extractor) {
-            LOGE("Failed to create media extractor");
-            break;
-        }
+static SegmentRenderCache* segmentRenderCache() {
+    std::lock_guard<std::mutex> lock(engineMutex);
+    return renderCache.get();
+}
 
-        // Open input file
-        int inputFd = open(inputPath, O_RDONLY);
-        if (inputFd < 0) {
-            LOGE("Cannot open input file: %s, error: %s", inputPath, strerror(errno));
-            break;
-        }
+static WaveformPeakCache* waveformPeakCache() {
+    std::lock_guard<std::mutex> lock(engineMutex);
+    return peakCache.get();
+}
 
-        // Get file size
-        off_t fileSize = lseek(inputFd, 0, SEEK_END);
-        lseek(inputFd, 0, SEEK_SET);
-        media_status_t status = AMediaExtractor_setDataSourceFd(extractor, inputFd, 0, fileSize);
-        if (status != AMEDIA_OK) {
-            LOGE("Failed to set data source for extractor, status: %d", status);
-            break;
-        }
+// Must match RAMP_* in EditActivity: ramp keyframes come flattened, one
+// stride per keyframe, as segment index, time, speed, interpolation and the
+// four Bezier handles
+static const jsize RAMP_KEYFRAME_STRIDE = 8;
+
+static std::vector<Segment> readSegments(JNIEnv *env, jfloatArray jStarts, jfloatArray jEnds,
+                                         jfloatArray jSpeeds, jfloatArray jRamps) {
+    jsize n = env->GetArrayLength(jStarts);
+    std::vector<Segment> segments(n);
+    jfloat *starts = env->GetFloatArrayElements(jStarts, nullptr);
+    jfloat *ends   = env->GetFloatArrayElements(jEnds, nullptr);
+    jfloat *speeds = env->GetFloatArrayElements(jSpeeds, nullptr);
+
+    for (int i = 0; i < n; i++) {
+        segments[i] = {starts[i], ends[i], speeds[i]};
+        LOGI("Segment %d: %.2f -> %.2f speed %.2f", i, starts[i], ends[i], speeds[i]);
+    }
 
-        // Find tracks
-        int trackCount = AMediaExtractor_getTrackCount(extractor);
-        int audioTrack = -1, videoTrack = -1;
-
-        for (int i = 0; i < trackCount; i++) {
-            AMediaFormat* fmt = AMediaExtractor_getTrackFormat(extractor, i);
-            const char* mime;
-            if (AMediaFormat_getString(fmt, AMEDIAFORMAT_KEY_MIME, &mime)) {
-                if (strstr(mime, "audio/")) {
-                    audioTrack = i;
-                    audioFormat = fmt;
-                    LOGI("Found audio track: %d", i);
-                } else if (strstr(mime, "video/")) {
-                    videoTrack = i;
-                    videoFormat = fmt;
-                    LOGI("Found video track: %d", i);
-                } else {
-                    AMediaFormat_delete(fmt);
-                }
-            } else {
-                AMediaFormat_delete(fmt);
+    env->ReleaseFloatArrayElements(jStarts, starts, JNI_ABORT);
+    env->ReleaseFloatArrayElements(jEnds, ends, JNI_ABORT);
+    env->ReleaseFloatArrayElements(jSpeeds, speeds, JNI_ABORT);
+
+    // Keyframes of one segment come in time order
+    jsize rampValues = jRamps ? env->GetArrayLength(jRamps) : 0;
+    if (rampValues >= RAMP_KEYFRAME_STRIDE) {
+        jfloat *ramps = env->GetFloatArrayElements(jRamps, nullptr);
+        for (jsize i = 0; i + RAMP_KEYFRAME_STRIDE <= rampValues; i += RAMP_KEYFRAME_STRIDE) {
+            const jfloat *k = ramps + i;
+            int segment = (int) k[0];
+            if (segment < 0 || segment >= n) {
+                LOGE("Speed keyframe for unknown segment %d", segment);
+                continue;
             }
+            SpeedInterpolation interpolation = k[3] == (jfloat) SpeedInterpolation::Bezier
+                                               ? SpeedInterpolation::Bezier : SpeedInterpolation::Linear;
+            segments[segment].ramp.push_back({k[1], k[2], interpolation, k[4], k[5], k[6], k[7]});
         }
-
-        if (videoTrack < 0) {
-            LOGE("No video track found");
-            break;
-        }
-
-        int fd = open(outputPath, O_CREAT | O_RDWR, 0644);
-        if (fd < 0) {
-            LOGE("Cannot open output file: %s", outputPath);
-        }
-        // Create muxer
-        muxer = AMediaMuxer_new(fd, AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
-        if (!muxer) {
-            LOGE("Failed to create media muxer");
-            break;
-        }
-
-        // Add video track
-        size_t videoTrackIndex = AMediaMuxer_addTrack(muxer, videoFormat);
-        LOGI("Added video track to muxer with index: %zu", videoTrackIndex);
-
-        size_t audioTrackIndex = (size_t)-1;
-
-        // Setup audio if available
-        if (audioTrack >= 0) {
-            int sampleRate, channels;
-            AMediaFormat_getInt32(audioFormat, AMEDIAFORMAT_KEY_SAMPLE_RATE, &sampleRate);
-            AMediaFormat_getInt32(audioFormat, AMEDIAFORMAT_KEY_CHANNEL_COUNT, &channels);
-
-            LOGI("Audio config: sampleRate=%d, channels=%d", sampleRate, channels);
-
-            // Create encoder format
-            AMediaFormat* encoderFormat = AMediaFormat_new();
-            AMediaFormat_setString(encoderFormat, AMEDIAFORMAT_KEY_MIME, "audio/mp4a-latm");
-            AMediaFormat_setInt32(encoderFormat, AMEDIAFORMAT_KEY_SAMPLE_RATE, sampleRate);
-            AMediaFormat_setInt32(encoderFormat, AMEDIAFORMAT_KEY_CHANNEL_COUNT, channels);
-            AMediaFormat_setInt32(encoderFormat, AMEDIAFORMAT_KEY_BIT_RATE, 128000);
-            AMediaFormat_setInt32(encoderFormat, AMEDIAFORMAT_KEY_AAC_PROFILE, 2);
-
-            // Create audio encoder
-            audioEncoder = AMediaCodec_createEncoderByType("audio/mp4a-latm");
-            if (!audioEncoder) {
-                LOGE("Failed to create audio encoder");
-                AMediaFormat_delete(encoderFormat);
-                break;
-            }
-
-            status = AMediaCodec_configure(audioEncoder, encoderFormat, nullptr, nullptr,
-                                           AMEDIACODEC_CONFIGURE_FLAG_ENCODE);
-            AMediaFormat_delete(encoderFormat);
-
-            if (status != AMEDIA_OK) {
-                LOGE("Failed to configure audio encoder, status: %d", status);
-                break;
-            }
-
-            status = AMediaCodec_start(audioEncoder);
-            if (status != AMEDIA_OK) {
-                LOGE("Failed to start audio encoder, status: %d", status);
-                break;
-            }
-
-            // Get encoder output format and add to muxer
-            AMediaFormat* outputFormat = AMediaCodec_getOutputFormat(audioEncoder);
-            if (outputFormat) {
-                audioTrackIndex = AMediaMuxer_addTrack(muxer, outputFormat);
-                LOGI("Added audio track to muxer with index: %zu", audioTrackIndex);
-                AMediaFormat_delete(outputFormat);
-            } else {
-                LOGE("Failed to get encoder output format");
-                break;
-            }
-
-            // Create sonic stream
-            sonic = sonicCreateStream(sampleRate, channels);
-            if (!sonic) {
-                LOGE("Failed to create sonic stream");
-                break;
-            }
-            sonicSetPitch(sonic, 1.0f);
-            LOGI("Sonic stream created for segment-based processing");
+        env->ReleaseFloatArrayElements(jRamps, ramps, JNI_ABORT);
+        for (int i = 0; i < n; i++) {
+            if (!segments[i].ramp.empty()) LOGI("Segment %d: speed ramp of %zu keyframes", i, segments[i].ramp.size());
         }
+    }
+    return segments;
+}
 
-        // Start muxer
-        status = AMediaMuxer_start(muxer);
-        if (status != AMEDIA_OK) {
-            LOGE("Failed to start muxer, status: %d", status);
-            break;
-        }
-        LOGI("Muxer started successfully");
-
-        // ===== VIDEO PROCESSING WITH SEGMENTS =====
-        LOGI("Processing video track with segments...");
-        AMediaExtractor_selectTrack(extractor, videoTrack);
-
-        int videoSampleCount = 0;
-        bool videoEOS = false;
-        int currentSegment = 0;
-        int64_t outputPts = 0;
-
-        // Process video segments
-        while (!videoEOS && currentSegment < segments.size()) {
-            Segment& segment = segments[currentSegment];
-            LOGI("Processing video segment %d: %.2fs-%.2fs at speed %.2fx",
-                 currentSegment, segment.start, segment.end, segment.speed);
-
-            // Seek to segment start
-            int64_t segmentStartUs = secToUs(segment.start);
-            int64_t segmentEndUs = secToUs(segment.end);
-
-            status = AMediaExtractor_seekTo(extractor, segmentStartUs, AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC);
-            if (status != AMEDIA_OK) {
-                LOGE("Failed to seek to segment start: %lld", (long long)segmentStartUs);
-                break;
-            }
+// Must match OUTPUT_* in EditActivity
+static const jint OUTPUT_FRAGMENTED = 1;
+static const jint OUTPUT_FASTSTART = 2;
+// Each audio worker holds a decoder of its own, so a few go a long way
+static const size_t MAX_AUDIO_WORKERS = 4;
 
-            bool segmentComplete = false;
-            int segmentSampleCount = 0;
-
-            while (!videoEOS && !segmentComplete && segmentSampleCount < 10000) {
-                const size_t BUFFER_SIZE = 1024 * 1024;
-                uint8_t* buffer = new uint8_t[BUFFER_SIZE];
-
-                ssize_t sampleSize = AMediaExtractor_readSampleData(extractor, buffer, BUFFER_SIZE);
-                if (sampleSize < 0) {
-                    videoEOS = true;
-                    delete[] buffer;
-                    break;
-                }
-
-                int64_t pts = AMediaExtractor_getSampleTime(extractor);
-                uint32_t flags = AMediaExtractor_getSampleFlags(extractor);
-
-                // Check if we've reached the end of this segment
-                if (pts >= segmentEndUs) {
-                    segmentComplete = true;
-                    delete[] buffer;
-                    AMediaExtractor_advance(extractor); // Move to next sample for next segment
-                    break;
-                }
-
-                // Calculate output PTS based on speed
-                int64_t segmentRelativePts = pts - segmentStartUs;
-                int64_t speedAdjustedPts = (int64_t)(segmentRelativePts / segment.speed);
-                int64_t finalPts = outputPts + speedAdjustedPts;
-
-                AMediaCodecBufferInfo info;
-                info.offset = 0;
-                info.size = sampleSize;
-                info.presentationTimeUs = finalPts;
-                info.flags = flags;
-
-                status = AMediaMuxer_writeSampleData(muxer, videoTrackIndex, buffer, &info);
-                delete[] buffer; // Delete immediately after use
-
-                if (status != AMEDIA_OK) {
-                    LOGE("Failed to write video sample, status: %d", status);
-                    break;
-                }
-
-                AMediaExtractor_advance(extractor);
-                videoSampleCount++;
-                segmentSampleCount++;
-
-                if (segmentSampleCount % 100 == 0) {
-                    LOGI("Segment %d: processed %d samples, PTS: %lld -> %lld",
-                         currentSegment, segmentSampleCount, (long long)pts, (long long)finalPts);
-                }
-            }
+// The cores left to each of the exports the engine runs side by side
+static size_t audioWorkerCount() {
+    size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    return std::min(std::max(cores / jobEngine().workers(), (size_t) 1), MAX_AUDIO_WORKERS);
+}
 
-            // Update output PTS for next segment
-            int64_t segmentDuration = segmentEndUs - segmentStartUs;
-            outputPts += (int64_t)(segmentDuration / segment.speed);
+static JobRequest readRequest(JNIEnv *env, jstring jInput, jstring jOutput,
+                              jfloatArray jStarts, jfloatArray jEnds, jfloatArray jSpeeds,
+                              jfloatArray jRamps, jint outputFlags) {
+    JobRequest request;
 
-            LOGI("Completed video segment %d: %d samples, duration: %lldus -> %lldus",
-                 currentSegment, segmentSampleCount, (long long)segmentDuration,
-                 (long long)(segmentDuration / segment.speed));
+    const char* inputPath = env->GetStringUTFChars(jInput, nullptr);
+    const char* outputPath = env->GetStringUTFChars(jOutput, nullptr);
+    request.inputPath = inputPath;
+    request.outputPath = outputPath;
+    env->ReleaseStringUTFChars(jInput, inputPath);
+    env->ReleaseStringUTFChars(jOutput, outputPath);
 
-            currentSegment++;
-        }
+    request.segments = readSegments(env, jStarts, jEnds, jSpeeds, jRamps);
+    request.options.indexCache = sampleIndexCache();
+    request.options.renderCache = segmentRenderCache();
+    request.options.peakCache = waveformPeakCache();
+    request.options.audioWorkers = audioWorkerCount();
+    request.options.fragmentedOutput = (outputFlags & OUTPUT_FRAGMENTED) != 0;
+    request.options.faststart = (outputFlags & OUTPUT_FASTSTART) != 0;
+    return request;
+}
 
-        LOGI("Video track completed: %d samples across %zu segments, total output duration: %lldus",
-             videoSampleCount, segments.size(), (long long)outputPts);
+// A preview handle owns its engine, sink and window; the engine goes first
+struct Preview {
+    ANativeWindow* window = nullptr;
+    std::unique_ptr<OpenSlAudioSink> sink;
+    std::unique_ptr<PreviewEngine> engine;
 
-        // If no audio track, we're done
-        if (audioTrack < 0) {
-            LOGI("No audio track, video-only output created");
-            result = 0;
-            break;
-        }
+    ~Preview() {
+        engine.reset();
+        sink.reset();
+        if (window) ANativeWindow_release(window);
+    }
+};
 
-        // ===== SIMPLIFIED AUDIO PROCESSING =====
-        // Instead of complex segment-based audio processing, we'll use a simpler approach:
-        // Process the entire audio track but apply speed changes in real-time based on video PTS
+static Preview* preview(jlong handle) {
+    return reinterpret_cast<Preview*>(handle);
+}
 
-        LOGI("Processing audio track with dynamic speed adjustment...");
-        AMediaExtractor_selectTrack(extractor, audioTrack);
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_initJobEngine(
+        JNIEnv *env, jclass clazz, jint maxConcurrentJobs) {
+    return (jint) jobEngine(maxConcurrentJobs > 0 ? maxConcurrentJobs : 1).workers();
+}
 
-        int sampleRate, channels;
-        AMediaFormat_getInt32(audioFormat, AMEDIAFORMAT_KEY_SAMPLE_RATE, &sampleRate);
-        AMediaFormat_getInt32(audioFormat, AMEDIAFORMAT_KEY_CHANNEL_COUNT, &channels);
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_initCodecPool(
+        JNIEnv *env, jclass clazz, jint maxDecoders, jint maxEncoders, jlong idleTimeoutMs) {
+    codecPool.setLimits((size_t) std::max(maxDecoders, 1), (size_t) std::max(maxEncoders, 1),
+                        (int64_t) idleTimeoutMs * 1000);
+}
 
-        const char* audioMime;
-        AMediaFormat_getString(audioFormat, AMEDIAFORMAT_KEY_MIME, &audioMime);
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_trimCodecPool(
+        JNIEnv *env, jclass clazz) {
+    codecPool.trim();
+}
 
-        // Create audio decoder
-        audioDecoder = AMediaCodec_createDecoderByType(audioMime);
-        if (!audioDecoder) {
-            LOGE("Failed to create audio decoder");
-            break;
-        }
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_initSampleIndexCache(
+        JNIEnv *env, jclass clazz, jstring jDirectory) {
+    const char* directory = env->GetStringUTFChars(jDirectory, nullptr);
+    std::lock_guard<std::mutex> lock(engineMutex);
+    if (!indexCache) indexCache = std::make_unique<SampleIndexCache>(directory);
+    env->ReleaseStringUTFChars(jDirectory, directory);
+}
 
-        status = AMediaCodec_configure(audioDecoder, audioFormat, nullptr, nullptr, 0);
-        if (status != AMEDIA_OK) {
-            LOGE("Failed to configure audio decoder, status: %d", status);
-            break;
-        }
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_initRenderCache(
+        JNIEnv *env, jclass clazz, jstring jDirectory, jlong maxBytes) {
+    const char* directory = env->GetStringUTFChars(jDirectory, nullptr);
+    std::lock_guard<std::mutex> lock(engineMutex);
+    if (!renderCache) renderCache = std::make_unique<SegmentRenderCache>(directory, (uint64_t) maxBytes);
+    env->ReleaseStringUTFChars(jDirectory, directory);
+}
 
-        status = AMediaCodec_start(audioDecoder);
-        if (status != AMEDIA_OK) {
-            LOGE("Failed to start audio decoder, status: %d", status);
-            break;
-        }
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_initWaveformCache(
+        JNIEnv *env, jclass clazz, jstring jDirectory) {
+    const char* directory = env->GetStringUTFChars(jDirectory, nullptr);
+    std::lock_guard<std::mutex> lock(engineMutex);
+    if (!peakCache) peakCache = std::make_unique<WaveformPeakCache>(directory);
+    env->ReleaseStringUTFChars(jDirectory, directory);
+}
 
-        // Audio processing state
-        bool audioEOS = false;
-        bool decoderEOS = false;
-        int64_t currentPts = 0;
-        int audioSampleCount = 0;
-        int currentAudioSegment = 0;
-
-        const int PCM_BUFFER_SIZE = 4096;
-        std::vector<short> pcmBuffer(PCM_BUFFER_SIZE * channels);
-        std::vector<short> processedBuffer(PCM_BUFFER_SIZE * channels * 4);
-
-        // Process entire audio track, adjusting speed based on current time
-        while (!audioEOS) {
-            // Feed data to decoder
-            if (!decoderEOS) {
-                ssize_t inIndex = AMediaCodec_dequeueInputBuffer(audioDecoder, 10000);
-                if (inIndex >= 0) {
-                    size_t bufSize;
-                    uint8_t* buf = AMediaCodec_getInputBuffer(audioDecoder, inIndex, &bufSize);
-                    if (buf) {
-                        ssize_t sampleSize = AMediaExtractor_readSampleData(extractor, buf, bufSize);
-                        if (sampleSize < 0) {
-                            decoderEOS = true;
-                            AMediaCodec_queueInputBuffer(audioDecoder, inIndex, 0, 0, 0,
-                                                         AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
-                            LOGI("Sent EOS to audio decoder");
-                        } else {
-                            int64_t pts = AMediaExtractor_getSampleTime(extractor);
-                            AMediaCodec_queueInputBuffer(audioDecoder, inIndex, 0, sampleSize, pts, 0);
-                            AMediaExtractor_advance(extractor);
-                        }
-                    }
-                }
-            }
+// The source's peak file image as a direct buffer, without a copy. The cache
+// keeps every image it hands out, so the buffer stays valid for the process.
+// Without decode only peaks computed before are returned.
+extern "C"
+JNIEXPORT jobject JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_getWaveform(
+        JNIEnv *env, jclass clazz, jstring jInput, jboolean decode) {
+    WaveformPeakCache* cache = waveformPeakCache();
+    if (!cache) return nullptr;
+    const char* inputPath = env->GetStringUTFChars(jInput, nullptr);
+    std::shared_ptr<const WaveformPeaks> peaks = decode ? cache->get(codecPool, inputPath) : cache->find(inputPath);
+    env->ReleaseStringUTFChars(jInput, inputPath);
+    if (!peaks) return nullptr;
+    return env->NewDirectByteBuffer(const_cast<uint8_t*>(peaks->data()), (jlong) peaks->size());
+}
 
-            // Process decoder output
-            AMediaCodecBufferInfo decInfo;
-            ssize_t outIndex = AMediaCodec_dequeueOutputBuffer(audioDecoder, &decInfo, 10000);
-
-            if (outIndex >= 0) {
-                if (decInfo.size > 0) {
-                    size_t outSize;
-                    uint8_t* outBuf = AMediaCodec_getOutputBuffer(audioDecoder, outIndex, &outSize);
-                    if (outBuf) {
-                        // Determine current speed based on audio PTS
-                        float currentSpeed = 1.0f;
-                        for (int i = 0; i < segments.size(); i++) {
-                            int64_t segmentStartUs = secToUs(segments[i].start);
-                            int64_t segmentEndUs = secToUs(segments[i].end);
-                            if (decInfo.presentationTimeUs >= segmentStartUs && decInfo.presentationTimeUs < segmentEndUs) {
-                                currentSpeed = segments[i].speed;
-                                if (i != currentAudioSegment) {
-                                    currentAudioSegment = i;
-                                    LOGI("Audio switched to segment %d: speed %.2fx at PTS %lld",
-                                         i, currentSpeed, (long long)decInfo.presentationTimeUs);
-                                }
-                                break;
-                            }
-                        }
-
-                        // Set sonic speed
-                        sonicSetSpeed(sonic, currentSpeed);
-
-                        // Process with sonic
-                        int sampleCount = decInfo.size / (channels * sizeof(short));
-                        sonicWriteShortToStream(sonic, reinterpret_cast<short*>(outBuf), sampleCount);
-
-                        // Read processed data
-                        int totalProcessed = 0;
-                        while (true) {
-                            int read = sonicReadShortFromStream(sonic,
-                                                                processedBuffer.data() + totalProcessed,
-                                                                (processedBuffer.size() - totalProcessed) / channels);
-                            if (read <= 0) break;
-                            totalProcessed += read * channels;
-                        }
-
-                        // Send to encoder
-                        if (totalProcessed > 0) {
-                            ssize_t encInIndex = AMediaCodec_dequeueInputBuffer(audioEncoder, 10000);
-                            if (encInIndex >= 0) {
-                                size_t encSize;
-                                uint8_t* encBuf = AMediaCodec_getInputBuffer(audioEncoder, encInIndex, &encSize);
-                                if (encBuf) {
-                                    size_t bytesToCopy = totalProcessed * sizeof(short);
-                                    if (bytesToCopy > encSize) {
-                                        bytesToCopy = encSize;
-                                    }
-                                    memcpy(encBuf, processedBuffer.data(), bytesToCopy);
-
-                                    int samplesCopied = bytesToCopy / (channels * sizeof(short));
-                                    AMediaCodec_queueInputBuffer(audioEncoder, encInIndex, 0,
-                                                                 bytesToCopy, currentPts, 0);
-                                    currentPts += (int64_t)((1000000LL * samplesCopied) / sampleRate);
-                                }
-                            }
-                        }
-                    }
-                }
-
-                AMediaCodec_releaseOutputBuffer(audioDecoder, outIndex, false);
-
-                if (decInfo.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
-                    LOGI("Audio decoder output EOS");
-                    // Flush sonic stream
-                    sonicFlushStream(sonic);
-                    int totalProcessed = 0;
-                    while (true) {
-                        int read = sonicReadShortFromStream(sonic,
-                                                            processedBuffer.data() + totalProcessed,
-                                                            (processedBuffer.size() - totalProcessed) / channels);
-                        if (read <= 0) break;
-                        totalProcessed += read * channels;
-                    }
-
-                    // Send remaining processed data
-                    if (totalProcessed > 0) {
-                        ssize_t encInIndex = AMediaCodec_dequeueInputBuffer(audioEncoder, 10000);
-                        if (encInIndex >= 0) {
-                            size_t encSize;
-                            uint8_t* encBuf = AMediaCodec_getInputBuffer(audioEncoder, encInIndex, &encSize);
-                            if (encBuf) {
-                                size_t bytesToCopy = std::min(totalProcessed * sizeof(short), encSize);
-                                memcpy(encBuf, processedBuffer.data(), bytesToCopy);
-                                AMediaCodec_queueInputBuffer(audioEncoder, encInIndex, 0,
-                                                             bytesToCopy, currentPts, 0);
-                            }
-                        }
-                    }
-
-                    // Send EOS to encoder
-                    ssize_t encInIndex = AMediaCodec_dequeueInputBuffer(audioEncoder, 10000);
-                    if (encInIndex >= 0) {
-                        AMediaCodec_queueInputBuffer(audioEncoder, encInIndex, 0, 0, currentPts,
-                                                     AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
-                        LOGI("Sent EOS to audio encoder");
-                    }
-                }
+// Indexes the source on first use; null without a cache or on failure
+static std::shared_ptr<const SampleIndex> sourceIndex(JNIEnv *env, jstring jInput, int* videoTrack,
+                                                      int* audioTrack, int64_t* durationUs) {
+    SampleIndexCache* cache = sampleIndexCache();
+    if (!cache) return nullptr;
+    const char* inputPath = env->GetStringUTFChars(jInput, nullptr);
+    std::shared_ptr<const SampleIndex> index = cache->get(backend, inputPath);
+    *videoTrack = *audioTrack = -1;
+    *durationUs = -1;
+    if (std::unique_ptr<MediaExtractor> extractor = backend.createExtractor(inputPath)) {
+        for (size_t i = 0; i < extractor->getTrackCount(); i++) {
+            std::unique_ptr<MediaFormat> format = extractor->getTrackFormat(i);
+            std::string mime;
+            if (!format || !format->getString(MEDIA_KEY_MIME, &mime)) continue;
+            if (*videoTrack < 0 && mime.compare(0, 6, "video/") == 0) {
+                *videoTrack = (int) i;
+                format->getInt64(MEDIA_KEY_DURATION, durationUs);
+            } else if (*audioTrack < 0 && mime.compare(0, 6, "audio/") == 0) {
+                *audioTrack = (int) i;
             }
+        }
+    }
+    env->ReleaseStringUTFChars(jInput, inputPath);
+    return *videoTrack >= 0 ? index : nullptr;
+}
 
-            // Process encoder output
-            AMediaCodecBufferInfo encInfo;
-            ssize_t encOutIndex = AMediaCodec_dequeueOutputBuffer(audioEncoder, &encInfo, 0);
-            while (encOutIndex >= 0) {
-                size_t encOutSize;
-                uint8_t* encBuf = AMediaCodec_getOutputBuffer(audioEncoder, encOutIndex, &encOutSize);
-
-                if (encBuf && (encInfo.size > 0)) {
-                    AMediaMuxer_writeSampleData(muxer, audioTrackIndex, encBuf, &encInfo);
-                    audioSampleCount++;
-                }
+// Output duration in us, video frames, video bytes and audio bytes of an
+// export, from the source index; null if the source cannot be indexed
+extern "C"
+JNIEXPORT jlongArray JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_estimateExport(
+        JNIEnv *env, jclass clazz,
+        jstring jInput,
+        jfloatArray jStarts,
+        jfloatArray jEnds,
+        jfloatArray jSpeeds,
+        jfloatArray jRamps) {
+    int videoTrack, audioTrack;
+    int64_t durationUs;
+    std::shared_ptr<const SampleIndex> index = sourceIndex(env, jInput, &videoTrack, &audioTrack, &durationUs);
+    SegmentTimeline timeline;
+    if (!index || !timeline.compile(readSegments(env, jStarts, jEnds, jSpeeds, jRamps), durationUs)) return nullptr;
+
+    SampleIndex::Estimate estimate = index->estimate(timeline, videoTrack, audioTrack);
+    jlong values[] = {estimate.durationUs, estimate.videoFrames, estimate.videoBytes, estimate.audioBytes};
+    jlongArray result = env->NewLongArray(4);
+    if (result) env->SetLongArrayRegion(result, 0, 4, values);
+    return result;
+}
 
-                AMediaCodec_releaseOutputBuffer(audioEncoder, encOutIndex, false);
+// Segments with their boundaries moved to the nearest video keyframe,
+// flattened as start, end, speed and the index of the segment passed in, so
+// ramp keyframes can be carried over; null if the source cannot be indexed
+extern "C"
+JNIEXPORT jfloatArray JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_snapToKeyframes(
+        JNIEnv *env, jclass clazz,
+        jstring jInput,
+        jfloatArray jStarts,
+        jfloatArray jEnds,
+        jfloatArray jSpeeds,
+        jfloatArray jRamps) {
+    int videoTrack, audioTrack;
+    int64_t durationUs;
+    std::shared_ptr<const SampleIndex> index = sourceIndex(env, jInput, &videoTrack, &audioTrack, &durationUs);
+    if (!index) return nullptr;
+
+    std::vector<size_t> origins;
+    std::vector<Segment> snapped = snapSegmentsToKeyframes(*index, videoTrack,
+                                                           readSegments(env, jStarts, jEnds, jSpeeds, jRamps),
+                                                           &origins);
+    std::vector<jfloat> values;
+    for (size_t i = 0; i < snapped.size(); i++) {
+        values.insert(values.end(), {snapped[i].start, snapped[i].end, snapped[i].speed, (jfloat) origins[i]});
+    }
+    jfloatArray result = env->NewFloatArray((jsize) values.size());
+    if (result) env->SetFloatArrayRegion(result, 0, (jsize) values.size(), values.data());
+    return result;
+}
 
-                if (encInfo.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
-                    LOGI("Audio encoder output EOS");
-                    audioEOS = true;
-                }
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_submitJob(
+        JNIEnv *env, jclass clazz,
+        jstring jInput,
+        jstring jOutput,
+        jfloatArray jStarts,
+        jfloatArray jEnds,
+        jfloatArray jSpeeds,
+        jfloatArray jRamps,
+        jint outputFlags) {
+    return jobEngine().submit(readRequest(env, jInput, jOutput, jStarts, jEnds, jSpeeds, jRamps, outputFlags));
+}
 
-                encOutIndex = AMediaCodec_dequeueOutputBuffer(audioEncoder, &encInfo, 0);
-            }
+// Returns the job state and writes its progress (0..1) to progress[0]; -1 for an unknown job
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_pollJob(
+        JNIEnv *env, jclass clazz, jlong jobId, jfloatArray jProgress) {
+    JobStatus status;
+    if (!jobEngine().poll(jobId, &status)) return -1;
+    if (jProgress && env->GetArrayLength(jProgress) > 0) {
+        jfloat progress = status.progress;
+        env->SetFloatArrayRegion(jProgress, 0, 1, &progress);
+    }
+    return (jint) status.state;
+}
 
-            if (audioSampleCount % 100 == 0 && audioSampleCount > 0) {
-                LOGI("Processed %d audio samples, current segment: %d", audioSampleCount, currentAudioSegment);
-            }
-        }
+// Flattened PipelineStats: wall time in us, then samples, bytes, busy us and
+// stall us for extract, decode, stretch, encode and mux; null for an unknown job
+extern "C"
+JNIEXPORT jlongArray JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_getJobStats(
+        JNIEnv *env, jclass clazz, jlong jobId) {
+    PipelineStats stats;
+    if (!jobEngine().stats(jobId, &stats)) return nullptr;
+
+    jlong values[1 + PIPELINE_STAGE_COUNT * 4];
+    values[0] = stats.wallUs;
+    for (size_t i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        values[1 + i * 4] = (jlong) stats.stages[i].samples;
+        values[2 + i * 4] = (jlong) stats.stages[i].bytes;
+        values[3 + i * 4] = stats.stages[i].busyUs;
+        values[4 + i * 4] = stats.stages[i].stallUs;
+    }
+    jlongArray result = env->NewLongArray(1 + PIPELINE_STAGE_COUNT * 4);
+    if (result) env->SetLongArrayRegion(result, 0, 1 + PIPELINE_STAGE_COUNT * 4, values);
+    return result;
+}
 
-        LOGI("Audio track completed: %d samples", audioSampleCount);
-        result = 0;
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_cancelJob(
+        JNIEnv *env, jclass clazz, jlong jobId) {
+    return jobEngine().cancel(jobId) ? JNI_TRUE : JNI_FALSE;
+}
 
-    } while (false);
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_waitJob(
+        JNIEnv *env, jclass clazz, jlong jobId) {
+    return (jint) jobEngine().wait(jobId);
+}
 
-    // Cleanup
-    LOGI("Starting cleanup...");
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_releaseJob(
+        JNIEnv *env, jclass clazz, jlong jobId) {
+    return jobEngine().release(jobId) ? JNI_TRUE : JNI_FALSE;
+}
 
-    if (sonic) {
-        sonicDestroyStream(sonic);
-        sonic = nullptr;
-    }
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_processVideo(
+        JNIEnv *env, jclass clazz,
+        jstring jInput,
+        jstring jOutput,
+        jfloatArray jStarts,
+        jfloatArray jEnds,
+        jfloatArray jSpeeds,
+        jfloatArray jRamps) {
 
-    if (muxer) {
-        AMediaMuxer_stop(muxer);
-        AMediaMuxer_delete(muxer);
-        muxer = nullptr;
-    }
+    JobEngine& jobs = jobEngine();
+    int64_t id = jobs.submit(readRequest(env, jInput, jOutput, jStarts, jEnds, jSpeeds, jRamps, 0));
+    return jobs.wait(id) == JobState::Succeeded ? 0 : -1;
+}
 
-    if (audioEncoder) {
-        AMediaCodec_stop(audioEncoder);
-        AMediaCodec_delete(audioEncoder);
-        audioEncoder = nullptr;
-    }
+// Returns a preview handle, 0 on failure. The first frame is shown paused.
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_previewCreate(
+        JNIEnv *env, jclass clazz,
+        jobject jSurface,
+        jstring jInput,
+        jfloatArray jStarts,
+        jfloatArray jEnds,
+        jfloatArray jSpeeds,
+        jfloatArray jRamps,
+        jint framesPerBurst) {
+    auto handle = std::make_unique<Preview>();
+    handle->window = ANativeWindow_fromSurface(env, jSurface);
+    if (!handle->window) return 0;
+    handle->sink = std::make_unique<OpenSlAudioSink>(framesPerBurst);
+    handle->engine = std::make_unique<PreviewEngine>(backend, handle->window, handle->sink.get());
 
-    if (audioDecoder) {
-        AMediaCodec_stop(audioDecoder);
-        AMediaCodec_delete(audioDecoder);
-        audioDecoder = nullptr;
-    }
+    const char* inputPath = env->GetStringUTFChars(jInput, nullptr);
+    int result = handle->engine->open(inputPath, readSegments(env, jStarts, jEnds, jSpeeds, jRamps));
+    env->ReleaseStringUTFChars(jInput, inputPath);
+    return result == 0 ? reinterpret_cast<jlong>(handle.release()) : 0;
+}
 
-    if (extractor) {
-        AMediaExtractor_delete(extractor);
-        extractor = nullptr;
-    }
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_previewPlay(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    return preview(handle)->engine->play();
+}
 
-    if (audioFormat) {
-        AMediaFormat_delete(audioFormat);
-        audioFormat = nullptr;
-    }
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_previewPause(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    preview(handle)->engine->pause();
+}
 
-    if (videoFormat) {
-        AMediaFormat_delete(videoFormat);
-        videoFormat = nullptr;
-    }
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_previewSeek(
+        JNIEnv *env, jclass clazz, jlong handle, jlong outputUs) {
+    return preview(handle)->engine->seekTo(outputUs);
+}
 
-    env->ReleaseStringUTFChars(jInput, inputPath);
-    env->ReleaseStringUTFChars(jOutput, outputPath);
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_previewSetSegments(
+        JNIEnv *env, jclass clazz,
+        jlong handle,
+        jfloatArray jStarts,
+        jfloatArray jEnds,
+        jfloatArray jSpeeds,
+        jfloatArray jRamps) {
+    return preview(handle)->engine->setSegments(readSegments(env, jStarts, jEnds, jSpeeds, jRamps));
+}
 
-    if (result == 0) {
-        LOGI("Successfully processed video with segment-based speed adjustment");
-    } else {
-        LOGE("Video processing failed");
-    }
+// Output position in us, or -1 once playback has reached the end
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_previewPosition(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    PreviewEngine& engine = *preview(handle)->engine;
+    return engine.hasEnded() ? -1 : engine.positionUs();
+}
 
-    return result;
-}
\ No newline at end of file
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_luongtd14_speedapplication_activities_EditActivity_previewRelease(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    delete preview(handle);
+}
@@ -0,0 +1,370 @@
+#include "waveform_peaks.h"
+#include "editor_log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char PEAK_MAGIC[8] = {'S', 'P', 'P', 'E', 'A', 'K', '0', '1'};
+// Decoder PTS this close to the running position count as contiguous
+static const int64_t PTS_SLACK_FRAMES = 64;
+// Coarser levels are added until one has at most this many bins
+static const uint32_t TOP_LEVEL_BINS = 64;
+static const int64_t CODEC_TIMEOUT_US = 10000;
+
+struct PeakHeader {
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    int64_t frames;
+    int32_t sampleRate;
+    int32_t channels;
+    uint32_t levelCount;
+    uint32_t pathLength;
+};
+
+struct PeakLevel {
+    uint32_t binFrames;
+    uint32_t count;
+    uint64_t offset;
+};
+
+static_assert(sizeof(PeakHeader) == 48, "PeakHeader is part of the file format");
+static_assert(sizeof(PeakLevel) == 16, "PeakLevel is part of the file format");
+static_assert(sizeof(WaveformPeak) == 6, "WaveformPeak is part of the file format");
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+static bool statSource(const char* path, uint64_t* size, int64_t* mtimeNs) {
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    *size = (uint64_t) st.st_size;
+    *mtimeNs = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+PeakAccumulator::PeakAccumulator(int32_t sampleRate, int32_t channels, const PeakKernels& kernels)
+        : rate(sampleRate), channelCount(channels), kernels(kernels) {}
+
+void PeakAccumulator::add(int64_t ptsUs, const short* pcm, size_t frames) {
+    int64_t start = ptsUs * rate / 1000000;
+    if (start > position + PTS_SLACK_FRAMES) {
+        addSilence(start - position);
+    } else if (start + PTS_SLACK_FRAMES < position) {
+        size_t overlap = (size_t) std::min(position - start, (int64_t) frames);
+        pcm += overlap * channelCount;
+        frames -= overlap;
+    }
+
+    while (frames > 0) {
+        size_t count = std::min(frames, (size_t) (BASE_BIN_FRAMES - currentFrames));
+        kernels.accumulate(pcm, count * channelCount, &current);
+        currentFrames += count;
+        position += count;
+        pcm += count * channelCount;
+        frames -= count;
+        if (currentFrames == BASE_BIN_FRAMES) closeBin();
+    }
+}
+
+void PeakAccumulator::addSilence(int64_t frames) {
+    while (frames > 0) {
+        uint32_t count = (uint32_t) std::min(frames, (int64_t) (BASE_BIN_FRAMES - currentFrames));
+        current.min = std::min(current.min, (int16_t) 0);
+        current.max = std::max(current.max, (int16_t) 0);
+        currentFrames += count;
+        position += count;
+        frames -= count;
+        if (currentFrames == BASE_BIN_FRAMES) closeBin();
+    }
+}
+
+void PeakAccumulator::finish() {
+    closeBin();
+}
+
+void PeakAccumulator::closeBin() {
+    if (currentFrames == 0) return;
+    double meanSquare = (double) current.sumSquares / ((uint64_t) currentFrames * channelCount);
+    bins.push_back({current.min, current.max, (uint16_t) std::lround(std::sqrt(meanSquare))});
+    current = PeakStats();
+    currentFrames = 0;
+}
+
+WaveformPeaks::~WaveformPeaks() {
+    if (mapped) munmap(const_cast<uint8_t*>(mapped), mappedSize);
+}
+
+std::unique_ptr<WaveformPeaks> WaveformPeaks::build(MediaBackend& backend, const char* path,
+                                                    const JobControl* control) {
+    std::unique_ptr<MediaExtractor> extractor = backend.createExtractor(path);
+    if (!extractor) return nullptr;
+
+    // The last audio track, as processSpeedVideo picks it
+    int audioTrack = -1;
+    std::unique_ptr<MediaFormat> format;
+    std::string mime;
+    for (size_t i = 0; i < extractor->getTrackCount(); i++) {
+        std::unique_ptr<MediaFormat> trackFormat = extractor->getTrackFormat(i);
+        std::string trackMime;
+        if (trackFormat && trackFormat->getString(MEDIA_KEY_MIME, &trackMime) &&
+            trackMime.find("audio/") != std::string::npos) {
+            audioTrack = (int) i;
+            format = std::move(trackFormat);
+            mime = trackMime;
+        }
+    }
+    int32_t sampleRate = 0, channels = 0;
+    if (audioTrack < 0 || !format->getInt32(MEDIA_KEY_SAMPLE_RATE, &sampleRate) ||
+        !format->getInt32(MEDIA_KEY_CHANNEL_COUNT, &channels) || sampleRate <= 0 || channels <= 0) {
+        return nullptr;
+    }
+
+    std::unique_ptr<MediaCodec> decoder = backend.createDecoder(mime.c_str());
+    if (!decoder || decoder->configure(*format, false) != MEDIA_OK || decoder->start() != MEDIA_OK) {
+        LOGE("Failed to start a %s decoder for the waveform of %s", mime.c_str(), path);
+        return nullptr;
+    }
+    extractor->selectTrack(audioTrack);
+
+    PeakAccumulator accumulator(sampleRate, channels);
+    const size_t frameBytes = channels * sizeof(short);
+    bool inputDone = false;
+    bool outputDone = false;
+    while (!outputDone && !isCancelled(control)) {
+        if (!inputDone) {
+            ssize_t inIndex = decoder->dequeueInputBuffer(CODEC_TIMEOUT_US);
+            if (inIndex >= 0) {
+                size_t bufSize;
+                uint8_t* buf = decoder->getInputBuffer(inIndex, &bufSize);
+                if (!buf) break;
+                ssize_t sampleSize = extractor->readSampleData(buf, bufSize);
+                if (sampleSize < 0) {
+                    decoder->queueInputBuffer(inIndex, 0, 0, 0, BUFFER_FLAG_END_OF_STREAM);
+                    inputDone = true;
+                } else {
+                    decoder->queueInputBuffer(inIndex, 0, sampleSize, extractor->getSampleTime(), 0);
+                    extractor->advance();
+                }
+            }
+        }
+
+        SampleInfo info;
+        ssize_t outIndex = decoder->dequeueOutputBuffer(&info, inputDone ? CODEC_TIMEOUT_US : 0);
+        if (outIndex < 0) continue;
+        if (info.size > 0) {
+            size_t outSize;
+            uint8_t* outBuf = decoder->getOutputBuffer(outIndex, &outSize);
+            if (outBuf) {
+                accumulator.add(info.presentationTimeUs, reinterpret_cast<const short*>(outBuf + info.offset),
+                                info.size / frameBytes);
+            }
+        }
+        decoder->releaseOutputBuffer(outIndex, false);
+        if (info.flags & BUFFER_FLAG_END_OF_STREAM) outputDone = true;
+    }
+    decoder->stop();
+
+    if (!outputDone) return nullptr;
+    return build(path, accumulator);
+}
+
+std::unique_ptr<WaveformPeaks> WaveformPeaks::build(const char* path, PeakAccumulator& accumulator) {
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    if (!statSource(path, &sourceSize, &sourceMtimeNs)) return nullptr;
+    accumulator.finish();
+
+    // Each level merges PEAK_LEVEL_FACTOR bins of the one below; RMS is
+    // merged as the mean of squares, which is exact for all but a short last bin
+    std::vector<std::vector<WaveformPeak>> pyramid = {accumulator.peaks()};
+    while (pyramid.back().size() > TOP_LEVEL_BINS) {
+        const std::vector<WaveformPeak>& finer = pyramid.back();
+        std::vector<WaveformPeak> coarser;
+        coarser.reserve((finer.size() + PEAK_LEVEL_FACTOR - 1) / PEAK_LEVEL_FACTOR);
+        for (size_t first = 0; first < finer.size(); first += PEAK_LEVEL_FACTOR) {
+            size_t last = std::min(first + PEAK_LEVEL_FACTOR, finer.size());
+            WaveformPeak merged = finer[first];
+            double sumSquares = 0;
+            for (size_t i = first; i < last; i++) {
+                merged.min = std::min(merged.min, finer[i].min);
+                merged.max = std::max(merged.max, finer[i].max);
+                sumSquares += (double) finer[i].rms * finer[i].rms;
+            }
+            merged.rms = (uint16_t) std::lround(std::sqrt(sumSquares / (last - first)));
+            coarser.push_back(merged);
+        }
+        pyramid.push_back(std::move(coarser));
+    }
+
+    // Lay the levels out exactly as they are saved, so built and mapped
+    // peaks are read the same way
+    size_t pathLength = strlen(path);
+    size_t size = sizeof(PeakHeader) + align8(pathLength) + pyramid.size() * sizeof(PeakLevel);
+    std::vector<PeakLevel> tables(pyramid.size());
+    uint32_t binFrames = PeakAccumulator::BASE_BIN_FRAMES;
+    for (size_t i = 0; i < pyramid.size(); i++) {
+        tables[i] = {binFrames, (uint32_t) pyramid[i].size(), size};
+        size += align8(pyramid[i].size() * sizeof(WaveformPeak));
+        binFrames *= PEAK_LEVEL_FACTOR;
+    }
+
+    std::unique_ptr<WaveformPeaks> peaks(new WaveformPeaks());
+    peaks->built.assign(size, 0);
+    uint8_t* out = peaks->built.data();
+    PeakHeader header;
+    memcpy(header.magic, PEAK_MAGIC, sizeof(header.magic));
+    header.sourceSize = sourceSize;
+    header.sourceMtimeNs = sourceMtimeNs;
+    header.frames = accumulator.frames();
+    header.sampleRate = accumulator.sampleRate();
+    header.channels = accumulator.channels();
+    header.levelCount = (uint32_t) pyramid.size();
+    header.pathLength = (uint32_t) pathLength;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), path, pathLength);
+    memcpy(out + sizeof(header) + align8(pathLength), tables.data(), tables.size() * sizeof(PeakLevel));
+    for (size_t i = 0; i < pyramid.size(); i++) {
+        memcpy(out + tables[i].offset, pyramid[i].data(), pyramid[i].size() * sizeof(WaveformPeak));
+    }
+
+    if (!peaks->attach(peaks->built.data(), peaks->built.size())) return nullptr;
+    return peaks;
+}
+
+std::unique_ptr<WaveformPeaks> WaveformPeaks::load(const char* peakPath, const char* path) {
+    int fd = open(peakPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(PeakHeader)) {
+        data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+
+    std::unique_ptr<WaveformPeaks> peaks(new WaveformPeaks());
+    peaks->mapped = static_cast<const uint8_t*>(data);
+    peaks->mappedSize = (size_t) st.st_size;
+
+    if (!peaks->attach(peaks->mapped, peaks->mappedSize) || peaks->sourcePath != path || !peaks->isCurrent()) {
+        return nullptr;
+    }
+    return peaks;
+}
+
+bool WaveformPeaks::isCurrent() const {
+    uint64_t size;
+    int64_t mtimeNs;
+    return statSource(sourcePath.c_str(), &size, &mtimeNs) && size == sourceSize && mtimeNs == sourceMtimeNs;
+}
+
+// Validates the image and points the level views into it
+bool WaveformPeaks::attach(const uint8_t* data, size_t size) {
+    PeakHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, PEAK_MAGIC, sizeof(header.magic)) != 0) return false;
+
+    size_t tablesOffset = sizeof(header) + align8(header.pathLength);
+    if (header.pathLength > size || tablesOffset + (size_t) header.levelCount * sizeof(PeakLevel) > size) {
+        return false;
+    }
+    sourcePath.assign(reinterpret_cast<const char*>(data + sizeof(header)), header.pathLength);
+    sourceSize = header.sourceSize;
+    sourceMtimeNs = header.sourceMtimeNs;
+    rate = header.sampleRate;
+    channelCount = header.channels;
+    frameCount = header.frames;
+
+    levels.clear();
+    for (uint32_t i = 0; i < header.levelCount; i++) {
+        PeakLevel table;
+        memcpy(&table, data + tablesOffset + i * sizeof(PeakLevel), sizeof(table));
+        if (table.offset % 8 || table.offset + (uint64_t) table.count * sizeof(WaveformPeak) > size) {
+            return false;
+        }
+        levels.push_back({table.binFrames, table.count, reinterpret_cast<const WaveformPeak*>(data + table.offset)});
+    }
+    return !levels.empty();
+}
+
+int WaveformPeaks::save(const char* peakPath) const {
+    std::string temporary = std::string(peakPath) + ".tmp";
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return -1;
+    bool written = fwrite(data(), 1, size(), file) == size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), peakPath) != 0) {
+        remove(temporary.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+std::shared_ptr<const WaveformPeaks> WaveformPeakCache::find(const char* path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return findLocked(path);
+}
+
+std::shared_ptr<const WaveformPeaks> WaveformPeakCache::get(MediaBackend& backend, const char* path,
+                                                            const JobControl* control) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const WaveformPeaks> peaks = findLocked(path);
+    if (peaks) return peaks;
+
+    std::unique_ptr<WaveformPeaks> builtPeaks = WaveformPeaks::build(backend, path, control);
+    if (!builtPeaks) return nullptr;
+    std::string peakPath = peakPathFor(path);
+    if (builtPeaks->save(peakPath.c_str()) != 0) LOGE("Failed to save waveform %s", peakPath.c_str());
+    LOGI("Waveform for %s built, %zu levels over %lld frames", path, builtPeaks->levelCount(),
+         (long long) builtPeaks->frames());
+    peaks = std::move(builtPeaks);
+    keep(path, peaks);
+    return peaks;
+}
+
+void WaveformPeakCache::store(const char* path, std::unique_ptr<WaveformPeaks> peaks) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string peakPath = peakPathFor(path);
+    if (peaks->save(peakPath.c_str()) != 0) LOGE("Failed to save waveform %s", peakPath.c_str());
+    keep(path, std::move(peaks));
+}
+
+std::shared_ptr<const WaveformPeaks> WaveformPeakCache::findLocked(const char* path) {
+    auto it = loaded.find(path);
+    if (it != loaded.end() && it->second->isCurrent()) return it->second;
+
+    std::string peakPath = peakPathFor(path);
+    std::shared_ptr<const WaveformPeaks> peaks = WaveformPeaks::load(peakPath.c_str(), path);
+    if (!peaks) return nullptr;
+    LOGI("Waveform for %s loaded from %s", path, peakPath.c_str());
+    keep(path, peaks);
+    return peaks;
+}
+
+void WaveformPeakCache::keep(const char* path, std::shared_ptr<const WaveformPeaks> peaks) {
+    auto it = loaded.find(path);
+    if (it != loaded.end()) replaced.push_back(std::move(it->second));
+    loaded[path] = std::move(peaks);
+}
+
+// One file per source path, named by its 64-bit FNV-1a hash
+std::string WaveformPeakCache::peakPathFor(const std::string& path) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : path) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.peaks", (unsigned long long) hash);
+    return directory + name;
+}
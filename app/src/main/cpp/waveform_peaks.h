@@ -0,0 +1,140 @@
+#pragma once
+
+#include "job_control.h"
+#include "media_backend.h"
+#include "peak_kernels.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One bin of a waveform: the sample extremes over all channels and their RMS
+struct WaveformPeak {
+    int16_t min;
+    int16_t max;
+    uint16_t rms;
+};
+
+// Turns decoded PCM into the finest level of a waveform, BASE_BIN_FRAMES
+// frames per bin. Fed in decode order; buffers are placed by PTS, so a gap
+// in the decoder output reads as silence and overlapping audio is skipped.
+class PeakAccumulator {
+public:
+    static const uint32_t BASE_BIN_FRAMES = 256;
+
+    PeakAccumulator(int32_t sampleRate, int32_t channels, const PeakKernels& kernels = PeakKernels::best());
+
+    // Interleaved 16-bit PCM starting at ptsUs
+    void add(int64_t ptsUs, const short* pcm, size_t frames);
+    // Closes the last, partial bin. add() must not be called afterwards.
+    void finish();
+
+    int32_t sampleRate() const { return rate; }
+    int32_t channels() const { return channelCount; }
+    int64_t frames() const { return position; }
+    const std::vector<WaveformPeak>& peaks() const { return bins; }
+
+private:
+    void addSilence(int64_t frames);
+    void closeBin();
+
+    int32_t rate;
+    int32_t channelCount;
+    const PeakKernels& kernels;
+    std::vector<WaveformPeak> bins;
+    PeakStats current;
+    uint32_t currentFrames = 0;
+    int64_t position = 0;
+};
+
+// Min / max / RMS waveform of a source's audio track as a pyramid of levels,
+// each PEAK_LEVEL_FACTOR times coarser than the one before, so a timeline at
+// any zoom draws from the level nearest its pixels without touching the PCM.
+//
+// On disk the peaks are one flat little-endian file that is mmapped as is:
+//   PeakHeader, the source path padded to 8 bytes, one PeakLevel per level,
+//   then per level its WaveformPeak array, each starting 8-aligned
+// It is only used while the source's path, size and mtime still match.
+class WaveformPeaks {
+public:
+    static const uint32_t PEAK_LEVEL_FACTOR = 4;
+
+    struct Level {
+        uint32_t binFrames;
+        uint32_t count;
+        const WaveformPeak* peaks;
+    };
+
+    ~WaveformPeaks();
+
+    // Decodes the audio track an export would use. Returns nullptr if the
+    // source has none, it cannot be decoded, or control cancels.
+    static std::unique_ptr<WaveformPeaks> build(MediaBackend& backend, const char* path,
+                                                const JobControl* control = nullptr);
+    // Finishes an accumulator that was fed the whole audio track of path
+    static std::unique_ptr<WaveformPeaks> build(const char* path, PeakAccumulator& accumulator);
+    // Maps saved peaks, nullptr if missing, corrupt or stale for path
+    static std::unique_ptr<WaveformPeaks> load(const char* peakPath, const char* path);
+    // Writes the peaks atomically (temporary file, then rename). Returns 0 on success.
+    int save(const char* peakPath) const;
+
+    // The source still has the size and mtime its peaks were taken at
+    bool isCurrent() const;
+
+    int32_t sampleRate() const { return rate; }
+    int32_t channels() const { return channelCount; }
+    int64_t frames() const { return frameCount; }
+    // Level 0 is the finest
+    size_t levelCount() const { return levels.size(); }
+    const Level& level(size_t i) const { return levels[i]; }
+
+    // The whole file image, valid as long as this object
+    const uint8_t* data() const { return mapped ? mapped : built.data(); }
+    size_t size() const { return mapped ? mappedSize : built.size(); }
+
+private:
+    WaveformPeaks() = default;
+    bool attach(const uint8_t* data, size_t size);
+
+    // Either an mmapped file or a freshly built image in the same layout
+    std::vector<uint8_t> built;
+    const uint8_t* mapped = nullptr;
+    size_t mappedSize = 0;
+    std::string sourcePath;
+    uint64_t sourceSize = 0;
+    int64_t sourceMtimeNs = 0;
+    int32_t rate = 0;
+    int32_t channelCount = 0;
+    int64_t frameCount = 0;
+    std::vector<Level> levels;
+};
+
+// Waveforms by source path, in memory and under directory on disk, like
+// SampleIndexCache. Every WaveformPeaks handed out stays alive until the
+// cache goes, so its image can back a direct buffer on the Java side even
+// after the source changes and it is replaced.
+class WaveformPeakCache {
+public:
+    explicit WaveformPeakCache(std::string directory) : directory(std::move(directory)) {}
+
+    // Peaks computed before, nullptr if there are none for the current source
+    std::shared_ptr<const WaveformPeaks> find(const char* path);
+    // Like find(), decoding the source if needed; nullptr if that fails
+    std::shared_ptr<const WaveformPeaks> get(MediaBackend& backend, const char* path,
+                                             const JobControl* control = nullptr);
+    // Saves peaks computed elsewhere, e.g. on an export's decode path
+    void store(const char* path, std::unique_ptr<WaveformPeaks> peaks);
+
+private:
+    std::shared_ptr<const WaveformPeaks> findLocked(const char* path);
+    void keep(const char* path, std::shared_ptr<const WaveformPeaks> peaks);
+    std::string peakPathFor(const std::string& path) const;
+
+    std::string directory;
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const WaveformPeaks>> loaded;
+    std::vector<std::shared_ptr<const WaveformPeaks>> replaced;
+};
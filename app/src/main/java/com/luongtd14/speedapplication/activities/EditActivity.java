@@ -1,10 +1,18 @@
 package com.luongtd14.speedapplication.activities;
 
+import android.content.Context;
 import android.content.Intent;
+import android.media.AudioManager;
 import android.media.MediaCodec;
 import android.media.MediaExtractor;
 import android.media.MediaMetadataRetriever;
 import android.os.Bundle;
+import android.os.Handler;
+import android.os.Looper;
+import android.util.Log;
+import android.view.Surface;
+import android.view.SurfaceHolder;
+import android.view.View;
 import android.widget.Toast;
 
 import androidx.activity.EdgeToEdge;
@@ -15,6 +23,10 @@ import androidx.core.view.WindowInsetsCompat;
 
 import com.luongtd14.speedapplication.R;
 import com.luongtd14.speedapplication.databinding.ActivityEditBinding;
+import com.luongtd14.speedapplication.utils.CodecUtils;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 
 public class EditActivity extends AppCompatActivity {
 
@@ -22,12 +34,53 @@ public class EditActivity extends AppCompatActivity {
     static {
         System.loadLibrary("video_speed_editor");
     }
+    // Must match JobState in job_engine.h
+    static final int JOB_QUEUED = 0;
+    static final int JOB_RUNNING = 1;
+    static final int JOB_SUCCEEDED = 2;
+    static final int JOB_FAILED = 3;
+    static final int JOB_CANCELLED = 4;
+    // submitJob outputFlags, must match video_editor.cpp; 0 is the platform muxer
+    static final int OUTPUT_FRAGMENTED = 1;
+    static final int OUTPUT_FASTSTART = 2;
+    // Intent extra with the OUTPUT_* flags of this activity's exports, 0 when absent
+    static final String EXTRA_OUTPUT_FLAGS = "outputFlags";
+    static final long RENDER_CACHE_BYTES = 2L << 30;
+    static final long CODEC_IDLE_TIMEOUT_MS = 60_000;
+    // Must match PeakHeader in waveform_peaks.cpp
+    static final int WAVEFORM_FRAMES_OFFSET = 24;
+    static final int WAVEFORM_SAMPLE_RATE_OFFSET = 32;
+    static final int WAVEFORM_LEVEL_COUNT_OFFSET = 40;
+    // Speed ramp keyframes, flattened RAMP_KEYFRAME_STRIDE floats each as
+    // segment index, time in seconds, speed, interpolation and the Bezier
+    // handles x1, y1, x2, y2; must match video_editor.cpp
+    static final int RAMP_KEYFRAME_STRIDE = 8;
+    static final float RAMP_LINEAR = 0f;
+    static final float RAMP_BEZIER = 1f;
+    static final long PROGRESS_POLL_MS = 200;
+    static final long PREVIEW_POLL_MS = 100;
+
     ActivityEditBinding binding;
     String filePath;
+    int outputFlags;
     int width, height;
     float[] starts = {0f, 5f, 7f, 15f};
     float[] ends   = {5f, 7f, 15f, 999f};
     float[] speeds = {1f, 0.5f, 1.5f, 1f};
+    // Eases the slow-motion segment in and out instead of jumping to 0.5x
+    float[] ramps = {
+            1, 5f, 1f, RAMP_BEZIER, 0.42f, 0f, 0.58f, 1f,
+            1, 5.8f, 0.5f, RAMP_LINEAR, 0f, 0f, 1f, 1f,
+            1, 6.2f, 0.5f, RAMP_BEZIER, 0.42f, 0f, 0.58f, 1f,
+            1, 7f, 1.5f, RAMP_LINEAR, 0f, 0f, 1f, 1f,
+    };
+    long jobId = 0;
+    final float[] jobProgress = new float[1];
+    final Handler handler = new Handler(Looper.getMainLooper());
+    final Runnable pollProgress = this::pollExport;
+    long previewHandle = 0;
+    final Runnable pollPreview = this::pollPreview;
+    ByteBuffer waveform;
 
     @Override
     protected void onCreate(Bundle savedInstanceState) {
@@ -37,21 +90,182 @@ public class EditActivity extends AppCompatActivity {
         binding = ActivityEditBinding.inflate(getLayoutInflater());
         setContentView(binding.getRoot());
 
+        initJobEngine(CodecUtils.maxConcurrentExports("video/avc"));
+        initCodecPool(CodecUtils.maxCodecInstances("audio/mp4a-latm", false),
+                CodecUtils.maxCodecInstances("audio/mp4a-latm", true), CODEC_IDLE_TIMEOUT_MS);
+        initSampleIndexCache(getCacheDir().getAbsolutePath());
+        initRenderCache(getCacheDir().getAbsolutePath() + "/render", RENDER_CACHE_BYTES);
+        initWaveformCache(getCacheDir().getAbsolutePath());
+
         Intent intent = getIntent();
         filePath = intent.getStringExtra("filePath");
+        outputFlags = intent.getIntExtra(EXTRA_OUTPUT_FLAGS, 0);
         if (filePath != null) {
             retrieverInfo();
             binding.surfaceView.setVideoSize(width, height);
+            loadWaveform();
             binding.btnTrans.setOnClickListener(v -> {
-                int result = processVideo(
+                // A second tap cancels the running export
+                if (jobId != 0) {
+                    cancelJob(jobId);
+                    return;
+                }
+                logEstimate(estimateExport(filePath, starts, ends, speeds, ramps));
+                jobId = submitJob(
                         filePath    ,
                         "/sdcard/output_speed.mp4",
-                        starts, ends, speeds
+                        starts, ends, speeds, ramps,
+                        outputFlags
                 );
-
+                binding.progressExport.setProgress(0);
+                binding.progressExport.setVisibility(View.VISIBLE);
+                binding.btnTrans.setText("Cancel");
+                handler.post(pollProgress);
             });
+            binding.surfaceView.getHolder().addCallback(previewCallback);
+            binding.btnPreview.setOnClickListener(v -> togglePreview());
+        }
+    }
+
+    @Override
+    protected void onPause() {
+        pausePreview();
+        super.onPause();
+    }
+
+    @Override
+    public void onTrimMemory(int level) {
+        super.onTrimMemory(level);
+        if (level >= TRIM_MEMORY_BACKGROUND) trimCodecPool();
+    }
+
+    @Override
+    protected void onDestroy() {
+        handler.removeCallbacks(pollProgress);
+        releasePreview();
+        if (jobId != 0) {
+            // Nothing will poll or wait for it once the activity is gone
+            cancelJob(jobId);
+            releaseJob(jobId);
+        }
+        super.onDestroy();
+    }
+
+    private void pollExport() {
+        int state = pollJob(jobId, jobProgress);
+        if (state == JOB_QUEUED || state == JOB_RUNNING) {
+            binding.progressExport.setProgress((int) (jobProgress[0] * 100));
+            handler.postDelayed(pollProgress, PROGRESS_POLL_MS);
+            return;
+        }
+
+        logJobStats(getJobStats(jobId));
+        // Finished, so this returns at once and releases the job
+        waitJob(jobId);
+        jobId = 0;
+        binding.progressExport.setVisibility(View.GONE);
+        binding.btnTrans.setText("Trans");
+        String message = state == JOB_SUCCEEDED ? "Export finished"
+                : state == JOB_CANCELLED ? "Export cancelled" : "Export failed";
+        Toast.makeText(this, message, Toast.LENGTH_SHORT).show();
+    }
+    // The preview renders into the surface, so it lives as long as the surface does
+    private final SurfaceHolder.Callback previewCallback = new SurfaceHolder.Callback() {
+        @Override
+        public void surfaceCreated(SurfaceHolder holder) {
+            AudioManager audioManager = (AudioManager) getSystemService(Context.AUDIO_SERVICE);
+            String burst = audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_FRAMES_PER_BUFFER);
+            previewHandle = previewCreate(holder.getSurface(), filePath, starts, ends, speeds, ramps,
+                    burst != null ? Integer.parseInt(burst) : 0);
+            if (previewHandle == 0) {
+                Toast.makeText(EditActivity.this, "Preview unavailable", Toast.LENGTH_SHORT).show();
+            }
+        }
+
+        @Override
+        public void surfaceChanged(SurfaceHolder holder, int format, int width, int height) {
+        }
+
+        @Override
+        public void surfaceDestroyed(SurfaceHolder holder) {
+            releasePreview();
+        }
+    };
+
+    private void togglePreview() {
+        if (previewHandle == 0) return;
+        if (binding.btnPreview.getText().equals("Pause")) {
+            pausePreview();
+            return;
+        }
+        previewPlay(previewHandle);
+        binding.btnPreview.setText("Pause");
+        handler.post(pollPreview);
+    }
+
+    private void pausePreview() {
+        handler.removeCallbacks(pollPreview);
+        if (previewHandle != 0) previewPause(previewHandle);
+        binding.btnPreview.setText("Play");
+    }
+
+    private void pollPreview() {
+        // At the end, rewind so the next tap plays from the start
+        if (previewPosition(previewHandle) < 0) {
+            pausePreview();
+            previewSeek(previewHandle, 0);
+            return;
+        }
+        handler.postDelayed(pollPreview, PREVIEW_POLL_MS);
+    }
+
+    private void releasePreview() {
+        handler.removeCallbacks(pollPreview);
+        if (previewHandle != 0) {
+            previewRelease(previewHandle);
+            previewHandle = 0;
+        }
+        binding.btnPreview.setText("Play");
+    }
+
+    // A clip seen before has its peaks on disk already; otherwise they are
+    // decoded off the main thread
+    private void loadWaveform() {
+        ByteBuffer cached = getWaveform(filePath, false);
+        if (cached != null) {
+            onWaveform(cached);
+            return;
+        }
+        String path = filePath;
+        new Thread(() -> {
+            ByteBuffer decoded = getWaveform(path, true);
+            if (decoded != null) handler.post(() -> onWaveform(decoded));
+        }, "waveform").start();
+    }
+
+    private void onWaveform(ByteBuffer peaks) {
+        waveform = peaks.asReadOnlyBuffer().order(ByteOrder.LITTLE_ENDIAN);
+        Log.i("VideoSpeed", "Waveform: " + waveform.getInt(WAVEFORM_LEVEL_COUNT_OFFSET) + " levels over "
+                + waveform.getLong(WAVEFORM_FRAMES_OFFSET) * 1000 / waveform.getInt(WAVEFORM_SAMPLE_RATE_OFFSET)
+                + " ms");
+    }
+
+    private static void logEstimate(long[] estimate) {
+        if (estimate == null) return;
+        Log.i("VideoSpeed", "Export estimate: " + estimate[0] / 1000 + " ms, " + estimate[1] + " frames, "
+                + (estimate[2] + estimate[3]) / 1024 + " KiB");
+    }
+
+    private static void logJobStats(long[] stats) {
+        if (stats == null) return;
+        String[] stages = {"extract", "decode", "stretch", "encode", "mux"};
+        Log.i("VideoSpeed", "Export took " + stats[0] / 1000 + " ms");
+        for (int i = 0; i < stages.length; i++) {
+            Log.i("VideoSpeed", stages[i] + ": " + stats[1 + i * 4] + " samples, " + stats[2 + i * 4]
+                    + " bytes, busy " + stats[3 + i * 4] / 1000 + " ms, stalled " + stats[4 + i * 4] / 1000 + " ms");
         }
     }
+
     private void retrieverInfo(){
         try {
             MediaMetadataRetriever retriever = new MediaMetadataRetriever();
@@ -70,11 +284,197 @@ public class EditActivity extends AppCompatActivity {
         }
     }
 
+    /**
+     * Starts the job engine with at most maxConcurrentJobs exports running at
+     * once. Only the first call has an effect.
+     *
+     * @return the engine's worker count
+     */
+    public static native int initJobEngine(int maxConcurrentJobs);
+
+    /**
+     * Sizes the pool that keeps audio decoders and AAC encoders started
+     * between exports, so back-to-back exports skip codec startup. Codecs
+     * idle for idleTimeoutMs are released.
+     *
+     * @param maxDecoders at most this many audio decoders, leased and idle
+     * @param maxEncoders at most this many audio encoders, leased and idle
+     */
+    public static native void initCodecPool(int maxDecoders, int maxEncoders, long idleTimeoutMs);
+
+    /**
+     * Releases every idle pooled codec now.
+     */
+    public static native void trimCodecPool();
+
+    /**
+     * Keeps source sample indexes under directory so repeated exports and
+     * estimates of a file skip scanning it. Only the first call has an effect.
+     */
+    public static native void initSampleIndexCache(String directory);
+
+    /**
+     * Keeps rendered segments under directory, up to maxBytes, so a
+     * re-export only renders the segments that changed. The directory is
+     * created if missing. Only the first call has an effect.
+     */
+    public static native void initRenderCache(String directory, long maxBytes);
+
+    /**
+     * Keeps source waveforms under directory, so a clip opened again shows
+     * its waveform without decoding. Exports that decode the whole audio
+     * track fill it as they go. Only the first call has an effect.
+     */
+    public static native void initWaveformCache(String directory);
+
+    /**
+     * The source's waveform as a view of its peak file, valid for the life
+     * of the process and not to be written to. Little-endian: a 48-byte header (magic
+     * "SPPEAK01", source size and mtime, frame count as long, sample rate,
+     * channels, level count and path length as int), the source path padded
+     * to 8 bytes, then per level its bin frames and bin count as int and the
+     * byte offset of its bins as long. A bin is min, max and RMS as shorts,
+     * RMS unsigned; each level has 4x wider bins than the one before.
+     *
+     * @param decode decode the audio if there are no peaks yet; blocks, so
+     *               not on the main thread
+     * @return null if there are no peaks, or without decode none computed before
+     */
+    public static native ByteBuffer getWaveform(String inputPath, boolean decode);
+
+    /**
+     * @return output duration in us, video frames, video bytes and audio
+     * bytes; null if the source cannot be indexed
+     */
+    public static native long[] estimateExport(
+            String inputPath,
+            float[] segmentStart,
+            float[] segmentEnd,
+            float[] speed,
+            float[] rampKeyframes
+    );
+
+    /**
+     * Moves segment boundaries to the nearest video keyframe so the cuts
+     * need no re-encoding.
+     *
+     * @return start, end, speed and the index of the segment passed in, for
+     * each segment kept; null if the source cannot be indexed
+     */
+    public static native float[] snapToKeyframes(
+            String inputPath,
+            float[] segmentStart,
+            float[] segmentEnd,
+            float[] speed,
+            float[] rampKeyframes
+    );
+
+    /**
+     * Queues an export and returns at once.
+     *
+     * @param rampKeyframes speed ramps of the segments that have one, laid
+     *                      out as RAMP_KEYFRAME_STRIDE floats per keyframe;
+     *                      a ramped segment ignores its speed. May be null
+     * @param outputFlags 0 writes through the platform MediaMuxer.
+     *                    OUTPUT_FRAGMENTED writes the output as it goes in
+     *                    moof / mdat fragments; with OUTPUT_FASTSTART it is
+     *                    rewritten to a plain MP4 with moov first at the end
+     * @return job id for pollJob / cancelJob / waitJob
+     */
+    public static native long submitJob(
+            String inputPath,
+            String outputPath,
+            float[] segmentStart,
+            float[] segmentEnd,
+            float[] speed,
+            float[] rampKeyframes,
+            int outputFlags
+    );
+
+    /**
+     * @param progress receives the fraction of the output written, 0..1, in progress[0]
+     * @return one of the JOB_* states, or -1 for an unknown job
+     */
+    public static native int pollJob(long jobId, float[] progress);
+
+    public static native boolean cancelJob(long jobId);
+
+    /**
+     * @return wall time in us, then samples, bytes, busy us and stall us for
+     * each of the extract, decode, stretch, encode and mux stages; null for an
+     * unknown job
+     */
+    public static native long[] getJobStats(long jobId);
+
+    /**
+     * Blocks until the job has finished and releases it.
+     *
+     * @return its final JOB_* state
+     */
+    public static native int waitJob(long jobId);
+
+    /**
+     * Forgets the job without waiting for it, as soon as it has finished.
+     * Its id is unknown to every other call afterwards.
+     */
+    public static native boolean releaseJob(long jobId);
+
+    /**
+     * Synchronous export, submitJob followed by waitJob.
+     *
+     * @return 0 on success, -1 on failure
+     */
     public static native int processVideo(
             String inputPath,
             String outputPath,
             float[] segmentStart,
             float[] segmentEnd,
-            float[] speed
+            float[] speed,
+            float[] rampKeyframes
+    );
+
+    /**
+     * Opens a real-time preview of the segments rendering into surface, paused
+     * on the first frame.
+     *
+     * @param framesPerBurst the device's PROPERTY_OUTPUT_FRAMES_PER_BUFFER, 0 if unknown
+     * @return preview handle, 0 on failure
+     */
+    public static native long previewCreate(
+            Surface surface,
+            String inputPath,
+            float[] segmentStart,
+            float[] segmentEnd,
+            float[] speed,
+            float[] rampKeyframes,
+            int framesPerBurst
     );
+
+    public static native int previewPlay(long handle);
+
+    public static native void previewPause(long handle);
+
+    /**
+     * @param outputUs position on the sped-up timeline
+     */
+    public static native int previewSeek(long handle, long outputUs);
+
+    /**
+     * Replaces the segments while playing; playback continues from the same
+     * source position.
+     */
+    public static native int previewSetSegments(
+            long handle,
+            float[] segmentStart,
+            float[] segmentEnd,
+            float[] speed,
+            float[] rampKeyframes
+    );
+
+    /**
+     * @return output position in us, or -1 once the preview has played to the end
+     */
+    public static native long previewPosition(long handle);
+
+    public static native void previewRelease(long handle);
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+package com.luongtd14.speedapplication.utils;
+
+import android.media.MediaCodecInfo;
+import android.media.MediaCodecList;
+
+public class CodecUtils {
+    /**
+     * How many exports can run side by side. Every export holds a video
+     * decoder and a video encoder, so this is bounded by the hardware codec
+     * with the fewest concurrent instances, and by the CPU cores left for
+     * the audio path.
+     *
+     * @param mime video mime type, e.g. "video/avc"
+     * @return concurrent export count, at least 1
+     */
+    public static int maxConcurrentExports(String mime) {
+        int decoders = 0, encoders = 0;
+        for (MediaCodecInfo info : new MediaCodecList(MediaCodecList.REGULAR_CODECS).getCodecInfos()) {
+            if (!info.isHardwareAccelerated()) continue;
+            for (String type : info.getSupportedTypes()) {
+                if (!type.equalsIgnoreCase(mime)) continue;
+                int instances = info.getCapabilitiesForType(type).getMaxSupportedInstances();
+                if (info.isEncoder()) {
+                    encoders = Math.max(encoders, instances);
+                } else {
+                    decoders = Math.max(decoders, instances);
+                }
+            }
+        }
+        int cores = Math.max(1, Runtime.getRuntime().availableProcessors() / 2);
+        return Math.max(1, Math.min(cores, Math.min(decoders, encoders)));
+    }
+
+    /**
+     * How many instances of the best codec for mime can run side by side,
+     * hardware or not, e.g. to size a pool of warm codecs.
+     *
+     * @return instance count, 0 if there is no such codec
+     */
+    public static int maxCodecInstances(String mime, boolean encoder) {
+        int instances = 0;
+        for (MediaCodecInfo info : new MediaCodecList(MediaCodecList.REGULAR_CODECS).getCodecInfos()) {
+            if (info.isEncoder() != encoder) continue;
+            for (String type : info.getSupportedTypes()) {
+                if (!type.equalsIgnoreCase(mime)) continue;
+                instances = Math.max(instances, info.getCapabilitiesForType(type).getMaxSupportedInstances());
+            }
+        }
+        return instances;
+    }
+}